@@ -0,0 +1,99 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+"""Benchmark the JSONDatabase of MetaSchedule on a large synthetic database.
+
+The database holds records spread evenly over many small workloads. The
+script measures committing the records, loading the database from its files,
+and querying the top records of random workloads.
+"""
+import argparse
+import os.path as osp
+import tempfile
+import time
+
+import numpy as np
+
+import tvm
+from tvm import meta_schedule as ms
+from tvm import te, tir
+
+
+def _parse_args():
+    args = argparse.ArgumentParser()
+    args.add_argument("--num-workloads", type=int, default=200)
+    args.add_argument("--num-records", type=int, default=100000)
+    args.add_argument("--num-queries", type=int, default=1000)
+    args.add_argument("--top-k", type=int, default=1)
+    return args.parse_args()
+
+
+def create_workload(index):
+    a = te.placeholder((index + 1,), name="A")
+    b = te.compute((index + 1,), lambda i: a[i] + 1.0, name="B")
+    return tvm.IRModule({"main": te.create_prim_func([a, b])})
+
+
+def main():
+    args = _parse_args()
+    rng = np.random.default_rng(0)
+    target = tvm.target.Target("llvm")
+    mods = [create_workload(i) for i in range(args.num_workloads)]
+    traces = []
+    for mod in mods:
+        sch = tir.Schedule(mod)
+        sch.get_block("B")
+        traces.append(sch.trace)
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path_workload = osp.join(tmpdir, "workloads.json")
+        path_tuning_record = osp.join(tmpdir, "tuning_records.json")
+        database = ms.database.JSONDatabase(path_workload, path_tuning_record)
+        workloads = [database.commit_workload(mod) for mod in mods]
+        records = [
+            ms.database.TuningRecord(
+                traces[i % args.num_workloads],
+                workloads[i % args.num_workloads],
+                [float(rng.random())],
+                target,
+            )
+            for i in range(args.num_records)
+        ]
+        start = time.perf_counter()
+        for record in records:
+            database.commit_tuning_record(record)
+        commit_us = (time.perf_counter() - start) * 1e6 / args.num_records
+        del database
+
+        start = time.perf_counter()
+        database = ms.database.JSONDatabase(path_workload, path_tuning_record)
+        load_s = time.perf_counter() - start
+        workloads = [database.commit_workload(mod) for mod in mods]
+
+        queries = rng.integers(0, args.num_workloads, args.num_queries)
+        start = time.perf_counter()
+        for index in queries:
+            database.get_top_k(workloads[index], args.top_k)
+        query_us = (time.perf_counter() - start) * 1e6 / args.num_queries
+
+    print(f"records: {args.num_records}, workloads: {args.num_workloads}")
+    print(f"commit_tuning_record: {commit_us:.1f} us/record")
+    print(f"load:                 {load_s:.2f} s")
+    print(f"get_top_k:            {query_us:.1f} us/query")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+"""Benchmark handing the features of PerStoreFeature to a cost model.
+
+The candidates are random tilings of a matmul. Their features are extracted
+once to warm the feature cache, and then handed over repeatedly, either per
+candidate with `extract_from` followed by a float32 conversion as the cost
+models used to do, or as one float32 batch with `extract_batch_from`. The
+time and the peak Python memory of each handoff are reported.
+"""
+import argparse
+import time
+import tracemalloc
+
+import numpy as np
+
+import tvm
+from tvm import meta_schedule as ms
+from tvm import te, tir
+
+
+def _parse_args():
+    args = argparse.ArgumentParser()
+    args.add_argument("--num-candidates", type=int, default=512)
+    args.add_argument("--num-repeats", type=int, default=20)
+    args.add_argument("--num-threads", type=int, default=1)
+    return args.parse_args()
+
+
+def create_candidates(num_candidates):
+    a = te.placeholder((256, 256), name="A")
+    b = te.placeholder((256, 256), name="B")
+    k = te.reduce_axis((0, 256), name="k")
+    c = te.compute((256, 256), lambda i, j: te.sum(a[i, k] * b[k, j], axis=k), name="C")
+    func = te.create_prim_func([a, b, c])
+    candidates = []
+    for seed in range(num_candidates):
+        sch = tir.Schedule(func, seed=seed)
+        block = sch.get_block("C")
+        i, j, _ = sch.get_loops(block)
+        sch.split(i, sch.sample_perfect_tile(i, n=2))
+        sch.split(j, sch.sample_perfect_tile(j, n=2))
+        candidates.append(ms.MeasureCandidate(sch, args_info=[]))
+    return func, candidates
+
+
+def measure(f, num_repeats):
+    f()
+    tracemalloc.start()
+    start = time.perf_counter()
+    for _ in range(num_repeats):
+        f()
+    elapsed_ms = (time.perf_counter() - start) * 1e3 / num_repeats
+    _, peak = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+    return elapsed_ms, peak / 1024
+
+
+def main():
+    args = _parse_args()
+    func, candidates = create_candidates(args.num_candidates)
+    context = ms.TuneContext(
+        mod=func, target=tvm.target.Target("llvm"), num_threads=args.num_threads
+    )
+    extractor = ms.feature_extractor.PerStoreFeature(extract_workload=True)
+
+    def per_candidate():
+        return [x.numpy().astype("float32") for x in extractor.extract_from(context, candidates)]
+
+    def batch():
+        features, offsets = extractor.extract_batch_from(context, candidates)
+        return np.split(features, offsets[1:-1])
+
+    print(f"candidates: {args.num_candidates}")
+    print(f"{'handoff':<16}{'ms/batch':>12}{'peak KiB':>12}")
+    for name, f in [("per-candidate", per_candidate), ("batch", batch)]:
+        elapsed_ms, peak_kib = measure(f, args.num_repeats)
+        print(f"{name:<16}{elapsed_ms:>12.2f}{peak_kib:>12.1f}")
+
+
+if __name__ == "__main__":
+    main()
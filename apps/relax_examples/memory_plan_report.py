@@ -0,0 +1,93 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+"""Report the memory planned by StaticPlanBlockMemory for ResNet.
+
+The ResNet workload is translated from Relay and lowered up to the memory
+planning of relax.build. The bytes of the storages allocated by each function
+are summed with the whole storage reuse, and with each offset planner of the
+pass config "relax.memory_plan.offset_planner".
+"""
+import argparse
+
+import tvm
+from tvm import relax
+from tvm.relay import testing
+from tvm.relax.testing import relay_translator
+
+
+def _parse_args():
+    args = argparse.ArgumentParser()
+    args.add_argument("--num-layers", type=int, default=50)
+    args.add_argument("--batch-size", type=int, default=1)
+    return args.parse_args()
+
+
+def planned_bytes(mod):
+    """Sum the bytes of the storages allocated by each Relax function."""
+    result = {}
+    for gvar, func in mod.functions.items():
+        if not isinstance(func, relax.Function):
+            continue
+        total = [0]
+
+        def fvisit(expr, total=total):
+            if isinstance(expr, relax.Call) and expr.op == tvm.ir.Op.get(
+                "relax.memory.alloc_storage"
+            ):
+                total[0] += int(expr.args[0].values[0])
+
+        relax.analysis.post_order_visit(func, fvisit)
+        result[gvar.name_hint] = total[0]
+    return result
+
+
+def plan(mod, target, offset_planner):
+    config = {"relax.memory_plan.offset_planner": offset_planner} if offset_planner else {}
+    seq = tvm.transform.Sequential(
+        [
+            relax.transform.RewriteDataflowReshape(),
+            relax.transform.ToNonDataflow(),
+            relax.transform.RemovePurityChecking(),
+            relax.transform.CallTIRRewrite(),
+            relax.transform.StaticPlanBlockMemory(),
+        ]
+    )
+    # The offset planner only runs for the targets that support storage offsets.
+    with target, tvm.transform.PassContext(config=config):
+        return planned_bytes(seq(mod))
+
+
+def main():
+    args = _parse_args()
+    relay_mod, _ = testing.resnet.get_workload(
+        num_layers=args.num_layers, batch_size=args.batch_size, dtype="float32"
+    )
+    target = tvm.target.Target("llvm", host="llvm")
+    mod = relay_translator.from_relay(relay_mod["main"], target)
+
+    baseline = plan(mod, target, None)
+    print(f"{'function':<16}{'planner':<16}{'bytes':>16}{'saved':>10}")
+    for name, nbytes in baseline.items():
+        print(f"{name:<16}{'reuse':<16}{nbytes:>16}{'':>10}")
+    for offset_planner in ["greedy_by_size", "best_fit", "auto"]:
+        for name, nbytes in plan(mod, target, offset_planner).items():
+            saved = (1 - nbytes / baseline[name]) * 100 if baseline[name] else 0
+            print(f"{name:<16}{offset_planner:<16}{nbytes:>16}{saved:>9.1f}%")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,67 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+"""Measure the cost of calling small VM functions in ns per call.
+
+The benchmark function calls a tiny VM function many times, the pattern of
+shape functions, closures and sampling wrappers, so the time is dominated by
+pushing and popping frames and passing the arguments and the result.
+"""
+import argparse
+
+import numpy as np  # type: ignore
+
+import tvm
+from tvm import relax
+
+
+def _parse_args():
+    args = argparse.ArgumentParser()
+    args.add_argument("--num-calls", type=int, default=4096)
+    args.add_argument("--num-registers", type=int, default=16)
+    args.add_argument("--number", type=int, default=100)
+    args.add_argument("--repeat", type=int, default=5)
+    return args.parse_args()
+
+
+def build_executable(num_calls, num_registers):
+    ib = relax.ExecBuilder()
+    with ib.function("callee", num_inputs=1):
+        # a register file of the given size, as in larger shape functions
+        ib.emit_call("vm.builtin.shape_of", args=[ib.r(0)], dst=ib.r(num_registers - 1))
+        ib.emit_ret(ib.r(num_registers - 1))
+    with ib.function("main", num_inputs=1):
+        for _ in range(num_calls):
+            ib.emit_call("callee", args=[ib.r(0)], dst=ib.r(1))
+        ib.emit_ret(ib.r(1))
+    return ib.get()
+
+
+def main():
+    args = _parse_args()
+    ex = build_executable(args.num_calls, args.num_registers)
+    dev = tvm.cpu()
+    vm = relax.VirtualMachine(ex, dev)
+    x = tvm.nd.array(np.zeros((4, 8), dtype="float32"), dev)
+    vm.save_function("main", "main_saved", x)
+
+    evaluator = vm.time_evaluator("main_saved", dev, number=args.number, repeat=args.repeat)
+    ns_per_call = evaluator().median * 1e9 / args.num_calls
+    print(f"{ns_per_call:.1f} ns/call")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,82 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+"""Measure the Relax VM interpreter overhead in ns per instruction.
+
+The benchmark function is a long chain of tiny builtin calls, so the time
+is dominated by instruction dispatch and argument packing. It is measured
+with the pre-decoded dispatch loop and with the original loop that decodes
+each instruction from the bytecode stream, and with the sampling profiler
+enabled on top of the pre-decoded dispatch.
+"""
+import argparse
+
+import numpy as np  # type: ignore
+
+import tvm
+from tvm import relax
+
+
+def _parse_args():
+    args = argparse.ArgumentParser()
+    args.add_argument("--num-instrs", type=int, default=4096)
+    args.add_argument("--number", type=int, default=100)
+    args.add_argument("--repeat", type=int, default=5)
+    args.add_argument("--sample-period", type=int, default=1000)
+    return args.parse_args()
+
+
+def build_executable(num_instrs):
+    ib = relax.ExecBuilder()
+    with ib.function("main", num_inputs=1):
+        for i in range(num_instrs):
+            if i % 2 == 0:
+                ib.emit_call("vm.builtin.shape_of", args=[ib.r(0)], dst=ib.r(1))
+            else:
+                args = [ib.r(1), ib.imm(2), ib.void_arg()]
+                ib.emit_call("vm.builtin.check_shape_info", args=args)
+        ib.emit_ret(ib.r(1))
+    return ib.get()
+
+
+def main():
+    args = _parse_args()
+    ex = build_executable(args.num_instrs)
+    dev = tvm.cpu()
+    vm = relax.VirtualMachine(ex, dev)
+    x = tvm.nd.array(np.zeros((4, 8), dtype="float32"), dev)
+    vm.save_function("main", "main_saved", x)
+
+    results = {}
+    for predecoded in [False, True]:
+        vm.module["set_predecoded_dispatch"](predecoded)
+        evaluator = vm.time_evaluator("main_saved", dev, number=args.number, repeat=args.repeat)
+        results[predecoded] = evaluator().median * 1e9 / (args.num_instrs + 1)
+
+    vm.start_sampling(args.sample_period)
+    evaluator = vm.time_evaluator("main_saved", dev, number=args.number, repeat=args.repeat)
+    sampled = evaluator().median * 1e9 / (args.num_instrs + 1)
+    vm.stop_sampling()
+
+    print(f"original dispatch:    {results[False]:.1f} ns/instr")
+    print(f"pre-decoded dispatch: {results[True]:.1f} ns/instr")
+    print(f"speedup:              {results[False] / results[True]:.2f}x")
+    print(f"with sampling:        {sampled:.1f} ns/instr")
+    print(f"sampling overhead:    {(sampled / results[True] - 1) * 100:.1f}%")
+
+
+if __name__ == "__main__":
+    main()
@@ -483,6 +483,15 @@ class Database : public runtime::ObjectRef {
    */
   TVM_DLL static Database JSONDatabase(String path_workload, String path_tuning_record,
                                        bool allow_missing, String mod_eq_name = "structural");
+  /*!
+   * \brief Create a database that stores the workloads and tuning records in one binary file,
+   * which is memory mapped when loaded and whose records are decoded lazily.
+   * \param path The path to the database file.
+   * \param allow_missing Whether to create new file when the given path is not found.
+   * \param mod_eq_name A string to specify the module equality testing and hashing method.
+   */
+  TVM_DLL static Database BinaryDatabase(String path, bool allow_missing,
+                                         String mod_eq_name = "structural");
   /*!
    * \brief A database composed of multiple databases, allowing users to guide IR rewriting using
    * combined knowledge of those databases. To each query, it returns the best record among all the
@@ -50,6 +50,17 @@ class FeatureExtractorNode : public runtime::Object {
   virtual Array<tvm::runtime::NDArray> ExtractFrom(const TuneContext& context,
                                                    const Array<MeasureCandidate>& candidates) = 0;
 
+  /*!
+   * \brief Extract features from the given measure candidates into one batch.
+   * \param context The tuning context for feature extraction.
+   * \param candidates The measure candidates to extract features from.
+   * \return The features of all the candidates stacked in a float32 ndarray, and an int64 ndarray
+   * of the (num_candidates + 1) offsets of the rows of each candidate in it.
+   * \note The default implementation stacks the results of `ExtractFrom`.
+   */
+  virtual Array<tvm::runtime::NDArray> ExtractBatchFrom(const TuneContext& context,
+                                                        const Array<MeasureCandidate>& candidates);
+
   static constexpr const char* _type_key = "meta_schedule.FeatureExtractor";
   TVM_DECLARE_BASE_OBJECT_INFO(FeatureExtractorNode, Object);
 };
@@ -135,6 +135,16 @@ TVM_DLL Pass RewriteDataflowReshape();
  * signature will have upper bound 1024. And we will use 1024 as its value
  * during memory planning.
  *
+ * With the pass config "relax.memory_plan.offset_planner" set to one of
+ * "greedy_by_size", "best_fit" and "auto", the tensors of each binding block
+ * are instead packed into one arena per device at byte offsets, so that the
+ * tensors live at the same time never overlap.
+ *
+ * With the pass config "relax.memory_plan.scope" set to "function", the
+ * planning spans all the binding blocks of a function, including the branches
+ * of If. Set to "module", the functions also reuse the storages of each other,
+ * which suits the functions that never run concurrently.
+ *
  * \return The pass.
  */
 TVM_DLL Pass StaticPlanBlockMemory();
@@ -182,6 +192,25 @@ TVM_DLL Pass EliminateCommonSubexpr(bool call_only = false);
  */
 TVM_DLL Pass BindParams(String func_name, Map<String, runtime::NDArray> params);
 
+/*!
+ * \brief Specialize the public functions with symbolic shapes to a set of static shape buckets.
+ *
+ * Every combination of the buckets of the symbolic vars used by the parameters of a function gets
+ * a private clone with static shapes. The function becomes a dispatcher to the clone of the
+ * buckets matching the arguments, and calls a copy of the original function otherwise.
+ *
+ * \param buckets The map from the name of a symbolic var to its buckets.
+ * \param pad_to_bucket Whether to also pad the arguments with zeros to the smallest fitting
+ *  bucket, and slice the result back. The padded elements must not affect the others, so this
+ *  gives wrong results for any function reducing over a bucketed axis, such as softmax,
+ *  attention or sum along it. Off by default, so that only the arguments matching a bucket
+ *  exactly are dispatched to the clones.
+ *
+ * \return The Pass.
+ */
+TVM_DLL Pass SpecializeShapeBuckets(Map<String, Array<Integer>> buckets,
+                                    bool pad_to_bucket = false);
+
 /*!
  * \brief Fold constant expressions.
  *
@@ -518,6 +547,15 @@ TVM_DLL Pass ToMixedPrecision(const DataType& out_dtype,
  */
 TVM_DLL Pass RewriteCUDAGraph();
 
+/*!
+ * \brief Launch the independent kernels of each binding block on multiple streams. The pass
+ * assigns the kernels to streams, and inserts the waits between the streams and the syncs with
+ * the VM thread needed by their dependencies.
+ * \param num_streams The number of streams.
+ * \return The Pass.
+ */
+TVM_DLL Pass AssignAsyncStreams(int num_streams);
+
 /*!
  * \brief The pass is designed for few shot tuning for static shape PrimFuncs. It examines all the
  *  blocks within the PrimFunc and conducts loop fusion, splitting, and other transformations based
@@ -150,6 +150,23 @@ class Executable : public runtime::ModuleNode {
    * \return The loaded executable, in the form of a `runtime::Module`.
    */
   static Module LoadFromFile(const String& file_name);
+  /*!
+   * \brief Write the Executable to a snapshot file.
+   *
+   * Unlike the binary form, a snapshot uses fixed-layout records for the
+   * function table and raw arrays for the bytecode, and aligns the payloads
+   * of NDArray constants, so that they can be used from a memory mapping.
+   * The imported modules are not included.
+   * \param file_name The name of the file to write the snapshot to.
+   */
+  void SaveSnapshot(const String& file_name);
+  /*!
+   * \brief Load Executable from a snapshot file. The file is memory mapped,
+   *  and the NDArray constants are CPU arrays viewing into the mapping.
+   * \param file_name The path of the snapshot file.
+   * \return The loaded executable, in the form of a `runtime::Module`.
+   */
+  static Module LoadSnapshot(const String& file_name);
 
   /*! \brief The virtual machine's function table. */
   std::vector<VMFuncInfo> func_table;
@@ -27,6 +27,7 @@
 #include <tvm/runtime/c_runtime_api.h>
 #include <tvm/runtime/ndarray.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -49,6 +50,7 @@ struct Buffer {
 enum AllocatorType {
   kNaive = 1,
   kPooled,
+  kBestFit,
 };
 
 class Allocator {
@@ -113,6 +115,8 @@ class MemoryManager {
  private:
   std::mutex mutex_;
   std::unordered_map<Device, std::unique_ptr<Allocator>> allocators_;
+  /*! \brief Bumped on Clear to invalidate the allocators cached by each thread. */
+  std::atomic<uint64_t> generation_{0};
 };
 
 /*! \brief An object representing a storage allocation. */
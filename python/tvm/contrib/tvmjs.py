@@ -52,6 +52,42 @@ def _convert_bf16_to_f32(value):
     return (data.astype("uint32") << 16).view("float32")
 
 
+def _quantize_group(value, bits, group_size):
+    """Quantize a float32 array per group of values sharing one float32 scale.
+
+    The result holds the quantized values followed by the scales. 8 bit values
+    are signed, 4 bit values are biased by 8 and packed two per byte, low bits first.
+    """
+    flat = value.reshape(-1).astype("float32")
+    size = flat.size
+    groups = np.pad(flat, (0, -size % group_size)).reshape(-1, group_size)
+    max_quant = (1 << (bits - 1)) - 1
+    scale = np.abs(groups).max(axis=1) / max_quant
+    scale[scale == 0] = 1
+    quant = np.clip(np.round(groups / scale[:, None]), -max_quant - 1, max_quant)
+    quant = quant.reshape(-1)[:size].astype("int32")
+    if bits == 8:
+        data = quant.astype("int8").tobytes()
+    else:
+        biased = np.pad((quant + 8).astype("uint8"), (0, size % 2))
+        data = (biased[0::2] | (biased[1::2] << 4)).astype("uint8").tobytes()
+    return data + scale.astype("float32").tobytes()
+
+
+def _dequantize_group(data, shape, bits, group_size):
+    """Dequantize the result of _quantize_group."""
+    size = int(np.prod(shape))
+    quant_nbytes = (size * bits + 7) // 8
+    if bits == 8:
+        quant = np.frombuffer(data[:quant_nbytes], dtype="int8").astype("float32")
+    else:
+        packed = np.frombuffer(data[:quant_nbytes], dtype="uint8")
+        quant = np.stack([packed & 0xF, packed >> 4], axis=1).reshape(-1)[:size]
+        quant = quant.astype("float32") - 8
+    scale = np.frombuffer(data[quant_nbytes:], dtype="float32")
+    return (quant * np.repeat(scale, group_size)[:size]).reshape(shape)
+
+
 class NDArrayCacheShardingManager:
     """Internal helper to shard ndarrays."""
 
@@ -62,9 +98,10 @@ class NDArrayCacheShardingManager:
         self.curr_data = bytearray()
         self.shard_records = []
         self.shard_cap_nbytes = shard_cap_nbytes
+        self.record_alignment = 64
         self.counter = 0
 
-    def append(self, data, name, shape, dtype, encode_format):
+    def append(self, data, name, shape, dtype, encode_format, group_size=None):
         """Commit a record to the manager.
 
         Parameters
@@ -83,6 +120,9 @@ class NDArrayCacheShardingManager:
 
         encode_format:
             The encode format of the entry
+
+        group_size: Optional[int]
+            The number of values sharing a scale, for group quantized formats
         """
         rec = {
             "name": name,
@@ -91,6 +131,8 @@ class NDArrayCacheShardingManager:
             "format": encode_format,
             "nbytes": len(data),
         }
+        if group_size is not None:
+            rec["groupSize"] = group_size
 
         if self.pending_nbytes + len(data) >= self.shard_cap_nbytes:
             if len(data) * 2 >= self.shard_cap_nbytes:
@@ -99,6 +141,8 @@ class NDArrayCacheShardingManager:
                 self._commit_internal(data, [rec])
                 return
             self.commit()
+        # align each record so that it can be used in place once the shard is memory mapped
+        self.curr_data += bytes(-self.pending_nbytes % self.record_alignment)
         rec["byteOffset"] = self.pending_nbytes
         self.curr_records.append(rec)
         self.curr_data += data
@@ -140,6 +184,7 @@ def dump_ndarray_cache(
     encode_format="f32-to-bf16",
     meta_data=None,
     shard_cap_mb=32,
+    group_size=32,
 ):
     """Dump parameters to NDArray cache.
 
@@ -151,16 +196,25 @@ def dump_ndarray_cache(
     cache_dir: str
         The path to the cache
 
-    encode_format: {"f32-to-bf16", "raw"}
-        Encoding format.
+    encode_format: {"f32-to-bf16", "f32-to-f16", "f32-to-int8-group", "f32-to-int4-group", "raw"}
+        Encoding format. Only applies to float32 arrays, other arrays are stored raw.
 
     meta_data: json-compatible-struct
         Extra meta_data to be stored in the cache json file.
 
     shard_cap_mb: int
         Maxinum number of MB to be kept per shard
+
+    group_size: int
+        The number of values sharing a scale, for group quantized formats
     """
-    if encode_format not in ("raw", "f32-to-bf16"):
+    if encode_format not in (
+        "raw",
+        "f32-to-bf16",
+        "f32-to-f16",
+        "f32-to-int8-group",
+        "f32-to-int4-group",
+    ):
         raise ValueError(f"Invalie encode_format {encode_format}")
 
     meta_data = {} if meta_data is None else meta_data
@@ -188,14 +242,28 @@ def dump_ndarray_cache(
         # prefer to preserve original dtype, especially if the format was bfloat16
         dtype = str(origin_v.dtype) if isinstance(origin_v, tvm.nd.NDArray) else str(v.dtype)
 
+        rec_group_size = None
         # convert fp32 to bf16
         if encode_format == "f32-to-bf16" and dtype == "float32":
             data = _convert_f32_to_bf16(v).tobytes()
             f32_to_bf16_triggered = True
+        elif encode_format == "f32-to-f16" and dtype == "float32":
+            data = v.astype("float16").tobytes()
+        elif encode_format in ("f32-to-int8-group", "f32-to-int4-group") and dtype == "float32":
+            bits = 8 if encode_format == "f32-to-int8-group" else 4
+            data = _quantize_group(v, bits, group_size)
+            rec_group_size = group_size
         else:
             data = v.tobytes()
 
-        shard_manager.append(data, name=k, shape=shape, dtype=dtype, encode_format=encode_format)
+        shard_manager.append(
+            data,
+            name=k,
+            shape=shape,
+            dtype=dtype,
+            encode_format=encode_format,
+            group_size=rec_group_size,
+        )
 
         counter += 1
         last_cmd = "[%04d/%04d] saving %s" % (counter, total, k)
@@ -267,6 +335,12 @@ def load_ndarray_cache(cachepath: str, device: tvm.runtime.Device):
             if encode_format == "f32-to-bf16" and dtype == "float32":
                 data = np.frombuffer(buffer_source, dtype="uint16").reshape(shape)
                 arr.copyfrom(_convert_bf16_to_f32(data))
+            elif encode_format == "f32-to-f16" and dtype == "float32":
+                data = np.frombuffer(buffer_source, dtype="float16").reshape(shape)
+                arr.copyfrom(data.astype("float32"))
+            elif encode_format in ("f32-to-int8-group", "f32-to-int4-group") and dtype == "float32":
+                bits = 8 if encode_format == "f32-to-int8-group" else 4
+                arr.copyfrom(_dequantize_group(buffer_source, shape, bits, rec["groupSize"]))
             elif dtype == "bfloat16":
                 data = np.frombuffer(buffer_source, dtype="uint16").reshape(shape)
                 arr.copyfrom(data)
@@ -32,7 +32,6 @@ import torch  # type: ignore
 import tvm
 
 from ...contrib.tar import tar, untar
-from ...runtime import NDArray
 from ...target import Target
 from ..cost_model import PyCostModel
 from ..database import JSONDatabase
@@ -441,15 +440,13 @@ def extract_features(
     """
     extractor = extractor or PerStoreFeature(extract_workload=True)
 
-    def _feature(feature: NDArray) -> np.ndarray:
-        return feature.numpy().astype("float32")
-
     def _mean_cost(res: RunnerResult) -> float:
         if not res.run_secs:
             return 1e10
         return float(np.median([float(s) for s in res.run_secs]))
 
-    new_features = [_feature(x) for x in extractor.extract_from(context, candidates)]
+    features, offsets = extractor.extract_batch_from(context, candidates)
+    new_features = np.split(features, offsets[1:-1]) if candidates else []
     new_mean_costs = (
         np.array([_mean_cost(x) for x in results]).astype("float32")
         if results is not None
@@ -19,14 +19,13 @@ import os
 import tempfile
 from collections import OrderedDict
 from itertools import chain as itertools_chain
-from typing import TYPE_CHECKING, Any, Callable, Dict, List, NamedTuple, Optional, Tuple
+from typing import TYPE_CHECKING, Any, Callable, Dict, List, NamedTuple, Optional, Tuple, Union
 
 from typing_extensions import Literal
 
 import numpy as np  # type: ignore
 
 from ...contrib.tar import tar, untar
-from ...runtime import NDArray
 from ..cost_model import PyCostModel
 from ..feature_extractor import FeatureExtractor
 from ..logging import get_logger
@@ -79,27 +78,35 @@ class PackSum:
 
     def __init__(
         self,
-        xs: List[np.ndarray],  # pylint: disable=invalid-name
+        xs: Union[List[np.ndarray], np.ndarray],  # pylint: disable=invalid-name
         ys: Optional[np.ndarray],  # pylint: disable=invalid-name
+        offsets: Optional[np.ndarray] = None,
     ):
         """Create PackSum format given a batch of samples
 
         Parameters
         ----------
-        xs : List[np.ndarray]
-            A batch of input samples
+        xs : Union[List[np.ndarray], np.ndarray]
+            A batch of input samples, or the blocks of all the samples stacked when `offsets`
+            is given
         ys : Optional[List[float]]
             A batch of labels. None means no labels available.
+        offsets : Optional[np.ndarray]
+            The offsets of the blocks of each sample in the stacked `xs`, whose length is the
+            number of samples plus one. The stacked `xs` is used without a copy.
         """
         import xgboost as xgb  # type: ignore # pylint: disable=import-outside-toplevel
 
-        repeats = [x.shape[0] for x in xs]
-        xs = np.concatenate(xs, axis=0)
-        self.ids = np.concatenate([[i] * repeat for i, repeat in enumerate(repeats)], axis=0)
+        if offsets is None:
+            repeats = np.array([x.shape[0] for x in xs], dtype="int64")
+            xs = np.concatenate(xs, axis=0)
+        else:
+            repeats = np.diff(offsets)
+        self.ids = np.repeat(np.arange(len(repeats)), repeats)
         if ys is None:
             self.dmatrix = xgb.DMatrix(data=xs, label=None)
         else:
-            ys = np.concatenate([[y] * repeat for y, repeat in zip(ys, repeats)], axis=0)
+            ys = np.repeat(ys, repeats)
             self.dmatrix = xgb.DMatrix(data=xs, label=ys)
             self.dmatrix.set_weight(ys)
 
@@ -484,15 +491,13 @@ class XGBModel(PyCostModel):
         group = self.data.get(new_group_hash, None)
 
         # Step 2. Extract features
-        def _feature(x: NDArray) -> np.ndarray:
-            return x.numpy().astype("float32")
-
         def _mean_cost(x: RunnerResult) -> float:
             if not x.run_secs:
                 return 1e10
             return float(np.median([float(s) for s in x.run_secs]))
 
-        new_features = [_feature(x) for x in self.extractor.extract_from(context, candidates)]
+        features, offsets = self.extractor.extract_batch_from(context, candidates)
+        new_features = np.split(features, offsets[1:-1])
         new_mean_costs = [_mean_cost(x) for x in results]
 
         # Filter instances with no features
@@ -565,15 +570,8 @@ class XGBModel(PyCostModel):
             The predicted normalized score.
         """
         if self.data_size >= self.num_warmup_samples and self.booster is not None:
-            ret = self._predict(
-                xs=[
-                    x.numpy().astype("float32")
-                    for x in self.extractor.extract_from(
-                        context,
-                        candidates,
-                    )
-                ]
-            )
+            features, offsets = self.extractor.extract_batch_from(context, candidates)
+            ret = self._predict(xs=features, offsets=offsets)
         else:
             ret = np.random.uniform(
                 low=0,
@@ -620,9 +618,10 @@ class XGBModel(PyCostModel):
 
     def _predict(  # type: ignore # pylint: disable=invalid-name
         self,
-        xs: List[np.ndarray],
+        xs: Union[List[np.ndarray], np.ndarray],
+        offsets: Optional[np.ndarray] = None,
     ) -> np.ndarray:
-        d_test = PackSum(xs=xs, ys=None)
+        d_test = PackSum(xs=xs, ys=None, offsets=offsets)
         pred = self.booster.predict(d_test.dmatrix)
         ret = d_test.predict_with_score(pred)
         return ret
@@ -0,0 +1,132 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+"""The database that uses a memory-mapped binary file to store tuning records"""
+import os.path as osp
+from typing import Dict, Optional
+
+from tvm._ffi import register_object
+
+from .. import _ffi_api
+from .database import Database, TuningRecord, Workload
+from .json_database import JSONDatabase
+
+
+@register_object("meta_schedule.BinaryDatabase")
+class BinaryDatabase(Database):
+    """Database class backed by a binary file.
+
+    The file is memory mapped when loaded. Only the columns used to rank the tuning records are
+    read then, and a tuning record is decoded when it is first returned by the database.
+
+    Parameters
+    ----------
+    path : str
+        The path to the database file.
+    module_equality : Optional[str]
+        A string to specify the module equality testing and hashing method.
+        It must be one of the followings:
+          - "structural": Use StructuralEqual/Hash
+          - "ignore-ndarray": Same as "structural", but ignore ndarray raw data during
+                              equality testing and hashing.
+          - "anchor-block": Apply equality testing and hashing on the anchor block extracted from a
+                            given module. The "ignore-ndarray" varint is used for the extracted
+                            blocks or in case no anchor block is found.
+                            For the definition of the anchor block, see tir/analysis/analysis.py.
+    """
+
+    path: str
+
+    def __init__(
+        self,
+        path: Optional[str] = None,
+        *,
+        work_dir: Optional[str] = None,
+        allow_missing: bool = True,
+        module_equality: str = "structural",
+    ) -> None:
+        """Constructor.
+
+        Parameters
+        ----------
+        path : Optional[str] = None
+            The path to the database file. If not specified,
+            will be generated from `work_dir` as `$work_dir/database.bin`.
+        work_dir : Optional[str] = None
+            The work directory, if specified, will be used to generate `path`.
+        allow_missing : bool
+            Whether to create new file when the given path is not found.
+        """
+        if work_dir is not None and path is None:
+            path = osp.join(work_dir, "database.bin")
+        if path is None:
+            raise ValueError("`path` is not specified.")
+        self.__init_handle_by_constructor__(
+            _ffi_api.DatabaseBinaryDatabase,  # type: ignore # pylint: disable=no-member
+            path,
+            allow_missing,
+            module_equality,
+        )
+
+    @staticmethod
+    def from_json(
+        path: str,
+        path_workload: str,
+        path_tuning_record: str,
+        *,
+        module_equality: str = "structural",
+    ) -> "BinaryDatabase":
+        """Convert the tuning records of a JSON database to a binary database.
+
+        Parameters
+        ----------
+        path : str
+            The path to the binary database file. The records are appended if it exists.
+        path_workload : str
+            The path to the workload table of the JSON database.
+        path_tuning_record : str
+            The path to the tuning record table of the JSON database.
+        module_equality : str
+            A string to specify the module equality testing and hashing method.
+
+        Returns
+        -------
+        database : BinaryDatabase
+            The binary database holding the converted tuning records.
+        """
+        source = JSONDatabase(
+            path_workload,
+            path_tuning_record,
+            allow_missing=False,
+            module_equality=module_equality,
+        )
+        database = BinaryDatabase(path, module_equality=module_equality)
+        workloads: Dict[Workload, Workload] = {}
+        for record in source.get_all_tuning_records():
+            workload = workloads.get(record.workload)
+            if workload is None:
+                workload = database.commit_workload(record.workload.mod)
+                workloads[record.workload] = workload
+            database.commit_tuning_record(
+                TuningRecord(
+                    record.trace,
+                    workload,
+                    record.run_secs,
+                    record.target,
+                    record.args_info,
+                )
+            )
+        return database
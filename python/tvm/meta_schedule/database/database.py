@@ -381,6 +381,7 @@ class Database(Object):
             Literal[
                 "json",
                 "memory",
+                "binary",
                 "union",
                 "ordered_union",
             ],
@@ -393,10 +394,10 @@ class Database(Object):
 
         Parameters
         ----------
-        kind : str = "json" | "memory" | "union" | "ordered_union" | Callable[[tvm.tir.Schedule],
-        bool]
+        kind : str = "json" | "memory" | "binary" | "union" | "ordered_union" |
+        Callable[[tvm.tir.Schedule], bool]
             The kind of the database to be created. The following kinds are supported:
-            "json", "memory", "union", "ordered_union", and a custom schedule function.
+            "json", "memory", "binary", "union", "ordered_union", and a custom schedule function.
 
         Returns
         -------
@@ -404,6 +405,7 @@ class Database(Object):
             The created database.
         """
         from . import (  # pylint: disable=import-outside-toplevel
+            BinaryDatabase,
             JSONDatabase,
             MemoryDatabase,
             OrderedUnionDatabase,
@@ -417,6 +419,8 @@ class Database(Object):
             return JSONDatabase(*args, **kwargs)
         if kind == "memory":
             return MemoryDatabase(*args, **kwargs)  # type: ignore
+        if kind == "binary":
+            return BinaryDatabase(*args, **kwargs)  # type: ignore
         if kind == "union":
             return UnionDatabase(*args, **kwargs)  # type: ignore
         if kind == "ordered_union":
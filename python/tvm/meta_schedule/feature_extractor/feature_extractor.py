@@ -15,7 +15,9 @@
 # specific language governing permissions and limitations
 # under the License.
 """Meta Schedule FeatureExtractor."""
-from typing import Callable, List, Union
+from typing import Callable, List, Tuple, Union
+
+import numpy as np
 
 # isort: off
 from typing_extensions import Literal
@@ -60,6 +62,33 @@ class FeatureExtractor(Object):
         )
         return result
 
+    def extract_batch_from(
+        self, context: TuneContext, candidates: List[MeasureCandidate]
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        """Extract features from the given measure candidates into one batch.
+
+        Parameters
+        ----------
+        context : TuneContext
+            The tuning context for feature extraction.
+        candidates : List[MeasureCandidate]
+            The measure candidates to extract features from.
+
+        Returns
+        -------
+        features : np.ndarray
+            The float32 features of all the candidates, stacked by rows. The array shares the
+            memory of the tvm ndarray extracted when numpy supports DLPack.
+        offsets : np.ndarray
+            The (len(candidates) + 1) offsets of the rows of each candidate in `features`.
+        """
+        features, offsets = _ffi_api.FeatureExtractorExtractBatchFrom(  # type: ignore # pylint: disable=no-member
+            self, context, candidates
+        )
+        if hasattr(np, "from_dlpack"):
+            return np.from_dlpack(features), np.from_dlpack(offsets)
+        return features.numpy(), offsets.numpy()
+
     @staticmethod
     def create(
         kind: Literal["per-store-feature"],
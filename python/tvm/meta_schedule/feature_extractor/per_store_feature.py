@@ -18,6 +18,8 @@
 """We extract one feature vector per BufferStoreNode statement in a TIR Stmt,
 so we call this feature as "per-store" feature.
 """
+from typing import Tuple
+
 from tvm._ffi import register_object
 
 from .. import _ffi_api
@@ -65,3 +67,17 @@ class PerStoreFeature(FeatureExtractor):
             cache_line_bytes,
             extract_workload,
         )
+
+    def cache_stats(self) -> Tuple[int, int]:
+        """Get the statistics of the cache of the extracted features.
+
+        Returns
+        -------
+        hits : int
+            The number of modules whose features were found in the cache, as a structurally
+            equal module had been extracted before.
+        size : int
+            The number of modules whose features are in the cache.
+        """
+        hits, size = _ffi_api.FeatureExtractorPerStoreFeatureCacheStats(self)  # type: ignore # pylint: disable=no-member
+        return int(hits), int(size)
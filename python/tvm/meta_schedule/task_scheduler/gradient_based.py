@@ -34,6 +34,7 @@ class GradientBased(TaskScheduler):
         alpha: float = 0.2,
         window_size: int = 3,
         seed: int = -1,
+        num_batches_in_flight: int = 1,
     ) -> None:
         """Constructor.
 
@@ -45,6 +46,11 @@ class GradientBased(TaskScheduler):
             The parameter to control backward window size in gradient computation.
         seed : int = -1
             The random seed.
+        num_batches_in_flight : int = 1
+            The number of batches of candidates in the tuning pipeline, including the one being
+            searched. With more than one batch, the next batch is searched with the latest cost
+            model while the previous ones are built and run in the background. With a local
+            runner, the builds and the search then share the machine with the runs.
         """
         self.__init_handle_by_constructor__(
             _ffi_api.TaskSchedulerGradientBased,  # type: ignore # pylint: disable=no-member
@@ -52,4 +58,5 @@ class GradientBased(TaskScheduler):
             alpha,
             window_size,
             seed,
+            num_batches_in_flight,
         )
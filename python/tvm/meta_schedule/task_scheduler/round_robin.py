@@ -28,9 +28,18 @@ logger = get_logger(__name__)  # pylint: disable=invalid-name
 class RoundRobin(TaskScheduler):
     """Round Robin Task Scheduler"""
 
-    def __init__(self) -> None:
-        """Constructor."""
+    def __init__(self, *, num_batches_in_flight: int = 1) -> None:
+        """Constructor.
+
+        Parameters
+        ----------
+        num_batches_in_flight : int = 1
+            The number of batches of candidates in the tuning pipeline, including the one being
+            searched. With more than one batch, the next batch is searched with the latest cost
+            model while the previous ones are built and run in the background.
+        """
         self.__init_handle_by_constructor__(
             _ffi_api.TaskSchedulerRoundRobin,  # type: ignore # pylint: disable=no-member
             get_logging_func(logger),
+            num_batches_in_flight,
         )
@@ -343,6 +343,18 @@ def StaticPlanBlockMemory() -> tvm.ir.transform.Pass:
     signature will have upper bound 1024. And we will use 1024 as its value
     during memory planning.
 
+    With the pass config "relax.memory_plan.offset_planner" set to one of
+    "greedy_by_size", "best_fit" and "auto", the tensors of each binding block
+    are instead packed into one arena per device at byte offsets, so that the
+    tensors live at the same time never overlap. The offsets are only planned
+    under a target with plain device pointers (CPU, CUDA or ROCm), as set by
+    `relax.build`. Otherwise the storages are reused whole.
+
+    With the pass config "relax.memory_plan.scope" set to "function", the
+    planning spans all the binding blocks of a function, including the branches
+    of If. Set to "module", the functions also reuse the storages of each other,
+    which suits the functions that never run concurrently.
+
     Returns
     -------
     ret : tvm.ir.transform.Pass
@@ -416,6 +428,37 @@ def BindParams(
     return _ffi_api.BindParams(func_name, tvm_params)  # type: ignore
 
 
+def SpecializeShapeBuckets(
+    buckets: Dict[str, List[int]],
+    pad_to_bucket: bool = False,
+) -> tvm.ir.transform.Pass:
+    """Specialize the public functions with symbolic shapes to a set of static shape buckets.
+
+    For every combination of the buckets of the symbolic vars used by the parameters of a
+    function, a private clone of the function is added where the vars are replaced with the
+    bucket values. The clones have static shapes, so they are planned exactly and run without
+    any shape computation. The function itself becomes a dispatcher that calls the clone of the
+    buckets matching the arguments, or a copy of the original function otherwise.
+
+    Parameters
+    ----------
+    buckets : Dict[str, List[int]]
+        The map from the name of a symbolic var to its buckets, e.g. {"seq_len": [1, 16, 128]}.
+
+    pad_to_bucket : bool
+        Whether to also pad the arguments with zeros along the axes of the vars to the smallest
+        fitting bucket, and slice the result back. Only enable it when the padded elements do
+        not affect the others: any reduction over a bucketed axis, such as softmax, attention
+        or a sum along it, silently gives wrong results on padded arguments. By default, only
+        the arguments matching a bucket exactly are dispatched to the clones.
+
+    Returns
+    -------
+    ret: tvm.ir.transform.Pass
+    """
+    return _ffi_api.SpecializeShapeBuckets(buckets, pad_to_bucket)  # type: ignore
+
+
 def RunCodegen(
     target_options: Optional[dict] = None,
     entry_functions: Optional[List[str]] = None,
@@ -1072,6 +1115,25 @@ def RewriteCUDAGraph() -> tvm.ir.transform.Pass:
     return _ffi_api.RewriteCUDAGraph()  # type: ignore
 
 
+def AssignAsyncStreams(num_streams: int) -> tvm.ir.transform.Pass:
+    """Launch the independent kernels of each binding block on multiple streams. The pass
+    assigns the kernels to streams, and inserts the waits between the streams and the syncs
+    with the VM thread needed by their dependencies. It is expected to run after
+    StaticPlanBlockMemory.
+
+    Parameters
+    ----------
+    num_streams : int
+        The number of streams.
+
+    Returns
+    -------
+    ret: tvm.ir.transform.Pass
+        The registered pass for assigning the kernels to streams
+    """
+    return _ffi_api.AssignAsyncStreams(num_streams)  # type: ignore
+
+
 def AllocateWorkspace() -> tvm.ir.transform.Pass:
     """Allocate a workspace, represented by a tensor of size big enough for all external
     functions that require a temporary storage, and append it to the arguments of external
@@ -101,6 +101,32 @@ class Executable:
         self.mod.export_library(dso_path, fcompile=fcompile, addons=addons, **kwargs)
         return tvm.runtime.load_module(dso_path)
 
+    def save_snapshot(self, file_name: str) -> None:
+        """Save the executable, without its imported modules, to a snapshot file.
+
+        The NDArray constants of a snapshot are memory mapped when it is loaded,
+        instead of being deserialized, so loading takes little time and memory.
+        The compiled kernels are exported separately, and imported back after loading.
+
+        Parameters
+        ----------
+        file_name : str
+            The name of the snapshot file.
+
+        Examples
+        --------
+        .. code:: python
+
+            ex = relax.build(mod, target)
+            ex.save_snapshot("model.snapshot")
+            ex.mod.imports[0].export_library("kernels.so")
+            # load the snapshot and link it with the kernels
+            rt_mod = tvm.runtime.load_module("model.snapshot", "relax_snapshot")
+            rt_mod.import_module(tvm.runtime.load_module("kernels.so"))
+            vm = relax.VirtualMachine(rt_mod, tvm.cpu())
+        """
+        self.mod.save(file_name, "relax_snapshot")
+
     def export_library(
         self,
         file_name: str,
@@ -311,14 +337,19 @@ def build(
     passes.append(relax.transform.CallTIRRewrite())
     passes.append(relax.transform.StaticPlanBlockMemory())
 
-    if tvm.transform.PassContext.current().config.get("relax.backend.use_cuda_graph", False):
+    config = tvm.transform.PassContext.current().config
+    if config.get("relax.backend.use_cuda_graph", False):
         passes.append(relax.transform.RewriteCUDAGraph())
+    elif config.get("relax.backend.num_async_streams", 1) > 1:
+        passes.append(relax.transform.AssignAsyncStreams(config["relax.backend.num_async_streams"]))
 
     passes.append(relax.transform.VMBuiltinLower())
     passes.append(relax.transform.VMShapeLower())
     passes.append(relax.transform.AttachGlobalSymbol())
     seq = tvm.transform.Sequential(passes)
-    new_mod = seq(mod)
+    # The target decides whether the memory planning may use storage offsets.
+    with target:
+        new_mod = seq(mod)
 
     # Extract external runtime modules if exist.
     attrs = dict(mod.attrs) if mod.attrs else {}
@@ -40,6 +40,7 @@ class VirtualMachine(object):
 
     NAIVE_ALLOCATOR = 1
     POOLED_ALLOCATOR = 2
+    BEST_FIT_ALLOCATOR = 3
 
     def __init__(
         self,
@@ -61,7 +62,7 @@ class VirtualMachine(object):
 
         memory_cfg : Optional[Union[str, Dict[Device, str]]]
             Config the type of memory allocator. The allocator type can be ["naive",
-            "pooled"]. If memory_cfg is None, all devices will use pooled allocator
+            "pooled", "best_fit"]. If memory_cfg is None, all devices will use pooled allocator
             by default. If memory_cfg is string, all devices will use the specified
             allocator type. If memory_cfg is a dict, each device uses the allocator
             type specified in the dict, or pooled allocator if not specified in the
@@ -84,6 +85,11 @@ class VirtualMachine(object):
 
         load_exec = "vm_profiler_load_executable" if profile else "vm_load_executable"
         self.module = rt_mod[load_exec]()
+        self._bind_module_functions()
+        self._setup_device(device, memory_cfg)
+
+    def _bind_module_functions(self) -> None:
+        """Look up the functions of the VM module that are called often."""
         self._invoke_closure = self.module["invoke_closure"]
         self._save_function = self.module["save_function"]
         self._set_input = self.module["set_input"]
@@ -93,7 +99,6 @@ class VirtualMachine(object):
         self._get_function_arity = self.module["get_function_arity"]
         self._get_function_param_name = self.module["get_function_param_name"]
         self._set_instrument = self.module["set_instrument"]
-        self._setup_device(device, memory_cfg)
 
     def _setup_device(self, dev: Device, memory_cfg: Union[str, Dict[Device, str]]) -> None:
         """init devices and allocators."""
@@ -119,9 +124,11 @@ class VirtualMachine(object):
         if memory_cfg is None:
             memory_cfg = {}
         elif isinstance(memory_cfg, str):
-            assert memory_cfg in ["naive", "pooled"]
+            assert memory_cfg in ["naive", "pooled", "best_fit"]
             if memory_cfg == "naive":
                 default_alloc_type = VirtualMachine.NAIVE_ALLOCATOR
+            elif memory_cfg == "best_fit":
+                default_alloc_type = VirtualMachine.BEST_FIT_ALLOCATOR
             memory_cfg = {}
         elif not isinstance(memory_cfg, dict):
             raise TypeError(
@@ -157,6 +164,50 @@ class VirtualMachine(object):
         """
         return self._invoke_closure(closure, *args)
 
+    def invoke_captured(self, func_name: str, *args: Any) -> Object:
+        """Invoke a function, replaying the calls captured in an earlier invocation
+        with inputs of the same shapes, dtypes and devices.
+
+        The first invocation for a signature runs the function normally and records
+        the calls it makes. Later invocations with the same signature copy the inputs
+        into the buffers of the capture and rerun only the recorded calls, skipping
+        the allocations and shape computations. Functions with control flow or calls
+        whose results may depend on the data are not replayed.
+
+        Parameters
+        ----------
+        func_name : str
+            The name of the function.
+
+        args : list[tvm.runtime.NDArray] or list[np.ndarray]
+            The arguments to the function.
+
+        Returns
+        -------
+        result : Object
+            The output. The same object is returned and overwritten by every replay,
+            so copy it if it has to outlive the next invocation.
+        """
+        return self.module["invoke_captured"](func_name, *args)
+
+    def create_session(self) -> "VirtualMachine":
+        """Create a session of the VM, which runs the same executable on the same devices.
+
+        The session shares the constants, including the weights, and the decoded
+        instructions with this VM, so it costs little memory. The inputs, outputs,
+        saved functions and captures are owned by the session, so the sessions can
+        serve requests from different threads concurrently.
+
+        Returns
+        -------
+        session : VirtualMachine
+            The session, which is already initialized.
+        """
+        session = VirtualMachine.__new__(VirtualMachine)
+        session.module = self.module["create_session"]()
+        session._bind_module_functions()
+        return session
+
     def save_function(
         self,
         func_name: str,
@@ -507,3 +558,44 @@ class VirtualMachine(object):
 
         report_json = self.module["profile"](func_name, *cargs)
         return Report.from_json(report_json)
+
+    def start_sampling(self, sample_period: int = 1000) -> None:
+        """Start sampling the calls made by the VM functions.
+
+        One in every `sample_period` calls is timed with the cycle counter, and the
+        time is aggregated per call stack of VM functions. The overhead is low enough
+        to keep sampling enabled in production. Sampling only applies to the
+        pre-decoded dispatch, and is restarted from scratch by every call.
+
+        Parameters
+        ----------
+        sample_period : int
+            The number of calls per sample.
+        """
+        self.module["start_sampling"](sample_period)
+
+    def stop_sampling(self) -> None:
+        """Stop sampling the calls. The samples so far can still be read."""
+        self.module["stop_sampling"]()
+
+    def sampling_report(self) -> Report:
+        """Get the report of the sampled calls.
+
+        Returns
+        -------
+        report: tvm.runtime.profiling.Report
+            One row per call stack. The counts and durations are extrapolated from
+            the samples by the sample period.
+        """
+        return Report.from_json(self.module["sampling_report"]())
+
+    def sampling_flamegraph(self) -> str:
+        """Get the sampled calls in the folded stack format of flamegraph tools.
+
+        Returns
+        -------
+        folded_stacks: str
+            One "main;func;callee value" line per call stack, where the value is the
+            sampled time in microseconds.
+        """
+        return self.module["sampling_flamegraph"]()
@@ -0,0 +1,407 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*!
+ * \file src/meta_schedule/database/binary_database.cc
+ * \brief A database storing the workloads and tuning records in one binary file.
+ * \details The file is memory mapped when loaded. Only the columns needed to rank the
+ * records are read then, and a record is decoded from its JSON when it is first returned.
+ *
+ * The file is a header followed by chunks, appended as the database is updated:
+ *
+ *   header: the magic "TVMMSDB" (8 bytes), uint64 version
+ *   chunk:  uint32 kind, uint32 num_entries, uint64 payload_bytes, the payload padded to 8 bytes
+ *
+ * A workload chunk holds one workload, as its uint64 shash followed by its JSON. The index
+ * of a workload is the number of workload chunks before it. A record chunk holds the columns
+ * of num_entries tuning records:
+ *
+ *   int32 workload_index[num_entries], padded to 8 bytes
+ *   float64 mean_run_secs[num_entries]
+ *   uint8 is_valid[num_entries], padded to 8 bytes
+ *   uint64 json_end[num_entries], the end offset of the JSON of each record in the blob
+ *   the blob of the JSON of the records
+ */
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#include "../../support/mapped_file.h"
+#include "../module_equality.h"
+#include "../utils.h"
+#include "./file_appender.h"
+
+namespace tvm {
+namespace meta_schedule {
+
+using support::MappedFile;
+
+/*! \brief Read a plain value from a possibly unaligned address. */
+template <typename T>
+T ReadBinaryValue(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+/*! \brief Append a plain value to a buffer. */
+template <typename T>
+void WriteBinaryValue(std::string* buffer, T value) {
+  buffer->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/*! \brief Round a number of bytes up to a multiple of 8. */
+inline uint64_t RoundUpTo8(uint64_t bytes) { return (bytes + 7) / 8 * 8; }
+
+class BinaryDatabaseNode : public DatabaseNode {
+ public:
+  /*! \brief The magic number at the start of the file. */
+  static constexpr const char kMagic[8] = {'T', 'V', 'M', 'M', 'S', 'D', 'B', '\0'};
+  /*! \brief The version of the file format. */
+  static constexpr uint64_t kVersion = 1;
+  /*! \brief The kind of a chunk holding a workload. */
+  static constexpr uint32_t kWorkloadChunk = 1;
+  /*! \brief The kind of a chunk holding the columns of tuning records. */
+  static constexpr uint32_t kRecordChunk = 2;
+
+  explicit BinaryDatabaseNode(String mod_eq_name = "structural")
+      : DatabaseNode(mod_eq_name),
+        workloads2idx_(/*bucket_count*/ 0, WorkloadHash(), WorkloadEqual(GetModuleEquality())) {}
+
+  /*! \brief The path to the database file */
+  String path;
+
+  void VisitAttrs(tvm::AttrVisitor* v) {
+    v->Visit("path", &path);
+    // `workloads2idx_` is not visited
+    // `entries_` is not visited
+  }
+
+  static constexpr const char* _type_key = "meta_schedule.BinaryDatabase";
+  TVM_DECLARE_FINAL_OBJECT_INFO(BinaryDatabaseNode, DatabaseNode);
+
+ public:
+  bool HasWorkload(const IRModule& mod) final {
+    return workloads2idx_.find(Workload(mod, GetModuleEquality().Hash(mod))) !=
+           workloads2idx_.end();
+  }
+
+  Workload CommitWorkload(const IRModule& mod) final {
+    auto [it, inserted] =
+        this->workloads2idx_.emplace(Workload(mod, GetModuleEquality().Hash(mod)), -1);
+    if (inserted) {
+      const Workload& workload = it->first;
+      it->second = static_cast<int>(this->workloads_.size());
+      this->workloads_.push_back(workload);
+      this->workload2entries_.emplace_back();
+      std::string payload;
+      WriteBinaryValue<uint64_t>(&payload, workload->shash);
+      payload += JSONDumps(workload->AsJSON());
+      // Not buffered, so that the file never has records indexing a workload chunk after them.
+      appender_->Write(EncodeChunk(kWorkloadChunk, 1, payload));
+    }
+    return it->first;
+  }
+
+  void CommitTuningRecord(const TuningRecord& record) final {
+    int workload_index = this->workloads2idx_.at(record->workload);
+    double mean_run_secs = SortTuningRecordByMeanRunSecs::Mean(record->run_secs.value_or({}));
+    bool is_valid = record->IsValid();
+    AddEntry(Entry{workload_index, mean_run_secs, is_valid, nullptr, 0, record});
+    // The buffered records are encoded into the columns of one chunk by EncodeRecordChunk.
+    std::string entry;
+    WriteBinaryValue<int32_t>(&entry, workload_index);
+    WriteBinaryValue<double>(&entry, mean_run_secs);
+    WriteBinaryValue<uint8_t>(&entry, is_valid ? 1 : 0);
+    entry += JSONDumps(record->AsJSON());
+    appender_->Append(std::move(entry));
+  }
+
+  Array<TuningRecord> GetTopK(const Workload& workload, int top_k) final {
+    CHECK_GE(top_k, 0) << "ValueError: top_k must be non-negative";
+    if (top_k == 0) {
+      return {};
+    }
+    auto it = this->workloads2idx_.find(workload);
+    if (it == this->workloads2idx_.end()) {
+      return {};
+    }
+    const auto& entry_ids = this->workload2entries_.at(it->second);
+    Array<TuningRecord> results;
+    results.reserve(std::min<size_t>(top_k, entry_ids.size()));
+    for (const auto& [mean_run_secs, entry_id] : entry_ids) {
+      results.push_back(GetRecord(entry_id));
+      if (results.size() == static_cast<size_t>(top_k)) {
+        break;
+      }
+    }
+    return results;
+  }
+
+  Array<TuningRecord> GetAllTuningRecords() final {
+    std::vector<size_t> entry_ids(entries_.size());
+    for (size_t i = 0; i < entry_ids.size(); ++i) {
+      entry_ids[i] = i;
+    }
+    std::stable_sort(entry_ids.begin(), entry_ids.end(), [this](size_t lhs, size_t rhs) {
+      return entries_[lhs].mean_run_secs < entries_[rhs].mean_run_secs;
+    });
+    Array<TuningRecord> results;
+    results.reserve(entry_ids.size());
+    for (size_t entry_id : entry_ids) {
+      results.push_back(GetRecord(entry_id));
+    }
+    return results;
+  }
+
+  int64_t Size() final { return entries_.size(); }
+
+  /*!
+   * \brief Load the database from its file, or create the file.
+   * \param allow_missing Whether to create the file when it is not found.
+   */
+  void Load(bool allow_missing) {
+    // The records buffered by the other databases of the file in this process are written first.
+    FileAppender::FlushPath(this->path);
+    if (!std::ifstream(this->path).good()) {
+      CHECK(allow_missing) << "ValueError: File doesn't exist: " << this->path;
+      std::string header(kMagic, sizeof(kMagic));
+      WriteBinaryValue<uint64_t>(&header, kVersion);
+      std::ofstream os(this->path, std::ofstream::binary);
+      CHECK(os.good()) << "ValueError: Cannot create new file: " << this->path;
+      os.write(header.data(), header.size());
+      appender_ = FileAppender::Get(this->path, EncodeRecordChunk);
+      return;
+    }
+    file_ = std::make_shared<MappedFile>(this->path);
+    const char* data = file_->data();
+    uint64_t size = file_->size();
+    CHECK(size >= 16 && std::memcmp(data, kMagic, sizeof(kMagic)) == 0)
+        << "ValueError: Not a binary tuning record database: " << this->path;
+    uint64_t version = ReadBinaryValue<uint64_t>(data + 8);
+    CHECK_EQ(version, kVersion) << "ValueError: Unsupported version of the binary tuning record "
+                                   "database "
+                                << this->path;
+    std::vector<std::pair<const char*, uint64_t>> workload_jsons;
+    for (uint64_t pos = 16; pos < size;) {
+      CHECK_LE(pos + 16, size) << "ValueError: The database " << this->path
+                               << " is truncated at byte " << pos;
+      uint32_t kind = ReadBinaryValue<uint32_t>(data + pos);
+      uint32_t num_entries = ReadBinaryValue<uint32_t>(data + pos + 4);
+      uint64_t payload_bytes = ReadBinaryValue<uint64_t>(data + pos + 8);
+      const char* payload = data + pos + 16;
+      // Compared without adding to the position, which a corrupt size could overflow.
+      CHECK_LE(payload_bytes, size - pos - 16)
+          << "ValueError: The database " << this->path << " is truncated at byte " << pos;
+      if (kind == kWorkloadChunk) {
+        CHECK_GE(payload_bytes, 8) << "ValueError: The workload chunk at byte " << pos << " of "
+                                   << this->path << " is corrupted";
+        workload_jsons.emplace_back(payload + 8, payload_bytes - 8);
+        workload2entries_.emplace_back();
+      } else if (kind == kRecordChunk) {
+        LoadRecordChunk(payload, payload_bytes, num_entries, workload_jsons.size(), pos);
+      } else {
+        LOG(FATAL) << "ValueError: Unknown chunk kind " << kind << " at byte " << pos << " of "
+                   << this->path;
+      }
+      pos += 16 + RoundUpTo8(payload_bytes);
+    }
+    LoadWorkloads(workload_jsons);
+    // The entries are filed once the workloads are known, under the first index of a workload
+    // written more than once.
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      Entry& entry = entries_[i];
+      entry.workload_index = workloads2idx_.at(workloads_.at(entry.workload_index));
+      if (entry.is_valid) {
+        workload2entries_.at(entry.workload_index).emplace(entry.mean_run_secs, i);
+      }
+    }
+    appender_ = FileAppender::Get(this->path, EncodeRecordChunk);
+  }
+
+ private:
+  /*! \brief A tuning record, whose JSON is decoded when the record is first returned. */
+  struct Entry {
+    int workload_index;
+    double mean_run_secs;
+    bool is_valid;
+    /*! \brief The JSON of the record in the mapped file, or nullptr if committed in memory. */
+    const char* json;
+    uint64_t json_size;
+    /*! \brief The record, or NullOpt if not decoded yet. */
+    Optional<TuningRecord> record;
+  };
+
+  void AddEntry(Entry entry) {
+    int64_t entry_id = entries_.size();
+    if (entry.is_valid) {
+      workload2entries_.at(entry.workload_index).emplace(entry.mean_run_secs, entry_id);
+    }
+    entries_.push_back(std::move(entry));
+  }
+
+  TuningRecord GetRecord(size_t entry_id) {
+    Entry& entry = entries_.at(entry_id);
+    if (!entry.record.defined()) {
+      const Workload& workload = workloads_.at(entry.workload_index);
+      ObjectRef json_obj{nullptr};
+      try {
+        json_obj = JSONLoads(std::string(entry.json, entry.json_size));
+        entry.record = TuningRecord::FromJSON(json_obj, workload);
+      } catch (std::runtime_error& e) {
+        LOG(FATAL) << "ValueError: Unable to parse TuningRecord " << entry_id << " of file "
+                   << this->path << ". The workload is:\n"
+                   << workload->mod->Script() << "\nThe JSONObject of TuningRecord is:\n"
+                   << json_obj << "\nThe error message is:\n"
+                   << e.what();
+      }
+    }
+    return entry.record.value();
+  }
+
+  /*!
+   * \brief Load the entries of a record chunk, after checking that they lie in its payload. The
+   * entries are filed under their workloads after the workloads are loaded.
+   * \param payload The payload of the chunk.
+   * \param payload_bytes The size of the payload.
+   * \param num_entries The number of entries in the chunk.
+   * \param num_workloads The number of workloads before the chunk.
+   * \param pos The position of the chunk in the file, for the error messages.
+   */
+  void LoadRecordChunk(const char* payload, uint64_t payload_bytes, uint32_t num_entries,
+                       size_t num_workloads, uint64_t pos) {
+    // The column sizes cannot overflow, as the number of entries is 32-bit.
+    uint64_t n = num_entries;
+    uint64_t columns_bytes = RoundUpTo8(4 * n) + 8 * n + RoundUpTo8(n) + 8 * n;
+    CHECK_LE(columns_bytes, payload_bytes)
+        << "ValueError: The columns of the record chunk at byte " << pos << " of " << this->path
+        << " exceed its payload";
+    uint64_t blob_bytes = payload_bytes - columns_bytes;
+    const char* workload_indices = payload;
+    const char* mean_run_secs = workload_indices + RoundUpTo8(4 * n);
+    const char* is_valid = mean_run_secs + 8 * n;
+    const char* json_ends = is_valid + RoundUpTo8(n);
+    const char* blob = json_ends + 8 * n;
+    // Every entry is checked before any is added, so that a corrupt chunk adds none.
+    uint64_t json_begin = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      int workload_index = ReadBinaryValue<int32_t>(workload_indices + 4 * i);
+      CHECK(workload_index >= 0 && static_cast<size_t>(workload_index) < num_workloads)
+          << "ValueError: Invalid workload index " << workload_index << " in " << this->path;
+      uint64_t json_end = ReadBinaryValue<uint64_t>(json_ends + 8 * i);
+      CHECK(json_begin <= json_end && json_end <= blob_bytes)
+          << "ValueError: The JSON of record " << i << " of the record chunk at byte " << pos
+          << " of " << this->path << " ends at " << json_end << ", out of [" << json_begin << ", "
+          << blob_bytes << "]";
+      json_begin = json_end;
+    }
+    json_begin = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+      uint64_t json_end = ReadBinaryValue<uint64_t>(json_ends + 8 * i);
+      entries_.push_back(Entry{ReadBinaryValue<int32_t>(workload_indices + 4 * i),
+                               ReadBinaryValue<double>(mean_run_secs + 8 * i), is_valid[i] != 0,
+                               blob + json_begin, json_end - json_begin, NullOpt});
+      json_begin = json_end;
+    }
+  }
+
+  void LoadWorkloads(const std::vector<std::pair<const char*, uint64_t>>& workload_jsons) {
+    int n = workload_jsons.size();
+    std::vector<Workload> workloads(n, Workload{nullptr});
+    support::parallel_for_dynamic(0, n, std::thread::hardware_concurrency(),
+                                  [&](int thread_id, int task_id) {
+                                    const auto& [json, json_size] = workload_jsons[task_id];
+                                    workloads[task_id] =
+                                        Workload::FromJSON(JSONLoads(std::string(json, json_size)));
+                                  });
+    workloads2idx_.reserve(n);
+    workloads_.reserve(n);
+    for (int i = 0; i < n; ++i) {
+      Workload workload = workloads[i];
+      // The structural hash may differ across environments, as in the JSON database.
+      auto recalc_hash = GetModuleEquality().Hash(workload->mod);
+      if (recalc_hash != workload->shash) {
+        ObjectPtr<WorkloadNode> wkl = make_object<WorkloadNode>(*workload.get());
+        wkl->shash = recalc_hash;
+        workload = Workload(wkl);
+      }
+      workloads2idx_.emplace(workload, i);
+      workloads_.push_back(workload);
+    }
+  }
+
+  /*! \brief Encode the tuning records buffered by the appender into one record chunk. */
+  static std::string EncodeRecordChunk(const std::vector<std::string>& entries) {
+    // Each entry is the workload index, the mean run secs, the validity and the JSON.
+    constexpr size_t kJSONBegin = 4 + 8 + 1;
+    std::string workload_indices, mean_run_secs, is_valid, json_ends, blob;
+    for (const std::string& entry : entries) {
+      workload_indices.append(entry, 0, 4);
+      mean_run_secs.append(entry, 4, 8);
+      is_valid.append(entry, 12, 1);
+      blob.append(entry, kJSONBegin, std::string::npos);
+      WriteBinaryValue<uint64_t>(&json_ends, blob.size());
+    }
+    workload_indices.resize(RoundUpTo8(workload_indices.size()), '\0');
+    is_valid.resize(RoundUpTo8(is_valid.size()), '\0');
+    return EncodeChunk(kRecordChunk, entries.size(),
+                       workload_indices + mean_run_secs + is_valid + json_ends + blob);
+  }
+
+  /*! \brief Encode a chunk, whose header and padding are written with its payload. */
+  static std::string EncodeChunk(uint32_t kind, uint32_t num_entries, const std::string& payload) {
+    std::string chunk;
+    chunk.reserve(16 + RoundUpTo8(payload.size()));
+    WriteBinaryValue<uint32_t>(&chunk, kind);
+    WriteBinaryValue<uint32_t>(&chunk, num_entries);
+    WriteBinaryValue<uint64_t>(&chunk, payload.size());
+    chunk += payload;
+    chunk.resize(16 + RoundUpTo8(payload.size()), '\0');
+    return chunk;
+  }
+
+  /*! \brief All the workloads in the database, and their indices */
+  std::unordered_map<Workload, int, WorkloadHash, WorkloadEqual> workloads2idx_;
+  /*! \brief The workloads in the order of their indices */
+  std::vector<Workload> workloads_;
+  /*! \brief All the tuning records in the database, in the order of commit */
+  std::vector<Entry> entries_;
+  /*! \brief The valid tuning records of each workload, as (mean run secs, entry id) */
+  std::vector<std::set<std::pair<double, int64_t>>> workload2entries_;
+  /*! \brief The mapped file, which the JSON of the loaded records points into */
+  std::shared_ptr<MappedFile> file_{nullptr};
+  /*! \brief The writer appending the chunks to the file */
+  std::shared_ptr<FileAppender> appender_{nullptr};
+};
+
+Database Database::BinaryDatabase(String path, bool allow_missing, String mod_eq_name) {
+  ObjectPtr<BinaryDatabaseNode> n = make_object<BinaryDatabaseNode>(mod_eq_name);
+  n->path = path;
+  n->Load(allow_missing);
+  return Database(n);
+}
+
+TVM_REGISTER_NODE_TYPE(BinaryDatabaseNode);
+TVM_REGISTER_GLOBAL("meta_schedule.DatabaseBinaryDatabase")
+    .set_body_typed(Database::BinaryDatabase);
+
+}  // namespace meta_schedule
+}  // namespace tvm
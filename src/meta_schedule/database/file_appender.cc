@@ -0,0 +1,195 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "./file_appender.h"
+
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/registry.h>
+
+#include <cstdlib>
+#include <thread>
+#include <unordered_map>
+
+namespace tvm {
+namespace meta_schedule {
+
+/*! \brief The live writers of each path. */
+struct FileAppender::Registry {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::weak_ptr<FileAppender>> appenders;
+
+  static Registry& Global() {
+    // The registry is never destructed, as the flushing thread runs until the process exits.
+    static Registry* registry = [] {
+      Registry* registry = new Registry();
+      std::atexit(FlushAtExit);
+      std::thread(FlushOld, registry).detach();
+      return registry;
+    }();
+    return *registry;
+  }
+
+  /*! \brief Get the live writers, and forget the destructed ones. */
+  std::vector<std::shared_ptr<FileAppender>> GetLive() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::shared_ptr<FileAppender>> live;
+    for (auto it = appenders.begin(); it != appenders.end();) {
+      if (std::shared_ptr<FileAppender> appender = it->second.lock()) {
+        live.push_back(std::move(appender));
+        ++it;
+      } else {
+        it = appenders.erase(it);
+      }
+    }
+    return live;
+  }
+
+  /*! \brief Write the buffers of the writers still alive when the process exits. */
+  static void FlushAtExit() {
+    for (const std::shared_ptr<FileAppender>& appender : Global().GetLive()) {
+      appender->FlushNoThrow(false);
+    }
+  }
+
+  /*! \brief Write the buffers older than the limit, periodically until the process exits. */
+  static void FlushOld(Registry* registry) {
+    auto period = std::chrono::duration<double>(kMaxBufferSeconds / 2);
+    while (true) {
+      std::this_thread::sleep_for(period);
+      for (const std::shared_ptr<FileAppender>& appender : registry->GetLive()) {
+        appender->FlushNoThrow(true);
+      }
+    }
+  }
+};
+
+std::shared_ptr<FileAppender> FileAppender::Get(const std::string& path, FEncode f_encode) {
+  Registry& registry = Registry::Global();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::weak_ptr<FileAppender>& entry = registry.appenders[path];
+  std::shared_ptr<FileAppender> appender = entry.lock();
+  if (appender == nullptr) {
+    appender = std::make_shared<FileAppender>(path, std::move(f_encode));
+    entry = appender;
+  }
+  return appender;
+}
+
+void FileAppender::FlushPath(const std::string& path) {
+  std::shared_ptr<FileAppender> appender{nullptr};
+  {
+    Registry& registry = Registry::Global();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = registry.appenders.find(path);
+    if (it != registry.appenders.end()) {
+      appender = it->second.lock();
+    }
+  }
+  if (appender != nullptr) {
+    appender->Flush();
+  }
+}
+
+void FileAppender::FlushAll() {
+  for (const std::shared_ptr<FileAppender>& appender : Registry::Global().GetLive()) {
+    appender->Flush();
+  }
+}
+
+void FileAppender::Append(std::string entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckErrorLocked();
+  if (buffer_.empty()) {
+    buffer_start_ = std::chrono::steady_clock::now();
+  }
+  buffer_bytes_ += entry.size();
+  buffer_.push_back(std::move(entry));
+  if (buffer_bytes_ >= kMaxBufferBytes) {
+    FlushLocked();
+  }
+}
+
+void FileAppender::Write(const std::string& bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CheckErrorLocked();
+  FlushLocked();
+  WriteLocked(bytes);
+}
+
+void FileAppender::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FlushLocked();
+}
+
+void FileAppender::FlushNoThrow(bool only_old) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (only_old &&
+      (buffer_.empty() ||
+       std::chrono::duration<double>(std::chrono::steady_clock::now() - buffer_start_).count() <
+           kMaxBufferSeconds)) {
+    return;
+  }
+  // Raising here would terminate the process, from the background thread or at exit.
+  try {
+    FlushLocked();
+  } catch (const std::exception& e) {
+    LOG(WARNING) << "Cannot write the buffered entries to " << path_ << ": " << e.what();
+    error_ = e.what();
+  }
+}
+
+void FileAppender::CheckErrorLocked() {
+  if (!error_.empty()) {
+    std::string error = std::move(error_);
+    error_.clear();
+    LOG(FATAL) << error;
+  }
+}
+
+void FileAppender::FlushLocked() {
+  if (buffer_.empty()) {
+    return;
+  }
+  std::string bytes;
+  if (f_encode_ != nullptr) {
+    bytes = f_encode_(buffer_);
+  } else {
+    bytes.reserve(buffer_bytes_);
+    for (const std::string& entry : buffer_) {
+      bytes += entry;
+    }
+  }
+  WriteLocked(bytes);
+  buffer_.clear();
+  buffer_bytes_ = 0;
+}
+
+void FileAppender::WriteLocked(const std::string& bytes) {
+  if (!os_.is_open()) {
+    os_.open(path_, std::ofstream::binary | std::ofstream::app);
+  }
+  CHECK(os_.good()) << "ValueError: Cannot open the file to write: " << path_;
+  // The bytes are written at once, so that the readers never see a part of an encoded buffer.
+  os_.write(bytes.data(), bytes.size());
+  os_.flush();
+}
+
+TVM_REGISTER_GLOBAL("meta_schedule.FileAppenderFlushAll").set_body_typed(FileAppender::FlushAll);
+
+}  // namespace meta_schedule
+}  // namespace tvm
@@ -0,0 +1,130 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#ifndef TVM_META_SCHEDULE_DATABASE_FILE_APPENDER_H_
+#define TVM_META_SCHEDULE_DATABASE_FILE_APPENDER_H_
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tvm {
+namespace meta_schedule {
+
+/*!
+ * \brief A writer appending to the file of a database, which keeps the file open and buffers
+ * the entries appended.
+ * \details The buffer is written to the file when it grows large, when it grows old (checked
+ * by a background thread, so that the last entries of a tuning round are written without
+ * another append), when the writer is destructed or the process exits, and before the file is
+ * read again (FlushPath). The writers are shared per path, so that the databases of the same
+ * file append to it in order. A failure to write the buffer in the background is logged, and
+ * raised by the next append or write.
+ */
+class FileAppender {
+ public:
+  /*!
+   * \brief The function encoding the buffered entries into the bytes written to the file.
+   * The entries are written one after another if it is not set.
+   */
+  using FEncode = std::function<std::string(const std::vector<std::string>& entries)>;
+
+  /*! \brief The max number of bytes to buffer. */
+  static constexpr size_t kMaxBufferBytes = 1 << 16;
+  /*! \brief The max number of seconds to buffer the entries for. */
+  static constexpr double kMaxBufferSeconds = 1.0;
+
+  explicit FileAppender(std::string path, FEncode f_encode = nullptr)
+      : path_(std::move(path)), f_encode_(std::move(f_encode)) {}
+
+  ~FileAppender() { FlushNoThrow(false); }
+
+  /*!
+   * \brief Get the writer of a path, creating it if there is no live one.
+   * \param path The path to the file.
+   * \param f_encode The function encoding the buffered entries, used if the writer is created.
+   * \return The writer.
+   */
+  static std::shared_ptr<FileAppender> Get(const std::string& path, FEncode f_encode = nullptr);
+
+  /*!
+   * \brief Write the buffer of the writer of a path, if there is a live one.
+   * \param path The path to the file.
+   */
+  static void FlushPath(const std::string& path);
+
+  /*! \brief Write the buffers of all the live writers. */
+  static void FlushAll();
+
+  /*!
+   * \brief Append an entry to the buffer.
+   * \param entry The entry to append.
+   */
+  void Append(std::string entry);
+
+  /*!
+   * \brief Write the buffer, and then bytes not to be buffered, to the file.
+   * \param bytes The bytes to write.
+   */
+  void Write(const std::string& bytes);
+
+  /*! \brief Write the buffer to the file. */
+  void Flush();
+
+ private:
+  struct Registry;
+
+  /*!
+   * \brief Write the buffer without raising, keeping the error to raise on the next append.
+   * \param only_old Whether to write the buffer only if it is older than the limit.
+   */
+  void FlushNoThrow(bool only_old);
+
+  /*! \brief Raise the error kept from writing the buffer in the background, if any. */
+  void CheckErrorLocked();
+
+  void FlushLocked();
+
+  void WriteLocked(const std::string& bytes);
+
+  /*! \brief The path to the file. */
+  std::string path_;
+  /*! \brief The function encoding the buffered entries. */
+  FEncode f_encode_;
+  /*! \brief The file, opened on the first write. */
+  std::ofstream os_;
+  /*! \brief The entries not written to the file yet. */
+  std::vector<std::string> buffer_;
+  /*! \brief The number of bytes of the entries in the buffer. */
+  size_t buffer_bytes_{0};
+  /*! \brief The time the first entry in the buffer was appended. */
+  std::chrono::steady_clock::time_point buffer_start_;
+  /*! \brief The error of writing the buffer in the background, empty if there is none. */
+  std::string error_;
+  /*! \brief The mutex guarding the buffer and the file. */
+  std::mutex mutex_;
+};
+
+}  // namespace meta_schedule
+}  // namespace tvm
+
+#endif  // TVM_META_SCHEDULE_DATABASE_FILE_APPENDER_H_
@@ -16,12 +16,14 @@
  * specific language governing permissions and limitations
  * under the License.
  */
+#include <memory>
 #include <set>
 #include <thread>
 #include <unordered_map>
 
 #include "../module_equality.h"
 #include "../utils.h"
+#include "./file_appender.h"
 
 namespace tvm {
 namespace meta_schedule {
@@ -34,6 +36,7 @@ namespace meta_schedule {
  * \return An array containing lines read from the json file.
  */
 std::vector<ObjectRef> JSONFileReadLines(const String& path, int num_threads, bool allow_missing) {
+  FileAppender::FlushPath(path);
   std::ifstream is(path);
   if (is.good()) {
     std::vector<String> json_strs;
@@ -60,6 +63,7 @@ std::vector<ObjectRef> JSONFileReadLines(const String& path, int num_threads, bo
  * \param line The line to append.
  */
 void JSONFileAppendLine(const String& path, const std::string& line) {
+  FileAppender::FlushPath(path);
   std::ofstream os(path, std::ofstream::app);
   CHECK(os.good()) << "ValueError: Cannot open the file to write: " << path;
   os << line << std::endl;
@@ -80,12 +84,19 @@ class JSONDatabaseNode : public DatabaseNode {
   std::unordered_map<Workload, int, WorkloadHash, WorkloadEqual> workloads2idx_;
   /*! \brief All the tuning records in the database */
   std::multiset<TuningRecord, SortTuningRecordByMeanRunSecs> tuning_records_;
+  /*! \brief The valid tuning records of each workload, indexed by the workload index */
+  std::vector<std::multiset<TuningRecord, SortTuningRecordByMeanRunSecs>> workload2records_;
+  /*! \brief The writer of the workload table */
+  std::shared_ptr<FileAppender> workload_writer_{nullptr};
+  /*! \brief The writer of the tuning record table */
+  std::shared_ptr<FileAppender> tuning_record_writer_{nullptr};
 
   void VisitAttrs(tvm::AttrVisitor* v) {
     v->Visit("path_workload", &path_workload);
     v->Visit("path_tuning_record", &path_tuning_record);
     // `workloads2idx_` is not visited
     // `tuning_records_` is not visited
+    // `workload2records_` is not visited
   }
 
   static constexpr const char* _type_key = "meta_schedule.JSONDatabase";
@@ -104,19 +115,23 @@ class JSONDatabaseNode : public DatabaseNode {
     Workload workload = it->first;
     // If `mod` is new in `workloads2idx_`, append it to the workload file
     if (inserted) {
-      it->second = static_cast<int>(this->workloads2idx_.size()) - 1;
-      JSONFileAppendLine(this->path_workload, JSONDumps(workload->AsJSON()));
+      // The index is the line of the workload in the file, which may hold duplicated workloads.
+      it->second = static_cast<int>(this->workload2records_.size());
+      this->workload2records_.emplace_back();
+      // The workload is written immediately, as the tuning records written later refer to it.
+      this->workload_writer_->Write(JSONDumps(workload->AsJSON()) + "\n");
     }
     return it->first;
   }
 
   void CommitTuningRecord(const TuningRecord& record) {
-    this->tuning_records_.insert(record);
-    JSONFileAppendLine(this->path_tuning_record,
-                       JSONDumps(Array<ObjectRef>{
-                           /*workload_index=*/Integer(this->workloads2idx_.at(record->workload)),
-                           /*tuning_record=*/record->AsJSON()  //
-                       }));
+    int workload_index = this->workloads2idx_.at(record->workload);
+    this->AddTuningRecord(record, workload_index);
+    std::string line = JSONDumps(Array<ObjectRef>{
+        /*workload_index=*/Integer(workload_index),
+        /*tuning_record=*/record->AsJSON()  //
+    });
+    this->tuning_record_writer_->Append(line + "\n");
   }
 
   Array<TuningRecord> GetTopK(const Workload& workload, int top_k) {
@@ -124,19 +139,17 @@ class JSONDatabaseNode : public DatabaseNode {
     if (top_k == 0) {
       return {};
     }
+    auto it = this->workloads2idx_.find(workload);
+    if (it == this->workloads2idx_.end()) {
+      return {};
+    }
+    const auto& records = this->workload2records_.at(it->second);
     Array<TuningRecord> results;
-    results.reserve(top_k);
-    for (const TuningRecord& record : this->tuning_records_) {
-      auto run_secs = record->run_secs;
-      if (!record->IsValid()) {
-        continue;
-      }
-      if (record->workload.same_as(workload) ||
-          WorkloadEqual(GetModuleEquality())(record->workload, workload)) {
-        results.push_back(record);
-        if (results.size() == static_cast<size_t>(top_k)) {
-          break;
-        }
+    results.reserve(std::min<size_t>(top_k, records.size()));
+    for (const TuningRecord& record : records) {
+      results.push_back(record);
+      if (results.size() == static_cast<size_t>(top_k)) {
+        break;
       }
     }
     return results;
@@ -152,6 +165,18 @@ class JSONDatabaseNode : public DatabaseNode {
   }
 
   int64_t Size() { return tuning_records_.size(); }
+
+  /*!
+   * \brief Add a tuning record to the tables in memory.
+   * \param record The tuning record.
+   * \param workload_index The index of the workload of the record.
+   */
+  void AddTuningRecord(const TuningRecord& record, int workload_index) {
+    this->tuning_records_.insert(record);
+    if (record->IsValid()) {
+      this->workload2records_.at(workload_index).insert(record);
+    }
+  }
 };
 
 Database Database::JSONDatabase(String path_workload, String path_tuning_record, bool allow_missing,
@@ -164,6 +189,7 @@ Database Database::JSONDatabase(String path_workload, String path_tuning_record,
     std::vector<ObjectRef> json_objs = JSONFileReadLines(path_workload, num_threads, allow_missing);
     int n_objs = json_objs.size();
     n->workloads2idx_.reserve(n_objs);
+    n->workload2records_.resize(n_objs);
     workloads.reserve(n_objs);
     for (int i = 0; i < n_objs; ++i) {
       Workload workload = Workload::FromJSON(json_objs[i]);
@@ -184,6 +210,7 @@ Database Database::JSONDatabase(String path_workload, String path_tuning_record,
     std::vector<ObjectRef> json_objs =
         JSONFileReadLines(path_tuning_record, num_threads, allow_missing);
     std::vector<TuningRecord> records;
+    std::vector<int> workload_indices(json_objs.size(), -1);
     records.resize(json_objs.size(), TuningRecord{nullptr});
     support::parallel_for_dynamic(
         0, json_objs.size(), num_threads, [&](int thread_id, int task_id) {
@@ -192,7 +219,8 @@ Database Database::JSONDatabase(String path_workload, String path_tuning_record,
           try {
             const ArrayNode* arr = json_obj.as<ArrayNode>();
             ICHECK_EQ(arr->size(), 2);
-            workload = workloads[Downcast<Integer>(arr->at(0)).IntValue()];
+            workload_indices[task_id] = Downcast<Integer>(arr->at(0)).IntValue();
+            workload = workloads[workload_indices[task_id]];
             records[task_id] = TuningRecord::FromJSON(arr->at(1), workload);
           } catch (std::runtime_error& e) {
             LOG(FATAL) << "ValueError: Unable to parse TuningRecord, on line " << (task_id + 1)
@@ -203,12 +231,15 @@ Database Database::JSONDatabase(String path_workload, String path_tuning_record,
                        << e.what();
           }
         });
-    for (const TuningRecord& record : records) {
-      n->tuning_records_.insert(record);
+    for (size_t i = 0; i < records.size(); ++i) {
+      // A workload written more than once is kept under its first index.
+      n->AddTuningRecord(records[i], n->workloads2idx_.at(workloads[workload_indices[i]]));
     }
   }
   n->path_workload = path_workload;
   n->path_tuning_record = path_tuning_record;
+  n->workload_writer_ = FileAppender::Get(path_workload);
+  n->tuning_record_writer_ = FileAppender::Get(path_tuning_record);
   return Database(n);
 }
 
@@ -21,6 +21,45 @@
 namespace tvm {
 namespace meta_schedule {
 
+Array<tvm::runtime::NDArray> FeatureExtractorNode::ExtractBatchFrom(
+    const TuneContext& context, const Array<MeasureCandidate>& candidates) {
+  Array<tvm::runtime::NDArray> features = this->ExtractFrom(context, candidates);
+  ICHECK_EQ(features.size(), candidates.size());
+  int64_t n = features.size();
+  int64_t feature_length = 0;
+  runtime::NDArray offsets = runtime::NDArray::Empty({n + 1}, DataType::Int(64), {kDLCPU, 0});
+  int64_t* offset = static_cast<int64_t*>(offsets->data);
+  offset[0] = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    const runtime::NDArray& feature = features[i];
+    CHECK_EQ(feature->ndim, 2) << "ValueError: The features of a candidate must be 2-dimensional";
+    if (i > 0) {
+      CHECK_EQ(feature->shape[1], feature_length)
+          << "ValueError: The candidates have features of different lengths";
+    }
+    feature_length = feature->shape[1];
+    offset[i + 1] = offset[i] + feature->shape[0];
+  }
+  runtime::NDArray result =
+      runtime::NDArray::Empty({offset[n], feature_length}, DataType::Float(32), {kDLCPU, 0});
+  float* data = static_cast<float*>(result->data);
+  for (const runtime::NDArray& feature : features) {
+    int64_t size = feature->shape[0] * feature_length;
+    runtime::NDArray src =
+        feature->device.device_type == kDLCPU ? feature : feature.CopyTo({kDLCPU, 0});
+    if (src.DataType() == DataType::Float(64)) {
+      const double* src_data = static_cast<const double*>(src->data);
+      data = std::copy(src_data, src_data + size, data);
+    } else if (src.DataType() == DataType::Float(32)) {
+      const float* src_data = static_cast<const float*>(src->data);
+      data = std::copy(src_data, src_data + size, data);
+    } else {
+      LOG(FATAL) << "TypeError: Unsupported dtype of features: " << src.DataType();
+    }
+  }
+  return {result, offsets};
+}
+
 Array<tvm::runtime::NDArray> PyFeatureExtractorNode::ExtractFrom(
     const TuneContext& context, const Array<MeasureCandidate>& candidates) {
   ICHECK(f_extract_from != nullptr) << "PyFeatureExtractor's ExtractFrom method not implemented!";
@@ -50,6 +89,8 @@ TVM_REGISTER_NODE_TYPE(PyFeatureExtractorNode);
 
 TVM_REGISTER_GLOBAL("meta_schedule.FeatureExtractorExtractFrom")
     .set_body_method<FeatureExtractor>(&FeatureExtractorNode::ExtractFrom);
+TVM_REGISTER_GLOBAL("meta_schedule.FeatureExtractorExtractBatchFrom")
+    .set_body_method<FeatureExtractor>(&FeatureExtractorNode::ExtractBatchFrom);
 TVM_REGISTER_GLOBAL("meta_schedule.FeatureExtractorPyFeatureExtractor")
     .set_body_typed(FeatureExtractor::PyFeatureExtractor);
 
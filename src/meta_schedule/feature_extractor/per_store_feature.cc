@@ -18,8 +18,10 @@
  */
 #include <tvm/tir/transform.h>
 
+#include <atomic>
 #include <cmath>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <string>
 #include <unordered_map>
@@ -1371,8 +1373,12 @@ class PerStoreFeatureNode : public FeatureExtractorNode {
     v->Visit("feature_vector_length", &feature_vector_length);
   }
 
-  void ExtractSingle(IRModule mod, bool is_gpu, std::vector<std::vector<double>>* results) {
+  /*! \brief The features of the stores in a module, before the workload features are added. */
+  using Features = std::vector<std::vector<double>>;
+
+  void ExtractSingle(IRModule mod, bool is_gpu, Features* results) {
     static transform::Sequential passes = tir::transform::PassListForPerStoreFeature();
+    // The passes are copy-on-write, so the module shared with the schedule is not mutated.
     mod = passes(std::move(mod));
     std::vector<tir::Feature> features = tir::PerStoreFeatureCollector::Collect(
         is_gpu, this->cache_line_bytes, this->arith_intensity_curve_num_samples, mod);
@@ -1390,8 +1396,48 @@ class PerStoreFeatureNode : public FeatureExtractorNode {
     }
   }
 
+  /*!
+   * \brief Extract the features of a module, or look them up if a structurally equal module has
+   * been extracted before, e.g. in an earlier iteration of the evolutionary search.
+   */
+  std::shared_ptr<const Features> ExtractCached(const IRModule& mod, bool is_gpu) {
+    size_t shash = StructuralHash()(mod);
+    std::vector<CacheEntry> bucket;
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex_);
+      auto it = cache_.find(shash);
+      if (it != cache_.end()) {
+        bucket = it->second;
+      }
+    }
+    // The structural equality is checked outside of the lock.
+    for (const CacheEntry& entry : bucket) {
+      if (entry.is_gpu == is_gpu && StructuralEqual()(entry.mod, mod)) {
+        ++cache_hits_;
+        return entry.features;
+      }
+    }
+    auto features = std::make_shared<Features>();
+    ExtractSingle(mod, is_gpu, features.get());
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (cache_size_ >= kMaxCacheSize) {
+      cache_.clear();
+      cache_size_ = 0;
+    }
+    cache_[shash].push_back(CacheEntry{mod, is_gpu, features});
+    ++cache_size_;
+    return features;
+  }
+
+  /*! \brief Get the number of lookups that hit the cache, and the number of cached modules. */
+  std::pair<int64_t, int64_t> CacheStats() const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    return {cache_hits_.load(), static_cast<int64_t>(cache_size_)};
+  }
+
   Array<runtime::NDArray> ExtractFrom(const TuneContext& tune_context,
                                       const Array<MeasureCandidate>& candidates) {
+    auto _ = Profiler::TimedScope("PerStoreFeature/ExtractFrom");
     bool is_gpu = tune_context->target.value()->kind->name == "cuda";
     std::vector<runtime::NDArray> results;
     results.resize(candidates.size());
@@ -1401,21 +1447,78 @@ class PerStoreFeatureNode : public FeatureExtractorNode {
     }
     auto f = [this, is_gpu, &feature_group6, &candidates, &results](int, int task_id) -> void {
       const auto& candidate = candidates[task_id];
-      std::vector<std::vector<double>> features;
-      ExtractSingle(DeepCopyIRModule(candidate->sch->mod()), is_gpu, &features);
+      std::shared_ptr<const Features> cached = ExtractCached(candidate->sch->mod(), is_gpu);
       if (extract_workload) {
+        Features features = *cached;
         for (auto& feature : features) {
           feature_group6->Export(&feature);
         }
+        results[task_id] = tir::utils::AsNDArray(features, this->feature_vector_length);
+      } else {
+        results[task_id] = tir::utils::AsNDArray(*cached, this->feature_vector_length);
       }
-      results[task_id] = tir::utils::AsNDArray(features, this->feature_vector_length);
     };
     support::parallel_for_dynamic(0, candidates.size(), tune_context->num_threads, f);
     return results;
   }
 
+  Array<runtime::NDArray> ExtractBatchFrom(const TuneContext& tune_context,
+                                           const Array<MeasureCandidate>& candidates) final {
+    auto _ = Profiler::TimedScope("PerStoreFeature/ExtractBatchFrom");
+    bool is_gpu = tune_context->target.value()->kind->name == "cuda";
+    int64_t n = candidates.size();
+    std::vector<std::shared_ptr<const Features>> features(n);
+    support::parallel_for_dynamic(0, n, tune_context->num_threads,
+                                  [this, is_gpu, &candidates, &features](int, int task_id) {
+                                    features[task_id] = ExtractCached(
+                                        candidates[task_id]->sch->mod(), is_gpu);
+                                  });
+    // The workload features are the same for all the stores, so they are exported once.
+    std::vector<double> workload_feature;
+    if (extract_workload) {
+      tir::group6::Feature(tune_context->mod.value()).Export(&workload_feature);
+    }
+    runtime::NDArray offsets = runtime::NDArray::Empty({n + 1}, DataType::Int(64), {kDLCPU, 0});
+    int64_t* offset = static_cast<int64_t*>(offsets->data);
+    offset[0] = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      offset[i + 1] = offset[i] + features[i]->size();
+    }
+    runtime::NDArray result = runtime::NDArray::Empty({offset[n], feature_vector_length},
+                                                      DataType::Float(32), {kDLCPU, 0});
+    float* data = static_cast<float*>(result->data);
+    support::parallel_for_dynamic(0, n, tune_context->num_threads, [&](int, int task_id) {
+      float* row = data + offset[task_id] * feature_vector_length;
+      for (const std::vector<double>& store : *features[task_id]) {
+        row = std::copy(store.begin(), store.end(), row);
+        row = std::copy(workload_feature.begin(), workload_feature.end(), row);
+      }
+    });
+    return {result, offsets};
+  }
+
   static constexpr const char* _type_key = "meta_schedule.PerStoreFeature";
   TVM_DECLARE_FINAL_OBJECT_INFO(PerStoreFeatureNode, FeatureExtractorNode);
+
+ private:
+  /*! \brief The max number of modules in the cache, which is cleared when full. */
+  static constexpr size_t kMaxCacheSize = 65536;
+
+  /*! \brief A module whose features are cached */
+  struct CacheEntry {
+    IRModule mod;
+    bool is_gpu;
+    std::shared_ptr<const Features> features;
+  };
+
+  /*! \brief The cached modules, bucketed by their structural hash */
+  std::unordered_map<size_t, std::vector<CacheEntry>> cache_;
+  /*! \brief The number of modules in the cache */
+  size_t cache_size_ = 0;
+  /*! \brief The number of lookups that hit the cache */
+  std::atomic<int64_t> cache_hits_{0};
+  /*! \brief The mutex guarding the cache */
+  mutable std::mutex cache_mutex_;
 };
 
 FeatureExtractor FeatureExtractor::PerStoreFeature(int buffers_per_store,
@@ -1440,6 +1543,14 @@ FeatureExtractor FeatureExtractor::PerStoreFeature(int buffers_per_store,
 TVM_REGISTER_NODE_TYPE(PerStoreFeatureNode);
 TVM_REGISTER_GLOBAL("meta_schedule.FeatureExtractorPerStoreFeature")
     .set_body_typed(FeatureExtractor::PerStoreFeature);
+TVM_REGISTER_GLOBAL("meta_schedule.FeatureExtractorPerStoreFeatureCacheStats")
+    .set_body_typed([](FeatureExtractor extractor) -> Array<IntImm> {
+      const auto* node = extractor.as<PerStoreFeatureNode>();
+      CHECK(node != nullptr) << "TypeError: Expects a PerStoreFeature, but gets "
+                             << extractor->GetTypeKey();
+      auto [hits, size] = node->CacheStats();
+      return {IntImm(DataType::Int(64), hits), IntImm(DataType::Int(64), size)};
+    });
 
 }  // namespace meta_schedule
 }  // namespace tvm
@@ -55,9 +55,11 @@ class RoundRobinNode final : public TaskSchedulerNode {
   }
 };
 
-TaskScheduler TaskScheduler::RoundRobin(PackedFunc logger) {
+TaskScheduler TaskScheduler::RoundRobin(PackedFunc logger, int num_batches_in_flight) {
+  CHECK_GE(num_batches_in_flight, 1) << "ValueError: `num_batches_in_flight` must be positive";
   ObjectPtr<RoundRobinNode> n = make_object<RoundRobinNode>();
   n->logger = logger;
+  n->num_batches_in_flight = num_batches_in_flight;
   n->task_id = -1;
   return TaskScheduler(n);
 }
@@ -16,6 +16,10 @@
  * specific language governing permissions and limitations
  * under the License.
  */
+#include <chrono>
+#include <deque>
+#include <future>
+
 #include "../utils.h"
 
 namespace tvm {
@@ -38,23 +42,19 @@ TaskRecord::TaskRecord(TuneContext ctx, double task_weight) {
   this->data_ = std::move(n);
 }
 
-void SendToBuilder(TaskRecordNode* self, const Builder& builder) {
-  auto _ = Profiler::TimedScope("SendToBuilder");
-  Array<MeasureCandidate> candidates = self->measure_candidates.value();
-  Target target = self->ctx->target.value();
+Array<BuilderResult> BuildCandidates(const Array<MeasureCandidate>& candidates,
+                                     const Target& target, const Builder& builder) {
   Array<BuilderInput> inputs;
   inputs.reserve(candidates.size());
   for (const MeasureCandidate& candidate : candidates) {
     inputs.push_back(BuilderInput(candidate->sch->mod(), target));
   }
-  self->builder_results = builder->Build(inputs);
+  return builder->Build(inputs);
 }
 
-void SendToRunner(TaskRecordNode* self, const Runner& runner) {
-  auto _ = Profiler::TimedScope("SendToRunner");
-  Array<MeasureCandidate> candidates = self->measure_candidates.value();
-  Array<BuilderResult> builder_results = self->builder_results.value();
-  Target target = self->ctx->target.value();
+Array<RunnerFuture> RunCandidates(const Array<MeasureCandidate>& candidates,
+                                  const Array<BuilderResult>& builder_results,
+                                  const Target& target, const Runner& runner) {
   ICHECK_EQ(candidates.size(), builder_results.size());
   int n = candidates.size();
   int n_build_errors = 0;
@@ -73,8 +73,7 @@ void SendToRunner(TaskRecordNode* self, const Runner& runner) {
   }
   Array<RunnerFuture> futures = runner->Run(inputs);
   if (n_build_errors == 0) {
-    self->runner_futures = futures;
-    return;
+    return futures;
   }
   Array<RunnerFuture> results;
   results.reserve(n);
@@ -91,7 +90,163 @@ void SendToRunner(TaskRecordNode* self, const Runner& runner) {
       results.push_back(futures[j++]);
     }
   }
-  self->runner_futures = results;
+  return results;
+}
+
+void SendToBuilder(TaskRecordNode* self, const Builder& builder) {
+  auto _ = Profiler::TimedScope("SendToBuilder");
+  self->builder_results =
+      BuildCandidates(self->measure_candidates.value(), self->ctx->target.value(), builder);
+}
+
+void SendToRunner(TaskRecordNode* self, const Runner& runner) {
+  auto _ = Profiler::TimedScope("SendToRunner");
+  self->runner_futures = RunCandidates(self->measure_candidates.value(),
+                                       self->builder_results.value(), self->ctx->target.value(),
+                                       runner);
+}
+
+/*! \brief A batch of candidates of a task, built and run in the background. */
+struct InFlightBatch {
+  /*! \brief The results of the background work, and the time it took. */
+  struct Measured {
+    Array<BuilderResult> builder_results;
+    Array<RunnerFuture> runner_futures;
+    double build_secs;
+    double run_secs;
+  };
+
+  /*! \brief The id of the task */
+  int task_id;
+  /*! \brief The candidates */
+  Array<MeasureCandidate> candidates;
+  /*! \brief The builder results and the runner futures, once the batch is sent to the runner */
+  std::shared_future<Measured> measured;
+
+  /*!
+   * \brief Send a batch to the builder and the runner in the background.
+   * \param previous The batch sent before, which is built first, as builders are not required
+   * to be reentrant.
+   */
+  static InFlightBatch Send(int task_id, Array<MeasureCandidate> candidates, Target target,
+                            Builder builder, Runner runner, const InFlightBatch* previous) {
+    std::shared_future<Measured> after =
+        previous != nullptr ? previous->measured : std::shared_future<Measured>();
+    auto f_measure = [after, candidates, target, builder, runner]() -> Measured {
+      using Clock = std::chrono::high_resolution_clock;
+      if (after.valid()) {
+        after.wait();
+      }
+      // The profiler of the tuning is thread local, so the work is timed here and recorded on the
+      // tuning thread once the batch is joined.
+      Clock::time_point tik = Clock::now();
+      Array<BuilderResult> builder_results = BuildCandidates(candidates, target, builder);
+      Clock::time_point mid = Clock::now();
+      Array<RunnerFuture> runner_futures =
+          RunCandidates(candidates, builder_results, target, runner);
+      Clock::time_point tok = Clock::now();
+      return {builder_results, runner_futures, std::chrono::duration<double>(mid - tik).count(),
+              std::chrono::duration<double>(tok - mid).count()};
+    };
+    return InFlightBatch{task_id, candidates, std::async(std::launch::async, f_measure).share()};
+  }
+
+  /*! \brief Check whether the batch has finished running, without blocking. */
+  bool Done() const {
+    if (measured.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      return false;
+    }
+    for (const RunnerFuture& future : measured.get().runner_futures) {
+      if (!future->Done()) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/*!
+ * \brief The tuning loop keeping `num_batches_in_flight` batches in the pipeline. The next batch
+ * of candidates is searched while the previous ones are built and run in the background, and a
+ * batch is joined once it is done or the pipeline is full.
+ */
+void TunePipelined(TaskSchedulerNode* self, int max_trials_global, int max_trials_per_task,
+                   int num_trials_per_iter, const Builder& builder, const Runner& runner) {
+  std::vector<int> num_trials_in_flight(self->tasks_.size(), 0);
+  std::vector<int> num_batches_of_task(self->tasks_.size(), 0);
+  std::deque<InFlightBatch> in_flight;
+  auto f_join_oldest = [self, &in_flight, &num_trials_in_flight, &num_batches_of_task]() {
+    InFlightBatch batch = std::move(in_flight.front());
+    in_flight.pop_front();
+    TaskRecordNode* task = self->tasks_[batch.task_id].get();
+    {
+      auto _ = Profiler::TimedScope("WaitForBuilder");
+      const InFlightBatch::Measured& measured = batch.measured.get();
+      task->builder_results = measured.builder_results;
+      task->runner_futures = measured.runner_futures;
+      if (Optional<Profiler> profiler = Profiler::Current()) {
+        profiler.value()->stats_sec["SendToBuilder"] += measured.build_secs;
+        profiler.value()->stats_sec["SendToRunner"] += measured.run_secs;
+      }
+    }
+    task->measure_candidates = batch.candidates;
+    num_trials_in_flight[batch.task_id] -= batch.candidates.size();
+    --num_batches_of_task[batch.task_id];
+    self->JoinRunningTask(batch.task_id);
+  };
+  // The batches are joined in order, so the batches of a task are joined with the ones before.
+  auto f_join_task = [&](int task_id) {
+    while (num_batches_of_task[task_id] > 0) {
+      f_join_oldest();
+    }
+  };
+  int num_trials_already = 0;
+  for (int task_id;
+       num_trials_already < max_trials_global && (task_id = self->NextTaskId()) != -1;) {
+    TVM_PY_LOG(INFO, self->logger) << "TaskScheduler picks Task #" << task_id << ": "
+                                   << self->tasks_[task_id]->ctx->task_name;
+    // The batches done by now are joined, so that the search uses the latest cost model.
+    while (!in_flight.empty() && in_flight.front().Done()) {
+      f_join_oldest();
+    }
+    TaskRecordNode* task = self->tasks_[task_id].get();
+    ICHECK(!task->is_terminated);
+    // The search strategy only counts the trials it is notified of, and would search a batch
+    // beyond the trials left to the task. When a batch may not fit, the task is joined first,
+    // so that the search strategy limits the batch itself.
+    if (static_cast<int>(task->latency_ms.size()) + num_trials_in_flight[task_id] +
+            num_trials_per_iter >
+        max_trials_per_task) {
+      f_join_task(task_id);
+    }
+    if (static_cast<int>(task->latency_ms.size()) >= max_trials_per_task) {
+      self->TerminateTask(task_id);
+      continue;
+    }
+    if (Optional<Array<MeasureCandidate>> candidates =
+            task->ctx->search_strategy.value()->GenerateMeasureCandidates()) {
+      const Array<MeasureCandidate>& batch = candidates.value();
+      int num_candidates = batch.size();
+      num_trials_already += num_candidates;
+      num_trials_in_flight[task_id] += num_candidates;
+      TVM_PY_LOG(INFO, self->logger)
+          << "Sending " << num_candidates << " sample(s) to builder and runner in the background";
+      in_flight.push_back(InFlightBatch::Send(task_id, batch, task->ctx->target.value(), builder,
+                                              runner,
+                                              in_flight.empty() ? nullptr : &in_flight.back()));
+      ++num_batches_of_task[task_id];
+      while (static_cast<int>(in_flight.size()) >= self->num_batches_in_flight) {
+        f_join_oldest();
+      }
+    } else {
+      // The batches in flight are joined before the task is terminated.
+      f_join_task(task_id);
+      self->TerminateTask(task_id);
+    }
+  }
+  while (!in_flight.empty()) {
+    f_join_oldest();
+  }
 }
 
 void TaskCleanUp(TaskRecordNode* self, int task_id, const Array<RunnerResult>& results) {
@@ -175,27 +330,32 @@ void TaskSchedulerNode::Tune(Array<TuneContext> ctxs, Array<FloatImm> task_weigh
                                             database, cost_model);
   }
 
-  int num_trials_already = 0;
-  for (int task_id; num_trials_already < max_trials_global && (task_id = NextTaskId()) != -1;) {
-    TVM_PY_LOG(INFO, this->logger)
-        << "TaskScheduler picks Task #" << task_id << ": " << tasks_[task_id]->ctx->task_name;
-    TaskRecordNode* task = tasks_[task_id].get();
-    ICHECK(!task->is_terminated);
-    ICHECK(!task->runner_futures.defined());
-    if (static_cast<int>(task->latency_ms.size()) >= max_trials_per_task) {
-      TerminateTask(task_id);
-      continue;
-    }
-    if (Optional<Array<MeasureCandidate>> candidates = task->measure_candidates =
-            task->ctx->search_strategy.value()->GenerateMeasureCandidates()) {
-      int num_candidates = candidates.value().size();
-      num_trials_already += num_candidates;
-      TVM_PY_LOG(INFO, this->logger) << "Sending " << num_candidates << " sample(s) to builder";
-      SendToBuilder(task, builder);
-      TVM_PY_LOG(INFO, this->logger) << "Sending " << num_candidates << " sample(s) to runner";
-      SendToRunner(task, runner);
-    } else {
-      TerminateTask(task_id);
+  if (this->num_batches_in_flight > 1) {
+    TunePipelined(this, max_trials_global, max_trials_per_task, num_trials_per_iter, builder,
+                  runner);
+  } else {
+    int num_trials_already = 0;
+    for (int task_id; num_trials_already < max_trials_global && (task_id = NextTaskId()) != -1;) {
+      TVM_PY_LOG(INFO, this->logger)
+          << "TaskScheduler picks Task #" << task_id << ": " << tasks_[task_id]->ctx->task_name;
+      TaskRecordNode* task = tasks_[task_id].get();
+      ICHECK(!task->is_terminated);
+      ICHECK(!task->runner_futures.defined());
+      if (static_cast<int>(task->latency_ms.size()) >= max_trials_per_task) {
+        TerminateTask(task_id);
+        continue;
+      }
+      if (Optional<Array<MeasureCandidate>> candidates = task->measure_candidates =
+              task->ctx->search_strategy.value()->GenerateMeasureCandidates()) {
+        int num_candidates = candidates.value().size();
+        num_trials_already += num_candidates;
+        TVM_PY_LOG(INFO, this->logger) << "Sending " << num_candidates << " sample(s) to builder";
+        SendToBuilder(task, builder);
+        TVM_PY_LOG(INFO, this->logger) << "Sending " << num_candidates << " sample(s) to runner";
+        SendToRunner(task, runner);
+      } else {
+        TerminateTask(task_id);
+      }
     }
   }
   for (int task_id = 0; task_id < n_tasks; ++task_id) {
@@ -0,0 +1,472 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * \file relax/transform/assign_async_streams.cc
+ * \brief Pass for launching the independent kernels of a Relax function on multiple streams.
+ *
+ * The VM runs the kernels of a function one after another, even when they do not depend on each
+ * other, e.g. the Q/K/V projections of an attention layer. This pass assigns the kernels of each
+ * binding block to streams, and makes the dependencies between the streams explicit.
+ *
+ * This transformation is expected to run after `StaticPlanBlockMemory`, where every kernel is a
+ * call to a PrimFunc or an ExternFunc with the outputs passed as arguments, and the tensors that
+ * share a storage are visible. Two kernels depend on each other if one of them writes to a storage
+ * that the other reads or writes. The written arguments of a PrimFunc are found from the buffer
+ * stores in its body. An ExternFunc, whose accesses are unknown, is taken to write to all its
+ * arguments.
+ *
+ * The kernels are rewritten to `vm.builtin.async_stream.launch`. A kernel is put on the stream of
+ * one of its dependencies when it is the last kernel of that stream, and otherwise on the least
+ * loaded stream. The dependencies on other streams become `vm.builtin.async_stream.wait`. Any
+ * other binding that may read the data of a tensor, and the end of the block, is preceded by
+ * `vm.builtin.async_stream.sync`, which waits for all the streams.
+ */
+
+#include <tvm/relax/analysis.h>
+#include <tvm/relax/attrs/op.h>
+#include <tvm/relax/expr_functor.h>
+#include <tvm/relax/transform.h>
+#include <tvm/tir/builtin.h>
+#include <tvm/tir/stmt_functor.h>
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../../support/utils.h"
+
+namespace tvm {
+namespace relax {
+
+TVM_REGISTER_PASS_CONFIG_OPTION("relax.backend.num_async_streams", Integer);
+
+/*! \brief Collect the buffer data vars that a PrimFunc writes to. */
+class BufferWriteCollector : public tir::StmtExprVisitor {
+ public:
+  /*!
+   * \brief Get the parameters of a PrimFunc that it may write to.
+   * \return Whether each parameter may be written, or std::nullopt if the PrimFunc may access
+   *  its buffers in a way the analysis does not understand.
+   */
+  static std::optional<std::vector<bool>> GetWrittenParams(const tir::PrimFunc& func) {
+    BufferWriteCollector collector;
+    collector(func->body);
+    if (collector.opaque_) {
+      return std::nullopt;
+    }
+    std::vector<bool> written;
+    for (const tir::Var& param : func->params) {
+      if (auto buffer = func->buffer_map.Get(param)) {
+        written.push_back(collector.written_.count(buffer.value()->data.get()));
+      } else {
+        written.push_back(param->dtype.is_handle());
+      }
+    }
+    return written;
+  }
+
+ private:
+  void VisitStmt_(const tir::BufferStoreNode* op) final {
+    written_.insert(GetSource(op->buffer->data.get()));
+    tir::StmtExprVisitor::VisitStmt_(op);
+  }
+
+  void VisitStmt_(const tir::BlockNode* op) final {
+    for (const tir::MatchBufferRegion& match_buffer : op->match_buffers) {
+      alias_[match_buffer->buffer->data.get()] =
+          GetSource(match_buffer->source->buffer->data.get());
+    }
+    tir::StmtExprVisitor::VisitStmt_(op);
+  }
+
+  void VisitStmt_(const tir::LetStmtNode* op) final {
+    // the buffer pointers may escape through the let bound handle.
+    opaque_ |= op->var->dtype.is_handle();
+    tir::StmtExprVisitor::VisitStmt_(op);
+  }
+
+  void VisitExpr_(const tir::CallNode* op) final {
+    static const std::vector<Op> opaque_ops = {
+        tir::builtin::address_of(),      tir::builtin::tvm_access_ptr(),
+        tir::builtin::tvm_call_packed(), tir::builtin::tvm_call_cpacked(),
+        tir::builtin::call_extern(),     tir::builtin::tvm_call_packed_lowered()};
+    opaque_ |= std::any_of(opaque_ops.begin(), opaque_ops.end(),
+                           [&](const Op& opaque_op) { return op->op.same_as(opaque_op); });
+    tir::StmtExprVisitor::VisitExpr_(op);
+  }
+
+  const tir::VarNode* GetSource(const tir::VarNode* var) const {
+    auto it = alias_.find(var);
+    return it == alias_.end() ? var : it->second;
+  }
+
+  std::unordered_set<const tir::VarNode*> written_;
+  std::unordered_map<const tir::VarNode*, const tir::VarNode*> alias_;
+  bool opaque_ = false;
+};
+
+/*! \brief Get the value bound by a VarBinding or a MatchCast. */
+Expr GetBoundValue(const Binding& binding) {
+  if (const auto* var_binding = binding.as<VarBindingNode>()) {
+    return var_binding->value;
+  }
+  return Downcast<MatchCast>(binding)->value;
+}
+
+/*! \brief The stream assignment of the bindings of a binding block. */
+struct AsyncStreamPlan {
+  /*! \brief Whether to wait for all the streams before the binding. */
+  std::vector<bool> sync_before;
+  /*! \brief The (dst, src) stream waits to emit before the binding. */
+  std::vector<std::vector<std::pair<int, int>>> waits_before;
+  /*! \brief The stream of the binding, or -1 if it is not launched on a stream. */
+  std::vector<int> stream;
+  /*! \brief The number of streams used. */
+  int num_streams_used = 0;
+};
+
+/*!
+ * \brief Assign the kernels of the binding blocks to streams. The planner visits all the bindings
+ * in order, as it tracks the storage each tensor lives in across the blocks of a function.
+ */
+class AsyncStreamPlanner {
+ public:
+  explicit AsyncStreamPlanner(IRModule mod, int num_streams)
+      : mod_(mod), num_streams_(num_streams) {}
+
+  AsyncStreamPlan Plan(const BindingBlockNode* block) {
+    AsyncStreamPlan plan;
+    size_t num_bindings = block->bindings.size();
+    plan.sync_before.resize(num_bindings, false);
+    plan.waits_before.resize(num_bindings);
+    plan.stream.resize(num_bindings, -1);
+    ResetSegment();
+    std::vector<bool> stream_used(num_streams_, false);
+
+    for (size_t i = 0; i < num_bindings; ++i) {
+      const Binding& binding = block->bindings[i];
+      if (std::optional<Kernel> kernel = GetKernel(binding)) {
+        int stream = Schedule(kernel.value(), &plan.waits_before[i]);
+        plan.stream[i] = stream;
+        stream_used[stream] = true;
+        continue;
+      }
+      if (!UpdateTrivialBinding(binding)) {
+        // the binding may access the data of any tensor.
+        plan.sync_before[i] = !kernels_.empty();
+        ResetSegment();
+        std::vector<const VarNode*> roots = GetRoots(FreeVars(GetBoundValue(binding)));
+        roots.push_back(binding->var.get());
+        roots_[binding->var.get()] = std::move(roots);
+      }
+    }
+    plan.num_streams_used = std::count(stream_used.begin(), stream_used.end(), true);
+    return plan;
+  }
+
+ private:
+  /*! \brief A kernel launch, and the storage roots it reads and writes. */
+  struct Kernel {
+    std::vector<const VarNode*> reads;
+    std::vector<const VarNode*> writes;
+  };
+
+  /*! \brief A kernel launched since the last sync. */
+  struct LaunchedKernel {
+    int stream;
+    /*! \brief The number of kernels launched on the stream up to this kernel. */
+    int position;
+  };
+
+  void ResetSegment() {
+    kernels_.clear();
+    readers_.clear();
+    writers_.clear();
+    last_kernel_.assign(num_streams_, -1);
+    num_launched_.assign(num_streams_, 0);
+    waited_.assign(num_streams_, std::vector<int>(num_streams_, 0));
+  }
+
+  /*! \brief Get the kernel launched by a binding, if it is one. */
+  std::optional<Kernel> GetKernel(const Binding& binding) {
+    const auto* var_binding = binding.as<VarBindingNode>();
+    if (var_binding == nullptr) return std::nullopt;
+    const auto* call = var_binding->value.as<CallNode>();
+    if (call == nullptr) return std::nullopt;
+    const auto* ret = GetStructInfoAs<TupleStructInfoNode>(var_binding->var);
+    if (ret == nullptr || !ret->fields.empty()) return std::nullopt;
+
+    std::vector<bool> written(call->args.size(), false);
+    if (const auto* gv = call->op.as<GlobalVarNode>()) {
+      const auto* prim_func = mod_->Lookup(GetRef<GlobalVar>(gv)).as<tir::PrimFuncNode>();
+      if (prim_func == nullptr) return std::nullopt;
+      auto it = written_params_.find(gv);
+      if (it == written_params_.end()) {
+        it = written_params_
+                 .emplace(gv, BufferWriteCollector::GetWrittenParams(GetRef<tir::PrimFunc>(
+                                  prim_func)))
+                 .first;
+      }
+      if (!it->second.has_value() || it->second->size() != call->args.size()) {
+        return std::nullopt;
+      }
+      written = it->second.value();
+    } else if (const auto* extern_func = call->op.as<ExternFuncNode>()) {
+      if (support::StartsWith(extern_func->global_symbol, "vm.builtin")) return std::nullopt;
+      // an ExternFunc may write any tensor passed to it, including in place.
+      written.assign(call->args.size(), true);
+    } else {
+      return std::nullopt;
+    }
+
+    Kernel kernel;
+    for (size_t i = 0; i < call->args.size(); ++i) {
+      const Expr& arg = call->args[i];
+      if (const auto* var = arg.as<VarNode>()) {
+        std::vector<const VarNode*> roots = GetRoots({var});
+        auto* target = written[i] ? &kernel.writes : &kernel.reads;
+        target->insert(target->end(), roots.begin(), roots.end());
+      } else if (!arg->IsInstance<ConstantNode>() && !arg->IsInstance<PrimValueNode>() &&
+                 !arg->IsInstance<ShapeExprNode>() && !arg->IsInstance<StringImmNode>() &&
+                 !arg->IsInstance<DataTypeImmNode>()) {
+        return std::nullopt;
+      }
+    }
+    return kernel;
+  }
+
+  /*! \brief Assign a kernel to a stream, and collect the waits it needs. */
+  int Schedule(const Kernel& kernel, std::vector<std::pair<int, int>>* waits) {
+    std::unordered_set<int> deps;
+    auto add_deps = [&](const std::unordered_map<const VarNode*, std::vector<int>>& launched,
+                        const std::vector<const VarNode*>& roots) {
+      for (const VarNode* root : roots) {
+        if (auto it = launched.find(root); it != launched.end()) {
+          deps.insert(it->second.begin(), it->second.end());
+        }
+      }
+    };
+    add_deps(writers_, kernel.reads);
+    add_deps(writers_, kernel.writes);
+    add_deps(readers_, kernel.writes);
+
+    // continue the stream of the latest dependency that is still at the tail of its stream.
+    int stream = -1;
+    for (int s = 0; s < num_streams_; ++s) {
+      if (deps.count(last_kernel_[s]) && (stream == -1 || last_kernel_[s] > last_kernel_[stream])) {
+        stream = s;
+      }
+    }
+    if (stream == -1) {
+      stream = std::min_element(num_launched_.begin(), num_launched_.end()) - num_launched_.begin();
+    }
+    std::vector<int> sorted_deps(deps.begin(), deps.end());
+    std::sort(sorted_deps.begin(), sorted_deps.end());
+    for (int dep : sorted_deps) {
+      const LaunchedKernel& launched = kernels_[dep];
+      if (launched.stream != stream && launched.position > waited_[stream][launched.stream]) {
+        waits->emplace_back(stream, launched.stream);
+        waited_[stream][launched.stream] = num_launched_[launched.stream];
+      }
+    }
+
+    int index = kernels_.size();
+    kernels_.push_back({stream, ++num_launched_[stream]});
+    last_kernel_[stream] = index;
+    for (const VarNode* root : kernel.reads) {
+      readers_[root].push_back(index);
+    }
+    for (const VarNode* root : kernel.writes) {
+      writers_[root].push_back(index);
+    }
+    return stream;
+  }
+
+  /*!
+   * \brief Track the storage of the tensor bound by a binding that does not access the data of
+   * tensors.
+   * \return Whether the binding is such a binding.
+   */
+  bool UpdateTrivialBinding(const Binding& binding) {
+    static const Op& mem_alloc_storage_op = Op::Get("relax.memory.alloc_storage");
+    static const Op& mem_alloc_tensor_op = Op::Get("relax.memory.alloc_tensor");
+    static const Op& mem_kill_storage_op = Op::Get("relax.memory.kill_storage");
+    static const Op& mem_kill_tensor_op = Op::Get("relax.memory.kill_tensor");
+    static const Op& builtin_alloc_tensor_op = Op::Get("relax.builtin.alloc_tensor");
+    static const Op& reshape_op = Op::Get("relax.reshape");
+
+    const VarNode* var = binding->var.get();
+    Expr value = GetBoundValue(binding);
+    if (const auto* call = value.as<CallNode>()) {
+      if (call->op.same_as(mem_alloc_storage_op)) {
+        roots_[var] = {var};
+      } else if (call->op.same_as(builtin_alloc_tensor_op)) {
+        roots_[var] = {var};
+      } else if (call->op.same_as(mem_alloc_tensor_op)) {
+        roots_[var] = GetRoots(FreeVars(call->args[0]));
+      } else if (call->op.same_as(reshape_op)) {
+        roots_[var] = GetRoots(FreeVars(value));
+      } else if (!call->op.same_as(mem_kill_storage_op) && !call->op.same_as(mem_kill_tensor_op)) {
+        return false;
+      }
+      return true;
+    }
+    if (value->IsInstance<VarNode>() || value->IsInstance<TupleNode>() ||
+        value->IsInstance<TupleGetItemNode>()) {
+      roots_[var] = GetRoots(FreeVars(value));
+      return true;
+    }
+    return value->IsInstance<ConstantNode>() || value->IsInstance<PrimValueNode>() ||
+           value->IsInstance<ShapeExprNode>() || value->IsInstance<StringImmNode>() ||
+           value->IsInstance<DataTypeImmNode>();
+  }
+
+  /*! \brief Get the storage roots of vars. The vars defined outside are their own roots. */
+  std::vector<const VarNode*> GetRoots(const Array<Var>& vars) {
+    std::vector<const VarNode*> var_nodes;
+    for (const Var& var : vars) {
+      var_nodes.push_back(var.get());
+    }
+    return GetRoots(var_nodes);
+  }
+
+  std::vector<const VarNode*> GetRoots(const std::vector<const VarNode*>& vars) {
+    std::vector<const VarNode*> roots;
+    for (const VarNode* var : vars) {
+      if (auto it = roots_.find(var); it != roots_.end()) {
+        roots.insert(roots.end(), it->second.begin(), it->second.end());
+      } else {
+        roots.push_back(var);
+      }
+    }
+    return roots;
+  }
+
+  IRModule mod_;
+  int num_streams_;
+  /*! \brief The storage roots of each var. */
+  std::unordered_map<const VarNode*, std::vector<const VarNode*>> roots_;
+  /*! \brief The cached written parameters of the PrimFuncs. */
+  std::unordered_map<const GlobalVarNode*, std::optional<std::vector<bool>>> written_params_;
+
+  // The states since the last sync.
+  std::vector<LaunchedKernel> kernels_;
+  std::unordered_map<const VarNode*, std::vector<int>> readers_;
+  std::unordered_map<const VarNode*, std::vector<int>> writers_;
+  /*! \brief The last kernel of each stream, or -1. */
+  std::vector<int> last_kernel_;
+  /*! \brief The number of kernels launched on each stream. */
+  std::vector<int> num_launched_;
+  /*! \brief waited_[dst][src] is the number of kernels of src that dst has waited for. */
+  std::vector<std::vector<int>> waited_;
+};
+
+/*! \brief The rewriter that launches the kernels on the planned streams. */
+class AsyncStreamRewriter : public ExprMutator {
+ public:
+  explicit AsyncStreamRewriter(const IRModule& mod, int num_streams)
+      : ExprMutator(mod), planner_(mod, num_streams) {}
+
+  IRModule Rewrite() {
+    for (const auto& [gv, func] : builder_->GetContextIRModule()->functions) {
+      if (func->IsInstance<FunctionNode>()) {
+        auto new_func = Downcast<Function>(VisitExpr(func));
+        if (!new_func.same_as(func)) {
+          builder_->UpdateFunction(gv, new_func);
+        }
+      }
+    }
+    return builder_->GetContextIRModule();
+  }
+
+  BindingBlock VisitBindingBlock_(const BindingBlockNode* block) final {
+    AsyncStreamPlan plan = planner_.Plan(block);
+    if (plan.num_streams_used < 2) {
+      return ExprMutator::VisitBindingBlock_(block);
+    }
+
+    builder_->BeginBindingBlock();
+    for (size_t i = 0; i < block->bindings.size(); ++i) {
+      if (plan.sync_before[i]) {
+        EmitSync();
+      }
+      for (const auto& [dst, src] : plan.waits_before[i]) {
+        EmitBuiltin("vm.builtin.async_stream.wait", {PrimValue::Int64(dst), PrimValue::Int64(src)});
+      }
+      const Binding& binding = block->bindings[i];
+      if (plan.stream[i] == -1) {
+        VisitBinding(binding);
+        continue;
+      }
+      const auto* var_binding = binding.as<VarBindingNode>();
+      const auto* call = var_binding->value.as<CallNode>();
+      Array<Expr> launch_args = {PrimValue::Int64(plan.stream[i]), call->op};
+      for (const Expr& arg : call->args) {
+        launch_args.push_back(VisitExpr(arg));
+      }
+      ReEmitBinding(var_binding, MakeBuiltinCall("vm.builtin.async_stream.launch", launch_args));
+    }
+    EmitSync();
+    return builder_->EndBlock();
+  }
+
+ private:
+  static Call MakeBuiltinCall(const String& name, const Array<Expr>& args) {
+    static const Op& call_builtin_with_ctx_op = Op::Get("relax.call_builtin_with_ctx");
+    return Call(call_builtin_with_ctx_op, {ExternFunc(name), Tuple(args)}, Attrs(),
+                {TupleStructInfo(Array<StructInfo>())});
+  }
+
+  void EmitBuiltin(const String& name, const Array<Expr>& args) {
+    builder_->Emit(MakeBuiltinCall(name, args), "_");
+  }
+
+  void EmitSync() { EmitBuiltin("vm.builtin.async_stream.sync", {}); }
+
+  AsyncStreamPlanner planner_;
+};
+
+IRModule AssignAsyncStreams(IRModule mod, int num_streams) {
+  CHECK_GE(num_streams, 1) << "ValueError: The number of streams must be positive, but got "
+                           << num_streams;
+  if (num_streams == 1) {
+    return mod;
+  }
+  AsyncStreamRewriter rewriter(mod, num_streams);
+  return rewriter.Rewrite();
+}
+
+namespace transform {
+
+Pass AssignAsyncStreams(int num_streams) {
+  runtime::TypedPackedFunc<IRModule(IRModule, PassContext)> pass_func =  //
+      [=](IRModule m, PassContext pc) {
+        return ::tvm::relax::AssignAsyncStreams(std::move(m), num_streams);
+      };
+  return CreateModulePass(pass_func, 0, "AssignAsyncStreams", {});
+}
+
+TVM_REGISTER_GLOBAL("relax.transform.AssignAsyncStreams").set_body_typed(AssignAsyncStreams);
+
+}  // namespace transform
+}  // namespace relax
+}  // namespace tvm
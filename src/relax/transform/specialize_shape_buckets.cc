@@ -0,0 +1,332 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * \file relax/transform/specialize_shape_buckets.cc
+ * \brief Pass for specializing dynamic-shape Relax functions to a set of static shape buckets.
+ *
+ * A function with symbolic shapes matches and computes its shapes at runtime on every call, and
+ * its memory is planned for the upper bounds of the symbolic vars, if any. For each public
+ * function whose parameters use the symbolic vars given a set of buckets, e.g. seq_len in
+ * {1, 16, 128}, this pass adds a clone of the function for every combination of the buckets,
+ * where the vars are replaced with the bucket values, so that the clones have static shapes and
+ * are planned exactly by the rest of the pipeline.
+ *
+ * The function itself becomes a dispatcher, calling `vm.builtin.shape_bucket.dispatch` with its
+ * arguments and the clones. The dispatcher picks the smallest bucket of every var that fits the
+ * arguments. With pad_to_bucket, the arguments not matching the bucket exactly are padded with
+ * zeros along the axes of the var, and the axes of the result are sliced back, which is only
+ * valid when the padded elements do not affect the others (no reduction over the axes).
+ * Otherwise, and for arguments beyond the largest bucket, a copy of the original dynamic function
+ * is called.
+ */
+
+#include <tvm/arith/analyzer.h>
+#include <tvm/relax/analysis.h>
+#include <tvm/relax/expr_functor.h>
+#include <tvm/relax/transform.h>
+#include <tvm/relax/utils.h>
+#include <tvm/tir/analysis.h>
+#include <tvm/tir/stmt_functor.h>
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tvm {
+namespace relax {
+
+/*! \brief Replace the symbolic vars of a function with the given values. */
+class SymbolicVarSpecializer : public ExprMutator {
+ public:
+  /*!
+   * \brief Specialize a function.
+   * \param func The function.
+   * \param var_map The values of the symbolic vars.
+   * \return The specialized function, with new vars.
+   */
+  static Function Specialize(const Function& func, const Map<tir::Var, PrimExpr>& var_map) {
+    SymbolicVarSpecializer specializer(var_map);
+    return CopyWithNewVars(Downcast<Function>(specializer.VisitExpr(func)));
+  }
+
+ private:
+  explicit SymbolicVarSpecializer(const Map<tir::Var, PrimExpr>& var_map) : var_map_(var_map) {}
+
+  using ExprMutator::VisitExpr_;
+
+  Expr VisitExpr_(const FunctionNode* op) final {
+    Function func = Downcast<Function>(ExprMutator::VisitExpr_(op));
+    StructInfo ret_struct_info = this->VisitExprDepStructInfoField(func->ret_struct_info);
+    if (ret_struct_info.same_as(func->ret_struct_info)) return func;
+    return Function(func->params, func->body, ret_struct_info, func->is_pure, func->attrs,
+                    func->span);
+  }
+
+  PrimExpr VisitPrimExpr(const PrimExpr& expr) final {
+    return analyzer_.Simplify(tir::Substitute(expr, var_map_));
+  }
+
+  Map<tir::Var, PrimExpr> var_map_;
+  arith::Analyzer analyzer_;
+};
+
+class ShapeBucketSpecializer {
+ public:
+  explicit ShapeBucketSpecializer(IRModule mod, Map<String, Array<Integer>> buckets,
+                                  bool pad_to_bucket)
+      : mod_(mod), builder_(BlockBuilder::Create(mod)), pad_to_bucket_(pad_to_bucket) {
+    for (const auto& kv : buckets) {
+      std::vector<int64_t> values;
+      for (const Integer& value : kv.second) {
+        CHECK_GT(value->value, 0) << "ValueError: The buckets of " << kv.first
+                                  << " must be positive, but got " << value;
+        values.push_back(value->value);
+      }
+      CHECK(!values.empty()) << "ValueError: No bucket is given for " << kv.first;
+      std::sort(values.begin(), values.end());
+      values.erase(std::unique(values.begin(), values.end()), values.end());
+      buckets_[kv.first] = std::move(values);
+    }
+  }
+
+  IRModule Run() {
+    std::vector<std::pair<GlobalVar, Function>> funcs;
+    for (const auto& kv : mod_->functions) {
+      if (const auto* func = kv.second.as<FunctionNode>()) {
+        if (func->GetAttr<String>(tvm::attr::kGlobalSymbol).defined()) {
+          funcs.emplace_back(kv.first, GetRef<Function>(func));
+        }
+      }
+    }
+    for (const auto& kv : funcs) {
+      SpecializeFunction(kv.first, kv.second);
+    }
+    return builder_->GetContextIRModule();
+  }
+
+ private:
+  /*! \brief A bucketed symbolic var of a function. */
+  struct BucketedVar {
+    tir::Var var;
+    const std::vector<int64_t>* buckets;
+    /*! \brief The (param, axis) pairs of the dims that are the var. */
+    std::vector<std::pair<int64_t, int64_t>> param_locs;
+  };
+
+  void SpecializeFunction(const GlobalVar& gv, const Function& func) {
+    std::vector<BucketedVar> vars;
+    std::unordered_map<const tir::VarNode*, int> var_index;
+    for (const Var& param : func->params) {
+      for (const tir::Var& var : TIRVarsInStructInfo(GetStructInfo(param))) {
+        auto it = buckets_.find(var->name_hint);
+        if (it != buckets_.end() && !var_index.count(var.get())) {
+          var_index[var.get()] = vars.size();
+          vars.push_back(BucketedVar{var, &it->second, {}});
+        }
+      }
+    }
+    if (vars.empty()) return;
+    auto f_uses_bucketed_var = [&](const PrimExpr& expr) {
+      return tir::UsesVar(expr, [&](const tir::VarNode* var) { return var_index.count(var); });
+    };
+
+    // The locations of the vars in the params, which are read and padded by the dispatcher.
+    for (size_t i = 0; i < func->params.size(); ++i) {
+      StructInfo sinfo = GetStructInfo(func->params[i]);
+      Optional<Array<PrimExpr>> dims;
+      if (const auto* tensor_sinfo = sinfo.as<TensorStructInfoNode>()) {
+        dims = tensor_sinfo->GetShape();
+      } else if (const auto* shape_sinfo = sinfo.as<ShapeStructInfoNode>()) {
+        dims = shape_sinfo->values;
+      }
+      if (dims.defined()) {
+        for (size_t axis = 0; axis < dims.value().size(); ++axis) {
+          PrimExpr dim = dims.value()[axis];
+          auto it = dim->IsInstance<tir::VarNode>() ? var_index.find(dim.as<tir::VarNode>())
+                                                     : var_index.end();
+          if (it != var_index.end()) {
+            vars[it->second].param_locs.emplace_back(i, axis);
+          } else {
+            CHECK(!f_uses_bucketed_var(dim))
+                << "ValueError: Cannot bucket " << gv->name_hint << ", whose parameter "
+                << func->params[i]->name_hint() << " has the shape dim " << dim
+                << ". The bucketed vars must be the dims of the parameters.";
+          }
+        }
+      } else {
+        for (const tir::Var& var : TIRVarsInStructInfo(sinfo)) {
+          CHECK(!var_index.count(var.get()))
+              << "ValueError: Cannot bucket " << gv->name_hint << ", whose parameter "
+              << func->params[i]->name_hint() << " of " << sinfo << " uses " << var
+              << ". The bucketed vars must be the dims of tensor or shape parameters.";
+        }
+      }
+    }
+
+    // The locations of the vars in the result, which are sliced back after padding.
+    std::vector<std::array<int64_t, 3>> ret_locs;
+    auto f_collect_ret_locs = [&](const StructInfo& sinfo, int64_t field) {
+      const auto* tensor_sinfo = sinfo.as<TensorStructInfoNode>();
+      Optional<Array<PrimExpr>> dims =
+          tensor_sinfo != nullptr ? tensor_sinfo->GetShape() : Optional<Array<PrimExpr>>();
+      if (!dims.defined()) {
+        for (const tir::Var& var : TIRVarsInStructInfo(sinfo)) {
+          CHECK(!pad_to_bucket_ || !var_index.count(var.get()))
+              << "ValueError: Cannot pad " << gv->name_hint << ", whose result " << sinfo
+              << " uses " << var << ". Use pad_to_bucket=False to only run the exact buckets.";
+        }
+        return;
+      }
+      for (size_t axis = 0; axis < dims.value().size(); ++axis) {
+        PrimExpr dim = dims.value()[axis];
+        auto it = dim->IsInstance<tir::VarNode>() ? var_index.find(dim.as<tir::VarNode>())
+                                                   : var_index.end();
+        if (it != var_index.end()) {
+          ret_locs.push_back({field, static_cast<int64_t>(axis), it->second});
+        } else {
+          CHECK(!pad_to_bucket_ || !f_uses_bucketed_var(dim))
+              << "ValueError: Cannot pad " << gv->name_hint << ", whose result has the shape dim "
+              << dim << ". Use pad_to_bucket=False to only run the exact buckets.";
+        }
+      }
+    };
+    if (const auto* tuple_sinfo = func->ret_struct_info.as<TupleStructInfoNode>()) {
+      for (size_t i = 0; i < tuple_sinfo->fields.size(); ++i) {
+        f_collect_ret_locs(tuple_sinfo->fields[i], i);
+      }
+    } else {
+      f_collect_ret_locs(func->ret_struct_info, -1);
+    }
+
+    // The clones, with the fallback first and then the bucket combinations in row-major order.
+    Array<Expr> clones;
+    clones.push_back(builder_->AddFunction(MakePrivate(CopyWithNewVars(func), {}),
+                                           gv->name_hint + "_dynamic"));
+    std::vector<size_t> combination(vars.size(), 0);
+    while (true) {
+      Map<tir::Var, PrimExpr> var_map;
+      std::string name = gv->name_hint;
+      for (size_t i = 0; i < vars.size(); ++i) {
+        int64_t value = (*vars[i].buckets)[combination[i]];
+        var_map.Set(vars[i].var, IntImm(vars[i].var->dtype, value));
+        name += "_" + vars[i].var->name_hint + std::to_string(value);
+      }
+      Function clone = SymbolicVarSpecializer::Specialize(func, var_map);
+      clones.push_back(builder_->AddFunction(MakePrivate(clone, var_map), name));
+      // advance to the next combination, with the last var changing fastest.
+      int i = static_cast<int>(vars.size()) - 1;
+      for (; i >= 0; --i) {
+        if (++combination[i] < vars[i].buckets->size()) break;
+        combination[i] = 0;
+      }
+      if (i < 0) break;
+    }
+
+    // The spec of the dispatcher, whose layout is documented in shape_bucket_builtin.cc.
+    Array<PrimExpr> spec;
+    auto f_push = [&spec](int64_t value) { spec.push_back(IntImm(DataType::Int(64), value)); };
+    f_push(pad_to_bucket_);
+    f_push(func->params.size());
+    f_push(vars.size());
+    for (const BucketedVar& var : vars) {
+      f_push(var.buckets->size());
+      for (int64_t value : *var.buckets) f_push(value);
+      f_push(var.param_locs.size());
+      for (const auto& loc : var.param_locs) {
+        f_push(loc.first);
+        f_push(loc.second);
+      }
+    }
+    f_push(pad_to_bucket_ ? ret_locs.size() : 0);
+    if (pad_to_bucket_) {
+      for (const auto& loc : ret_locs) {
+        for (int64_t value : loc) f_push(value);
+      }
+    }
+
+    Array<Var> params;
+    for (const Var& param : func->params) {
+      params.push_back(Var(param->name_hint(), GetStructInfo(param)));
+    }
+    Array<Expr> args{ShapeExpr(spec)};
+    args.insert(args.end(), params.begin(), params.end());
+    args.insert(args.end(), clones.begin(), clones.end());
+
+    static const Op& call_builtin_with_ctx_op = Op::Get("relax.call_builtin_with_ctx");
+    builder_->BeginScope(params);
+    builder_->BeginBindingBlock();
+    Var ret = builder_->Emit(Call(call_builtin_with_ctx_op,
+                                  {ExternFunc("vm.builtin.shape_bucket.dispatch"), Tuple(args)},
+                                  Attrs(), {func->ret_struct_info}),
+                             "ret");
+    BindingBlock block = builder_->EndBlock();
+    builder_->EndScope();
+    Function dispatcher(params, SeqExpr({block}, ret), func->ret_struct_info, func->is_pure,
+                        func->attrs, func->span);
+    if (func->is_pure) {
+      // the dispatch is pure as long as the clones are.
+      dispatcher = WithAttr(std::move(dispatcher), relax::attr::kForcePure, Bool(true));
+    }
+    builder_->UpdateFunction(gv, dispatcher);
+  }
+
+  /*!
+   * \brief Make a clone private, and drop the upper bounds of the specialized vars.
+   * \param func The clone.
+   * \param var_map The specialized vars.
+   * \return The private clone.
+   */
+  static Function MakePrivate(Function func, const Map<tir::Var, PrimExpr>& var_map) {
+    func = WithoutAttr(std::move(func), tvm::attr::kGlobalSymbol);
+    if (auto opt_upper_bounds = func->GetAttr<Map<String, IntImm>>("tir_var_upper_bound")) {
+      Map<String, IntImm> upper_bounds = opt_upper_bounds.value();
+      for (const auto& kv : var_map) {
+        upper_bounds.erase(kv.first->name_hint);
+      }
+      func = WithAttr(std::move(func), "tir_var_upper_bound", upper_bounds);
+    }
+    return func;
+  }
+
+  IRModule mod_;
+  BlockBuilder builder_;
+  bool pad_to_bucket_;
+  std::unordered_map<std::string, std::vector<int64_t>> buckets_;
+};
+
+namespace transform {
+
+Pass SpecializeShapeBuckets(Map<String, Array<Integer>> buckets, bool pad_to_bucket) {
+  runtime::TypedPackedFunc<IRModule(IRModule, PassContext)> pass_func =
+      [=](IRModule mod, PassContext pc) {
+        return ShapeBucketSpecializer(std::move(mod), buckets, pad_to_bucket).Run();
+      };
+  return CreateModulePass(pass_func, 0, "SpecializeShapeBuckets", {});
+}
+
+TVM_REGISTER_GLOBAL("relax.transform.SpecializeShapeBuckets")
+    .set_body_typed(SpecializeShapeBuckets);
+
+}  // namespace transform
+
+}  // namespace relax
+}  // namespace tvm
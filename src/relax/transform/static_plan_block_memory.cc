@@ -61,21 +61,59 @@
  * It means the maximum value of variable that names "n" in the function
  * signature will have upper bound 1024. And we will use 1024 as its value
  * during memory planning.
+ *
+ * Instead of reusing whole storages, the tokens of a binding block can be
+ * packed into one arena per device with byte offsets, by setting the pass
+ * config "relax.memory_plan.offset_planner". Each token is then live from its
+ * allocation to its release, and the tokens whose live intervals overlap get
+ * disjoint ranges of the arena. Several small tensors can share the space of
+ * a large one, which the storage reuse cannot do. The offsets move the data
+ * pointers of the tensors, so they are only planned when the current target
+ * is a device with plain pointers (CPU, CUDA or ROCm). Otherwise the storages
+ * are reused whole, as without the pass config.
+ *
+ * The pass config "relax.memory_plan.scope" extends the planning beyond a
+ * binding block:
+ * - "block", the default, plans each binding block on its own;
+ * - "function" plans across the binding blocks of each SeqExpr, so a tensor
+ * may be used by later blocks than the one allocating it. The branches of an
+ * If may reuse the storages released before the If, and the storages are
+ * killed at the end of the SeqExpr allocating them;
+ * - "module" additionally lets each function reuse the storages of the
+ * functions planned before it. The storages shared this way get the same size
+ * in every function, so that the functions that never run concurrently are
+ * served the same buffer by the pooled allocator of the VM.
  */
 #include <tvm/arith/analyzer.h>
 #include <tvm/relax/analysis.h>
 #include <tvm/relax/expr_functor.h>
 #include <tvm/relax/nested_msg.h>
 #include <tvm/relax/transform.h>
+#include <tvm/runtime/device_api.h>
+#include <tvm/target/target.h>
 #include <tvm/tir/stmt_functor.h>
 
+#include <algorithm>
 #include <map>
+#include <numeric>
 #include <set>
+#include <string>
+#include <unordered_set>
 #include <vector>
 
 namespace tvm {
 namespace relax {
 
+TVM_REGISTER_PASS_CONFIG_OPTION("relax.memory_plan.offset_planner", String);
+TVM_REGISTER_PASS_CONFIG_OPTION("relax.memory_plan.scope", String);
+
+/*! \brief The scope of the memory planning. */
+enum class PlanScope : int {
+  kBlock = 0,
+  kFunction = 1,
+  kModule = 2,
+};
+
 /*!
  * \brief A representation of a block of reusable memory required at runtime.
  * \details Only the tensors whose memory can be "possibly reused" will have
@@ -83,6 +121,7 @@ namespace relax {
  * - that is a function parameter,
  * - that is a function return value,
  * - one of whose use site is a BindingBlock different from its allocation site,
+ * or a SeqExpr different from it when planning across blocks,
  * - that is used as a condition or branch return of a IfNode,
  * - that is used as the body of a SeqExprNode,
  * - that is used as arguments in a Call whose op is not a PrimFunc.
@@ -101,6 +140,10 @@ class StorageTokenNode : public Object {
   DataType dtype;
   /*! \brief The storage id, reserved for debug and demo use. */
   int storage_id{-1};
+  /*! \brief The StorageToken of the arena holding this token, when planned with offsets. */
+  ObjectRef arena;
+  /*! \brief The byte offset of this token in its arena. */
+  int64_t offset{0};
 
   static constexpr const char* _type_key = "relax.transform.StorageToken";
   TVM_DECLARE_BASE_OBJECT_INFO(StorageTokenNode, Object);
@@ -204,6 +247,26 @@ class TokenAllocator1D {
     return prototype;
   }
 
+  /*! \brief The available tokens of each dtype, keyed by their sizes. */
+  using AvailablePool = std::unordered_map<DataType, std::multimap<int64_t, StorageToken>>;
+
+  /*! \brief Get the available pool, to be restored after planning a nested scope. */
+  AvailablePool GetAvailablePool() const { return available_pool_; }
+
+  /*!
+   * \brief Restore the available pool.
+   * \param pool The pool, whose tokens may have been enlarged since it was got.
+   */
+  void SetAvailablePool(const AvailablePool& pool) {
+    available_pool_.clear();
+    for (const auto& [dtype, tokens] : pool) {
+      for (const auto& [bytes, token] : tokens) {
+        ICHECK_EQ(token->ref_counter, 0) << "Available tokens are expected to have 0 reference.";
+        available_pool_[dtype].insert({token->bytes, token});
+      }
+    }
+  }
+
   /*!
    * \brief Release the input token, putting it into the available pool.
    * \param token The token to be released.
@@ -220,11 +283,130 @@ class TokenAllocator1D {
   /*! \brief A constant scale representing the token search range. */
   const int match_range_{16};
   /*! \brief The pool of available storage tokens for each dtype. */
-  std::unordered_map<DataType, std::multimap<int64_t, StorageToken>> available_pool_;
+  AvailablePool available_pool_;
   /*! \brief All the storage tokens that have been allocated with actual storage. */
   std::vector<StorageToken> full_pool_;
 };
 
+/*!
+ * \brief Planner packing the tokens of a binding block into one arena with byte offsets.
+ * \details Two tokens may overlap in the arena only if their live intervals are
+ * disjoint. The heuristics place the tokens one at a time, in the smallest gap
+ * between the placed tokens that are live at the same time, or after them:
+ * - "greedy_by_size" places the larger tokens first,
+ * - "best_fit" places the tokens in the order of allocation,
+ * - "auto" takes the better of the two, and for small blocks tries every order,
+ *   placing each token at the lowest offset that fits, which finds an optimal
+ *   packing.
+ */
+class OffsetPlanner {
+ public:
+  /*! \brief A token to place, live in the bindings [start, end] of its block. */
+  struct Item {
+    int64_t bytes;
+    int start;
+    int end;
+    int64_t offset{0};
+  };
+
+  /*! \brief The max number of tokens of a block for which every order is tried. */
+  static constexpr size_t kMaxExactSearchSize = 8;
+
+  /*! \brief Check if the input is a known strategy. */
+  static bool IsValidStrategy(const std::string& strategy) {
+    return strategy == "greedy_by_size" || strategy == "best_fit" || strategy == "auto";
+  }
+
+  /*!
+   * \brief Assign the offsets of the items.
+   * \param items The items, whose offsets are set.
+   * \param strategy The strategy.
+   * \return The size of the arena.
+   */
+  static int64_t Plan(std::vector<Item>* items, const std::string& strategy) {
+    for (Item& item : *items) {
+      // keep every tensor aligned as if it were allocated on its own.
+      item.bytes = (item.bytes + runtime::kAllocAlignment - 1) / runtime::kAllocAlignment *
+                   runtime::kAllocAlignment;
+    }
+    std::vector<Item> best;
+    int64_t best_size = std::numeric_limits<int64_t>::max();
+    auto f_try = [&](const std::vector<int>& order, bool best_fit) {
+      std::vector<Item> trial = *items;
+      int64_t size = PlaceInOrder(&trial, order, best_fit);
+      if (size < best_size) {
+        best_size = size;
+        best = std::move(trial);
+      }
+    };
+
+    std::vector<int> order(items->size());
+    std::iota(order.begin(), order.end(), 0);
+    if (strategy == "greedy_by_size" || strategy == "auto") {
+      std::stable_sort(order.begin(), order.end(), [items](int lhs, int rhs) {
+        return (*items)[lhs].bytes > (*items)[rhs].bytes;
+      });
+      f_try(order, /*best_fit=*/true);
+    }
+    if (strategy == "best_fit" || strategy == "auto") {
+      std::stable_sort(order.begin(), order.end(), [items](int lhs, int rhs) {
+        return (*items)[lhs].start < (*items)[rhs].start;
+      });
+      f_try(order, /*best_fit=*/true);
+    }
+    if (strategy == "auto" && items->size() <= kMaxExactSearchSize) {
+      std::sort(order.begin(), order.end());
+      do {
+        f_try(order, /*best_fit=*/false);
+      } while (std::next_permutation(order.begin(), order.end()));
+    }
+    *items = std::move(best);
+    return best_size;
+  }
+
+ private:
+  /*!
+   * \brief Place the items in the given order.
+   * \param items The items.
+   * \param order The order of the items.
+   * \param best_fit Whether to use the smallest gap that fits, or the lowest one.
+   * \return The size of the arena.
+   */
+  static int64_t PlaceInOrder(std::vector<Item>* items, const std::vector<int>& order,
+                              bool best_fit) {
+    int64_t size = 0;
+    std::vector<const Item*> placed;
+    std::vector<const Item*> live;
+    for (int index : order) {
+      Item& item = (*items)[index];
+      live.clear();
+      for (const Item* other : placed) {
+        if (other->start <= item.end && item.start <= other->end) {
+          live.push_back(other);
+        }
+      }
+      std::sort(live.begin(), live.end(),
+                [](const Item* lhs, const Item* rhs) { return lhs->offset < rhs->offset; });
+      int64_t offset = -1;
+      int64_t best_gap = std::numeric_limits<int64_t>::max();
+      int64_t live_end = 0;
+      for (const Item* other : live) {
+        int64_t gap = other->offset - live_end;
+        if (gap >= item.bytes && gap < best_gap) {
+          offset = live_end;
+          best_gap = gap;
+          if (!best_fit) break;
+        }
+        live_end = std::max(live_end, other->offset + other->bytes);
+      }
+      item.offset = offset >= 0 ? offset : live_end;
+      size = std::max(size, item.offset + item.bytes);
+      placed.push_back(&item);
+    }
+    return size;
+  }
+};
+
 /*! \brief Check if the input op is "relax.reshape". */
 bool IsReshape(const Expr& op) { return op.same_as(Op::Get("relax.reshape")); }
 
@@ -281,10 +463,27 @@ class StorageAllocatorBaseVisitor : public ExprVisitor {
 
   virtual void SetTokens(const ExprNode* expr, Tokens tokens) { token_map_[expr] = tokens; }
 
+  /*!
+   * \brief Get the scope that a token may not be used outside of, which is the current
+   * binding block, or the current SeqExpr when planning across blocks.
+   */
+  const Object* CurrentScope() const {
+    if (plan_scope_ == PlanScope::kBlock) {
+      ICHECK(!block_stack_.empty());
+      return block_stack_.back();
+    }
+    ICHECK(!seq_stack_.empty());
+    return seq_stack_.back();
+  }
+
   /*! \brief The mapping from each Expr to its corresponding storage tokens. */
   std::unordered_map<const ExprNode*, Tokens> token_map_;
   /*! \brief The binding block stack. */
   std::vector<const BindingBlockNode*> block_stack_;
+  /*! \brief The SeqExpr stack. */
+  std::vector<const SeqExprNode*> seq_stack_;
+  /*! \brief The scope of the planning. */
+  PlanScope plan_scope_{PlanScope::kBlock};
 };
 
 /*!
@@ -300,10 +499,12 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
   /*!
    * \brief The entry of the initialization.
    * \param mod The IRModule to be planned
+   * \param plan_scope The scope of the planning.
    * \return The mapping from each Expr to the token it uses.
    */
-  static std::unordered_map<const ExprNode*, Tokens> Initialize(const IRModule& mod) {
-    StorageAllocatorInit initializer(mod);
+  static std::unordered_map<const ExprNode*, Tokens> Initialize(const IRModule& mod,
+                                                                PlanScope plan_scope) {
+    StorageAllocatorInit initializer(mod, plan_scope);
 
     for (auto it : mod->functions) {
       const auto* func = it.second.as<FunctionNode>();
@@ -318,7 +519,10 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
  private:
   using ExprVisitor::VisitExpr_;
 
-  explicit StorageAllocatorInit(const IRModule& ctx_mod) : ctx_mod_(ctx_mod) {}
+  explicit StorageAllocatorInit(const IRModule& ctx_mod, PlanScope plan_scope)
+      : ctx_mod_(ctx_mod) {
+    this->plan_scope_ = plan_scope;
+  }
 
   void VisitExpr_(const FunctionNode* func) final {
     // Use the attribute-annotated TIR var upper bounds as the TIR var values for
@@ -368,9 +572,8 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
         call->op == call_tir_dyn_op) {
       Array<Expr> args =
           call->op == call_tir_dyn_op ? Downcast<Tuple>(call->args[1])->fields : call->args;
-      ICHECK(!block_stack_.empty());
       for (const Expr& arg : call->args) {
-        Tokens tokens = GetTokensWithAllocSiteCheck(arg, block_stack_.back());
+        Tokens tokens = GetTokensWithAllocSiteCheck(arg, CurrentScope());
         ForEachLeaf(tokens, [](StorageToken token) { token->ref_counter += 1; });
       }
     } else {
@@ -392,12 +595,15 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
   }
 
   void VisitExpr_(const SeqExprNode* seq) final {
+    seq_stack_.push_back(seq);
     for (const BindingBlock& binding_block : seq->blocks) {
       this->VisitBindingBlock(binding_block);
     }
     Tokens body_tokens = GetTokens(seq->body);
     // Discard the tokens used by the body, as the planning works on block level.
     DiscardTokensIn(body_tokens);
+    ICHECK(seq_stack_.back() == seq);
+    seq_stack_.pop_back();
   }
 
   /******************** Utilities ********************/
@@ -464,8 +670,7 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
 
     Tokens tokens(token);
     SetTokens(call, tokens);
-    ICHECK(!block_stack_.empty());
-    token2block_[token.get()] = block_stack_.back();
+    token2scope_[token.get()] = CurrentScope();
     return tokens;
   }
 
@@ -485,19 +690,19 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
   /*!
    * \brief Token getter with allocation site check.
    * We first get the tokens used by the input Expr, and check if the allocation
-   * site of each token is the input current block.
-   * Since the planning works on block level, if some token's allocation site
-   * is not the current block, we discard the token so that it will not be planned.
+   * site of each token is the input current scope.
+   * Since the planning works on block (or SeqExpr) level, if some token's allocation
+   * site is not the current scope, we discard the token so that it will not be planned.
    * \param expr The Expr whose tokens is to be got.
-   * \param cur_block The pointer to the current block.
+   * \param cur_scope The pointer to the current block or SeqExpr.
    * \return The tokens used by the input Expr.
    */
-  Tokens GetTokensWithAllocSiteCheck(const Expr& expr, const BindingBlockNode* cur_block) {
+  Tokens GetTokensWithAllocSiteCheck(const Expr& expr, const Object* cur_scope) {
     Tokens tokens = GetTokens(expr);
-    ForEachLeaf(tokens, [this, cur_block](StorageToken token) {
-      auto it = this->token2block_.find(token.get());
-      ICHECK(it != this->token2block_.end());
-      if (it->second != cur_block) {
+    ForEachLeaf(tokens, [this, cur_scope](StorageToken token) {
+      auto it = this->token2scope_.find(token.get());
+      ICHECK(it != this->token2scope_.end());
+      if (it->second != cur_scope) {
         this->DiscardToken(token);
       }
     });
@@ -522,7 +727,7 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
       });
     }
     token2exprs_.erase(token_to_discard.get());
-    token2block_.erase(token_to_discard.get());
+    token2scope_.erase(token_to_discard.get());
   }
 
   /*! \brief The arithmetic analyzer. */
@@ -534,8 +739,8 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
   const IRModule& ctx_mod_;
   /*! \brief The mapping from TIR variables to their respective upper bound values. */
   std::unordered_map<tir::Var, IntImm, ObjectPtrHash, ObjectPtrEqual> var_upper_bound_;
-  /*! \brief The mapping from each token to the binding block where it is created. */
-  std::unordered_map<const StorageTokenNode*, const BindingBlockNode*> token2block_;
+  /*! \brief The mapping from each token to the binding block or SeqExpr where it is created. */
+  std::unordered_map<const StorageTokenNode*, const Object*> token2scope_;
   /*! \brief The mapping from each token to the Exprs that are using this token. */
   std::unordered_map<const StorageTokenNode*, std::vector<const ExprNode*>> token2exprs_;
 };
@@ -557,11 +762,21 @@ class StorageAllocatorInit : public StorageAllocatorBaseVisitor {
  * information is used for inserting kill_tensor in the rewrite stage.
  * - know the tokens allocated in each binding block. This information
  * is used for inserting kill_storage in the rewrite stage.
+ *
+ * With an offset planner, no token is reused during the traversal. Instead,
+ * the live interval of each token is recorded, and at the end of each block
+ * the tokens are packed into one arena token per device.
+ *
+ * When planning across blocks, the tokens are instead collected and killed
+ * (or packed into arenas) per SeqExpr, at the end of its last block.
  */
 class StorageAllocator : public StorageAllocatorBaseVisitor {
  public:
-  explicit StorageAllocator(std::unordered_map<const ExprNode*, Tokens> token_map) {
+  explicit StorageAllocator(std::unordered_map<const ExprNode*, Tokens> token_map,
+                            std::string offset_planner, PlanScope plan_scope)
+      : offset_planner_(std::move(offset_planner)) {
     this->token_map_ = std::move(token_map);
+    this->plan_scope_ = plan_scope;
   }
 
   void Allocate(const IRModule& mod) {
@@ -570,8 +785,23 @@ class StorageAllocator : public StorageAllocatorBaseVisitor {
       if (func == nullptr) {
         continue;
       }
+      if (plan_scope_ == PlanScope::kFunction) {
+        allocator_.SetAvailablePool({});
+      }
+      visible_tokens_.clear();
       this->VisitExpr_(func);
     }
+    // The arenas of the function bodies are shared across the module in the same way as
+    // the storages, by giving the arenas of each device the same size.
+    for (const auto& [device_index, arenas] : device2shared_arenas_) {
+      int64_t max_bytes = 0;
+      for (const StorageToken& arena : arenas) {
+        max_bytes = std::max(max_bytes, arena->bytes);
+      }
+      for (const StorageToken& arena : arenas) {
+        arena->bytes = max_bytes;
+      }
+    }
   }
 
   /*!
@@ -590,11 +820,66 @@ class StorageAllocator : public StorageAllocatorBaseVisitor {
 
   void VisitBindingBlock_(const BindingBlockNode* block) final {
     StorageAllocatorBaseVisitor::VisitBindingBlock_(block);
+    if (plan_scope_ != PlanScope::kBlock) {
+      return;
+    }
     // Sanity check: each token allocated inside the block should not be
     // referenced by anyone at the end of the block.
     for (const StorageTokenNode* token : block2tokens[block]) {
       ICHECK_EQ(token->ref_counter, 0);
     }
+    if (!offset_planner_.empty()) {
+      PlanArenas(&block2tokens[block], /*is_function_body=*/false);
+    }
+  }
+
+  void VisitExpr_(const SeqExprNode* seq) final {
+    seq_stack_.push_back(seq);
+    // The storages allocated inside the SeqExpr are not visible outside it.
+    std::unordered_set<const StorageTokenNode*> outer_visible_tokens = visible_tokens_;
+    ExprVisitor::VisitExpr_(seq);
+    ICHECK(seq_stack_.back() == seq);
+    seq_stack_.pop_back();
+    if (plan_scope_ == PlanScope::kBlock) {
+      return;
+    }
+    visible_tokens_ = std::move(outer_visible_tokens);
+
+    std::vector<const StorageTokenNode*> tokens = std::move(seq2tokens_[seq]);
+    seq2tokens_.erase(seq);
+    // Sanity check: each token allocated inside the SeqExpr should not be
+    // referenced by anyone at the end of the SeqExpr.
+    for (const StorageTokenNode* token : tokens) {
+      ICHECK_EQ(token->ref_counter, 0);
+    }
+    if (!offset_planner_.empty()) {
+      PlanArenas(&tokens, /*is_function_body=*/seq_stack_.empty());
+    }
+    if (!tokens.empty()) {
+      ICHECK(!seq->blocks.empty());
+      std::vector<const StorageTokenNode*>& block_tokens = block2tokens[seq->blocks.back().get()];
+      block_tokens.insert(block_tokens.end(), tokens.begin(), tokens.end());
+    }
+  }
+
+  void VisitExpr_(const IfNode* if_node) final {
+    if (plan_scope_ == PlanScope::kBlock) {
+      ExprVisitor::VisitExpr_(if_node);
+      return;
+    }
+    // Each branch may reuse the storages available before the If, but not the ones
+    // allocated in the other branch, which are killed at the end of that branch.
+    this->VisitExpr(if_node->cond);
+    TokenAllocator1D::AvailablePool pool = allocator_.GetAvailablePool();
+    this->VisitExpr(if_node->true_branch);
+    allocator_.SetAvailablePool(pool);
+    this->VisitExpr(if_node->false_branch);
+    allocator_.SetAvailablePool(pool);
+  }
+
+  void VisitBinding(const Binding& binding) final {
+    StorageAllocatorBaseVisitor::VisitBinding(binding);
+    ++num_bindings_;
   }
 
   void VisitBinding_(const VarBindingNode* binding, const CallNode* call) final {
@@ -610,11 +895,24 @@ class StorageAllocator : public StorageAllocatorBaseVisitor {
       }
       ICHECK(it->second.IsLeaf());
       StorageToken new_token = this->RequestReuseOrAlloc(it->second.LeafValue());
+      if (!offset_planner_.empty()) {
+        int64_t device_index = Downcast<PrimValue>(call->args[2])->value.as<IntImmNode>()->value;
+        token2interval_[new_token.get()] = {device_index, num_bindings_, num_bindings_};
+      }
 
       // Record that this alloc_tensor is using the token.
       alloc_tensor2token.insert({call, new_token});
       token2cur_tensor_[new_token.get()].push_back(binding->var);
       SetTokens(call, Tokens(new_token));
+      if (plan_scope_ != PlanScope::kBlock) {
+        // Record that the token is allocated in the current SeqExpr, unless its
+        // storage is already allocated in an enclosing one.
+        if (visible_tokens_.insert(new_token.get()).second) {
+          ICHECK(!seq_stack_.empty());
+          seq2tokens_[seq_stack_.back()].push_back(new_token.get());
+        }
+        return;
+      }
       // Record that the token is allocated in the current block.
       ICHECK(!block_stack_.empty());
       std::vector<const StorageTokenNode*>& block_tokens = block2tokens[block_stack_.back()];
@@ -651,6 +949,10 @@ class StorageAllocator : public StorageAllocatorBaseVisitor {
 
   /*! \brief Request a storage reuse, or allocate storage if no appropriate storage is reusable. */
   StorageToken RequestReuseOrAlloc(StorageToken prototype) {
+    if (!offset_planner_.empty()) {
+      // The tokens share an arena instead, after their live intervals are known.
+      return allocator_.Alloc(prototype, this->n_storage_++);
+    }
     Optional<StorageToken> token = allocator_.RequestReuse(prototype);
     if (!token.defined()) {
       return allocator_.Alloc(prototype, this->n_storage_++);
@@ -672,7 +974,11 @@ class StorageAllocator : public StorageAllocatorBaseVisitor {
     ICHECK_GE(token->ref_counter, 0);
 
     if (token->ref_counter == 0) {
-      allocator_.Release(token);
+      if (offset_planner_.empty()) {
+        allocator_.Release(token);
+      } else {
+        token2interval_.at(token.get()).end = num_bindings_;
+      }
       auto it = token2cur_tensor_.find(token.get());
       ICHECK(it != token2cur_tensor_.end());
       // Record that the tensors that are using this token will be killed
@@ -683,8 +989,60 @@ class StorageAllocator : public StorageAllocatorBaseVisitor {
     }
   }
 
+  /*!
+   * \brief Pack the tokens allocated in a block (or SeqExpr) into one arena per device,
+   * and make the arenas the tokens to be killed at its end.
+   * \param scope_tokens The tokens allocated in the block, replaced with the arenas.
+   * \param is_function_body Whether the tokens are allocated in the body of a function.
+   */
+  void PlanArenas(std::vector<const StorageTokenNode*>* scope_tokens, bool is_function_body) {
+    std::map<int64_t, std::vector<const StorageTokenNode*>> device2tokens;
+    for (const StorageTokenNode* token : *scope_tokens) {
+      device2tokens[token2interval_.at(token).device_index].push_back(token);
+    }
+    scope_tokens->clear();
+    for (const auto& [device_index, tokens] : device2tokens) {
+      std::vector<OffsetPlanner::Item> items;
+      for (const StorageTokenNode* token : tokens) {
+        const LiveInterval& interval = token2interval_.at(token);
+        items.push_back({token->bytes, interval.start, interval.end});
+      }
+      int64_t arena_bytes = OffsetPlanner::Plan(&items, offset_planner_);
+      StorageToken arena({IntImm(DataType::Int(64), arena_bytes)}, DataType::UInt(8));
+      arena->storage_id = this->n_storage_++;
+      for (size_t i = 0; i < tokens.size(); ++i) {
+        StorageTokenNode* token = const_cast<StorageTokenNode*>(tokens[i]);
+        token->arena = arena;
+        token->offset = items[i].offset;
+      }
+      scope_tokens->push_back(arena.get());
+      if (plan_scope_ == PlanScope::kModule && is_function_body) {
+        device2shared_arenas_[device_index].push_back(arena);
+      }
+    }
+  }
+
+  /*! \brief The device and the live bindings of a token planned with offsets. */
+  struct LiveInterval {
+    int64_t device_index;
+    int start;
+    int end;
+  };
+
   /*! \brief Number of allocated storages. */
   int n_storage_{0};
+  /*! \brief The offset planning strategy, or empty if the storages are reused whole. */
+  std::string offset_planner_;
+  /*! \brief The number of bindings visited, which orders the live intervals. */
+  int num_bindings_{0};
+  /*! \brief The tokens allocated in each SeqExpr being visited, when planning across blocks. */
+  std::unordered_map<const SeqExprNode*, std::vector<const StorageTokenNode*>> seq2tokens_;
+  /*! \brief The tokens whose storages are allocated in the SeqExprs being visited. */
+  std::unordered_set<const StorageTokenNode*> visible_tokens_;
+  /*! \brief The arenas of the function bodies on each device, when planning the module. */
+  std::map<int64_t, std::vector<StorageToken>> device2shared_arenas_;
+  /*! \brief The live interval of each token planned with offsets. */
+  std::unordered_map<const StorageTokenNode*, LiveInterval> token2interval_;
   /*! \brief The 1D memory allocator. */
   TokenAllocator1D allocator_;
   /*! \brief The mapping from each token to the tensors that are currently using it. */
@@ -770,7 +1128,9 @@ class StorageAllocationRewriter : public ExprMutator {
 
       // If the token is visited for the first time, create a storage variable using
       // `memory.alloc_storage` for it.
-      StorageToken token = it->second;
+      // The tokens planned with offsets share the storage of their arena.
+      StorageToken token =
+          it->second->arena.defined() ? Downcast<StorageToken>(it->second->arena) : it->second;
       Var storage_var{nullptr};
       auto it_token = token2storage_var_.find(token.get());
       if (it_token == token2storage_var_.end()) {
@@ -791,7 +1151,7 @@ class StorageAllocationRewriter : public ExprMutator {
 
       // And always create a `memory.alloc_tensor` for the old `builtin.alloc_tensor`.
       static const Op& mem_alloc_tensor = Op::Get("relax.memory.alloc_tensor");
-      PrimValue offset = PrimValue::Int64(0);
+      PrimValue offset = PrimValue::Int64(it->second->offset);
       DataType dtype = sinfo->dtype;
       return Call(mem_alloc_tensor, {storage_var, offset, sinfo->shape.value(), DataTypeImm(dtype)},
                   Attrs());
@@ -800,6 +1160,14 @@ class StorageAllocationRewriter : public ExprMutator {
     return ExprMutator::VisitExpr_(call);
   }
 
+  Expr VisitExpr_(const SeqExprNode* seq) final {
+    // The storage vars defined inside the SeqExpr are not visible outside it.
+    std::unordered_map<const StorageTokenNode*, Var> outer_storage_vars = token2storage_var_;
+    Expr new_seq = ExprMutator::VisitExpr_(seq);
+    token2storage_var_ = std::move(outer_storage_vars);
+    return new_seq;
+  }
+
   /*!
    * \brief The mapping from each memory-reusable `builtin.alloc_tensor` to
    its corresponding underlying storage token that it is using.
@@ -813,11 +1181,54 @@ class StorageAllocationRewriter : public ExprMutator {
   std::unordered_map<const StorageTokenNode*, Var> token2storage_var_;
 };
 
-IRModule StaticPlanBlockMemory(IRModule mod) {
+/*!
+ * \brief Check whether the tensors of a target can be allocated at byte offsets of a storage.
+ * \details The offsets are added to the data pointer of the storage, which is an opaque
+ * handle rather than an address on devices such as OpenCL, Vulkan and Metal.
+ * \param target The target, or an undefined target if unknown.
+ */
+bool SupportsStorageOffsets(const Target& target) {
+  if (!target.defined()) {
+    return false;
+  }
+  switch (target->GetTargetDeviceType()) {
+    case kDLCPU:
+    case kDLCUDA:
+    case kDLCUDAHost:
+    case kDLCUDAManaged:
+    case kDLROCM:
+    case kDLROCMHost:
+      return true;
+    default:
+      return false;
+  }
+}
+
+IRModule StaticPlanBlockMemory(IRModule mod, std::string offset_planner, std::string scope) {
+  CHECK(offset_planner.empty() || OffsetPlanner::IsValidStrategy(offset_planner))
+      << "ValueError: Unknown offset planner " << offset_planner
+      << ", expected one of greedy_by_size, best_fit and auto";
+  if (!offset_planner.empty() && !SupportsStorageOffsets(Target::Current(true))) {
+    LOG(WARNING) << "The offset planner " << offset_planner
+                 << " is ignored, as the target does not support storage offsets. The storages "
+                    "are reused whole";
+    offset_planner.clear();
+  }
+  PlanScope plan_scope = PlanScope::kBlock;
+  if (scope == "function") {
+    plan_scope = PlanScope::kFunction;
+  } else if (scope == "module") {
+    plan_scope = PlanScope::kModule;
+  } else {
+    CHECK(scope.empty() || scope == "block")
+        << "ValueError: Unknown memory planning scope " << scope
+        << ", expected one of block, function and module";
+  }
   // Step 1. Initialize.
-  std::unordered_map<const ExprNode*, Tokens> token_map = StorageAllocatorInit::Initialize(mod);
+  std::unordered_map<const ExprNode*, Tokens> token_map =
+      StorageAllocatorInit::Initialize(mod, plan_scope);
   // Step 2. Collect the memory allocation info.
-  StorageAllocator allocator(std::move(token_map));
+  StorageAllocator allocator(std::move(token_map), std::move(offset_planner), plan_scope);
   allocator.Allocate(mod);
   // Step 3. Rewrite the function.
   StorageAllocationRewriter rewriter(std::move(mod),  //
@@ -831,7 +1242,12 @@ namespace transform {
 
 Pass StaticPlanBlockMemory() {
   runtime::TypedPackedFunc<IRModule(IRModule, PassContext)> pass_func =
-      [=](IRModule m, PassContext pc) { return relax::StaticPlanBlockMemory(std::move(m)); };
+      [=](IRModule m, PassContext pc) {
+        String offset_planner =
+            pc->GetConfig<String>("relax.memory_plan.offset_planner").value_or("");
+        String scope = pc->GetConfig<String>("relax.memory_plan.scope").value_or("");
+        return relax::StaticPlanBlockMemory(std::move(m), offset_planner, scope);
+      };
   return CreateModulePass(pass_func, /*opt_level=*/0, "StaticPlanBlockMemory", {});
 }
 
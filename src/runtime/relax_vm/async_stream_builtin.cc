@@ -0,0 +1,248 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * \file src/runtime/relax_vm/async_stream_builtin.cc
+ * \brief The builtin functions for running independent kernels of the Relax virtual machine
+ *  concurrently on multiple streams.
+ *
+ * Each stream is a worker thread with its own device stream. The launches of a stream run in
+ * order. The dependencies between streams are explicit wait instructions, which the
+ * AssignAsyncStreams pass inserts, and the VM thread waits for all the streams at a sync.
+ * On CPU, the workers split the threads of the VM thread among their own thread pools.
+ */
+
+#include <dmlc/thread_local.h>
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+#include <tvm/runtime/relax_vm/vm.h>
+#include <tvm/runtime/threading_backend.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+/*! \brief The streams of the kernels launched by a VM thread. */
+class AsyncStreamPool {
+ public:
+  ~AsyncStreamPool() {
+    for (auto& stream : streams_) {
+      {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->shutdown = true;
+      }
+      stream->cv.notify_all();
+      stream->thread.join();
+    }
+  }
+
+  static AsyncStreamPool* Get() { return dmlc::ThreadLocalStore<AsyncStreamPool>::Get(); }
+
+  /*!
+   * \brief Launch a function on a stream.
+   * \param dev The device the function runs on.
+   * \param stream_id The stream.
+   * \param func The function to launch.
+   * \param args The arguments of the function, which are kept alive until it finishes.
+   */
+  void Launch(Device dev, int64_t stream_id, PackedFunc func, std::vector<TVMRetValue> args) {
+    Stream* stream = GetStream(dev, stream_id);
+    Enqueue(stream, [func, args = std::move(args)]() {
+      std::vector<TVMValue> values(args.size());
+      std::vector<int> tcodes(args.size());
+      TVMArgsSetter setter(values.data(), tcodes.data());
+      for (size_t i = 0; i < args.size(); ++i) {
+        setter(i, args[i]);
+      }
+      TVMRetValue rv;
+      func.CallPacked(TVMArgs(values.data(), tcodes.data(), values.size()), &rv);
+    });
+  }
+
+  /*!
+   * \brief Make a stream wait for everything launched on another stream so far.
+   * \param dev The device of the streams.
+   * \param dst_id The stream that waits.
+   * \param src_id The stream waited for.
+   */
+  void Wait(Device dev, int64_t dst_id, int64_t src_id) {
+    Stream* dst = GetStream(dev, dst_id);
+    Stream* src = GetStream(dev, src_id);
+    uint64_t target = src->num_enqueued;
+    Enqueue(dst, [dev, dst, src, target]() {
+      {
+        std::unique_lock<std::mutex> lock(src->mutex);
+        src->done_cv.wait(lock, [&]() { return src->num_done >= target; });
+      }
+      // the host side of the source launches has finished, order the device side.
+      DeviceAPI::Get(dev)->SyncStreamFromTo(dev, src->device_stream, dst->device_stream);
+    });
+  }
+
+  /*! \brief Wait for everything launched on all the streams, and rethrow the first error. */
+  void Sync() {
+    std::string error;
+    for (auto& stream : streams_) {
+      std::unique_lock<std::mutex> lock(stream->mutex);
+      stream->done_cv.wait(lock, [&]() { return stream->num_done >= stream->num_enqueued; });
+      if (error.empty()) {
+        error = stream->error;
+      }
+      stream->error.clear();
+    }
+    for (auto& stream : streams_) {
+      DeviceAPI::Get(stream->device)->StreamSync(stream->device, stream->device_stream);
+    }
+    if (!error.empty()) {
+      LOG(FATAL) << error;
+    }
+  }
+
+ private:
+  /*! \brief A stream, served by a worker thread. */
+  struct Stream {
+    Device device;
+    TVMStreamHandle device_stream{nullptr};
+    /*! \brief The max number of threads of the kernels launched on the stream, on CPU. */
+    int max_concurrency{1};
+    std::thread thread;
+    std::mutex mutex;
+    /*! \brief Signaled when a task is enqueued or on shutdown. */
+    std::condition_variable cv;
+    /*! \brief Signaled when a task is done. */
+    std::condition_variable done_cv;
+    std::deque<std::function<void()>> tasks;
+    /*! \brief The number of tasks enqueued, only written by the VM thread. */
+    uint64_t num_enqueued{0};
+    /*! \brief The number of tasks done. */
+    uint64_t num_done{0};
+    /*! \brief The first error of the tasks since the last sync. */
+    std::string error;
+    bool shutdown{false};
+  };
+
+  Stream* GetStream(Device dev, int64_t stream_id) {
+    CHECK_GE(stream_id, 0) << "ValueError: Invalid stream " << stream_id;
+    // The threads of the VM thread are split among the streams, of which there are at least two.
+    // A stream created before one of a larger id keeps its larger share.
+    int num_streams = static_cast<int>(std::max<int64_t>(2, stream_id + 1));
+    int max_concurrency = std::max(1, threading::MaxConcurrency() / num_streams);
+    while (static_cast<int64_t>(streams_.size()) <= stream_id) {
+      auto stream = std::make_unique<Stream>();
+      stream->device = dev;
+      stream->max_concurrency = max_concurrency;
+      stream->device_stream = DeviceAPI::Get(dev)->CreateStream(dev);
+      Stream* ptr = stream.get();
+      ptr->thread = std::thread([ptr]() { RunWorker(ptr); });
+      streams_.push_back(std::move(stream));
+    }
+    Stream* stream = streams_[stream_id].get();
+    CHECK(stream->device.device_type == dev.device_type &&
+          stream->device.device_id == dev.device_id)
+        << "ValueError: Stream " << stream_id << " is on " << stream->device
+        << ", but launched on " << dev;
+    return stream;
+  }
+
+  void Enqueue(Stream* stream, std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(stream->mutex);
+      stream->tasks.push_back(std::move(task));
+      ++stream->num_enqueued;
+    }
+    stream->cv.notify_one();
+  }
+
+  static void RunWorker(Stream* stream) {
+    // kernels launched from this thread go to the device stream of the stream.
+    DeviceAPI::Get(stream->device)->SetStream(stream->device, stream->device_stream);
+    if (stream->device.device_type == kDLCPU) {
+      // The max concurrency is per thread, and sizes the thread pool this thread creates for the
+      // parallel kernels, so that the streams do not each start one thread per core.
+      threading::SetMaxConcurrency(stream->max_concurrency);
+    }
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(stream->mutex);
+        stream->cv.wait(lock, [&]() { return stream->shutdown || !stream->tasks.empty(); });
+        if (stream->tasks.empty()) break;
+        task = std::move(stream->tasks.front());
+        stream->tasks.pop_front();
+      }
+      std::string error;
+      try {
+        task();
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+      {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (!error.empty() && stream->error.empty()) {
+          stream->error = std::move(error);
+        }
+        ++stream->num_done;
+      }
+      stream->done_cv.notify_all();
+    }
+    DeviceAPI::Get(stream->device)->FreeStream(stream->device, stream->device_stream);
+  }
+
+  std::vector<std::unique_ptr<Stream>> streams_;
+};
+
+TVM_REGISTER_GLOBAL("vm.builtin.async_stream.launch").set_body([](TVMArgs args, TVMRetValue* rv) {
+  ICHECK_GE(args.size(), 3);
+  VirtualMachine* vm = VirtualMachine::GetContextPtr(args[0]);
+  int64_t stream_id = args[1];
+  ObjectRef func = args[2];
+  CHECK(func->IsInstance<PackedFuncObj>())
+      << "TypeError: Only PackedFunc can be launched on a stream, but got " << func->GetTypeKey();
+  std::vector<TVMRetValue> func_args(args.size() - 3);
+  for (int i = 3; i < args.size(); ++i) {
+    func_args[i - 3] = args[i];
+  }
+  AsyncStreamPool::Get()->Launch(vm->devices[0], stream_id, Downcast<PackedFunc>(func),
+                                 std::move(func_args));
+});
+
+TVM_REGISTER_GLOBAL("vm.builtin.async_stream.wait")
+    .set_body_typed([](TVMArgValue vm_ptr, int64_t dst_stream, int64_t src_stream) {
+      VirtualMachine* vm = VirtualMachine::GetContextPtr(vm_ptr);
+      AsyncStreamPool::Get()->Wait(vm->devices[0], dst_stream, src_stream);
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.async_stream.sync").set_body_typed([](TVMArgValue vm_ptr) {
+  AsyncStreamPool::Get()->Sync();
+});
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
@@ -0,0 +1,341 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * \file tvm/runtime/relax_vm/best_fit_allocator.h
+ * \brief An allocator that caches device memory in segments, carves blocks
+ *  out of them with best fit, and coalesces freed neighbouring blocks.
+ *
+ * Unlike the pooled allocator, a freed block can serve any request that is
+ * not larger than it, which keeps memory bounded when shapes are dynamic.
+ */
+#ifndef TVM_RUNTIME_RELAX_VM_BEST_FIT_ALLOCATOR_H_
+#define TVM_RUNTIME_RELAX_VM_BEST_FIT_ALLOCATOR_H_
+
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/relax_vm/memory_manager.h>
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+class BestFitAllocator final : public Allocator {
+ public:
+  /*! \brief All block sizes are multiples of this size. */
+  static constexpr size_t kRoundSize = 512;
+  /*! \brief Requests up to this size are small, and share small segments. */
+  static constexpr size_t kSmallSize = 1 << 20;
+  /*! \brief The size of the segments for small requests. */
+  static constexpr size_t kSmallSegmentSize = 2 << 20;
+  /*! \brief The segments for large requests are rounded to multiples of this size. */
+  static constexpr size_t kLargeSegmentRoundSize = 2 << 20;
+
+  /*! \brief The statistics of the allocator. */
+  struct Stats {
+    /*! \brief The bytes held from the device. */
+    size_t reserved_bytes{0};
+    /*! \brief The bytes of the blocks handed out. */
+    size_t allocated_bytes{0};
+    size_t peak_reserved_bytes{0};
+    size_t peak_allocated_bytes{0};
+    size_t num_segments{0};
+    size_t num_allocs{0};
+    /*! \brief The number of allocations served from cached memory. */
+    size_t num_cache_hits{0};
+    size_t num_device_allocs{0};
+    size_t num_device_frees{0};
+  };
+
+  /*!
+   * \param dev The device.
+   * \param budget The high-water mark of reserved bytes, above which the
+   *        least recently used free segments are returned to the device.
+   */
+  explicit BestFitAllocator(Device dev, size_t budget = std::numeric_limits<size_t>::max())
+      : Allocator(kBestFit), device_(dev), budget_(budget) {
+    // Carving blocks out of a segment needs pointer arithmetic on device
+    // pointers, which is only valid on devices with a flat address space.
+    splittable_ = dev.device_type == kDLCPU || dev.device_type == kDLCUDA ||
+                  dev.device_type == kDLCUDAHost || dev.device_type == kDLCUDAManaged ||
+                  dev.device_type == kDLROCM;
+  }
+
+  ~BestFitAllocator() { ReleaseFreeSegments(0); }
+
+  Buffer Alloc(size_t nbytes, size_t alignment, DLDataType type_hint) override {
+    std::lock_guard<std::mutex> lock(mu_);
+    size_t size = RoundUp(std::max<size_t>(nbytes, 1), kRoundSize);
+    bool is_small = size <= kSmallSize;
+    ++stats_.num_allocs;
+
+    Block* block = nullptr;
+    if (alignment <= kRoundSize) {
+      block = FindFreeBlock(size, is_small);
+    }
+    if (block != nullptr) {
+      ++stats_.num_cache_hits;
+    } else {
+      block = AllocSegment(size, is_small, alignment, type_hint);
+    }
+    if (splittable_) {
+      SplitBlock(block, size);
+    }
+
+    block->allocated = true;
+    allocated_blocks_[block->ptr] = block;
+    stats_.allocated_bytes += block->size;
+    stats_.peak_allocated_bytes = std::max(stats_.peak_allocated_bytes, stats_.allocated_bytes);
+
+    Buffer buf;
+    buf.device = device_;
+    buf.size = block->size;
+    buf.data = block->ptr;
+    return buf;
+  }
+
+  void Free(const Buffer& buffer) override {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = allocated_blocks_.find(buffer.data);
+    ICHECK(it != allocated_blocks_.end()) << "Freeing a buffer not allocated by this allocator";
+    Block* block = it->second;
+    allocated_blocks_.erase(it);
+    block->allocated = false;
+    stats_.allocated_bytes -= block->size;
+
+    // coalesce with the free neighbours
+    if (block->prev != nullptr && !block->prev->allocated) {
+      block = MergeBlocks(block->prev, block);
+    }
+    if (block->next != nullptr && !block->next->allocated) {
+      block = MergeBlocks(block, block->next);
+    }
+    block->last_used = ++clock_;
+    FreeBlocks(block->is_small).insert(block);
+
+    if (stats_.reserved_bytes > budget_) {
+      ReleaseFreeSegments(budget_);
+    }
+  }
+
+  /*!
+   * \brief Set the high-water mark of reserved bytes.
+   * \param budget The budget in bytes.
+   */
+  void SetBudget(size_t budget) {
+    std::lock_guard<std::mutex> lock(mu_);
+    budget_ = budget;
+    ReleaseFreeSegments(budget_);
+  }
+
+  /*! \brief Return all free segments to the device. */
+  void Trim() {
+    std::lock_guard<std::mutex> lock(mu_);
+    ReleaseFreeSegments(0);
+  }
+
+  Stats GetStats() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return stats_;
+  }
+
+  /*! \brief The statistics in json. */
+  std::string GetStatsJSON() {
+    Stats stats = GetStats();
+    std::ostringstream os;
+    os << "{\"reserved_bytes\": " << stats.reserved_bytes
+       << ", \"allocated_bytes\": " << stats.allocated_bytes
+       << ", \"peak_reserved_bytes\": " << stats.peak_reserved_bytes
+       << ", \"peak_allocated_bytes\": " << stats.peak_allocated_bytes
+       << ", \"num_segments\": " << stats.num_segments << ", \"num_allocs\": " << stats.num_allocs
+       << ", \"num_cache_hits\": " << stats.num_cache_hits
+       << ", \"num_device_allocs\": " << stats.num_device_allocs
+       << ", \"num_device_frees\": " << stats.num_device_frees << "}";
+    return os.str();
+  }
+
+ private:
+  /*!
+   * \brief A block of memory in a segment. The blocks of a segment
+   *  form a list in address order.
+   */
+  struct Block {
+    void* ptr{nullptr};
+    size_t size{0};
+    bool is_small{false};
+    bool allocated{false};
+    /*! \brief The logical time this block is last freed. */
+    uint64_t last_used{0};
+    Block* prev{nullptr};
+    Block* next{nullptr};
+  };
+
+  /*! \brief Order the free blocks by size, ties broken by address. */
+  struct BlockSizeLess {
+    bool operator()(const Block* lhs, const Block* rhs) const {
+      return std::make_pair(lhs->size, reinterpret_cast<uintptr_t>(lhs->ptr)) <
+             std::make_pair(rhs->size, reinterpret_cast<uintptr_t>(rhs->ptr));
+    }
+  };
+
+  using FreeBlockSet = std::set<Block*, BlockSizeLess>;
+
+  static size_t RoundUp(size_t size, size_t align) { return (size + align - 1) / align * align; }
+
+  FreeBlockSet& FreeBlocks(bool is_small) {
+    return is_small ? small_free_blocks_ : large_free_blocks_;
+  }
+
+  /*! \brief Take the smallest free block that fits, nullptr if there is none. */
+  Block* FindFreeBlock(size_t size, bool is_small) {
+    FreeBlockSet& free_blocks = FreeBlocks(is_small);
+    Block key;
+    key.size = size;
+    auto it = free_blocks.lower_bound(&key);
+    if (it == free_blocks.end()) return nullptr;
+    // Without splitting, do not waste a block much larger than the request.
+    if (!splittable_ && (*it)->size > size * 2) return nullptr;
+    Block* block = *it;
+    free_blocks.erase(it);
+    return block;
+  }
+
+  /*! \brief Allocate a new segment from the device, as a single block. */
+  Block* AllocSegment(size_t size, bool is_small, size_t alignment, DLDataType type_hint) {
+    size_t segment_size = size;
+    if (splittable_) {
+      segment_size = is_small ? kSmallSegmentSize : RoundUp(size, kLargeSegmentRoundSize);
+    }
+    if (budget_ >= segment_size) {
+      ReleaseFreeSegments(budget_ - segment_size);
+    }
+    // Blocks are multiples of kRoundSize, so a segment aligned to it keeps every block it is
+    // split into aligned for the requests reusing them.
+    alignment = std::max<size_t>(alignment, kRoundSize);
+    void* ptr = nullptr;
+    try {
+      ptr = DeviceAPI::Get(device_)->AllocDataSpace(device_, segment_size, alignment, type_hint);
+    } catch (InternalError& err) {
+      LOG(WARNING) << "BestFitAllocator got InternalError during allocation: " << err.message();
+      LOG(WARNING) << "Trying to release all free segments and reallocate...";
+      ReleaseFreeSegments(0);
+      ptr = DeviceAPI::Get(device_)->AllocDataSpace(device_, segment_size, alignment, type_hint);
+    }
+    ++stats_.num_device_allocs;
+    ++stats_.num_segments;
+    stats_.reserved_bytes += segment_size;
+    stats_.peak_reserved_bytes = std::max(stats_.peak_reserved_bytes, stats_.reserved_bytes);
+    DLOG(INFO) << "allocate segment " << segment_size << " B, reserved memory "
+               << stats_.reserved_bytes << " B";
+
+    Block* block = new Block();
+    block->ptr = ptr;
+    block->size = segment_size;
+    block->is_small = is_small;
+    return block;
+  }
+
+  /*! \brief Split the tail beyond size off the block, if it is worth keeping. */
+  void SplitBlock(Block* block, size_t size) {
+    size_t remaining = block->size - size;
+    if (remaining < (block->is_small ? kRoundSize : kSmallSize)) return;
+    Block* rest = new Block();
+    rest->ptr = static_cast<char*>(block->ptr) + size;
+    rest->size = remaining;
+    rest->is_small = block->is_small;
+    rest->last_used = ++clock_;
+    rest->prev = block;
+    rest->next = block->next;
+    if (block->next != nullptr) {
+      block->next->prev = rest;
+    }
+    block->next = rest;
+    block->size = size;
+    FreeBlocks(rest->is_small).insert(rest);
+  }
+
+  /*!
+   * \brief Merge two adjacent blocks, where at most one of them is in the free set.
+   * \return The merged block, which is not in the free set.
+   */
+  Block* MergeBlocks(Block* lhs, Block* rhs) {
+    FreeBlockSet& free_blocks = FreeBlocks(lhs->is_small);
+    free_blocks.erase(lhs);
+    free_blocks.erase(rhs);
+    lhs->size += rhs->size;
+    lhs->next = rhs->next;
+    if (rhs->next != nullptr) {
+      rhs->next->prev = lhs;
+    }
+    delete rhs;
+    return lhs;
+  }
+
+  /*!
+   * \brief Return the least recently used free segments to the device
+   *  until the reserved bytes are within the target.
+   */
+  void ReleaseFreeSegments(size_t target) {
+    while (stats_.reserved_bytes > target) {
+      // A free segment is a free block without neighbours.
+      Block* victim = nullptr;
+      for (FreeBlockSet* free_blocks : {&small_free_blocks_, &large_free_blocks_}) {
+        for (Block* block : *free_blocks) {
+          if (block->prev == nullptr && block->next == nullptr &&
+              (victim == nullptr || block->last_used < victim->last_used)) {
+            victim = block;
+          }
+        }
+      }
+      if (victim == nullptr) return;
+      FreeBlocks(victim->is_small).erase(victim);
+      DeviceAPI::Get(device_)->FreeDataSpace(device_, victim->ptr);
+      ++stats_.num_device_frees;
+      --stats_.num_segments;
+      stats_.reserved_bytes -= victim->size;
+      DLOG(INFO) << "release segment " << victim->size << " B, reserved memory "
+                 << stats_.reserved_bytes << " B";
+      delete victim;
+    }
+  }
+
+  Device device_;
+  size_t budget_;
+  bool splittable_;
+  uint64_t clock_{0};
+  Stats stats_;
+  FreeBlockSet small_free_blocks_;
+  FreeBlockSet large_free_blocks_;
+  std::unordered_map<void*, Block*> allocated_blocks_;
+  std::mutex mu_;
+};
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
+
+#endif  // TVM_RUNTIME_RELAX_VM_BEST_FIT_ALLOCATOR_H_
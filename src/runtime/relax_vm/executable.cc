@@ -22,13 +22,19 @@
  */
 
 #include <dmlc/memory_io.h>
+#include <tvm/runtime/device_api.h>
 #include <tvm/runtime/logging.h>
 #include <tvm/runtime/relax_vm/executable.h>
 #include <tvm/runtime/relax_vm/vm.h>
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <memory>
 #include <sstream>
 
+#include "../../support/mapped_file.h"
 #include "../file_utils.h"
 
 namespace tvm {
@@ -220,6 +226,10 @@ void Executable::SaveToBinary(dmlc::Stream* stream) {
 }
 
 void Executable::SaveToFile(const String& file_name, const String& format) {
+  if (format == "relax_snapshot") {
+    SaveSnapshot(file_name);
+    return;
+  }
   std::string data;
   dmlc::MemoryStringStream writer(&data);
   dmlc::SeekStream* strm = &writer;
@@ -263,6 +273,349 @@ Module Executable::LoadFromFile(const String& file_name) {
 TVM_REGISTER_GLOBAL("runtime.module.loadfile_relax.Executable")
     .set_body_typed(Executable::LoadFromFile);
 
+//-----------------------------------------------------------
+// Executable snapshot.
+//-----------------------------------------------------------
+/*!
+ * A snapshot consists of a SnapshotHeader at the beginning of the file,
+ * followed by the sections it points to, and the NDArray payloads. Every
+ * section and payload starts at a multiple of kSnapshotAlignment, so the
+ * records and arrays can be used in place from a memory mapping. The
+ * snapshot is in the native byte order, which the magic number checks.
+ */
+/*! \brief The magic number for the VM executable snapshot file. */
+constexpr uint64_t kTVMVMSnapshotMagic = 0xD225DE2F4214151E;
+/*! \brief The version of the snapshot layout. */
+constexpr uint32_t kSnapshotLayoutVersion = 1;
+/*! \brief The alignment of the sections and the NDArray payloads. */
+constexpr uint64_t kSnapshotAlignment = kAllocAlignment;
+
+/*! \brief A section of the snapshot, as a file offset and a number of elements. */
+struct SnapshotSection {
+  uint64_t offset;
+  uint64_t size;
+};
+
+/*! \brief A string, as an offset and a length in the string section. */
+struct SnapshotString {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t layout_version;
+  uint32_t alignment;
+  /*! \brief The total size of the file, to detect truncation. */
+  uint64_t file_size;
+  /*! \brief The RELAX_VM_VERSION of the bytecode. */
+  SnapshotString vm_version;
+  /*! \brief The function table, as SnapshotFuncRecord. */
+  SnapshotSection funcs;
+  /*! \brief The parameter names of the functions, as SnapshotString. */
+  SnapshotSection param_names;
+  /*! \brief The constant pool, as SnapshotConstantRecord. */
+  SnapshotSection constants;
+  /*! \brief The shapes of the NDArray and ShapeTuple constants, as int64_t. */
+  SnapshotSection shapes;
+  /*! \brief The instruction offsets, as Index. */
+  SnapshotSection instr_offset;
+  /*! \brief The instruction data, as ExecWord. */
+  SnapshotSection instr_data;
+  /*! \brief The string section, as char. */
+  SnapshotSection strings;
+};
+
+struct SnapshotFuncRecord {
+  int32_t kind;
+  int32_t reserved;
+  int64_t start_instr;
+  int64_t end_instr;
+  int64_t num_args;
+  int64_t register_file_size;
+  SnapshotString name;
+  /*! \brief The range of the parameter names in the param_names section. */
+  uint64_t param_names_begin;
+  uint64_t num_param_names;
+};
+
+struct SnapshotConstantRecord {
+  /*! \brief The ConstantType. */
+  int32_t type;
+  /*! \brief The dtype of kNDArray, or the value of kDLDataType. */
+  DLDataType dtype;
+  /*! \brief The value of kInt. */
+  int64_t value;
+  /*! \brief The range of the shape of kNDArray and kShapeTuple in the shapes section. */
+  uint64_t shape_begin;
+  uint64_t ndim;
+  /*!
+   * \brief The payload: the file offset of the data of kNDArray, or the
+   *  offset in the string section of kString.
+   */
+  uint64_t data_offset;
+  uint64_t nbytes;
+};
+
+inline uint64_t SnapshotRoundUp(uint64_t offset) {
+  return (offset + kSnapshotAlignment - 1) / kSnapshotAlignment * kSnapshotAlignment;
+}
+
+void Executable::SaveSnapshot(const String& file_name) {
+  std::string strings;
+  auto add_string = [&strings](const std::string& str) {
+    SnapshotString ret{strings.size(), str.size()};
+    strings += str;
+    return ret;
+  };
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kTVMVMSnapshotMagic;
+  header.layout_version = kSnapshotLayoutVersion;
+  header.alignment = kSnapshotAlignment;
+  header.vm_version = add_string(RELAX_VM_VERSION);
+
+  std::vector<SnapshotFuncRecord> funcs;
+  std::vector<SnapshotString> param_names;
+  for (const VMFuncInfo& info : func_table) {
+    SnapshotFuncRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.kind = static_cast<int32_t>(info.kind);
+    record.start_instr = info.start_instr;
+    record.end_instr = info.end_instr;
+    record.num_args = info.num_args;
+    record.register_file_size = info.register_file_size;
+    record.name = add_string(info.name);
+    record.param_names_begin = param_names.size();
+    record.num_param_names = info.param_names.size();
+    for (const std::string& param_name : info.param_names) {
+      param_names.push_back(add_string(param_name));
+    }
+    funcs.push_back(record);
+  }
+
+  std::vector<SnapshotConstantRecord> constant_records;
+  std::vector<int64_t> shapes;
+  // The NDArray constants, to be placed after the sections.
+  std::vector<std::pair<size_t, NDArray>> arrays;
+  for (const auto& it : this->constants) {
+    SnapshotConstantRecord record;
+    std::memset(&record, 0, sizeof(record));
+    if (it.IsObjectRef<runtime::NDArray>()) {
+      NDArray arr = it.operator NDArray();
+      if (arr->device.device_type != kDLCPU || !arr.IsContiguous()) {
+        arr = arr.CopyTo(DLDevice{kDLCPU, 0});
+      }
+      record.type = ConstantType::kNDArray;
+      record.dtype = arr->dtype;
+      record.shape_begin = shapes.size();
+      record.ndim = arr->ndim;
+      shapes.insert(shapes.end(), arr->shape, arr->shape + arr->ndim);
+      record.nbytes = GetDataSize(*arr.operator->());
+      arrays.emplace_back(constant_records.size(), arr);
+    } else if (it.IsObjectRef<ShapeTuple>()) {
+      ShapeTuple shape = it.operator ShapeTuple();
+      record.type = ConstantType::kShapeTuple;
+      record.shape_begin = shapes.size();
+      record.ndim = shape.size();
+      shapes.insert(shapes.end(), shape.begin(), shape.end());
+    } else if (it.IsObjectRef<String>()) {
+      SnapshotString str = add_string(it.operator String());
+      record.type = ConstantType::kString;
+      record.data_offset = str.offset;
+      record.nbytes = str.size;
+    } else if (it.type_code() == kDLInt) {
+      record.type = ConstantType::kInt;
+      record.value = it.value().v_int64;
+    } else {
+      try {
+        record.type = ConstantType::kDLDataType;
+        record.dtype = it.operator DLDataType();
+      } catch (std::exception& exc) {
+        LOG(FATAL) << "Constant pool can only contain NDArray, DLDataType, and Integers but got "
+                   << ArgTypeCode2Str(it.type_code());
+      }
+    }
+    constant_records.push_back(record);
+  }
+
+  // Lay out the sections, then the NDArray payloads.
+  uint64_t offset = SnapshotRoundUp(sizeof(SnapshotHeader));
+  auto place = [&offset](SnapshotSection* section, uint64_t size, uint64_t elem_size) {
+    section->offset = offset;
+    section->size = size;
+    offset = SnapshotRoundUp(offset + size * elem_size);
+  };
+  place(&header.funcs, funcs.size(), sizeof(SnapshotFuncRecord));
+  place(&header.param_names, param_names.size(), sizeof(SnapshotString));
+  place(&header.constants, constant_records.size(), sizeof(SnapshotConstantRecord));
+  place(&header.shapes, shapes.size(), sizeof(int64_t));
+  place(&header.instr_offset, instr_offset.size(), sizeof(Index));
+  place(&header.instr_data, instr_data.size(), sizeof(ExecWord));
+  place(&header.strings, strings.size(), sizeof(char));
+  for (const auto& kv : arrays) {
+    SnapshotConstantRecord& record = constant_records[kv.first];
+    record.data_offset = offset;
+    offset = SnapshotRoundUp(offset + record.nbytes);
+  }
+  header.file_size = offset;
+
+  std::ofstream fout(file_name, std::ios::binary);
+  CHECK(!fout.fail()) << "Cannot open " << file_name << " for writing";
+  uint64_t written = 0;
+  auto write_at = [&](uint64_t at, const void* data, uint64_t nbytes) {
+    ICHECK_LE(written, at);
+    static const char kPadding[kSnapshotAlignment] = {0};
+    while (written < at) {
+      uint64_t num_padding = std::min<uint64_t>(at - written, kSnapshotAlignment);
+      fout.write(kPadding, num_padding);
+      written += num_padding;
+    }
+    fout.write(static_cast<const char*>(data), nbytes);
+    written += nbytes;
+  };
+  write_at(0, &header, sizeof(header));
+  write_at(header.funcs.offset, funcs.data(), funcs.size() * sizeof(SnapshotFuncRecord));
+  write_at(header.param_names.offset, param_names.data(),
+           param_names.size() * sizeof(SnapshotString));
+  write_at(header.constants.offset, constant_records.data(),
+           constant_records.size() * sizeof(SnapshotConstantRecord));
+  write_at(header.shapes.offset, shapes.data(), shapes.size() * sizeof(int64_t));
+  write_at(header.instr_offset.offset, instr_offset.data(), instr_offset.size() * sizeof(Index));
+  write_at(header.instr_data.offset, instr_data.data(), instr_data.size() * sizeof(ExecWord));
+  write_at(header.strings.offset, strings.data(), strings.size());
+  for (const auto& kv : arrays) {
+    const SnapshotConstantRecord& record = constant_records[kv.first];
+    const DLTensor* tensor = kv.second.operator->();
+    write_at(record.data_offset, static_cast<const char*>(tensor->data) + tensor->byte_offset,
+             record.nbytes);
+  }
+  write_at(header.file_size, nullptr, 0);
+  CHECK(!fout.fail()) << "Failed to write " << file_name;
+}
+
+Module Executable::LoadSnapshot(const String& file_name) {
+  auto file = std::make_shared<support::MappedFile>(file_name);
+  const char* base = file->data();
+  CHECK_GE(file->size(), sizeof(SnapshotHeader)) << "Invalid VM snapshot file " << file_name;
+  const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(base);
+  STREAM_CHECK(header->magic == kTVMVMSnapshotMagic, "snapshot header");
+  STREAM_CHECK(header->layout_version == kSnapshotLayoutVersion, "snapshot header");
+  STREAM_CHECK(header->file_size == file->size(), "snapshot header");
+
+  // Whether the range [begin, begin + size) is within [0, limit), without overflowing.
+  auto in_range = [](uint64_t begin, uint64_t size, uint64_t limit) {
+    return begin <= limit && size <= limit - begin;
+  };
+  // Get a section as an array, checking that it is within the file.
+  auto section = [&](const SnapshotSection& sec, uint64_t elem_size, const char* name) {
+    STREAM_CHECK(sec.offset % kSnapshotAlignment == 0 && sec.offset <= header->file_size &&
+                     sec.size <= (header->file_size - sec.offset) / elem_size,
+                 name);
+    return base + sec.offset;
+  };
+  const char* strings = section(header->strings, sizeof(char), "string");
+  auto get_string = [&](const SnapshotString& str) {
+    STREAM_CHECK(in_range(str.offset, str.size, header->strings.size), "string");
+    return std::string(strings + str.offset, str.size);
+  };
+  STREAM_CHECK(get_string(header->vm_version) == RELAX_VM_VERSION, "version");
+
+  ObjectPtr<Executable> exec = make_object<Executable>();
+
+  // Global section.
+  auto* funcs = reinterpret_cast<const SnapshotFuncRecord*>(
+      section(header->funcs, sizeof(SnapshotFuncRecord), "Global Section"));
+  auto* param_names = reinterpret_cast<const SnapshotString*>(
+      section(header->param_names, sizeof(SnapshotString), "Global Section"));
+  exec->func_table.resize(header->funcs.size);
+  for (uint64_t i = 0; i < header->funcs.size; ++i) {
+    const SnapshotFuncRecord& record = funcs[i];
+    VMFuncInfo& info = exec->func_table[i];
+    info.kind = static_cast<VMFuncInfo::FuncKind>(record.kind);
+    info.name = get_string(record.name);
+    info.start_instr = record.start_instr;
+    info.end_instr = record.end_instr;
+    info.num_args = record.num_args;
+    info.register_file_size = record.register_file_size;
+    STREAM_CHECK(
+        in_range(record.param_names_begin, record.num_param_names, header->param_names.size),
+        "Global Section");
+    for (uint64_t j = 0; j < record.num_param_names; ++j) {
+      info.param_names.push_back(get_string(param_names[record.param_names_begin + j]));
+    }
+    exec->func_map[info.name] = i;
+  }
+
+  // Constant section.
+  auto* constants = reinterpret_cast<const SnapshotConstantRecord*>(
+      section(header->constants, sizeof(SnapshotConstantRecord), "constant"));
+  auto* shapes =
+      reinterpret_cast<const int64_t*>(section(header->shapes, sizeof(int64_t), "constant"));
+  for (uint64_t i = 0; i < header->constants.size; ++i) {
+    const SnapshotConstantRecord& record = constants[i];
+    auto get_shape = [&]() {
+      STREAM_CHECK(in_range(record.shape_begin, record.ndim, header->shapes.size), "constant");
+      return ShapeTuple(shapes + record.shape_begin, shapes + record.shape_begin + record.ndim);
+    };
+    TVMRetValue cell;
+    if (record.type == ConstantType::kNDArray) {
+      ShapeTuple shape = get_shape();
+      // The payload must hold the whole array, whose size must not overflow.
+      uint64_t elem_bytes = std::max((record.dtype.bits * record.dtype.lanes + 7) / 8, 1);
+      uint64_t max_elems = UINT64_MAX / elem_bytes;
+      for (int64_t dim : shape) {
+        STREAM_CHECK(dim >= 0 && (dim == 0 || max_elems / dim > 0), "constant");
+        max_elems = dim == 0 ? max_elems : max_elems / dim;
+      }
+      DLTensor tensor;
+      tensor.ndim = shape.size();
+      tensor.shape = const_cast<int64_t*>(shape.data());
+      tensor.dtype = record.dtype;
+      STREAM_CHECK(GetDataSize(tensor) == record.nbytes, "constant");
+      STREAM_CHECK(in_range(record.data_offset, record.nbytes, header->file_size), "constant");
+      const char* data = base + record.data_offset;
+      if (reinterpret_cast<uintptr_t>(data) % kAllocAlignment == 0) {
+        cell = support::MappedFile::CreateView(file, record.data_offset, shape,
+                                               DataType(record.dtype));
+      } else {
+        // The file is read into memory which is not aligned enough for a view.
+        NDArray arr = NDArray::Empty(shape, record.dtype, DLDevice{kDLCPU, 0});
+        arr.CopyFromBytes(data, record.nbytes);
+        cell = arr;
+      }
+    } else if (record.type == ConstantType::kShapeTuple) {
+      cell = get_shape();
+    } else if (record.type == ConstantType::kDLDataType) {
+      cell = record.dtype;
+    } else if (record.type == ConstantType::kString) {
+      cell = String(get_string(SnapshotString{record.data_offset, record.nbytes}));
+    } else if (record.type == ConstantType::kInt) {
+      cell = record.value;
+    } else {
+      LOG(FATAL) << "Constant pool can only contain NDArray and DLDataType, but got "
+                 << ArgTypeCode2Str(record.type) << " when loading the VM constant pool.";
+    }
+    exec->constants.push_back(cell);
+  }
+
+  // Code section.
+  auto* offsets = reinterpret_cast<const Index*>(
+      section(header->instr_offset, sizeof(Index), "instr offset"));
+  exec->instr_offset.assign(offsets, offsets + header->instr_offset.size);
+  auto* data = reinterpret_cast<const ExecWord*>(
+      section(header->instr_data, sizeof(ExecWord), "instr data"));
+  exec->instr_data.assign(data, data + header->instr_data.size);
+
+  return Module(exec);
+}
+
+TVM_REGISTER_GLOBAL("runtime.module.loadfile_relax_snapshot")
+    .set_body_typed([](String file_name, String format) {
+      return Executable::LoadSnapshot(file_name);
+    });
+
 void VMFuncInfo::Save(dmlc::Stream* strm) const {
   int32_t temp_kind = static_cast<int32_t>(kind);
   strm->Write(temp_kind);
@@ -20,7 +20,8 @@
  * \file src/runtime/relax_vm/lm_support.cc
  * \brief Runtime to support language model related task
  *
- * Including inplace attention kv cache for runtime and simple sampler.
+ * Including inplace attention kv cache, paged attention kv cache
+ * for runtime and simple sampler.
  *
  * This file provides a simple implementation of inplace attention
  * kv cache for relax runtime. The main goal here is to help us enable
@@ -35,6 +36,7 @@
  *
  * We can evolve this implementation as we build more LM verticals.
  */
+#include <tvm/runtime/c_backend_api.h>
 #include <tvm/runtime/container/shape_tuple.h>
 #include <tvm/runtime/device_api.h>
 #include <tvm/runtime/logging.h>
@@ -43,7 +45,18 @@
 #include <tvm/runtime/relax_vm/memory_manager.h>
 #include <tvm/runtime/relax_vm/vm.h>
 
+#include <algorithm>
 #include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace tvm {
 namespace runtime {
@@ -273,113 +286,633 @@ void AttentionKVCacheArrayClear(Array<AttentionKVCache> caches) {
 TVM_REGISTER_GLOBAL("vm.builtin.attention_kv_cache_array_clear")
     .set_body_typed(AttentionKVCacheArrayClear);
 
-// NOTE this is a built-in highly related to LM so we put it here.
-int SampleTopPFromLogits(NDArray logits, double temperature, double top_p, double uniform_sample) {
-  ICHECK(logits.IsContiguous());
-  ICHECK(logits.DataType() == DataType::Float(32));
+//-------------------------------------------------
+//  Paged attention kv cache
+//-------------------------------------------------
+/*!
+ * \brief An object representing a paged attention kv cache.
+ *
+ * Instead of one contiguous array per sequence, the cache owns a pool
+ * of fixed-size pages allocated once as an NDArray of shape
+ * (num_pages, page_size, *elem_shape). Every sequence keeps a block
+ * table that maps its slots to pages in the pool, so a sequence grows
+ * one page at a time without reallocation and returns its pages to
+ * the pool once it is removed.
+ *
+ * Sequences of different lengths can be appended to and viewed as one
+ * ragged batch, which enables continuous batching in the decode loop.
+ *
+ * Pages are reference counted so that sequences can share a prefix:
+ * a forked sequence references the pages of its parent, and a shared
+ * page is copied only when one of its owners writes into it. Full pages
+ * can further be kept in a prefix tree keyed by the tokens they hold,
+ * so that new sequences with a cached prefix skip recomputing it.
+ */
+class PagedKVCacheObj : public Object {
+ public:
+  /*! \brief The bookkeeping of one sequence in the cache. */
+  struct Sequence {
+    /*! \brief The block table, i.e. the pages holding the sequence in order. */
+    std::vector<int32_t> page_ids;
+    /*! \brief The number of slots already filled. */
+    int64_t seq_length{0};
+  };
 
-  if (logits->device.device_type != kDLCPU) {
-    logits = logits.CopyTo(DLDevice{kDLCPU, 0});
+  /*!
+   * \brief The page pool, of shape (num_pages, page_size, *elem_shape).
+   */
+  NDArray pages;
+
+  /*! \brief The number of slots in each page. */
+  int64_t page_size{0};
+
+  /*! \brief The shape of one slot. */
+  std::vector<int64_t> elem_shape;
+
+  /*! \brief The number of bytes of one slot. */
+  int64_t slot_nbytes{0};
+
+  /*! \brief The pages not used by any sequence or the prefix tree. */
+  std::vector<int32_t> free_page_ids;
+
+  /*! \brief The number of sequences and prefix tree nodes referencing each page. */
+  std::vector<int32_t> page_ref_counts;
+
+  /*! \brief The sequences in the cache, indexed by sequence id. */
+  std::unordered_map<int64_t, Sequence> seqs;
+
+  /*! \brief A node of the prefix tree, holding one full page of tokens. */
+  struct PrefixTreeNode {
+    /*! \brief The page holding the kv of the tokens, -1 for the root. */
+    int32_t page_id{-1};
+    /*! \brief The logical time of the last access, used for LRU eviction. */
+    int64_t last_access{0};
+    /*! \brief The children, indexed by the tokens of their page. */
+    std::map<std::vector<int64_t>, std::unique_ptr<PrefixTreeNode>> children;
+  };
+
+  /*! \brief The root of the prefix tree. */
+  PrefixTreeNode prefix_tree;
+
+  /*! \brief The logical clock of the prefix tree. */
+  int64_t prefix_tree_clock{0};
+
+  /*!
+   * \brief Add an empty sequence to the cache.
+   * \param seq_id The id of the new sequence.
+   */
+  void AddSequence(int64_t seq_id) {
+    CHECK(seqs.find(seq_id) == seqs.end())
+        << "The sequence " << seq_id << " is already in the KV cache.";
+    seqs[seq_id] = Sequence();
   }
 
-  ICHECK(logits->device.device_type == kDLCPU);
+  /*!
+   * \brief Remove a sequence and give its pages back to the pool.
+   * \param seq_id The id of the sequence to remove.
+   */
+  void RemoveSequence(int64_t seq_id) {
+    Sequence& seq = GetSequence(seq_id);
+    for (int32_t page_id : seq.page_ids) {
+      FreePage(page_id);
+    }
+    seqs.erase(seq_id);
+  }
 
-  for (int i = 0; i < logits->ndim - 1; ++i) {
-    ICHECK_EQ(logits->shape[i], 1) << "The leading dimensions of logits must be 1";
+  /*!
+   * \brief Add a sequence that shares the first slots of an existing sequence.
+   * \param parent_seq_id The id of the parent sequence.
+   * \param child_seq_id The id of the new sequence.
+   * \param fork_pos The number of slots to share, or -1 to share the whole parent.
+   * \note No value is copied. A shared page is copied when it is written to.
+   */
+  void ForkSequence(int64_t parent_seq_id, int64_t child_seq_id, int64_t fork_pos) {
+    const Sequence& parent = GetSequence(parent_seq_id);
+    if (fork_pos < 0) {
+      fork_pos = parent.seq_length;
+    }
+    CHECK_LE(fork_pos, parent.seq_length)
+        << "Cannot fork at position " << fork_pos << " of sequence " << parent_seq_id
+        << " of length " << parent.seq_length;
+    Sequence child;
+    child.page_ids.assign(parent.page_ids.begin(),
+                          parent.page_ids.begin() + CeilDiv(fork_pos, page_size));
+    child.seq_length = fork_pos;
+    AddSequence(child_seq_id);
+    for (int32_t page_id : child.page_ids) {
+      ++page_ref_counts[page_id];
+    }
+    seqs[child_seq_id] = std::move(child);
   }
 
-  std::vector<std::pair<float, int>> data;
-  data.resize(logits->shape[logits->ndim - 1]);
-  const float* plogits = static_cast<float*>(logits->data);
-  for (size_t i = 0; i < data.size(); ++i) {
-    data[i] = std::make_pair(plogits[i], static_cast<int>(i));
+  /*!
+   * \brief Insert the full pages of a sequence into the prefix tree.
+   * \param seq_id The id of the sequence.
+   * \param token_ids The tokens whose kv the first slots of the sequence hold.
+   */
+  void CachePrefix(int64_t seq_id, const ShapeTuple& token_ids) {
+    const Sequence& seq = GetSequence(seq_id);
+    CHECK_LE(static_cast<int64_t>(token_ids.size()), seq.seq_length)
+        << "The sequence " << seq_id << " holds fewer slots than the given tokens.";
+    PrefixTreeNode* node = &prefix_tree;
+    ++prefix_tree_clock;
+    for (int64_t i = 0; (i + 1) * page_size <= static_cast<int64_t>(token_ids.size()); ++i) {
+      std::vector<int64_t> key(token_ids.begin() + i * page_size,
+                               token_ids.begin() + (i + 1) * page_size);
+      std::unique_ptr<PrefixTreeNode>& child = node->children[key];
+      if (child == nullptr) {
+        child = std::make_unique<PrefixTreeNode>();
+        child->page_id = seq.page_ids[i];
+        ++page_ref_counts[child->page_id];
+      }
+      child->last_access = prefix_tree_clock;
+      node = child.get();
+    }
   }
 
-  auto fcmp = [](const std::pair<float, int>& lhs, const std::pair<float, int>& rhs) {
-    return lhs.first > rhs.first;
-  };
-  // sort by logits from largest to smallest
-  std::sort(data.begin(), data.end(), fcmp);
+  /*!
+   * \brief Fill an empty sequence with the longest prefix of tokens found in the prefix tree.
+   * \param seq_id The id of the sequence.
+   * \param token_ids The tokens of the sequence.
+   * \return The number of slots filled, which is a multiple of the page size.
+   *         The kv of the remaining tokens need to be computed and appended.
+   */
+  int64_t MatchPrefix(int64_t seq_id, const ShapeTuple& token_ids) {
+    Sequence& seq = GetSequence(seq_id);
+    CHECK_EQ(seq.seq_length, 0) << "Only empty sequences can match the prefix tree.";
+    PrefixTreeNode* node = &prefix_tree;
+    ++prefix_tree_clock;
+    for (int64_t i = 0; (i + 1) * page_size <= static_cast<int64_t>(token_ids.size()); ++i) {
+      std::vector<int64_t> key(token_ids.begin() + i * page_size,
+                               token_ids.begin() + (i + 1) * page_size);
+      auto it = node->children.find(key);
+      if (it == node->children.end()) break;
+      node = it->second.get();
+      node->last_access = prefix_tree_clock;
+      seq.page_ids.push_back(node->page_id);
+      ++page_ref_counts[node->page_id];
+      seq.seq_length += page_size;
+    }
+    return seq.seq_length;
+  }
 
-  // argmax
-  if (temperature < 1e-6f) {
-    return data[0].second;
+  /*! \brief Drop all pages held by the prefix tree. */
+  void ClearPrefixCache() {
+    std::function<void(PrefixTreeNode*)> fvisit = [&](PrefixTreeNode* node) {
+      for (auto& kv : node->children) {
+        fvisit(kv.second.get());
+        FreePage(kv.second->page_id);
+      }
+      node->children.clear();
+    };
+    fvisit(&prefix_tree);
   }
 
-  // compute expf scaled by temp
-  float sum = 0.0f, logit_scale = 1.0f / temperature;
-  float max_value = data[0].first;
-  for (auto it = data.begin(); it != data.end(); ++it) {
-    it->first = expf((it->first - max_value) * logit_scale);
-    sum += it->first;
+  /*!
+   * \brief Append value to the end of a sequence.
+   * \param seq_id The id of the sequence.
+   * \param value The value to be appended, of shape (n, *elem_shape).
+   */
+  void Append(int64_t seq_id, NDArray value) {
+    CheckValue(value);
+    Sequence& seq = GetSequence(seq_id);
+    ReserveFreePages(NumNewPages(seq, value->shape[0]));
+    AppendSlots(&seq, value.operator->(), 0, value->shape[0]);
   }
 
-  // do a cumsum in order of data
-  float cum_sum_prob = 0.0f;
-  float top_p_sum = 0.0f;
-  for (auto it = data.begin(); it != data.end(); ++it) {
-    float prob = it->first / sum;
-    if (cum_sum_prob < top_p) {
-      top_p_sum += prob;
+  /*!
+   * \brief Append ragged values to a batch of sequences at once.
+   * \param seq_ids The ids of the sequences.
+   * \param value The values to be appended, of shape (sum_len, *elem_shape).
+   * \param append_indptr The offsets of the values of each sequence in value,
+   *        i.e. the slots [append_indptr[i], append_indptr[i + 1]) go to seq_ids[i].
+   */
+  void BatchAppend(const ShapeTuple& seq_ids, NDArray value, const ShapeTuple& append_indptr) {
+    CheckValue(value);
+    CHECK_EQ(append_indptr.size(), seq_ids.size() + 1)
+        << "The append indptr must have one more element than the sequence ids.";
+    CHECK_EQ(append_indptr[0], 0) << "The append indptr must start from 0.";
+    CHECK_EQ(append_indptr.back(), value->shape[0])
+        << "The append indptr must end at the number of appended slots.";
+    // Check all sequences before copying, so that a failed append leaves the cache unchanged.
+    std::vector<Sequence*> batch;
+    int64_t num_new_pages = 0;
+    for (size_t i = 0; i < seq_ids.size(); ++i) {
+      CHECK_LE(append_indptr[i], append_indptr[i + 1]) << "The append indptr must be ascending.";
+      batch.push_back(&GetSequence(seq_ids[i]));
+      num_new_pages += NumNewPages(*batch.back(), append_indptr[i + 1] - append_indptr[i]);
+    }
+    CHECK_EQ(std::set<Sequence*>(batch.begin(), batch.end()).size(), batch.size())
+        << "The sequence ids of a batched append must be unique.";
+    ReserveFreePages(num_new_pages);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      AppendSlots(batch[i], value.operator->(), append_indptr[i],
+                  append_indptr[i + 1] - append_indptr[i]);
     }
-    cum_sum_prob += prob;
-    it->first = cum_sum_prob;
   }
-  // pick a number based on random in (0, 1)
-  for (auto it = data.begin(); it != data.end(); ++it) {
-    if (uniform_sample < it->first / top_p_sum) {
-      return it->second;
+
+  /*!
+   * \brief Pop n entries from the end of a sequence.
+   * \param seq_id The id of the sequence.
+   * \param n The number of entries to pop.
+   */
+  void PopN(int64_t seq_id, int64_t n) {
+    Sequence& seq = GetSequence(seq_id);
+    CHECK_LE(n, seq.seq_length) << "Cannot pop " << n << " entries from sequence " << seq_id
+                                << " of length " << seq.seq_length;
+    seq.seq_length -= n;
+    while (static_cast<int64_t>(seq.page_ids.size()) > CeilDiv(seq.seq_length, page_size)) {
+      FreePage(seq.page_ids.back());
+      seq.page_ids.pop_back();
     }
   }
-  ICHECK_LE(uniform_sample, data[0].first);
-  return data[0].second;
-}
 
-TVM_REGISTER_GLOBAL("vm.builtin.sample_top_p_from_logits").set_body_typed(SampleTopPFromLogits);
+  /*!
+   * \brief Gather all cached values of a sequence into one array.
+   * \param seq_id The id of the sequence.
+   * \return The values, of shape (seq_length, *elem_shape).
+   * \note This copies the values out of the pages. Kernels that are aware of
+   *       paging should read the pages through the block table instead.
+   */
+  NDArray View(int64_t seq_id) { return BatchView(ShapeTuple({seq_id}))[0]; }
 
-int SampleTopPFromProb(NDArray prob, double top_p, double uniform_sample) {
-  ICHECK(prob.IsContiguous());
-  ICHECK(prob.DataType() == DataType::Float(32));
+  /*!
+   * \brief Gather the cached values of a batch of sequences into one ragged array.
+   * \param seq_ids The ids of the sequences.
+   * \return The ragged values of shape (sum_len, *elem_shape), and the int32
+   *         indptr of shape (num_seqs + 1,) locating each sequence in them.
+   */
+  Array<NDArray> BatchView(const ShapeTuple& seq_ids) {
+    std::vector<int32_t> seq_indptr{0};
+    for (int64_t seq_id : seq_ids) {
+      seq_indptr.push_back(seq_indptr.back() + GetSequence(seq_id).seq_length);
+    }
+    std::vector<int64_t> shape{seq_indptr.back()};
+    shape.insert(shape.end(), elem_shape.begin(), elem_shape.end());
+    NDArray data = NDArray::Empty(shape, pages->dtype, pages->device);
+    for (size_t i = 0; i < seq_ids.size(); ++i) {
+      const Sequence& seq = GetSequence(seq_ids[i]);
+      for (int64_t begin = 0; begin < seq.seq_length; begin += page_size) {
+        int32_t page_id = seq.page_ids[begin / page_size];
+        CopySlots(pages.operator->(), page_id * page_size, data.operator->(),
+                  seq_indptr[i] + begin, std::min(page_size, seq.seq_length - begin));
+      }
+    }
+    return {data, ToDeviceInt32Array(seq_indptr)};
+  }
 
-  if (prob->device.device_type != kDLCPU) {
-    prob = prob.CopyTo(DLDevice{kDLCPU, 0});
+  /*!
+   * \brief Get the block table of a sequence.
+   * \param seq_id The id of the sequence.
+   * \return The int32 page ids of the sequence, on the device of the cache.
+   */
+  NDArray BlockTable(int64_t seq_id) { return ToDeviceInt32Array(GetSequence(seq_id).page_ids); }
+
+  /*!
+   * \brief Get the block tables of a batch of sequences in the CSR layout
+   *        that paged attention kernels consume.
+   * \param seq_ids The ids of the sequences.
+   * \return The int32 arrays page_indptr of shape (num_seqs + 1,), page_indices
+   *         of shape (page_indptr[num_seqs],) and last_page_len of shape (num_seqs,),
+   *         on the device of the cache.
+   */
+  Array<NDArray> BatchBlockTable(const ShapeTuple& seq_ids) {
+    std::vector<int32_t> page_indptr{0};
+    std::vector<int32_t> page_indices;
+    std::vector<int32_t> last_page_len;
+    for (int64_t seq_id : seq_ids) {
+      const Sequence& seq = GetSequence(seq_id);
+      page_indices.insert(page_indices.end(), seq.page_ids.begin(), seq.page_ids.end());
+      page_indptr.push_back(static_cast<int32_t>(page_indices.size()));
+      int64_t num_full_pages = std::max<int64_t>(CeilDiv(seq.seq_length, page_size) - 1, 0);
+      last_page_len.push_back(static_cast<int32_t>(seq.seq_length - num_full_pages * page_size));
+    }
+    return {ToDeviceInt32Array(page_indptr), ToDeviceInt32Array(page_indices),
+            ToDeviceInt32Array(last_page_len)};
   }
 
-  ICHECK(prob->device.device_type == kDLCPU);
+  static constexpr const uint32_t _type_index = TypeIndex::kDynamic;
+  static constexpr const char* _type_key = "relax.vm.PagedKVCache";
+  TVM_DECLARE_FINAL_OBJECT_INFO(PagedKVCacheObj, Object);
 
-  for (int i = 0; i < prob->ndim - 1; ++i) {
-    ICHECK_EQ(prob->shape[i], 1) << "The leading dimensions of logits must be 1";
+ private:
+  static int64_t CeilDiv(int64_t a, int64_t b) { return (a + b - 1) / b; }
+
+  Sequence& GetSequence(int64_t seq_id) {
+    auto it = seqs.find(seq_id);
+    CHECK(it != seqs.end()) << "The sequence " << seq_id << " is not in the KV cache.";
+    return it->second;
   }
 
-  // Key observation: when we are doing top_p sampling
-  // usually we only need to preserve some of the elements with
-  // high probablities before we do sort
-  std::vector<std::pair<float, int>> data;
-  int64_t ndata = prob->shape[prob->ndim - 1];
-  const float* p_prob = static_cast<float*>(prob->data);
+  void CheckValue(const NDArray& value) {
+    CHECK(pages.DataType() == value.DataType()) << "dtype mismatch";
+    CHECK_EQ(value->ndim, pages->ndim - 1) << "ndim mismatch";
+    for (int i = 1; i < value->ndim; ++i) {
+      CHECK_EQ(value->shape[i], elem_shape[i - 1]) << "Dimension " << i << " mismatch";
+    }
+    ICHECK(value.IsContiguous());
+  }
+
+  int64_t NumNewPages(const Sequence& seq, int64_t num_slots) {
+    if (num_slots == 0) return 0;
+    int64_t num_new_pages =
+        CeilDiv(seq.seq_length + num_slots, page_size) - static_cast<int64_t>(seq.page_ids.size());
+    // Writing into a shared partial page copies it first.
+    if (seq.seq_length % page_size != 0 && page_ref_counts[seq.page_ids.back()] > 1) {
+      ++num_new_pages;
+    }
+    return num_new_pages;
+  }
+
+  /*!
+   * \brief Make sure there are enough free pages, evicting the least recently
+   *        used prefix tree pages if needed.
+   */
+  void ReserveFreePages(int64_t num_new_pages) {
+    while (num_new_pages > static_cast<int64_t>(free_page_ids.size()) && EvictPrefixTreeLeaf()) {
+    }
+    CHECK_LE(num_new_pages, static_cast<int64_t>(free_page_ids.size()))
+        << "The paged KV cache is out of pages: " << num_new_pages << " pages are needed but only "
+        << free_page_ids.size() << " pages are free.";
+  }
+
+  /*!
+   * \brief Append the slots [begin, begin + num_slots) of value to a sequence.
+   * \note The caller is responsible for checking that there are enough free pages.
+   */
+  void AppendSlots(Sequence* seq, const DLTensor* value, int64_t begin, int64_t num_slots) {
+    int64_t num_copied = 0;
+    while (num_copied < num_slots) {
+      int64_t page_offset = seq->seq_length % page_size;
+      if (page_offset == 0) {
+        seq->page_ids.push_back(AllocPage());
+      } else if (page_ref_counts[seq->page_ids.back()] > 1) {
+        // copy on write
+        int32_t page_id = AllocPage();
+        CopySlots(pages.operator->(), seq->page_ids.back() * page_size, pages.operator->(),
+                  page_id * page_size, page_offset);
+        FreePage(seq->page_ids.back());
+        seq->page_ids.back() = page_id;
+      }
+      int64_t num_copy = std::min(page_size - page_offset, num_slots - num_copied);
+      CopySlots(value, begin + num_copied, pages.operator->(),
+                seq->page_ids.back() * page_size + page_offset, num_copy);
+      num_copied += num_copy;
+      seq->seq_length += num_copy;
+    }
+  }
+
+  NDArray ToDeviceInt32Array(const std::vector<int32_t>& data) {
+    int64_t size = static_cast<int64_t>(data.size());
+    NDArray result = NDArray::Empty({size}, DataType::Int(32), pages->device);
+    result.CopyFromBytes(data.data(), size * sizeof(int32_t));
+    return result;
+  }
+
+  int32_t AllocPage() {
+    ICHECK(!free_page_ids.empty());
+    int32_t page_id = free_page_ids.back();
+    free_page_ids.pop_back();
+    page_ref_counts[page_id] = 1;
+    return page_id;
+  }
+
+  void FreePage(int32_t page_id) {
+    ICHECK_GT(page_ref_counts[page_id], 0);
+    if (--page_ref_counts[page_id] == 0) {
+      free_page_ids.push_back(page_id);
+    }
+  }
+
+  /*!
+   * \brief Evict the least recently used prefix tree leaf whose page is
+   *        not referenced by any sequence.
+   * \return Whether a leaf is evicted.
+   */
+  bool EvictPrefixTreeLeaf() {
+    PrefixTreeNode* victim_parent = nullptr;
+    const std::vector<int64_t>* victim_key = nullptr;
+    int64_t victim_access = std::numeric_limits<int64_t>::max();
+    std::function<void(PrefixTreeNode*)> fvisit = [&](PrefixTreeNode* node) {
+      for (auto& kv : node->children) {
+        PrefixTreeNode* child = kv.second.get();
+        if (!child->children.empty()) {
+          fvisit(child);
+        } else if (page_ref_counts[child->page_id] == 1 && child->last_access < victim_access) {
+          victim_parent = node;
+          victim_key = &kv.first;
+          victim_access = child->last_access;
+        }
+      }
+    };
+    fvisit(&prefix_tree);
+    if (victim_parent == nullptr) return false;
+    auto it = victim_parent->children.find(*victim_key);
+    FreePage(it->second->page_id);
+    victim_parent->children.erase(it);
+    return true;
+  }
+
+  /*!
+   * \brief Copy consecutive slots between two arrays whose slots are elem_shape.
+   * \note The slots of the page pool are indexed by page_id * page_size + page_offset.
+   */
+  void CopySlots(const DLTensor* from, int64_t from_slot, const DLTensor* to, int64_t to_slot,
+                 int64_t num_slots) {
+    std::vector<int64_t> shape{num_slots};
+    shape.insert(shape.end(), elem_shape.begin(), elem_shape.end());
+    DLTensor copy_src = *from;
+    copy_src.ndim = static_cast<int>(shape.size());
+    copy_src.shape = shape.data();
+    copy_src.strides = nullptr;
+    copy_src.byte_offset += from_slot * slot_nbytes;
+    DLTensor copy_dst = *to;
+    copy_dst.ndim = static_cast<int>(shape.size());
+    copy_dst.shape = shape.data();
+    copy_dst.strides = nullptr;
+    copy_dst.byte_offset += to_slot * slot_nbytes;
+    NDArray::CopyFromTo(&copy_src, &copy_dst);
+  }
+};
+
+/*! \brief reference to paged kv cache. */
+class PagedKVCache : public ObjectRef {
+ public:
+  /*!
+   * \brief Create the paged attention kv cache.
+   * \param init_data An array of shape (n, *elem_shape) whose dtype, device
+   *        and trailing dimensions determine the layout of each slot.
+   * \param page_size The number of slots in each page.
+   * \param num_pages The number of pages in the pool.
+   */
+  static PagedKVCache Create(NDArray init_data, int64_t page_size, int64_t num_pages) {
+    CHECK_GT(page_size, 0) << "The page size must be positive.";
+    CHECK_GT(num_pages, 0) << "The number of pages must be positive.";
+    CHECK_LE(num_pages, std::numeric_limits<int32_t>::max());
+    auto n = make_object<PagedKVCacheObj>();
+    n->page_size = page_size;
+    n->elem_shape.assign(init_data->shape + 1, init_data->shape + init_data->ndim);
+    n->slot_nbytes = (init_data->dtype.bits * init_data->dtype.lanes + 7) / 8;
+    for (int64_t dim : n->elem_shape) {
+      n->slot_nbytes *= dim;
+    }
+    std::vector<int64_t> pages_shape{num_pages, page_size};
+    pages_shape.insert(pages_shape.end(), n->elem_shape.begin(), n->elem_shape.end());
+    n->pages = NDArray::Empty(pages_shape, init_data->dtype, init_data->device);
+    n->page_ref_counts.resize(num_pages, 0);
+    // Hand out low page ids first.
+    for (int64_t page_id = num_pages - 1; page_id >= 0; --page_id) {
+      n->free_page_ids.push_back(static_cast<int32_t>(page_id));
+    }
+    return PagedKVCache(n);
+  }
+
+  TVM_DEFINE_MUTABLE_OBJECT_REF_METHODS(PagedKVCache, ObjectRef, PagedKVCacheObj);
+};
+
+TVM_REGISTER_OBJECT_TYPE(PagedKVCacheObj);
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_create").set_body_typed(PagedKVCache::Create);
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_add_sequence")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id) { cache->AddSequence(seq_id); });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_remove_sequence")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id) { cache->RemoveSequence(seq_id); });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_fork_sequence")
+    .set_body_typed([](PagedKVCache cache, int64_t parent_seq_id, int64_t child_seq_id,
+                       int64_t fork_pos) {
+      cache->ForkSequence(parent_seq_id, child_seq_id, fork_pos);
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_cache_prefix")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id, ShapeTuple token_ids) {
+      cache->CachePrefix(seq_id, token_ids);
+    });
 
-  auto sample_top_p_with_filter = [&](float cuttoff) -> int64_t {
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_match_prefix")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id, ShapeTuple token_ids) {
+      return cache->MatchPrefix(seq_id, token_ids);
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_clear_prefix_cache")
+    .set_body_typed([](PagedKVCache cache) { cache->ClearPrefixCache(); });
+
+PagedKVCache PagedKVCacheAppend(PagedKVCache cache, int64_t seq_id, NDArray value) {
+  cache->Append(seq_id, value);
+  return cache;
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_append").set_body_typed(PagedKVCacheAppend);
+
+PagedKVCache PagedKVCacheBatchAppend(PagedKVCache cache, ShapeTuple seq_ids, NDArray value,
+                                     ShapeTuple append_indptr) {
+  cache->BatchAppend(seq_ids, value, append_indptr);
+  return cache;
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_batch_append")
+    .set_body_typed(PagedKVCacheBatchAppend);
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_popn")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id, int64_t n) { cache->PopN(seq_id, n); });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_view")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id) { return cache->View(seq_id); });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_block_table")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id) { return cache->BlockTable(seq_id); });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_batch_view")
+    .set_body_typed([](PagedKVCache cache, ShapeTuple seq_ids) {
+      return cache->BatchView(seq_ids);
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_batch_block_table")
+    .set_body_typed([](PagedKVCache cache, ShapeTuple seq_ids) {
+      return cache->BatchBlockTable(seq_ids);
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_get_pages")
+    .set_body_typed([](PagedKVCache cache) { return cache->pages; });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_get_seq_length")
+    .set_body_typed([](PagedKVCache cache, int64_t seq_id) {
+      auto it = cache->seqs.find(seq_id);
+      CHECK(it != cache->seqs.end()) << "The sequence " << seq_id << " is not in the KV cache.";
+      return it->second.seq_length;
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.paged_kv_cache_get_num_free_pages")
+    .set_body_typed([](PagedKVCache cache) {
+      return static_cast<int64_t>(cache->free_page_ids.size());
+    });
+
+/*!
+ * \brief Sample from the renormalized top-k and top-p candidates of a distribution.
+ *
+ * Only the few candidates above a cutoff are sorted, instead of the whole
+ * vocabulary. By the pigeonhole principle there are at most 1024 elements
+ * whose probability is at least top_p / 1024, usually it is much less
+ * (order of 10 - 20). We fall back to the full distribution in the rare
+ * case that the candidates above the cutoff do not cover top_p.
+ *
+ * When every candidate is kept (top_p >= 1 and no top-k), nothing is sorted:
+ * the uniform sample is mapped through the cumulative probabilities in the
+ * order of the indices, which draws from the same distribution as the sorted
+ * order but may pick a different index for the same uniform sample.
+ *
+ * \param p_prob The normalized probabilities.
+ * \param ndata The number of probabilities.
+ * \param top_k The number of most likely candidates to keep, non-positive to keep all.
+ * \param top_p The cumulative probability of the most likely candidates to keep.
+ * \param uniform_sample A random number in [0, 1).
+ * \return The sampled index.
+ */
+int SampleTopKTopPFromProbData(const float* p_prob, int64_t ndata, int64_t top_k, double top_p,
+                               double uniform_sample) {
+  if (top_k <= 0 || top_k > ndata) {
+    top_k = ndata;
+  }
+  if (top_p >= 1 && top_k == ndata) {
+    double sum = 0.0;
+    for (int64_t i = 0; i < ndata; ++i) {
+      sum += p_prob[i];
+    }
+    double target = uniform_sample * sum;
+    double cum_sum_prob = 0.0;
+    int64_t last_nonzero = 0;
+    for (int64_t i = 0; i < ndata; ++i) {
+      if (p_prob[i] <= 0.0f) continue;
+      cum_sum_prob += p_prob[i];
+      if (target < cum_sum_prob) return i;
+      last_nonzero = i;
+    }
+    return last_nonzero;
+  }
+  // The candidates are reused across calls to avoid allocation per token.
+  static thread_local std::vector<std::pair<float, int>> data;
+  auto fcmp = [](const std::pair<float, int>& lhs, const std::pair<float, int>& rhs) {
+    return lhs.first > rhs.first;
+  };
+
+  auto sample_with_cutoff = [&](float cutoff) -> int64_t {
     data.clear();
-    // filter the data with cuttoff
+    // filter the data with cutoff
     for (int64_t i = 0; i < ndata; ++i) {
-      if (p_prob[i] >= cuttoff) {
+      if (p_prob[i] >= cutoff) {
         data.emplace_back(std::make_pair(p_prob[i], static_cast<int>(i)));
       }
     }
     if (data.size() == 0) return -1;
-    auto fcmp = [](const std::pair<float, int>& lhs, const std::pair<float, int>& rhs) {
-      return lhs.first > rhs.first;
-    };
+    // only keep the top k candidates, and only sort those
+    if (static_cast<int64_t>(data.size()) > top_k) {
+      std::nth_element(data.begin(), data.begin() + top_k, data.end(), fcmp);
+      data.resize(top_k);
+    }
     std::sort(data.begin(), data.end(), fcmp);
 
-    // short cut, if we know that
-    // uniform sample < p[0] / top_p
-    // we know that unform_sample < p[0] / top_p_sum
-    // because top_p_sum gaurantees to be smaller than top_p
-    // so we can simply return the argmax sample
-    // without computing anything
-    if (uniform_sample < data[0].first / top_p) return data[0].second;
-
     // compute top_p_sum
     float cum_sum_prob = 0.0f;
     float top_p_sum = 0.0f;
@@ -396,8 +929,11 @@ int SampleTopPFromProb(NDArray prob, double top_p, double uniform_sample) {
     }
     // we find that the current total sum by the given cutoff
     // is not sufficient to cover everything
-    // this means we might need to retry a smaller cutoff pt.
-    if (cum_sum_prob < top_p && cuttoff != 0.0f) return -1;
+    // this means we might need to retry a smaller cutoff pt,
+    // unless we already hold the top k candidates.
+    if (cum_sum_prob < top_p && cutoff != 0.0f && static_cast<int64_t>(data.size()) < top_k) {
+      return -1;
+    }
 
     for (auto it = data.begin(); it != data.end(); ++it) {
       if (uniform_sample < it->first / top_p_sum) {
@@ -408,34 +944,133 @@ int SampleTopPFromProb(NDArray prob, double top_p, double uniform_sample) {
   };
 
   if (top_p < 1) {
-    // sample through cutoff by a number
-    // by pigeonhole principle we will get at most 1024 elements
-    // usually it is much less by applying this filtering(order of 10 - 20)
-    data.reserve(128);
-    int64_t sampled_index = sample_top_p_with_filter(top_p / 1024);
+    int64_t sampled_index = sample_with_cutoff(top_p / 1024);
     if (sampled_index >= 0) return sampled_index;
   }
   // fallback via full prob, rare case
-  data.reserve(ndata);
-  int64_t sampled_index = sample_top_p_with_filter(0.0f);
+  int64_t sampled_index = sample_with_cutoff(0.0f);
   ICHECK_GE(sampled_index, 0);
   return sampled_index;
 }
 
+/*!
+ * \brief Sample from a row of logits with temperature, top-k and top-p.
+ * \param p_logits The logits.
+ * \param ndata The number of logits.
+ * \param temperature The temperature, argmax is taken when it is close to 0.
+ * \param top_k The number of most likely candidates to keep, non-positive to keep all.
+ * \param top_p The cumulative probability of the most likely candidates to keep.
+ * \param uniform_sample A random number in [0, 1).
+ * \return The sampled index.
+ */
+int SampleTopKTopPFromLogitsData(const float* p_logits, int64_t ndata, double temperature,
+                                 int64_t top_k, double top_p, double uniform_sample) {
+  // Reduce with kLanes independent accumulators, which breaks the
+  // dependency chain and lets the compiler vectorize the reduction
+  // without reordering floating point operations itself.
+  constexpr int64_t kLanes = 8;
+  int64_t nvec = ndata / kLanes * kLanes;
+  float max_lanes[kLanes];
+  std::fill(max_lanes, max_lanes + kLanes, p_logits[0]);
+  for (int64_t i = 0; i < nvec; i += kLanes) {
+    for (int64_t j = 0; j < kLanes; ++j) {
+      max_lanes[j] = std::max(max_lanes[j], p_logits[i + j]);
+    }
+  }
+  float max_value = *std::max_element(max_lanes, max_lanes + kLanes);
+  for (int64_t i = nvec; i < ndata; ++i) {
+    max_value = std::max(max_value, p_logits[i]);
+  }
+
+  // argmax
+  if (temperature < 1e-6f) {
+    return static_cast<int>(std::find(p_logits, p_logits + ndata, max_value) - p_logits);
+  }
+
+  // compute expf scaled by temp
+  static thread_local std::vector<float> prob;
+  prob.resize(ndata);
+  float logit_scale = 1.0f / temperature;
+  for (int64_t i = 0; i < ndata; ++i) {
+    prob[i] = expf((p_logits[i] - max_value) * logit_scale);
+  }
+  float sum_lanes[kLanes] = {0.0f};
+  for (int64_t i = 0; i < nvec; i += kLanes) {
+    for (int64_t j = 0; j < kLanes; ++j) {
+      sum_lanes[j] += prob[i + j];
+    }
+  }
+  float sum = std::accumulate(sum_lanes, sum_lanes + kLanes, 0.0f);
+  for (int64_t i = nvec; i < ndata; ++i) {
+    sum += prob[i];
+  }
+  float inv_sum = 1.0f / sum;
+  for (int64_t i = 0; i < ndata; ++i) {
+    prob[i] *= inv_sum;
+  }
+  return SampleTopKTopPFromProbData(prob.data(), ndata, top_k, top_p, uniform_sample);
+}
+
+// NOTE this is a built-in highly related to LM so we put it here.
+int SampleTopKTopPFromLogits(NDArray logits, double temperature, int64_t top_k, double top_p,
+                             double uniform_sample) {
+  ICHECK(logits.IsContiguous());
+  ICHECK(logits.DataType() == DataType::Float(32));
+
+  if (logits->device.device_type != kDLCPU) {
+    logits = logits.CopyTo(DLDevice{kDLCPU, 0});
+  }
+
+  ICHECK(logits->device.device_type == kDLCPU);
+
+  for (int i = 0; i < logits->ndim - 1; ++i) {
+    ICHECK_EQ(logits->shape[i], 1) << "The leading dimensions of logits must be 1";
+  }
+
+  return SampleTopKTopPFromLogitsData(static_cast<float*>(logits->data),
+                                      logits->shape[logits->ndim - 1], temperature, top_k, top_p,
+                                      uniform_sample);
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.sample_top_k_top_p_from_logits")
+    .set_body_typed(SampleTopKTopPFromLogits);
+
+int SampleTopPFromLogits(NDArray logits, double temperature, double top_p, double uniform_sample) {
+  return SampleTopKTopPFromLogits(logits, temperature, -1, top_p, uniform_sample);
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.sample_top_p_from_logits").set_body_typed(SampleTopPFromLogits);
+
+int SampleTopPFromProb(NDArray prob, double top_p, double uniform_sample) {
+  ICHECK(prob.IsContiguous());
+  ICHECK(prob.DataType() == DataType::Float(32));
+
+  if (prob->device.device_type != kDLCPU) {
+    prob = prob.CopyTo(DLDevice{kDLCPU, 0});
+  }
+
+  ICHECK(prob->device.device_type == kDLCPU);
+
+  for (int i = 0; i < prob->ndim - 1; ++i) {
+    ICHECK_EQ(prob->shape[i], 1) << "The leading dimensions of logits must be 1";
+  }
+
+  const float* p_prob = static_cast<float*>(prob->data);
+  int64_t ndata = prob->shape[prob->ndim - 1];
+  // short cut, kept from the sorting implementation so that the sampled
+  // tokens do not change: if uniform_sample < p[argmax] / top_p, the argmax
+  // is returned without collecting the candidates
+  int64_t argmax = std::max_element(p_prob, p_prob + ndata) - p_prob;
+  if (uniform_sample < p_prob[argmax] / top_p) return argmax;
+  return SampleTopKTopPFromProbData(p_prob, ndata, -1, top_p, uniform_sample);
+}
+
 TVM_REGISTER_GLOBAL("vm.builtin.sample_top_p_from_prob").set_body_typed(SampleTopPFromProb);
 
 // This is an inplace operation.
-void ApplyRepetitionPenalty(NDArray logits, NDArray token_ids, double penalty) {
-  ICHECK(logits.IsContiguous());
-  ICHECK(token_ids.IsContiguous());
-  ICHECK(logits.DataType() == DataType::Float(32)) << "Logits data type is not float32!";
-  ICHECK(token_ids.DataType() == DataType::Int(32)) << "token ids must be int32!";
-  ICHECK(logits->device.device_type == kDLCPU) << "logits device must be CPU!";
-  ICHECK(token_ids->device.device_type == kDLCPU) << "token_ids device must be CPU!";
-  float* logits_raw_data = static_cast<float*>(logits->data);
-  int* token_ids_data = static_cast<int*>(token_ids->data);
-  size_t num_token_ids = token_ids->shape[token_ids->ndim - 1];
-  for (size_t i = 0; i < num_token_ids; ++i) {
+void ApplyRepetitionPenaltyData(float* logits_raw_data, const int* token_ids_data,
+                                int64_t num_token_ids, double penalty) {
+  for (int64_t i = 0; i < num_token_ids; ++i) {
     int token_id = token_ids_data[i];
     if (logits_raw_data[token_id] <= 0) {
       logits_raw_data[token_id] *= penalty;
@@ -445,6 +1080,19 @@ void ApplyRepetitionPenalty(NDArray logits, NDArray token_ids, double penalty) {
   }
 }
 
+// This is an inplace operation.
+void ApplyRepetitionPenalty(NDArray logits, NDArray token_ids, double penalty) {
+  ICHECK(logits.IsContiguous());
+  ICHECK(token_ids.IsContiguous());
+  ICHECK(logits.DataType() == DataType::Float(32)) << "Logits data type is not float32!";
+  ICHECK(token_ids.DataType() == DataType::Int(32)) << "token ids must be int32!";
+  ICHECK(logits->device.device_type == kDLCPU) << "logits device must be CPU!";
+  ICHECK(token_ids->device.device_type == kDLCPU) << "token_ids device must be CPU!";
+  ApplyRepetitionPenaltyData(static_cast<float*>(logits->data),
+                             static_cast<const int*>(token_ids->data),
+                             token_ids->shape[token_ids->ndim - 1], penalty);
+}
+
 TVM_REGISTER_GLOBAL("vm.builtin.apply_repetition_penalty").set_body_typed(ApplyRepetitionPenalty);
 
 // This is an inplace operation.
@@ -472,6 +1120,156 @@ void ApplySoftmaxWithTemperature(NDArray logits, double temperature) {
 TVM_REGISTER_GLOBAL("vm.builtin.apply_softmax_with_temperature")
     .set_body_typed(ApplySoftmaxWithTemperature);
 
+/*!
+ * \brief Sample one token for every row of a batch of logits.
+ *
+ * Rows are sampled in parallel on the runtime thread pool, each row with
+ * its own sampling parameters.
+ *
+ * \param logits The float32 logits of shape (batch_size, vocab_size).
+ * \param temperatures The float32 temperature of each row.
+ * \param top_ks The int32 top-k of each row, non-positive to disable top-k.
+ * \param top_ps The float32 top-p of each row.
+ * \param repetition_penalties The float32 repetition penalty of each row.
+ * \param history_token_ids The int32 tokens to apply the repetition penalty to, of all rows.
+ * \param history_indptr The int32 indptr of shape (batch_size + 1,) locating
+ *        the history tokens of each row in history_token_ids.
+ * \param uniform_samples The float32 random number in [0, 1) of each row.
+ * \return The int32 sampled tokens of shape (batch_size,), on CPU.
+ * \note The repetition penalty is applied to a copy, logits are not modified.
+ */
+NDArray BatchSampleTopKTopPFromLogits(NDArray logits, NDArray temperatures, NDArray top_ks,
+                                      NDArray top_ps, NDArray repetition_penalties,
+                                      NDArray history_token_ids, NDArray history_indptr,
+                                      NDArray uniform_samples) {
+  auto to_cpu = [](NDArray arr, DataType dtype, const char* name) {
+    ICHECK(arr.IsContiguous());
+    CHECK(arr.DataType() == dtype) << "The dtype of " << name << " must be " << dtype;
+    if (arr->device.device_type != kDLCPU) {
+      arr = arr.CopyTo(DLDevice{kDLCPU, 0});
+    }
+    return arr;
+  };
+  logits = to_cpu(logits, DataType::Float(32), "logits");
+  CHECK_EQ(logits->ndim, 2) << "The logits must be of shape (batch_size, vocab_size)";
+  int64_t batch_size = logits->shape[0];
+  int64_t vocab_size = logits->shape[1];
+  auto row_params = [&](NDArray arr, DataType dtype, const char* name) {
+    arr = to_cpu(arr, dtype, name);
+    CHECK(arr->ndim == 1 && arr->shape[0] == batch_size)
+        << "The " << name << " must be of shape (" << batch_size << ",)";
+    return arr;
+  };
+  temperatures = row_params(temperatures, DataType::Float(32), "temperatures");
+  top_ks = row_params(top_ks, DataType::Int(32), "top_ks");
+  top_ps = row_params(top_ps, DataType::Float(32), "top_ps");
+  repetition_penalties =
+      row_params(repetition_penalties, DataType::Float(32), "repetition_penalties");
+  uniform_samples = row_params(uniform_samples, DataType::Float(32), "uniform_samples");
+  history_token_ids = to_cpu(history_token_ids, DataType::Int(32), "history_token_ids");
+  history_indptr = to_cpu(history_indptr, DataType::Int(32), "history_indptr");
+  CHECK(history_indptr->ndim == 1 && history_indptr->shape[0] == batch_size + 1)
+      << "The history_indptr must be of shape (" << batch_size + 1 << ",)";
+  CHECK_EQ(history_token_ids->ndim, 1) << "The history_token_ids must be 1-D";
+  // The history is indexed by the workers without checks, so it is validated up front.
+  const int32_t* indptr = static_cast<const int32_t*>(history_indptr->data);
+  CHECK_EQ(indptr[0], 0) << "The history_indptr must start at 0";
+  for (int64_t i = 0; i < batch_size; ++i) {
+    CHECK_LE(indptr[i], indptr[i + 1])
+        << "The history_indptr must be non-decreasing, but history_indptr[" << i
+        << "] = " << indptr[i] << " > history_indptr[" << i + 1 << "] = " << indptr[i + 1];
+  }
+  CHECK_LE(indptr[batch_size], history_token_ids->shape[0])
+      << "The history_indptr ends at " << indptr[batch_size] << ", beyond the "
+      << history_token_ids->shape[0] << " history_token_ids";
+  const int32_t* token_ids = static_cast<const int32_t*>(history_token_ids->data);
+  for (int32_t j = 0; j < indptr[batch_size]; ++j) {
+    CHECK(token_ids[j] >= 0 && token_ids[j] < vocab_size)
+        << "The history token id " << token_ids[j] << " at " << j
+        << " is out of the vocabulary [0, " << vocab_size << ")";
+  }
+
+  NDArray result = NDArray::Empty({batch_size}, DataType::Int(32), DLDevice{kDLCPU, 0});
+
+  struct ParallelTask {
+    static int RunTask(int task_id, TVMParallelGroupEnv* penv, void* cdata) {
+      ParallelTask* task = static_cast<ParallelTask*>(cdata);
+      // Errors are reported from the launching thread.
+      try {
+        task->Run(task_id, penv->num_task);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->error = e.what();
+        return -1;
+      }
+      return 0;
+    }
+
+    void Run(int task_id, int num_tasks) {
+      // Each worker keeps its own copy of the row to apply the repetition penalty to.
+      static thread_local std::vector<float> penalized_logits;
+      for (int64_t i = task_id; i < batch_size; i += num_tasks) {
+        const float* row = logits + i * vocab_size;
+        int32_t history_begin = history_indptr[i];
+        int32_t history_end = history_indptr[i + 1];
+        if (repetition_penalties[i] != 1.0f && history_begin < history_end) {
+          penalized_logits.assign(row, row + vocab_size);
+          ApplyRepetitionPenaltyData(penalized_logits.data(), history_token_ids + history_begin,
+                                     history_end - history_begin, repetition_penalties[i]);
+          row = penalized_logits.data();
+        }
+        result[i] = SampleTopKTopPFromLogitsData(row, vocab_size, temperatures[i], top_ks[i],
+                                                 top_ps[i], uniform_samples[i]);
+      }
+    }
+
+    int64_t batch_size;
+    int64_t vocab_size;
+    const float* logits;
+    const float* temperatures;
+    const int32_t* top_ks;
+    const float* top_ps;
+    const float* repetition_penalties;
+    const int32_t* history_token_ids;
+    const int32_t* history_indptr;
+    const float* uniform_samples;
+    int32_t* result;
+    std::mutex mutex;
+    std::string error;
+  };
+
+  ParallelTask task;
+  task.batch_size = batch_size;
+  task.vocab_size = vocab_size;
+  task.logits = static_cast<const float*>(logits->data);
+  task.temperatures = static_cast<const float*>(temperatures->data);
+  task.top_ks = static_cast<const int32_t*>(top_ks->data);
+  task.top_ps = static_cast<const float*>(top_ps->data);
+  task.repetition_penalties = static_cast<const float*>(repetition_penalties->data);
+  task.history_token_ids = static_cast<const int32_t*>(history_token_ids->data);
+  task.history_indptr = static_cast<const int32_t*>(history_indptr->data);
+  task.uniform_samples = static_cast<const float*>(uniform_samples->data);
+  task.result = static_cast<int32_t*>(result->data);
+
+  if (batch_size <= 1) {
+    // not worth waking up the thread pool
+    task.Run(0, 1);
+  } else {
+    // The launch returns 0 when the rows are sampled inline by a single worker, even if one
+    // failed.
+    int res = TVMBackendParallelLaunch(ParallelTask::RunTask, &task, 0);
+    std::lock_guard<std::mutex> lock(task.mutex);
+    if (!task.error.empty()) {
+      LOG(FATAL) << task.error;
+    }
+    ICHECK_EQ(res, 0) << "BatchSampleTopKTopPFromLogits: TVMBackendParallelLaunch failed";
+  }
+  return result;
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.batch_sample_top_k_top_p_from_logits")
+    .set_body_typed(BatchSampleTopKTopPFromLogits);
+
 }  // namespace relax_vm
 }  // namespace runtime
 }  // namespace tvm
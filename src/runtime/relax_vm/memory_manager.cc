@@ -24,9 +24,11 @@
 #include <tvm/runtime/registry.h>
 #include <tvm/runtime/relax_vm/memory_manager.h>
 
+#include <limits>
 #include <memory>
 #include <utility>
 
+#include "best_fit_allocator.h"
 #include "naive_allocator.h"
 #include "pooled_allocator.h"
 #include "tvm/runtime/memory.h"
@@ -125,8 +127,34 @@ MemoryManager* MemoryManager::Global() {
   return inst;
 }
 
+/*!
+ * \brief The allocators the calling thread has looked up. The allocators
+ *  live until MemoryManager::Clear, so the lookups of every buffer free
+ *  can skip the manager lock.
+ */
+struct ThreadLocalAllocatorTable {
+  uint64_t generation{std::numeric_limits<uint64_t>::max()};
+  std::unordered_map<Device, Allocator*> allocators;
+
+  static ThreadLocalAllocatorTable* Get(uint64_t generation) {
+    static thread_local ThreadLocalAllocatorTable table;
+    if (table.generation != generation) {
+      table.allocators.clear();
+      table.generation = generation;
+    }
+    return &table;
+  }
+};
+
 Allocator* MemoryManager::GetOrCreateAllocator(Device dev, AllocatorType type) {
   MemoryManager* m = MemoryManager::Global();
+  uint64_t generation = m->generation_.load(std::memory_order_acquire);
+  auto* table = ThreadLocalAllocatorTable::Get(generation);
+  auto cached = table->allocators.find(dev);
+  if (cached != table->allocators.end() && cached->second->type() == type) {
+    return cached->second;
+  }
+
   std::lock_guard<std::mutex> lock(m->mutex_);
   if (m->allocators_.find(dev) == m->allocators_.end()) {
     std::unique_ptr<Allocator> alloc;
@@ -143,11 +171,20 @@ Allocator* MemoryManager::GetOrCreateAllocator(Device dev, AllocatorType type) {
         alloc.reset(new PooledAllocator(dev));
         break;
       }
+      case kBestFit: {
+        DLOG(INFO) << "New best fit allocator for " << runtime::DeviceName(dev.device_type) << "("
+                   << dev.device_id << ")";
+        alloc.reset(new BestFitAllocator(dev));
+        break;
+      }
       default:
         LOG(FATAL) << "Unknown allocator type: " << type;
     }
     auto ret = alloc.get();
     m->allocators_.emplace(dev, std::move(alloc));
+    if (generation == m->generation_.load(std::memory_order_relaxed)) {
+      table->allocators[dev] = ret;
+    }
     return ret;
   }
   auto alloc = m->allocators_.at(dev).get();
@@ -155,24 +192,37 @@ Allocator* MemoryManager::GetOrCreateAllocator(Device dev, AllocatorType type) {
     LOG(WARNING) << "The type of existing allocator for " << runtime::DeviceName(dev.device_type)
                  << "(" << dev.device_id << ") is different from the request type ("
                  << alloc->type() << " vs " << type << ")";
+  } else if (generation == m->generation_.load(std::memory_order_relaxed)) {
+    table->allocators[dev] = alloc;
   }
   return alloc;
 }
 
 Allocator* MemoryManager::GetAllocator(Device dev) {
   MemoryManager* m = MemoryManager::Global();
+  uint64_t generation = m->generation_.load(std::memory_order_acquire);
+  auto* table = ThreadLocalAllocatorTable::Get(generation);
+  auto cached = table->allocators.find(dev);
+  if (cached != table->allocators.end()) {
+    return cached->second;
+  }
+
   std::lock_guard<std::mutex> lock(m->mutex_);
   auto it = m->allocators_.find(dev);
   if (it == m->allocators_.end()) {
     LOG(FATAL) << "Allocator for " << runtime::DeviceName(dev.device_type) << "(" << dev.device_id
                << ") has not been created yet.";
   }
+  if (generation == m->generation_.load(std::memory_order_relaxed)) {
+    table->allocators[dev] = it->second.get();
+  }
   return it->second.get();
 }
 
 void MemoryManager::Clear() {
   MemoryManager* m = MemoryManager::Global();
   std::lock_guard<std::mutex> lock(m->mutex_);
+  m->generation_.fetch_add(1, std::memory_order_release);
   m->allocators_.clear();
 }
 
@@ -211,6 +261,38 @@ runtime::NDArray Allocator::Empty(ShapeTuple shape, DLDataType dtype, DLDevice d
 
 TVM_REGISTER_GLOBAL("vm.builtin.memory_manager.clear").set_body_typed(MemoryManager::Clear);
 
+TVM_REGISTER_GLOBAL("vm.builtin.memory_manager.pooled_stats")
+    .set_body_typed([](int device_type, int device_id) {
+      Device dev{static_cast<DLDeviceType>(device_type), device_id};
+      Allocator* alloc = MemoryManager::GetAllocator(dev);
+      CHECK_EQ(alloc->type(), kPooled) << "The allocator of " << runtime::DeviceName(device_type)
+                                       << "(" << device_id << ") is not a pooled allocator";
+      return String(static_cast<PooledAllocator*>(alloc)->GetStatsJSON());
+    });
+
+BestFitAllocator* GetBestFitAllocator(int device_type, int device_id) {
+  Device dev{static_cast<DLDeviceType>(device_type), device_id};
+  Allocator* alloc = MemoryManager::GetAllocator(dev);
+  CHECK_EQ(alloc->type(), kBestFit) << "The allocator of " << runtime::DeviceName(device_type)
+                                    << "(" << device_id << ") is not a best fit allocator";
+  return static_cast<BestFitAllocator*>(alloc);
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.memory_manager.best_fit_stats")
+    .set_body_typed([](int device_type, int device_id) {
+      return String(GetBestFitAllocator(device_type, device_id)->GetStatsJSON());
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.memory_manager.best_fit_set_budget")
+    .set_body_typed([](int device_type, int device_id, int64_t budget) {
+      GetBestFitAllocator(device_type, device_id)->SetBudget(static_cast<size_t>(budget));
+    });
+
+TVM_REGISTER_GLOBAL("vm.builtin.memory_manager.best_fit_trim")
+    .set_body_typed([](int device_type, int device_id) {
+      GetBestFitAllocator(device_type, device_id)->Trim();
+    });
+
 }  // namespace relax_vm
 }  // namespace runtime
 }  // namespace tvm
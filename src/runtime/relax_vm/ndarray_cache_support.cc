@@ -37,13 +37,23 @@
 #define PICOJSON_USE_INT64
 
 #include <picojson.h>
+#include <tvm/runtime/c_backend_api.h>
+#include <tvm/runtime/device_api.h>
 #include <tvm/runtime/ndarray.h>
 #include <tvm/runtime/registry.h>
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "../../support/mapped_file.h"
 #include "../../support/utils.h"
 #include "../file_utils.h"
 
@@ -86,28 +96,146 @@ class NDArrayCache {
 
   static void Clear() { Global()->pool_.clear(); }
 
+  /*! \brief The record of one array in a shard. */
+  struct ParamRecord {
+    String name;
+    ShapeTuple shape;
+    DataType dtype;
+    std::string format;
+    int64_t byte_offset;
+    int64_t nbytes;
+    /*! \brief The number of values sharing a scale, for group quantized formats. */
+    int64_t group_size{0};
+  };
+
+  /*! \brief The record of one shard file. */
+  struct ShardRecord {
+    std::string data_path;
+    int64_t nbytes;
+    std::vector<ParamRecord> records;
+  };
+
   /*!
-   * \brief Load parameters from path and append them.
-   *
+   * \brief Load the shard records from the json file of the cache.
    * \param cache_path The cache to path.
-   * \param device_type The type of device to be loaded.
-   * \param device_id The device id.
    */
-  static void Load(const std::string& cache_path, int device_type, int device_id) {
-    DLDevice device{static_cast<DLDeviceType>(device_type), device_id};
+  static std::vector<ShardRecord> LoadShardRecords(const std::string& cache_path) {
     std::string json_str;
     LoadBinaryFromFile(cache_path + "/ndarray-cache.json", &json_str);
     picojson::value json_info;
     picojson::parse(json_info, json_str);
     auto shard_records = json_info.get<picojson::object>()["records"].get<picojson::array>();
 
-    Map<String, NDArray> result;
+    std::vector<ShardRecord> result;
+    for (auto shard_item : shard_records) {
+      auto shard_rec = shard_item.get<picojson::object>();
+      ICHECK(shard_rec["dataPath"].is<std::string>());
+      CHECK_EQ(shard_rec["format"].get<std::string>(), "raw-shard");
+      ShardRecord shard;
+      shard.data_path = cache_path + "/" + shard_rec["dataPath"].get<std::string>();
+      shard.nbytes = shard_rec["nbytes"].get<int64_t>();
+
+      for (auto nd_item : shard_rec["records"].get<picojson::array>()) {
+        auto nd_rec = nd_item.get<picojson::object>();
+        CHECK(nd_rec["name"].is<std::string>());
+        ParamRecord param;
+        param.name = nd_rec["name"].get<std::string>();
+        std::vector<int64_t> shape;
+        for (auto value : nd_rec["shape"].get<picojson::array>()) {
+          shape.push_back(value.get<int64_t>());
+        }
+        param.shape = ShapeTuple(shape.begin(), shape.end());
+        param.dtype = DataType(String2DLDataType(nd_rec["dtype"].get<std::string>()));
+        param.format = nd_rec["format"].get<std::string>();
+        param.byte_offset = nd_rec["byteOffset"].get<int64_t>();
+        param.nbytes = nd_rec["nbytes"].get<int64_t>();
+        if (nd_rec.count("groupSize")) {
+          param.group_size = nd_rec["groupSize"].get<int64_t>();
+        }
+        shard.records.push_back(param);
+      }
+      result.push_back(shard);
+    }
+    return result;
+  }
+
+  /*!
+   * \brief Load parameters from path and append them.
+   *
+   * Loading is pipelined: the next shards are read from disk by
+   * background threads while the current shard is decoded and copied
+   * to the device on a dedicated stream.
+   *
+   * \param cache_path The cache to path.
+   * \param device_type The type of device to be loaded.
+   * \param device_id The device id.
+   * \param fprogress Optional callback invoked after each shard with the
+   *        number of bytes loaded so far and the total number of bytes.
+   */
+  static void Load(const std::string& cache_path, int device_type, int device_id,
+                   Optional<PackedFunc> fprogress) {
+    DLDevice device{static_cast<DLDeviceType>(device_type), device_id};
+    std::vector<ShardRecord> shards = LoadShardRecords(cache_path);
+    int64_t total_nbytes = 0;
+    for (const ShardRecord& shard : shards) {
+      total_nbytes += shard.nbytes;
+    }
+
+    // Keep two shards in flight, so that the next shard is read
+    // while the current one is being decoded and copied.
+    constexpr size_t kNumShardsInFlight = 2;
+    std::deque<std::future<std::string>> pending_reads;
+    size_t num_issued_reads = 0;
+    auto fissue_reads = [&]() {
+      while (num_issued_reads < shards.size() && pending_reads.size() < kNumShardsInFlight) {
+        std::string data_path = shards[num_issued_reads++].data_path;
+        pending_reads.push_back(std::async(std::launch::async, [data_path]() {
+          std::string raw_data;
+          LoadBinaryFromFile(data_path, &raw_data);
+          return raw_data;
+        }));
+      }
+    };
+
+    // The host bytes of the current shard, and its decoded parameters reused
+    // across shards, which must outlive the copies in flight on the stream.
     std::string raw_data;
+    std::vector<std::vector<char>> decoded_buffers;
+
+    DeviceAPI* device_api = DeviceAPI::Get(device);
+    // OpenCL copies go through a staging buffer instead of a stream.
+    TVMStreamHandle copy_stream =
+        device_type != kDLOpenCL ? device_api->CreateStream(device) : nullptr;
+    // Free the stream on any exit, once the copies that read the host bytes are done.
+    struct StreamGuard {
+      DeviceAPI* device_api;
+      Device device;
+      TVMStreamHandle stream;
+      ~StreamGuard() {
+        if (stream == nullptr) return;
+        // A destructor may run during unwinding, so the errors are only logged.
+        try {
+          device_api->StreamSync(device, stream);
+          device_api->FreeStream(device, stream);
+        } catch (const std::exception& e) {
+          LOG(WARNING) << "Failed to release the copy stream: " << e.what();
+        }
+      }
+    } stream_guard{device_api, device, copy_stream};
     Optional<NDArray> staging_buffer;
 
-    auto fcopy_param_from_bytes = [&](NDArray param, void* data, size_t nbytes) {
+    auto fcopy_param_from_bytes = [&](NDArray param, const void* data, size_t nbytes) {
       if (device_type != kDLOpenCL) {
-        param.CopyFromBytes(data, nbytes);
+        // Asynchronous with regard to the host, the source bytes are kept
+        // alive until the stream is synchronized at the end of the shard.
+        DLTensor copy_src = *(param.operator->());
+        copy_src.data = const_cast<void*>(data);
+        copy_src.device = DLDevice{kDLCPU, 0};
+        copy_src.byte_offset = 0;
+        DLTensor copy_dst = *(param.operator->());
+        ICHECK_EQ(runtime::GetDataSize(copy_dst), nbytes);
+        NDArray::CopyFromTo(&copy_src, &copy_dst, copy_stream);
+        return;
       }
       // special handle OpenCL
       // OpenCL runtime can create a host side memory mirror
@@ -130,52 +258,258 @@ class NDArrayCache {
       TVMSynchronize(device_type, device_id, nullptr);
     };
 
-    for (auto shard_item : shard_records) {
-      auto shard_rec = shard_item.get<picojson::object>();
-      ICHECK(shard_rec["dataPath"].is<std::string>());
-      std::string data_path = shard_rec["dataPath"].get<std::string>();
-
-      LoadBinaryFromFile(cache_path + "/" + data_path, &raw_data);
-      CHECK_EQ(shard_rec["format"].get<std::string>(), "raw-shard");
-      int64_t raw_nbytes = shard_rec["nbytes"].get<int64_t>();
-      CHECK_EQ(raw_nbytes, raw_data.length())
+    int64_t loaded_nbytes = 0;
+    for (const ShardRecord& shard : shards) {
+      fissue_reads();
+      raw_data = pending_reads.front().get();
+      pending_reads.pop_front();
+      fissue_reads();
+      CHECK_EQ(shard.nbytes, raw_data.length())
           << "ValueError: Parameters are not loaded properly. Please check your parameter shards "
              "and git lfs installation";
 
-      for (auto nd_item : shard_rec["records"].get<picojson::array>()) {
-        auto nd_rec = nd_item.get<picojson::object>();
-        CHECK(nd_rec["name"].is<std::string>());
-        String name = nd_rec["name"].get<std::string>();
+      if (decoded_buffers.size() < shard.records.size()) {
+        decoded_buffers.resize(shard.records.size());
+      }
+      std::vector<DecodeTask> decode_tasks;
+      for (size_t i = 0; i < shard.records.size(); ++i) {
+        const ParamRecord& param = shard.records[i];
+        if (FDecode fdecode = GetDecoder(param)) {
+          decoded_buffers[i].resize(GetNumElements(param.shape) * param.dtype.bytes());
+          decode_tasks.push_back(
+              {&param, fdecode, raw_data.data() + param.byte_offset, decoded_buffers[i].data()});
+        }
+      }
+      ParallelDecode(decode_tasks);
 
-        std::vector<int64_t> shape;
-        for (auto value : nd_rec["shape"].get<picojson::array>()) {
-          shape.push_back(value.get<int64_t>());
+      for (size_t i = 0; i < shard.records.size(); ++i) {
+        const ParamRecord& param = shard.records[i];
+        NDArray arr = NDArray::Empty(param.shape, param.dtype, device);
+        if (GetDecoder(param) != nullptr) {
+          fcopy_param_from_bytes(arr, decoded_buffers[i].data(), decoded_buffers[i].size());
+        } else {
+          fcopy_param_from_bytes(arr, raw_data.data() + param.byte_offset, param.nbytes);
         }
+        Update(param.name, arr, true);
+      }
+      // The host buffers of this shard can only be reused after the copies finish.
+      device_api->StreamSync(device, copy_stream);
 
-        DataType dtype(String2DLDataType(nd_rec["dtype"].get<std::string>()));
-        std::string encode_format = nd_rec["format"].get<std::string>();
-        int64_t offset = nd_rec["byteOffset"].get<int64_t>();
-        int64_t nbytes = nd_rec["nbytes"].get<int64_t>();
-        NDArray arr = NDArray::Empty(ShapeTuple(shape.begin(), shape.end()), dtype, device);
-
-        if (dtype == DataType::Float(32) && encode_format == "f32-to-bf16") {
-          // decode bf16 to f32
-          std::vector<uint16_t> buffer(nbytes / 2);
-          std::vector<uint32_t> decoded(nbytes / 2);
-          std::memcpy(buffer.data(), raw_data.data() + offset, nbytes);
-          for (size_t i = 0; i < buffer.size(); ++i) {
-            decoded[i] = static_cast<uint32_t>(buffer[i]) << 16;
-          }
-          fcopy_param_from_bytes(arr, decoded.data(), decoded.size() * sizeof(uint32_t));
+      loaded_nbytes += shard.nbytes;
+      if (fprogress.defined()) {
+        fprogress.value()(loaded_nbytes, total_nbytes);
+      }
+    }
+  }
+
+  /*!
+   * \brief Load parameters from path on CPU without copying them.
+   *
+   * The shard files are memory mapped and raw encoded parameters become
+   * views into the mapping, so that processes loading the same cache share
+   * one copy of the weights through the page cache. Parameters that need
+   * decoding, or that are not aligned in the shard, are copied out.
+   *
+   * \param cache_path The cache to path.
+   */
+  static void LoadMemoryMapped(const std::string& cache_path) {
+    DLDevice device{kDLCPU, 0};
+    for (const ShardRecord& shard : LoadShardRecords(cache_path)) {
+      auto file = std::make_shared<support::MappedFile>(shard.data_path);
+      CHECK_EQ(shard.nbytes, file->size())
+          << "ValueError: Parameters are not loaded properly. Please check your parameter shards "
+             "and git lfs installation";
+      std::vector<DecodeTask> decode_tasks;
+      for (const ParamRecord& param : shard.records) {
+        const char* data = file->data() + param.byte_offset;
+        NDArray arr;
+        if (FDecode fdecode = GetDecoder(param)) {
+          // decode straight into the array
+          arr = NDArray::Empty(param.shape, param.dtype, device);
+          decode_tasks.push_back({&param, fdecode, data, arr->data});
+        } else if (reinterpret_cast<size_t>(data) % kAllocAlignment == 0) {
+          arr = support::MappedFile::CreateView(file, param.byte_offset, param.shape, param.dtype);
         } else {
-          fcopy_param_from_bytes(arr, raw_data.data() + offset, nbytes);
+          arr = NDArray::Empty(param.shape, param.dtype, device);
+          arr.CopyFromBytes(data, param.nbytes);
         }
-        Update(name, arr, true);
+        Update(param.name, arr, true);
       }
+      ParallelDecode(decode_tasks);
     }
   }
 
+  /*!
+   * \brief Decoder of an encoding format.
+   * \param param The record of the array.
+   * \param data The encoded bytes of the array.
+   * \param decoded The buffer to write the decoded array to.
+   */
+  using FDecode = void (*)(const ParamRecord& param, const char* data, void* decoded);
+
+  /*!
+   * \brief Register the decoder of an encoding format.
+   * \param format The encoding format, as in the "format" field of the records.
+   * \param fdecode The decoder.
+   */
+  static void RegisterDecoder(const std::string& format, FDecode fdecode) {
+    Decoders()[format] = fdecode;
+  }
+
  private:
+  /*! \brief A parameter to decode. */
+  struct DecodeTask {
+    const ParamRecord* param;
+    FDecode fdecode;
+    const char* data;
+    void* decoded;
+  };
+
+  static std::unordered_map<std::string, FDecode>& Decoders() {
+    static std::unordered_map<std::string, FDecode> decoders = {
+        {"f32-to-bf16", DecodeF32FromBF16},
+        {"f32-to-f16", DecodeF32FromF16},
+        {"f32-to-int8-group", DecodeF32FromGroupQuant<8>},
+        {"f32-to-int4-group", DecodeF32FromGroupQuant<4>},
+    };
+    return decoders;
+  }
+
+  /*!
+   * \brief Get the decoder of a record, nullptr if it is stored raw.
+   * \note Encodings only apply to float32 arrays, arrays of other dtypes
+   *       are stored raw whatever format the record carries.
+   */
+  static FDecode GetDecoder(const ParamRecord& param) {
+    if (param.format == "raw" || param.dtype != DataType::Float(32)) return nullptr;
+    auto it = Decoders().find(param.format);
+    CHECK(it != Decoders().end()) << "ValueError: Unsupported encoding format " << param.format
+                                  << " of parameter " << param.name;
+    return it->second;
+  }
+
+  /*! \brief Decode the parameters in parallel on the runtime thread pool. */
+  static void ParallelDecode(const std::vector<DecodeTask>& tasks) {
+    struct ParallelTask {
+      static int RunTask(int task_id, TVMParallelGroupEnv* penv, void* cdata) {
+        ParallelTask* task = static_cast<ParallelTask*>(cdata);
+        // Errors are reported from the launching thread.
+        try {
+          task->Run(task_id, penv->num_task);
+        } catch (const std::exception& e) {
+          std::lock_guard<std::mutex> lock(task->mutex);
+          task->error = e.what();
+          return -1;
+        }
+        return 0;
+      }
+
+      void Run(int task_id, int num_tasks) {
+        for (size_t i = task_id; i < tasks->size(); i += num_tasks) {
+          const DecodeTask& t = (*tasks)[i];
+          t.fdecode(*t.param, t.data, t.decoded);
+        }
+      }
+
+      const std::vector<DecodeTask>* tasks;
+      std::mutex mutex;
+      std::string error;
+    };
+
+    ParallelTask task;
+    task.tasks = &tasks;
+    if (tasks.size() <= 1) {
+      task.Run(0, 1);
+      return;
+    }
+    // With a single worker the tasks run inline and the launch succeeds whatever they report,
+    // so the error is checked in any case.
+    int res = TVMBackendParallelLaunch(ParallelTask::RunTask, &task, 0);
+    std::lock_guard<std::mutex> lock(task.mutex);
+    if (!task.error.empty()) {
+      LOG(FATAL) << task.error;
+    }
+    CHECK_EQ(res, 0) << "ParallelDecode: TVMBackendParallelLaunch failed";
+  }
+
+  // The decoders below are written as plain loops over contiguous
+  // arrays, so that the compiler can vectorize them.
+
+  /*! \brief Decode bf16 to f32. */
+  static void DecodeF32FromBF16(const ParamRecord& param, const char* data, void* decoded) {
+    int64_t size = GetNumElements(param.shape);
+    CHECK_EQ(param.nbytes, size * 2) << "Record size mismatch of parameter " << param.name;
+    const uint16_t* src = reinterpret_cast<const uint16_t*>(data);
+    uint32_t* dst = static_cast<uint32_t*>(decoded);
+    for (int64_t i = 0; i < size; ++i) {
+      dst[i] = static_cast<uint32_t>(src[i]) << 16;
+    }
+  }
+
+  /*! \brief Decode f16 to f32. */
+  static void DecodeF32FromF16(const ParamRecord& param, const char* data, void* decoded) {
+    int64_t size = GetNumElements(param.shape);
+    CHECK_EQ(param.nbytes, size * 2) << "Record size mismatch of parameter " << param.name;
+    const uint16_t* src = reinterpret_cast<const uint16_t*>(data);
+    float* dst = static_cast<float*>(decoded);
+    for (int64_t i = 0; i < size; ++i) {
+      // Move the exponent and mantissa into place, then rebias the exponent
+      // by multiplying with 2^112, which also handles subnormal values.
+      // Values beyond the f16 range are inf or nan, whose exponent is saturated.
+      uint32_t bits = static_cast<uint32_t>(src[i] & 0x7fff) << 13;
+      float value;
+      std::memcpy(&value, &bits, sizeof(float));
+      value *= 0x1.0p112f;
+      std::memcpy(&bits, &value, sizeof(float));
+      bits |= value >= 65536.0f ? 0x7f800000u : 0u;
+      bits |= static_cast<uint32_t>(src[i] & 0x8000) << 16;
+      std::memcpy(dst + i, &bits, sizeof(float));
+    }
+  }
+
+  /*!
+   * \brief Decode group quantized values to f32.
+   *
+   * The record holds the quantized values followed by one f32 scale per
+   * group of param.group_size values. 8 bit values are signed, 4 bit values
+   * are packed two per byte, low bits first, and biased by 8.
+   */
+  template <int kBits>
+  static void DecodeF32FromGroupQuant(const ParamRecord& param, const char* data, void* decoded) {
+    static_assert(kBits == 4 || kBits == 8, "Only 4 and 8 bit quantization are supported");
+    int64_t size = GetNumElements(param.shape);
+    int64_t group_size = param.group_size;
+    CHECK_GT(group_size, 0) << "Missing groupSize of parameter " << param.name;
+    int64_t num_groups = (size + group_size - 1) / group_size;
+    int64_t quant_nbytes = (size * kBits + 7) / 8;
+    CHECK_EQ(param.nbytes, quant_nbytes + num_groups * static_cast<int64_t>(sizeof(float)))
+        << "Record size mismatch of parameter " << param.name;
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    const char* scale_data = data + quant_nbytes;
+    float* dst = static_cast<float*>(decoded);
+    for (int64_t g = 0; g < num_groups; ++g) {
+      float scale;
+      std::memcpy(&scale, scale_data + g * sizeof(float), sizeof(float));
+      int64_t end = std::min(size, (g + 1) * group_size);
+      for (int64_t i = g * group_size; i < end; ++i) {
+        if (kBits == 8) {
+          dst[i] = static_cast<float>(static_cast<int8_t>(src[i])) * scale;
+        } else {
+          int q = (src[i / 2] >> ((i % 2) * 4)) & 0xf;
+          dst[i] = static_cast<float>(q - 8) * scale;
+        }
+      }
+    }
+  }
+
+  static int64_t GetNumElements(const ShapeTuple& shape) {
+    int64_t size = 1;
+    for (int64_t dim : shape) {
+      size *= dim;
+    }
+    return size;
+  }
+
   Map<String, NDArray> pool_;
 };
 
@@ -183,7 +517,18 @@ TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.get").set_body_typed(NDArrayCache:
 TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.update").set_body_typed(NDArrayCache::Update);
 TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.remove").set_body_typed(NDArrayCache::Remove);
 TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.clear").set_body_typed(NDArrayCache::Clear);
-TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.load").set_body_typed(NDArrayCache::Load);
+TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.load").set_body([](TVMArgs args, TVMRetValue* rv) {
+  CHECK(args.size() == 3 || args.size() == 4)
+      << "ValueError: `vm.builtin.ndarray_cache.load` expects 3 or 4 arguments, but got "
+      << args.size() << ".";
+  Optional<PackedFunc> fprogress = NullOpt;
+  if (args.size() == 4 && args[3].type_code() != kTVMNullptr) {
+    fprogress = args[3].operator PackedFunc();
+  }
+  NDArrayCache::Load(args[0], args[1], args[2], fprogress);
+});
+TVM_REGISTER_GLOBAL("vm.builtin.ndarray_cache.load_mmap")
+    .set_body_typed(NDArrayCache::LoadMemoryMapped);
 
 // This param module node can be useful to get param dict in RPC mode
 // when the remote already have loaded parameters from file.
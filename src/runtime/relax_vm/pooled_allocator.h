@@ -26,8 +26,13 @@
 #include <tvm/runtime/device_api.h>
 #include <tvm/runtime/relax_vm/memory_manager.h>
 
+#include <algorithm>
 #include <atomic>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <sstream>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -38,15 +43,60 @@ namespace relax_vm {
 class PooledAllocator final : public Allocator {
  public:
   static constexpr size_t kDefaultPageSize = 4096;
+  /*! \brief Buffers up to this size are cached per thread. */
+  static constexpr size_t kThreadCacheMaxBufferSize = 256 << 10;
+  /*! \brief The bytes a thread cache may hold before it returns half to the shared pool. */
+  static constexpr size_t kThreadCacheCapacity = 4 << 20;
+  /*! \brief The number of buffers a thread cache takes from the shared pool at once. */
+  static constexpr size_t kThreadCacheRefillBatch = 4;
 
   explicit PooledAllocator(Device dev, size_t page_size = kDefaultPageSize)
-      : Allocator(kPooled), page_size_(page_size), used_memory_(0), device_(dev) {}
+      : Allocator(kPooled), page_size_(page_size), used_memory_(0), device_(dev) {
+    static std::atomic<uint64_t> next_id{0};
+    id_ = next_id.fetch_add(1, std::memory_order_relaxed);
+  }
 
-  ~PooledAllocator() { ReleaseAll(); }
+  ~PooledAllocator() {
+    // No thread may use the allocator at this point, so the caches of live
+    // threads can be drained as well.
+    for (const auto& cache : thread_caches_) {
+      ReturnToSharedPool(cache.get(), 0);
+    }
+    thread_caches_.clear();
+    ReleaseAll();
+  }
 
   Buffer Alloc(size_t nbytes, size_t alignment, DLDataType type_hint) override {
-    std::lock_guard<std::recursive_mutex> lock(mu_);
     size_t size = ((nbytes + page_size_ - 1) / page_size_) * page_size_;
+    if (size <= kThreadCacheMaxBufferSize) {
+      ThreadCache* cache = GetThreadCache();
+      auto it = cache->pool.find(size);
+      if (it != cache->pool.end() && !it->second.empty()) {
+        auto ret = it->second.back();
+        it->second.pop_back();
+        cache->nbytes -= size;
+        num_thread_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+        return ret;
+      }
+      auto lock = Lock();
+      ReclaimOrphanedThreadCaches();
+      auto&& pool_it = memory_pool_.find(size);
+      if (pool_it != memory_pool_.end() && !pool_it->second.empty()) {
+        // Take a batch, so that the next few allocations of this size skip the lock.
+        auto&& pool = pool_it->second;
+        auto ret = pool.back();
+        pool.pop_back();
+        size_t num_refill = std::min(kThreadCacheRefillBatch - 1, pool.size());
+        auto&& local = cache->pool[size];
+        local.insert(local.end(), pool.end() - num_refill, pool.end());
+        pool.resize(pool.size() - num_refill);
+        cache->nbytes += num_refill * size;
+        return ret;
+      }
+      return AllocFromDevice(size, alignment, type_hint);
+    }
+
+    auto lock = Lock();
     auto&& it = memory_pool_.find(size);
     if (it != memory_pool_.end() && !it->second.empty()) {
       auto&& pool = it->second;
@@ -54,6 +104,146 @@ class PooledAllocator final : public Allocator {
       pool.pop_back();
       return ret;
     }
+    return AllocFromDevice(size, alignment, type_hint);
+  }
+
+  void Free(const Buffer& buffer) override {
+    if (buffer.size <= kThreadCacheMaxBufferSize) {
+      ThreadCache* cache = GetThreadCache();
+      cache->pool[buffer.size].push_back(buffer);
+      cache->nbytes += buffer.size;
+      if (cache->nbytes > kThreadCacheCapacity) {
+        auto lock = Lock();
+        ReturnToSharedPool(cache, kThreadCacheCapacity / 2);
+        num_thread_cache_flushes_.fetch_add(1, std::memory_order_relaxed);
+      }
+      return;
+    }
+    auto lock = Lock();
+    memory_pool_[buffer.size].push_back(buffer);
+    DLOG(INFO) << "reclaim buffer " << buffer.size;
+  }
+
+  /*! \brief The statistics of the allocator in json. */
+  std::string GetStatsJSON() const {
+    std::ostringstream os;
+    os << "{\"used_memory\": " << used_memory_.load(std::memory_order_relaxed)
+       << ", \"num_lock_acquires\": " << num_lock_acquires_.load(std::memory_order_relaxed)
+       << ", \"num_lock_contentions\": " << num_lock_contentions_.load(std::memory_order_relaxed)
+       << ", \"num_thread_cache_hits\": " << num_thread_cache_hits_.load(std::memory_order_relaxed)
+       << ", \"num_thread_cache_flushes\": "
+       << num_thread_cache_flushes_.load(std::memory_order_relaxed) << "}";
+    return os.str();
+  }
+
+ private:
+  /*! \brief The free buffers cached by one thread, accessed without the lock. */
+  struct ThreadCache {
+    std::unordered_map<size_t, std::vector<Buffer>> pool;
+    size_t nbytes{0};
+    /*! \brief The release generation the cache has caught up with, read by the owner only. */
+    uint64_t release_generation{0};
+    /*! \brief Set when the owner thread exits, after which the shared pool takes the buffers. */
+    std::atomic<bool> orphaned{false};
+  };
+
+  /*!
+   * \brief Get the cache of the calling thread, creating it on first use. A
+   *  cache that missed a release of all memory is released to the device first.
+   */
+  ThreadCache* GetThreadCache() {
+    ThreadCache* cache = FindOrCreateThreadCache();
+    if (cache->release_generation != release_generation_.load(std::memory_order_acquire)) {
+      ReleaseThreadCache(cache);
+    }
+    return cache;
+  }
+
+  /*! \brief Find the cache of the calling thread, creating it on first use. */
+  ThreadCache* FindOrCreateThreadCache() {
+    // The caches are keyed by allocator id rather than address, so that an
+    // allocator created at the address of a destroyed one gets fresh caches.
+    struct ThreadCacheTable {
+      std::unordered_map<uint64_t, std::shared_ptr<ThreadCache>> caches;
+      ~ThreadCacheTable() {
+        for (const auto& kv : caches) {
+          kv.second->orphaned.store(true, std::memory_order_release);
+        }
+      }
+    };
+    static thread_local ThreadCacheTable table;
+    auto it = table.caches.find(id_);
+    if (it != table.caches.end()) return it->second.get();
+
+    // drop the caches of destroyed allocators
+    for (auto iter = table.caches.begin(); iter != table.caches.end();) {
+      iter = iter->second.use_count() == 1 ? table.caches.erase(iter) : std::next(iter);
+    }
+    auto cache = std::make_shared<ThreadCache>();
+    cache->release_generation = release_generation_.load(std::memory_order_acquire);
+    {
+      auto lock = Lock();
+      thread_caches_.push_back(cache);
+    }
+    table.caches.emplace(id_, cache);
+    return cache.get();
+  }
+
+  /*! \brief Lock the shared pool, counting the acquisitions that had to wait. */
+  std::unique_lock<std::recursive_mutex> Lock() {
+    std::unique_lock<std::recursive_mutex> lock(mu_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      num_lock_contentions_.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+    num_lock_acquires_.fetch_add(1, std::memory_order_relaxed);
+    return lock;
+  }
+
+  /*!
+   * \brief Move buffers of a thread cache to the shared pool until the cache
+   *  holds at most target bytes. Requires the lock.
+   */
+  void ReturnToSharedPool(ThreadCache* cache, size_t target) {
+    for (auto it = cache->pool.begin(); it != cache->pool.end() && cache->nbytes > target; ++it) {
+      auto&& local = it->second;
+      auto&& pool = memory_pool_[it->first];
+      while (!local.empty() && cache->nbytes > target) {
+        pool.push_back(local.back());
+        local.pop_back();
+        cache->nbytes -= it->first;
+      }
+    }
+  }
+
+  /*! \brief Free the buffers of the cache of the calling thread to the device. */
+  void ReleaseThreadCache(ThreadCache* cache) {
+    auto lock = Lock();
+    for (auto const& it : cache->pool) {
+      for (auto const& buf : it.second) {
+        runtime::DeviceAPI::Get(buf.device)->FreeDataSpace(buf.device, buf.data);
+        used_memory_.fetch_sub(buf.size, std::memory_order_relaxed);
+      }
+    }
+    cache->pool.clear();
+    cache->nbytes = 0;
+    cache->release_generation = release_generation_.load(std::memory_order_acquire);
+  }
+
+  /*! \brief Take over the buffers of the threads that have exited. Requires the lock. */
+  void ReclaimOrphanedThreadCaches() {
+    for (auto it = thread_caches_.begin(); it != thread_caches_.end();) {
+      if ((*it)->orphaned.load(std::memory_order_acquire)) {
+        ReturnToSharedPool(it->get(), 0);
+        it = thread_caches_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  /*! \brief Allocate from the device. Requires the lock. */
+  Buffer AllocFromDevice(size_t size, size_t alignment, DLDataType type_hint) {
     Buffer buf;
     buf.device = device_;
     buf.size = size;
@@ -63,6 +253,12 @@ class PooledAllocator final : public Allocator {
     } catch (InternalError& err) {
       LOG(WARNING) << "PooledAllocator got InternalError during allocation: " << err.message();
       LOG(WARNING) << "Trying to release all unused memory and reallocate...";
+      // The caches of other live threads cannot be touched from here. They are
+      // released by their owners on their next allocation or free, so a retry
+      // may still fail while other threads hold cached buffers.
+      release_generation_.fetch_add(1, std::memory_order_acq_rel);
+      ReclaimOrphanedThreadCaches();
+      ReleaseThreadCache(FindOrCreateThreadCache());
       ReleaseAll();
       buf.data =
           runtime::DeviceAPI::Get(device_)->AllocDataSpace(device_, size, alignment, type_hint);
@@ -73,26 +269,16 @@ class PooledAllocator final : public Allocator {
     return buf;
   }
 
-  void Free(const Buffer& buffer) override {
-    std::lock_guard<std::recursive_mutex> lock(mu_);
-    if (memory_pool_.find(buffer.size) == memory_pool_.end()) {
-      memory_pool_.emplace(buffer.size, std::vector<Buffer>{});
-    }
-    memory_pool_.at(buffer.size).push_back(buffer);
-    DLOG(INFO) << "reclaim buffer " << buffer.size;
-  }
-
- private:
   void ReleaseAll() {
     std::lock_guard<std::recursive_mutex> lock(mu_);
     for (auto const& it : memory_pool_) {
       auto const& pool = it.second;
       for (auto const& buf : pool) {
         runtime::DeviceAPI::Get(buf.device)->FreeDataSpace(buf.device, buf.data);
+        used_memory_.fetch_sub(buf.size, std::memory_order_relaxed);
       }
     }
     memory_pool_.clear();
-    used_memory_ = 0;
     DLOG(INFO) << "release all buffers";
   }
 
@@ -102,6 +288,16 @@ class PooledAllocator final : public Allocator {
   std::unordered_map<size_t, std::vector<Buffer> > memory_pool_;
   std::recursive_mutex mu_;
   Device device_;
+  /*! \brief The unique id of the allocator, which keys the thread caches. */
+  uint64_t id_;
+  /*! \brief The caches of all threads that used the allocator, guarded by the lock. */
+  std::vector<std::shared_ptr<ThreadCache>> thread_caches_;
+  /*! \brief Bumped when all unused memory is released, which the thread caches then follow. */
+  std::atomic<uint64_t> release_generation_{0};
+  std::atomic<size_t> num_lock_acquires_{0};
+  std::atomic<size_t> num_lock_contentions_{0};
+  std::atomic<size_t> num_thread_cache_hits_{0};
+  std::atomic<size_t> num_thread_cache_flushes_{0};
 };
 
 }  // namespace relax_vm
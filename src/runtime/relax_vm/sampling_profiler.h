@@ -0,0 +1,246 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * \file tvm/runtime/relax_vm/sampling_profiler.h
+ * \brief A sampling profiler for the calls of the Relax virtual machine.
+ *
+ * The VM times one in every `sample_period` calls with the cycle counter, and
+ * records the time under the stack of VM functions the call was made from.
+ * The time is exclusive: a builtin that invokes a VM function, such as
+ * vm.builtin.invoke_closure, is not charged for the calls of that function,
+ * which are sampled under their own stacks.
+ * The samples are aggregated into a fixed-size table that is updated without
+ * locks, so the profiler can stay enabled in production and be read from
+ * another thread.
+ */
+#ifndef TVM_RUNTIME_RELAX_VM_SAMPLING_PROFILER_H_
+#define TVM_RUNTIME_RELAX_VM_SAMPLING_PROFILER_H_
+
+#include <tvm/runtime/container/map.h>
+#include <tvm/runtime/profiling.h>
+#include <tvm/runtime/relax_vm/bytecode.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+/*! \brief Read the cycle counter of the CPU, or the steady clock in nanoseconds. */
+inline uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(_M_X64)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t value;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+class VMSamplingProfiler {
+ public:
+  /*! \brief The number of distinct call stacks that can be recorded. */
+  static constexpr size_t kNumBuckets = 4096;
+  /*! \brief The max number of functions in a recorded stack, including the callee. */
+  static constexpr int kMaxStackDepth = 16;
+
+  explicit VMSamplingProfiler(int64_t sample_period)
+      : sample_period_(sample_period),
+        buckets_(new Bucket[kNumBuckets]),
+        start_time_(std::chrono::steady_clock::now()),
+        start_cycles_(ReadCycleCounter()) {
+    CHECK_GT(sample_period, 0) << "ValueError: The sample period must be positive, but got "
+                               << sample_period;
+  }
+
+  /*! \brief The number of calls per sample. */
+  int64_t sample_period() const { return sample_period_; }
+
+  /*!
+   * \brief Record a sampled call.
+   * \param stack The functions on the stack, from the outermost to the callee.
+   * \param depth The number of functions on the stack, at most kMaxStackDepth.
+   * \param cycles The cycles the call took, excluding the VM functions it invoked.
+   */
+  void Record(const Index* stack, int depth, uint64_t cycles) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < depth; ++i) {
+      hash = (hash ^ static_cast<uint64_t>(stack[i])) * 1099511628211ULL;
+    }
+    // zero marks an empty bucket.
+    hash = std::max<uint64_t>(hash, 1);
+
+    for (size_t probe = 0; probe < kNumBuckets; ++probe) {
+      Bucket& bucket = buckets_[(hash + probe) % kNumBuckets];
+      uint64_t bucket_hash = bucket.hash.load(std::memory_order_acquire);
+      // on failure, the bucket has been taken by another thread, which may record the same stack.
+      if (bucket_hash == 0 &&
+          bucket.hash.compare_exchange_strong(bucket_hash, hash, std::memory_order_acq_rel)) {
+        std::copy_n(stack, depth, bucket.stack);
+        bucket.depth = depth;
+        bucket.ready.store(true, std::memory_order_release);
+      } else if (bucket_hash != hash) {
+        continue;
+      }
+      while (!bucket.ready.load(std::memory_order_acquire)) {
+      }
+      if (bucket.depth != depth || !std::equal(stack, stack + depth, bucket.stack)) {
+        continue;
+      }
+      bucket.samples.fetch_add(1, std::memory_order_relaxed);
+      bucket.cycles.fetch_add(cycles, std::memory_order_relaxed);
+      return;
+    }
+    num_dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /*!
+   * \brief Get the report of the sampled calls, one row per call stack.
+   * \param func_names The names of the function indices in the stacks.
+   * \return The report, where the counts and durations are extrapolated from the samples,
+   *  and the percents of the exclusive durations add up to 100.
+   */
+  profiling::Report Report(const std::vector<std::string>& func_names) const {
+    std::vector<Entry> entries = GetEntries(func_names);
+    double total_us = 0;
+    for (const Entry& entry : entries) {
+      total_us += entry.microseconds;
+    }
+    Array<Map<String, ObjectRef>> calls;
+    for (const Entry& entry : entries) {
+      Map<String, ObjectRef> call;
+      call.Set("Name", String(entry.stack.back()));
+      call.Set("Stack", String(JoinStack(entry.stack)));
+      call.Set("Count", ObjectRef(make_object<profiling::CountNode>(
+                            static_cast<int64_t>(entry.samples) * sample_period_)));
+      call.Set("Samples", ObjectRef(make_object<profiling::CountNode>(entry.samples)));
+      call.Set("Duration (us)", ObjectRef(make_object<profiling::DurationNode>(
+                                    entry.microseconds * sample_period_)));
+      call.Set("Percent", ObjectRef(make_object<profiling::PercentNode>(
+                              total_us > 0 ? entry.microseconds / total_us * 100 : 0)));
+      calls.push_back(call);
+    }
+    Map<String, ObjectRef> configuration;
+    configuration.Set("Executor", String("VM"));
+    configuration.Set("Sample Period",
+                      ObjectRef(make_object<profiling::CountNode>(sample_period_)));
+    configuration.Set("Dropped Samples", ObjectRef(make_object<profiling::CountNode>(
+                                             num_dropped_.load(std::memory_order_relaxed))));
+    return profiling::Report(calls, {}, configuration);
+  }
+
+  /*!
+   * \brief Get the sampled calls in the folded stack format of flamegraph tools.
+   * \param func_names The names of the function indices in the stacks.
+   * \return One "outer;...;callee value" line per call stack, where the value is the sampled
+   *  time in microseconds.
+   */
+  std::string FoldedStacks(const std::vector<std::string>& func_names) const {
+    std::ostringstream os;
+    for (const Entry& entry : GetEntries(func_names)) {
+      os << JoinStack(entry.stack) << " "
+         << std::max<int64_t>(static_cast<int64_t>(entry.microseconds + 0.5), 1) << "\n";
+    }
+    return os.str();
+  }
+
+ private:
+  struct Bucket {
+    std::atomic<uint64_t> hash{0};
+    std::atomic<bool> ready{false};
+    int depth{0};
+    Index stack[kMaxStackDepth];
+    std::atomic<int64_t> samples{0};
+    std::atomic<uint64_t> cycles{0};
+  };
+
+  /*! \brief A recorded call stack. */
+  struct Entry {
+    std::vector<std::string> stack;
+    int64_t samples;
+    double microseconds;
+  };
+
+  std::vector<Entry> GetEntries(const std::vector<std::string>& func_names) const {
+    // the cycle counter is calibrated against the steady clock over the profiling time.
+    double elapsed_us = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start_time_)
+                            .count();
+    uint64_t elapsed_cycles = ReadCycleCounter() - start_cycles_;
+    double us_per_cycle = elapsed_cycles > 0 ? elapsed_us / elapsed_cycles : 0;
+
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      const Bucket& bucket = buckets_[i];
+      if (!bucket.ready.load(std::memory_order_acquire)) continue;
+      Entry entry;
+      for (int j = 0; j < bucket.depth; ++j) {
+        Index func_idx = bucket.stack[j];
+        entry.stack.push_back(static_cast<size_t>(func_idx) < func_names.size()
+                                  ? func_names[func_idx]
+                                  : "unknown");
+      }
+      entry.samples = bucket.samples.load(std::memory_order_relaxed);
+      entry.microseconds = bucket.cycles.load(std::memory_order_relaxed) * us_per_cycle;
+      if (entry.samples > 0) {
+        entries.push_back(std::move(entry));
+      }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+      return lhs.microseconds > rhs.microseconds;
+    });
+    return entries;
+  }
+
+  static std::string JoinStack(const std::vector<std::string>& stack) {
+    std::ostringstream os;
+    for (size_t i = 0; i < stack.size(); ++i) {
+      os << (i == 0 ? "" : ";") << stack[i];
+    }
+    return os.str();
+  }
+
+  int64_t sample_period_;
+  std::unique_ptr<Bucket[]> buckets_;
+  std::atomic<int64_t> num_dropped_{0};
+  std::chrono::steady_clock::time_point start_time_;
+  uint64_t start_cycles_;
+};
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
+
+#endif  // TVM_RUNTIME_RELAX_VM_SAMPLING_PROFILER_H_
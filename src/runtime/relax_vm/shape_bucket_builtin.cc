@@ -0,0 +1,301 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*!
+ * \file src/runtime/relax_vm/shape_bucket_builtin.cc
+ * \brief The dispatcher to the functions specialized for shape buckets by the
+ *  SpecializeShapeBuckets pass.
+ */
+
+#include <tvm/runtime/container/shape_tuple.h>
+#include <tvm/runtime/data_type.h>
+#include <tvm/runtime/ndarray.h>
+#include <tvm/runtime/packed_func.h>
+#include <tvm/runtime/registry.h>
+#include <tvm/runtime/relax_vm/vm.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+namespace {
+
+/*!
+ * \brief Copy bytes between two arrays, which may be on different devices.
+ * \param from The source array.
+ * \param from_offset The byte offset in the source array.
+ * \param to The destination array.
+ * \param to_offset The byte offset in the destination array.
+ * \param num_bytes The number of bytes to copy.
+ */
+void CopyBytes(const DLTensor* from, int64_t from_offset, const DLTensor* to, int64_t to_offset,
+               int64_t num_bytes) {
+  if (num_bytes == 0) return;
+  DLTensor from_bytes = *from;
+  DLTensor to_bytes = *to;
+  for (DLTensor* bytes : {&from_bytes, &to_bytes}) {
+    bytes->ndim = 1;
+    bytes->dtype = DataType::UInt(8);
+    bytes->shape = &num_bytes;
+    bytes->strides = nullptr;
+  }
+  from_bytes.byte_offset += from_offset;
+  to_bytes.byte_offset += to_offset;
+  NDArray::CopyFromTo(&from_bytes, &to_bytes);
+}
+
+/*!
+ * \brief Fill bytes of an array with zeros, with a memset on the host, or with
+ *  copies of a bounded buffer of zeros on other devices.
+ */
+void ZeroBytes(const DLTensor* to, int64_t to_offset, int64_t num_bytes) {
+  if (num_bytes == 0) return;
+  if (to->device.device_type == kDLCPU) {
+    std::memset(static_cast<char*>(to->data) + to->byte_offset + to_offset, 0, num_bytes);
+    return;
+  }
+  constexpr int64_t kMaxChunkBytes = 1 << 20;
+  static const std::vector<uint8_t> zeros(kMaxChunkBytes, 0);
+  int64_t shape = kMaxChunkBytes;
+  DLTensor from{const_cast<uint8_t*>(zeros.data()), {kDLCPU, 0}, 1, DataType::UInt(8), &shape,
+                nullptr, 0};
+  for (int64_t offset = 0; offset < num_bytes; offset += kMaxChunkBytes) {
+    CopyBytes(&from, 0, to, to_offset + offset, std::min(kMaxChunkBytes, num_bytes - offset));
+  }
+}
+
+/*! \brief Allocate an array with the allocator of the VM for its device, if there is one. */
+NDArray AllocArray(VirtualMachine* vm, ShapeTuple shape, DLDataType dtype, Device device) {
+  for (size_t i = 0; i < vm->devices.size(); ++i) {
+    if (vm->devices[i].device_type == device.device_type &&
+        vm->devices[i].device_id == device.device_id) {
+      return vm->allocators[i]->Empty(shape, dtype, device);
+    }
+  }
+  return NDArray::Empty(shape, dtype, device);
+}
+
+/*!
+ * \brief The copies along an axis of a row-major array: `outer` blocks of `extent` rows
+ *  of `row_bytes` bytes.
+ */
+struct AxisBlocks {
+  int64_t outer{1};
+  int64_t extent;
+  int64_t row_bytes;
+
+  AxisBlocks(const NDArray& arr, int64_t axis) {
+    ICHECK_LT(axis, arr->ndim);
+    row_bytes = (arr->dtype.bits * arr->dtype.lanes + 7) / 8;
+    for (int64_t i = 0; i < arr->ndim; ++i) {
+      if (i < axis) {
+        outer *= arr->shape[i];
+      } else if (i > axis) {
+        row_bytes *= arr->shape[i];
+      }
+    }
+    extent = arr->shape[axis];
+  }
+};
+
+/*!
+ * \brief Pad an array with zeros along an axis.
+ * \param vm The VM, whose allocator of the device of the array is used.
+ * \param arr The array.
+ * \param axis The axis.
+ * \param size The padded size of the axis.
+ * \return The padded array.
+ */
+NDArray PadAxis(VirtualMachine* vm, const NDArray& arr, int64_t axis, int64_t size) {
+  AxisBlocks blocks(arr, axis);
+  std::vector<int64_t> shape(arr->shape, arr->shape + arr->ndim);
+  shape[axis] = size;
+  NDArray result = AllocArray(vm, ShapeTuple(shape), arr->dtype, arr->device);
+  int64_t src_block = blocks.extent * blocks.row_bytes;
+  int64_t dst_block = size * blocks.row_bytes;
+  // Off the host, the padding of all blocks is zeroed at once rather than block by block.
+  bool zero_at_once = blocks.outer > 1 && arr->device.device_type != kDLCPU;
+  if (zero_at_once) {
+    ZeroBytes(result.operator->(), 0, blocks.outer * dst_block);
+  }
+  for (int64_t i = 0; i < blocks.outer; ++i) {
+    CopyBytes(arr.operator->(), i * src_block, result.operator->(), i * dst_block, src_block);
+    if (!zero_at_once) {
+      ZeroBytes(result.operator->(), i * dst_block + src_block, dst_block - src_block);
+    }
+  }
+  return result;
+}
+
+/*!
+ * \brief Slice the leading elements of an array along an axis.
+ * \param vm The VM, whose allocator of the device of the array is used.
+ * \param arr The array.
+ * \param axis The axis.
+ * \param size The sliced size of the axis.
+ * \return The sliced array, which is a view of the array when the axis is the outermost one.
+ */
+NDArray SliceAxis(VirtualMachine* vm, NDArray arr, int64_t axis, int64_t size) {
+  AxisBlocks blocks(arr, axis);
+  std::vector<int64_t> shape(arr->shape, arr->shape + arr->ndim);
+  shape[axis] = size;
+  if (blocks.outer == 1) {
+    return arr.CreateView(ShapeTuple(shape), arr->dtype);
+  }
+  NDArray result = AllocArray(vm, ShapeTuple(shape), arr->dtype, arr->device);
+  int64_t src_block = blocks.extent * blocks.row_bytes;
+  int64_t dst_block = size * blocks.row_bytes;
+  for (int64_t i = 0; i < blocks.outer; ++i) {
+    CopyBytes(arr.operator->(), i * src_block, result.operator->(), i * dst_block, dst_block);
+  }
+  return result;
+}
+
+}  // namespace
+
+/*!
+ * \brief Dispatch a call to the function specialized for the smallest buckets that fit.
+ *
+ * The arguments are (vm, spec, args..., fallback, clones...), where the clones are in the
+ * row-major order of the bucket combinations, and spec is a shape tuple of
+ *
+ *   pad_to_bucket, num_args, num_vars,
+ *   for each var: num_buckets, buckets..., num_param_locs, (param, axis)...,
+ *   num_ret_locs, (field, axis, var)...
+ *
+ * where the field of a ret loc is -1 when the result is a tensor.
+ */
+void ShapeBucketDispatch(TVMArgs args, TVMRetValue* rv) {
+  VirtualMachine* vm = VirtualMachine::GetContextPtr(args[0]);
+  ShapeTuple spec = args[1];
+  const int64_t* code = spec.data();
+  bool pad_to_bucket = *code++;
+  int64_t num_args = *code++;
+  int64_t num_vars = *code++;
+  auto f_get_dim = [&](int64_t param, int64_t axis) -> int64_t {
+    TVMArgValue arg = args[2 + param];
+    if (arg.IsObjectRef<ShapeTuple>()) {
+      return arg.AsObjectRef<ShapeTuple>()[axis];
+    }
+    NDArray arr = arg;
+    return arr->shape[axis];
+  };
+
+  struct VarDispatch {
+    int64_t value;
+    int64_t bucket;
+    const int64_t* param_locs;
+    int64_t num_param_locs;
+  };
+  std::vector<VarDispatch> vars(num_vars);
+  int64_t clone_index = 0;
+  bool fallback = false;
+  bool padded = false;
+  for (VarDispatch& var : vars) {
+    int64_t num_buckets = *code++;
+    const int64_t* buckets = code;
+    code += num_buckets;
+    var.num_param_locs = *code++;
+    var.param_locs = code;
+    code += 2 * var.num_param_locs;
+    var.value = f_get_dim(var.param_locs[0], var.param_locs[1]);
+    for (int64_t i = 1; i < var.num_param_locs; ++i) {
+      int64_t value = f_get_dim(var.param_locs[2 * i], var.param_locs[2 * i + 1]);
+      CHECK_EQ(value, var.value) << "ValueError: The dim " << var.param_locs[2 * i + 1]
+                                 << " of argument " << var.param_locs[2 * i] << " is " << value
+                                 << ", but the same dim of another argument is " << var.value;
+    }
+    int64_t index = std::lower_bound(buckets, buckets + num_buckets, var.value) - buckets;
+    if (index == num_buckets || (!pad_to_bucket && buckets[index] != var.value)) {
+      fallback = true;
+    } else {
+      var.bucket = buckets[index];
+      padded |= var.bucket != var.value;
+    }
+    clone_index = clone_index * num_buckets + index;
+  }
+  int64_t num_ret_locs = *code++;
+  const int64_t* ret_locs = code;
+
+  const TVMValue* values = args.values + 2;
+  const int* tcodes = args.type_codes + 2;
+  if (fallback) {
+    vm->InvokeClosurePacked(args[2 + num_args], TVMArgs(values, tcodes, num_args), rv);
+    return;
+  }
+  ObjectRef clone = args[2 + num_args + 1 + clone_index];
+  if (!padded) {
+    vm->InvokeClosurePacked(clone, TVMArgs(values, tcodes, num_args), rv);
+    return;
+  }
+
+  std::vector<TVMRetValue> padded_args(num_args);
+  for (int64_t i = 0; i < num_args; ++i) {
+    padded_args[i] = args[2 + i];
+  }
+  for (const VarDispatch& var : vars) {
+    if (var.bucket == var.value) continue;
+    for (int64_t i = 0; i < var.num_param_locs; ++i) {
+      int64_t param = var.param_locs[2 * i];
+      int64_t axis = var.param_locs[2 * i + 1];
+      if (padded_args[param].IsObjectRef<ShapeTuple>()) {
+        ShapeTuple shape = padded_args[param].AsObjectRef<ShapeTuple>();
+        std::vector<int64_t> dims(shape.begin(), shape.end());
+        dims[axis] = var.bucket;
+        padded_args[param] = ShapeTuple(dims);
+      } else {
+        padded_args[param] = PadAxis(vm, padded_args[param], axis, var.bucket);
+      }
+    }
+  }
+  std::vector<TVMValue> padded_values(num_args);
+  std::vector<int> padded_tcodes(num_args);
+  TVMArgsSetter setter(padded_values.data(), padded_tcodes.data());
+  for (int64_t i = 0; i < num_args; ++i) {
+    setter(i, padded_args[i]);
+  }
+  vm->InvokeClosurePacked(clone, TVMArgs(padded_values.data(), padded_tcodes.data(), num_args),
+                          rv);
+
+  if (num_ret_locs == 0) return;
+  ObjectRef result = rv->operator ObjectRef();
+  bool is_tuple = result->IsInstance<ArrayNode>();
+  Array<ObjectRef> fields = is_tuple ? Downcast<Array<ObjectRef>>(result) : Array<ObjectRef>();
+  for (int64_t i = 0; i < num_ret_locs; ++i, ret_locs += 3) {
+    const VarDispatch& var = vars[ret_locs[2]];
+    if (var.bucket == var.value) continue;
+    if (ret_locs[0] < 0) {
+      result = SliceAxis(vm, Downcast<NDArray>(result), ret_locs[1], var.value);
+    } else {
+      fields.Set(ret_locs[0], SliceAxis(vm, Downcast<NDArray>(fields[ret_locs[0]]), ret_locs[1],
+                                        var.value));
+    }
+  }
+  *rv = is_tuple ? ObjectRef(fields) : result;
+}
+
+TVM_REGISTER_GLOBAL("vm.builtin.shape_bucket.dispatch").set_body(ShapeBucketDispatch);
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
@@ -25,7 +25,12 @@
 #include <tvm/runtime/profiling.h>
 #include <tvm/runtime/relax_vm/vm.h>
 
+#include <mutex>
 #include <optional>
+#include <sstream>
+#include <unordered_set>
+
+#include "sampling_profiler.h"
 
 namespace tvm {
 namespace runtime {
@@ -160,6 +165,8 @@ using RegType = TVMRetValue;
 struct VMFrame {
   /*! \brief The return program counter. */
   Index return_pc;
+  /*! \brief The index of the function in the function table. */
+  Index func_idx;
   /*! \brief Statically allocated space for objects */
   std::vector<RegType> register_file;
   /*! \brief Register in caller's frame to put return value */
@@ -172,8 +179,126 @@ struct VMFrame {
   /*! \brief Temporary argument tcode stack for packed func call. */
   std::vector<int> call_arg_tcodes;
 
-  VMFrame(Index pc, Index register_file_size)
-      : return_pc(pc), register_file(register_file_size), caller_return_register(0) {}
+  VMFrame(Index pc, Index func_idx, Index register_file_size)
+      : return_pc(pc),
+        func_idx(func_idx),
+        register_file(register_file_size),
+        caller_return_register(0) {}
+
+  /*!
+   * \brief Reuse the frame for another call. The register file keeps its
+   *  capacity, so this does not allocate once the frame has been sized.
+   */
+  void Reset(Index pc, Index func_idx, Index register_file_size) {
+    this->return_pc = pc;
+    this->func_idx = func_idx;
+    this->register_file.resize(register_file_size);
+    this->caller_return_register = 0;
+  }
+
+  /*! \brief Release the objects held by the registers. */
+  void Clear() { register_file.clear(); }
+};
+
+/*!
+ * \brief An instruction decoded when the VM is initialized.
+ *
+ * The arguments of a call that are not read from registers stay the same
+ * across runs once the constant and function pools are set up, so their
+ * packed values are prepared at decode time, and a call only fills in the
+ * register arguments before invoking the directly bound callee.
+ */
+struct DecodedInstr {
+  /*! \brief The opcode. */
+  Opcode op;
+  /*! \brief The destination of Call, the result of Ret, or the condition of If. */
+  RegName reg;
+  /*! \brief The pc offset of Goto, or the false offset of If. */
+  Index pc_offset;
+  /*! \brief The callee of Call: the PackedFunc, or the implementation of a VMClosure. */
+  const PackedFuncObj* callee;
+  /*! \brief The begin and size of the packed arguments in the argument tables. */
+  uint32_t args_begin;
+  uint32_t num_args;
+  /*! \brief The begin and size of the register arguments in the register argument table. */
+  uint32_t reg_args_begin;
+  uint32_t num_reg_args;
+  /*! \brief The begin and size of the VM pointer arguments in the VM argument table. */
+  uint32_t vm_args_begin;
+  uint32_t num_vm_args;
+  /*! \brief The index of the callee in the function table. */
+  Index func_idx;
+  /*!
+   * \brief Whether the callee is a bytecode function of the VM, whose frame is on the
+   *  stack of the calls it makes, so that it is not sampled as a call itself.
+   */
+  bool calls_vm_func;
+  /*! \brief How a capture treats the call. */
+  enum class CaptureKind : uint8_t {
+    /*! \brief The call writes into its arguments, and is replayed. */
+    kReplay,
+    /*! \brief The result only depends on the shapes, and is kept from the capture. */
+    kKeep,
+    /*! \brief The result may depend on the data, so the function cannot be replayed. */
+    kUnsupported,
+  } capture_kind;
+};
+
+/*! \brief A call argument read from a register. */
+struct DecodedRegArg {
+  /*! \brief The index in the packed arguments. */
+  uint32_t arg_index;
+  /*! \brief The register to read from. */
+  RegName reg;
+};
+
+/*!
+ * \brief The decoded instructions of an executable. The tables do not refer to
+ *  the VM, whose pointer is filled in per call, so the sessions of a VM share them.
+ */
+struct DecodedProgram {
+  /*! \brief The decoded instructions, indexed by pc. */
+  std::vector<DecodedInstr> instrs;
+  /*! \brief The packed argument values of the decoded calls, with registers left as holes. */
+  std::vector<TVMValue> arg_values;
+  /*! \brief The packed argument type codes of the decoded calls. */
+  std::vector<int> arg_tcodes;
+  /*! \brief The register arguments of the decoded calls. */
+  std::vector<DecodedRegArg> reg_args;
+  /*! \brief The indices of the arguments of the decoded calls that take the VM pointer. */
+  std::vector<uint32_t> vm_args;
+};
+
+/*!
+ * \brief The calls of a VM function recorded for one input signature.
+ *
+ * Replaying a capture copies the inputs into the static input arrays of
+ * the capture, and calls the recorded kernels with the recorded arguments.
+ * The allocations and shape computations are not rerun: their results are
+ * kept alive by the capture, so the recorded argument values stay valid.
+ */
+struct VMCapture {
+  /*! \brief A recorded call. */
+  struct Call {
+    const PackedFuncObj* callee;
+    uint32_t args_begin;
+    uint32_t num_args;
+  };
+  /*! \brief The signature of the inputs. */
+  std::string key;
+  /*! \brief Whether the function can be replayed. */
+  bool replayable{true};
+  /*! \brief The inputs the function was captured with, owned by the capture. */
+  std::vector<RegType> inputs;
+  /*! \brief The recorded calls. */
+  std::vector<Call> calls;
+  /*! \brief The packed arguments of the recorded calls. */
+  std::vector<TVMValue> arg_values;
+  std::vector<int> arg_tcodes;
+  /*! \brief The register values referenced by the recorded arguments. */
+  std::vector<RegType> keep_alive;
+  /*! \brief The result of the function. */
+  RegType result;
 };
 
 class VirtualMachineImpl : public VirtualMachine {
@@ -264,8 +389,30 @@ class VirtualMachineImpl : public VirtualMachine {
    * \return The object representing the result.
    */
   RegType InvokeBytecode(Index fidx, const std::vector<RegType>& args);
+  /*!
+   * \brief Invoke a VM function, replaying the calls captured in an earlier
+   *  invocation when the inputs have the same signature.
+   * \param fidx The function index.
+   * \param args The arguments to the function.
+   * \return The object representing the result, which is reused across replays.
+   */
+  RegType InvokeCaptured(Index fidx, const std::vector<RegType>& args);
+  /*!
+   * \brief Create a session of the VM, which runs the same executable on the same
+   *  devices and can be invoked concurrently with the VM.
+   *
+   *  The session shares the constants, the function pool and the decoded
+   *  instructions with the VM by reference. The frames, inputs, outputs,
+   *  saved closures and captures are owned by the session.
+   * \return The session.
+   */
+  ObjectPtr<VirtualMachineImpl> CreateSession() const;
 
  protected:
+  /*! \brief Create an uninitialized VM of the same kind, used by CreateSession. */
+  virtual ObjectPtr<VirtualMachineImpl> NewInstance() const {
+    return make_object<VirtualMachineImpl>();
+  }
   /*!
    * \brief Get function by querying all of the current module's imports.
    * \param name The name of the function.
@@ -288,10 +435,17 @@ class VirtualMachineImpl : public VirtualMachine {
   /*!
    * \brief Push a call frame onto the call stack.
    * \param ret_pc The program counter to return to.
+   * \param func_idx The index of the function to be pushed to the call stack.
    * \param vm_func The function to be pushed to the call stack.
    */
-  void PushFrame(Index ret_pc, const VMFuncInfo& vm_func) {
-    frames_.emplace_back(std::make_unique<VMFrame>(ret_pc, vm_func.register_file_size));
+  void PushFrame(Index ret_pc, Index func_idx, const VMFuncInfo& vm_func) {
+    if (free_frames_.empty()) {
+      frames_.emplace_back(std::make_unique<VMFrame>(ret_pc, func_idx, vm_func.register_file_size));
+    } else {
+      frames_.emplace_back(std::move(free_frames_.back()));
+      free_frames_.pop_back();
+      frames_.back()->Reset(ret_pc, func_idx, vm_func.register_file_size);
+    }
   }
   /*!
    * \brief Pop a frame off the call stack.
@@ -299,6 +453,8 @@ class VirtualMachineImpl : public VirtualMachine {
   void PopFrame() {
     ICHECK_GT(frames_.size(), 0);
     pc_ = frames_.back()->return_pc;
+    frames_.back()->Clear();
+    free_frames_.emplace_back(std::move(frames_.back()));
     frames_.pop_back();
   }
   /*!
@@ -343,6 +499,58 @@ class VirtualMachineImpl : public VirtualMachine {
   /*! \brief Run VM dispatch loop. */
   void RunLoop();
 
+  /*!
+   * \brief Whether calls need to go through RunInstrCall, which the
+   *  pre-decoded dispatch loop skips.
+   */
+  virtual bool HasCallHook() const { return instrument_ != nullptr; }
+
+  /*! \brief Decode the instructions of the executable into decoded_. */
+  void DecodeInstructions();
+
+  /*!
+   * \brief Run a decoded call instruction.
+   * \param curr_frame The current frame.
+   * \param instr The decoded call instruction.
+   */
+  void RunDecodedCall(VMFrame* curr_frame, const DecodedInstr& instr);
+
+  /*!
+   * \brief Record a decoded call into the capture being recorded.
+   * \param curr_frame The current frame.
+   * \param instr The decoded call instruction.
+   * \param values The packed argument values of the call.
+   * \param tcodes The packed argument type codes of the call.
+   */
+  void RecordCall(VMFrame* curr_frame, const DecodedInstr& instr, const TVMValue* values,
+                  const int* tcodes);
+
+  /*!
+   * \brief Record a sampled call under the current stack of VM functions.
+   * \param sampler The sampling profiler to record into.
+   * \param callee_idx The function index of the callee.
+   * \param cycles The cycles the call took, excluding the VM functions it invoked.
+   */
+  void RecordSample(VMSamplingProfiler* sampler, Index callee_idx, uint64_t cycles);
+
+  /*! \brief Get the sampling profiler, which may be swapped by another thread. */
+  std::shared_ptr<VMSamplingProfiler> GetSampler() {
+    std::lock_guard<std::mutex> lock(sampler_mutex_);
+    return sampler_;
+  }
+
+  /*! \brief Get the names of the functions in the function table. */
+  std::vector<std::string> GetFuncNames() const {
+    std::vector<std::string> names;
+    for (const VMFuncInfo& info : exec_->func_table) {
+      names.push_back(info.name);
+    }
+    return names;
+  }
+
+  /*! \brief Run the dispatch loop over the decoded instructions. */
+  void RunDecodedLoop();
+
   /*!
    * \brief Retrieve the name of the function identified by the given index.
    * \param idx The index into the VM executable function table.
@@ -372,6 +580,29 @@ class VirtualMachineImpl : public VirtualMachine {
    * \brief Function pool to cache functions in func_table
    */
   std::vector<TVMRetValue> func_pool_;
+  /*! \brief The decoded instructions, shared with the sessions of the VM. */
+  std::shared_ptr<const DecodedProgram> decoded_;
+  /*! \brief Whether to run the decoded instructions when there is no call hook. */
+  bool use_decoded_dispatch_{true};
+  /*! \brief The last capture of each function, by function index. */
+  std::unordered_map<Index, std::unique_ptr<VMCapture>> captures_;
+  /*! \brief The capture being recorded, if any. */
+  VMCapture* capture_{nullptr};
+  /*!
+   * \brief The sampling profiler, kept after sampling stops so it can be read.
+   *  It can be swapped and read from other threads, under sampler_mutex_.
+   */
+  std::shared_ptr<VMSamplingProfiler> sampler_;
+  /*! \brief The mutex guarding sampler_. */
+  std::mutex sampler_mutex_;
+  /*! \brief Whether the calls are being sampled, which other threads may toggle. */
+  std::atomic<bool> sampling_{false};
+  /*! \brief The number of calls until the next sample, only used by the running thread. */
+  int64_t sample_countdown_{0};
+  /*! \brief The number of sampled calls being timed on the stack. */
+  int num_active_samples_{0};
+  /*! \brief The cycles spent in the VM functions invoked by the innermost sampled call. */
+  uint64_t nested_cycles_{0};
   //--------------------------------------------------------
   // Executor interface support
   //--------------------------------------------------------
@@ -389,6 +620,11 @@ class VirtualMachineImpl : public VirtualMachine {
    * \note: Use unique ptr to avoid re-allocation and copy when frames_ get resized.
    */
   std::vector<std::unique_ptr<VMFrame>> frames_;
+  /*!
+   * \brief The popped frames, reused by the next calls so that the frames and
+   *  their register files are not allocated per call.
+   */
+  std::vector<std::unique_ptr<VMFrame>> free_frames_;
   /*! \brief The virtual machine PC. */
   Index pc_{0};
   /*! \brief The special return register. */
@@ -427,6 +663,21 @@ void VirtualMachineImpl::Init(const std::vector<Device>& devices,
   }
   // Setup function sections.
   this->InitFuncPool();
+  this->DecodeInstructions();
+}
+
+ObjectPtr<VirtualMachineImpl> VirtualMachineImpl::CreateSession() const {
+  CHECK(decoded_ != nullptr) << "ValueError: The VM must be initialized before creating a session";
+  ObjectPtr<VirtualMachineImpl> session = this->NewInstance();
+  session->exec_ = exec_;
+  session->imports_ = imports_;
+  session->devices = devices;
+  session->allocators = allocators;
+  session->const_pool_ = const_pool_;
+  session->func_pool_ = func_pool_;
+  session->decoded_ = decoded_;
+  session->use_decoded_dispatch_ = use_decoded_dispatch_;
+  return session;
 }
 
 VMFuncInfo VirtualMachineImpl::LookupVMFuncInfo(const std::string& func_name) {
@@ -493,6 +744,55 @@ PackedFunc VirtualMachineImpl::GetFunction(const String& name,
       }
       this->SetInstrument(func);
     });
+  } else if (name == "set_predecoded_dispatch") {
+    return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
+      this->use_decoded_dispatch_ = args[0];
+    });
+  } else if (name == "start_sampling") {
+    return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
+      int64_t sample_period = args[0];
+      {
+        std::lock_guard<std::mutex> lock(this->sampler_mutex_);
+        this->sampler_ = std::make_shared<VMSamplingProfiler>(sample_period);
+      }
+      this->sampling_ = true;
+    });
+  } else if (name == "stop_sampling") {
+    return PackedFunc(
+        [sptr_to_self, this](TVMArgs args, TVMRetValue* rv) { this->sampling_ = false; });
+  } else if (name == "sampling_report") {
+    return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
+      std::shared_ptr<VMSamplingProfiler> sampler = this->GetSampler();
+      CHECK(sampler != nullptr) << "ValueError: Sampling has not been started";
+      // Return the report as json, since profiling::Report object is not supported by RPC
+      *rv = sampler->Report(this->GetFuncNames())->AsJSON();
+    });
+  } else if (name == "sampling_flamegraph") {
+    return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
+      std::shared_ptr<VMSamplingProfiler> sampler = this->GetSampler();
+      CHECK(sampler != nullptr) << "ValueError: Sampling has not been started";
+      *rv = sampler->FoldedStacks(this->GetFuncNames());
+    });
+  } else if (name == "invoke_captured") {
+    return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
+      ICHECK_GE(args.size(), 1);
+      std::string func_name = args[0];
+      const auto& m = this->exec_->func_map;
+      auto it = m.find(func_name);
+      CHECK(it != m.end()) << "ValueError: Unknown function: " << func_name;
+      std::vector<RegType> inputs(args.size() - 1);
+      for (int i = 1; i < args.size(); ++i) {
+        inputs[i - 1] = ConvertArgToDevice(args[i], devices[0], allocators[0]);
+      }
+      *rv = this->InvokeCaptured(it->second, inputs);
+    });
+  } else if (name == "create_session") {
+    return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
+      *rv = Module(this->CreateSession());
+    });
+  } else if (name == "clear_captures") {
+    return PackedFunc(
+        [sptr_to_self, this](TVMArgs args, TVMRetValue* rv) { this->captures_.clear(); });
   } else if (name == "invoke_stateful") {
     return PackedFunc([sptr_to_self, this](TVMArgs args, TVMRetValue* rv) {
       std::string func_name = args[0];
@@ -701,10 +1001,11 @@ Optional<VMClosure> VirtualMachineImpl::GetClosureInternal(const String& func_na
     PackedFunc tir_func = GetFuncFromImports("__vmtir__" + finfo.name);
     ICHECK(tir_func != nullptr) << "Cannot find underlying compiled tir function of VMTIRFunc "
                                 << finfo.name;
-    auto impl = PackedFunc([this, finfo, tir_func](TVMArgs args, TVMRetValue* rv) {
+    // NOTE: the pools are taken from the ctx ptr, so the closure can be called by the sessions.
+    auto impl = PackedFunc([finfo, tir_func](TVMArgs args, TVMRetValue* rv) {
       // Per convention, ctx ptr is a VirtualMachine*
       VirtualMachine* ctx_ptr = static_cast<VirtualMachine*>(args[0].operator void*());
-      ICHECK(ctx_ptr == this);
+      VirtualMachineImpl* vm = static_cast<VirtualMachineImpl*>(ctx_ptr);
       ICHECK_EQ(args.size() - 1, finfo.num_args)
           << "Function " << finfo.name << " expects " << finfo.num_args << " arguments";
       ICHECK_GE(finfo.register_file_size, finfo.num_args + 1);
@@ -713,8 +1014,8 @@ Optional<VMClosure> VirtualMachineImpl::GetClosureInternal(const String& func_na
         reg_file[i] = args[i + 1];
       }
       void* reg_anylist_handle = reg_file.data();
-      void* const_anylist_handle = this->const_pool_.data();
-      void* func_anylist_handle = this->func_pool_.data();
+      void* const_anylist_handle = vm->const_pool_.data();
+      void* func_anylist_handle = vm->func_pool_.data();
       tir_func(static_cast<void*>(ctx_ptr), reg_anylist_handle, const_anylist_handle,
                func_anylist_handle);
       // Return value always stored after inputs.
@@ -732,12 +1033,12 @@ RegType VirtualMachineImpl::InvokeBytecode(Index gf_idx, const std::vector<RegTy
   ICHECK(gfunc.kind == VMFuncInfo::FuncKind::kVMFunc);
 
   // Get the curr instr which might be a potential caller.
-  Instruction curr_instr = exec_->GetInstruction(pc_);
-  PushFrame(this->pc_, gfunc);
+  PushFrame(this->pc_, gf_idx, gfunc);
   // Get new frame and set the caller info.
   VMFrame* curr_frame = frames_.back().get();
-  if (curr_instr.op == Opcode::Call) {
-    curr_frame->caller_return_register = curr_instr.dst;
+  if (static_cast<size_t>(pc_) < decoded_->instrs.size() &&
+      decoded_->instrs[pc_].op == Opcode::Call) {
+    curr_frame->caller_return_register = decoded_->instrs[pc_].reg;
   }
 
   // load arguments to the register file
@@ -749,7 +1050,14 @@ RegType VirtualMachineImpl::InvokeBytecode(Index gf_idx, const std::vector<RegTy
   }
   // set program counter
   pc_ = gfunc.start_instr;
-  RunLoop();
+  if (num_active_samples_ == 0) {
+    RunLoop();
+  } else {
+    // the time of a VM function is charged to the calls it makes, not to the sampled caller.
+    uint64_t start = ReadCycleCounter();
+    RunLoop();
+    nested_cycles_ += ReadCycleCounter() - start;
+  }
   return return_value_;
 }
 
@@ -867,6 +1175,10 @@ void VirtualMachineImpl::RunInstrCall(VMFrame* curr_frame, Instruction instr) {
 }
 
 void VirtualMachineImpl::RunLoop() {
+  if (use_decoded_dispatch_ && !HasCallHook()) {
+    RunDecodedLoop();
+    return;
+  }
   VMFrame* curr_frame = frames_.back().get();
 
   while (true) {
@@ -912,6 +1224,388 @@ void VirtualMachineImpl::RunLoop() {
   }
 }
 
+void VirtualMachineImpl::DecodeInstructions() {
+  size_t num_instrs = exec_->instr_offset.size();
+  auto program = std::make_shared<DecodedProgram>();
+  std::vector<DecodedInstr>& decoded_instrs = program->instrs;
+  std::vector<TVMValue>& decoded_arg_values = program->arg_values;
+  std::vector<int>& decoded_arg_tcodes = program->arg_tcodes;
+  std::vector<DecodedRegArg>& decoded_reg_args = program->reg_args;
+  std::vector<uint32_t>& decoded_vm_args = program->vm_args;
+  decoded_instrs.reserve(num_instrs);
+
+  // The register file size of the function that each instruction belongs to.
+  std::vector<Index> register_file_size(num_instrs, 0);
+  for (const VMFuncInfo& info : exec_->func_table) {
+    if (info.kind != VMFuncInfo::FuncKind::kVMFunc) continue;
+    for (Index pc = info.start_instr; pc < info.end_instr; ++pc) {
+      register_file_size[pc] = info.register_file_size;
+    }
+  }
+
+  for (size_t pc = 0; pc < num_instrs; ++pc) {
+    Instruction instr = exec_->GetInstruction(pc);
+    DecodedInstr decoded{};
+    decoded.op = instr.op;
+    switch (instr.op) {
+      case Opcode::Call: {
+        ICHECK_LT(static_cast<size_t>(instr.func_idx), func_pool_.size());
+        ICHECK(instr.dst >= Instruction::kBeginSpecialReg || instr.dst < register_file_size[pc])
+            << "pc = " << pc << " writes to register " << instr.dst << " out of range";
+        decoded.reg = instr.dst;
+        // Bind the callee, the closures take the VM as the first argument.
+        ObjectRef callee = func_pool_[instr.func_idx];
+        bool pass_vm = false;
+        if (auto* clo = callee.as<VMClosureObj>()) {
+          decoded.callee = static_cast<const PackedFuncObj*>(clo->impl.get());
+          pass_vm = true;
+        } else {
+          decoded.callee = callee.as<PackedFuncObj>();
+          ICHECK(decoded.callee != nullptr) << "Function expects a closure or PackedFunc ";
+        }
+        // The calls inside a VM function are captured on their own. The TIR
+        // functions of the VM call their kernels directly, which a capture
+        // cannot record.
+        static const std::unordered_set<std::string> shape_only_builtins = {
+            "vm.builtin.alloc_storage", "vm.builtin.alloc_tensor", "vm.builtin.alloc_shape_heap",
+            "vm.builtin.make_shape",    "vm.builtin.shape_of",     "vm.builtin.reshape",
+            "vm.builtin.null_value",    "vm.builtin.make_tuple",   "vm.builtin.tuple_getitem",
+            "vm.builtin.make_closure"};
+        VMFuncInfo::FuncKind callee_kind = exec_->func_table[instr.func_idx].kind;
+        if (callee_kind == VMFuncInfo::FuncKind::kVMTIRFunc) {
+          decoded.capture_kind = DecodedInstr::CaptureKind::kUnsupported;
+        } else if (callee_kind == VMFuncInfo::FuncKind::kVMFunc ||
+                   shape_only_builtins.count(GetFuncName(instr.func_idx))) {
+          decoded.capture_kind = DecodedInstr::CaptureKind::kKeep;
+        } else if (instr.dst == Instruction::kVoidRegister) {
+          decoded.capture_kind = DecodedInstr::CaptureKind::kReplay;
+        } else {
+          decoded.capture_kind = DecodedInstr::CaptureKind::kUnsupported;
+        }
+        decoded.func_idx = instr.func_idx;
+        decoded.calls_vm_func = callee_kind == VMFuncInfo::FuncKind::kVMFunc;
+        decoded.args_begin = decoded_arg_values.size();
+        decoded.num_args = instr.num_args + (pass_vm ? 1 : 0);
+        decoded.reg_args_begin = decoded_reg_args.size();
+        decoded.vm_args_begin = decoded_vm_args.size();
+        decoded_arg_values.resize(decoded.args_begin + decoded.num_args);
+        decoded_arg_tcodes.resize(decoded.args_begin + decoded.num_args);
+        runtime::TVMArgsSetter setter(decoded_arg_values.data() + decoded.args_begin,
+                                      decoded_arg_tcodes.data() + decoded.args_begin);
+        // per convention, ctx ptr must be VirtualMachine* casted to void, which
+        // is filled in by the VM running the call.
+        if (pass_vm) {
+          setter(0, static_cast<void*>(nullptr));
+          decoded_vm_args.push_back(0);
+        }
+        for (Index i = 0; i < instr.num_args; ++i) {
+          Instruction::Arg arg = instr.args[i];
+          uint32_t arg_index = i + (pass_vm ? 1 : 0);
+          switch (arg.kind()) {
+            case Instruction::ArgKind::kRegister: {
+              if (arg.value() == Instruction::kVoidRegister) {
+                setter(arg_index, nullptr);
+              } else if (arg.value() == Instruction::kVMRegister) {
+                setter(arg_index, static_cast<void*>(nullptr));
+                decoded_vm_args.push_back(arg_index);
+              } else {
+                decoded_reg_args.push_back(DecodedRegArg{arg_index, arg.value()});
+              }
+              break;
+            }
+            case Instruction::ArgKind::kImmediate: {
+              setter(arg_index, arg.value());
+              break;
+            }
+            case Instruction::ArgKind::kConstIdx: {
+              setter(arg_index, this->const_pool_[arg.value()]);
+              break;
+            }
+            case Instruction::ArgKind::kFuncIdx: {
+              ICHECK_LT(static_cast<size_t>(arg.value()), this->func_pool_.size());
+              setter(arg_index, this->func_pool_[arg.value()]);
+              break;
+            }
+            default: {
+              LOG(FATAL) << "ValueError: Unknown argument kind: " << int(arg.kind());
+            }
+          }
+        }
+        decoded.num_reg_args = decoded_reg_args.size() - decoded.reg_args_begin;
+        decoded.num_vm_args = decoded_vm_args.size() - decoded.vm_args_begin;
+        break;
+      }
+      case Opcode::Ret: {
+        decoded.reg = instr.result;
+        break;
+      }
+      case Opcode::Goto: {
+        decoded.pc_offset = instr.pc_offset;
+        break;
+      }
+      case Opcode::If: {
+        ICHECK_GT(instr.false_offset, 1);
+        decoded.reg = instr.cond;
+        decoded.pc_offset = instr.false_offset;
+        break;
+      }
+    }
+    decoded_instrs.push_back(decoded);
+  }
+  decoded_ = std::move(program);
+}
+
+void VirtualMachineImpl::RunDecodedCall(VMFrame* curr_frame, const DecodedInstr& instr) {
+  // Use the call arg stack from the current frame to increase reuse
+  // and avoid re-allocation
+  curr_frame->call_arg_values.resize(instr.num_args);
+  curr_frame->call_arg_tcodes.resize(instr.num_args);
+  TVMValue* values = curr_frame->call_arg_values.data();
+  int* tcodes = curr_frame->call_arg_tcodes.data();
+  std::copy_n(decoded_->arg_values.data() + instr.args_begin, instr.num_args, values);
+  std::copy_n(decoded_->arg_tcodes.data() + instr.args_begin, instr.num_args, tcodes);
+  const uint32_t* vm_args = decoded_->vm_args.data() + instr.vm_args_begin;
+  for (uint32_t i = 0; i < instr.num_vm_args; ++i) {
+    values[vm_args[i]].v_handle = static_cast<void*>(static_cast<VirtualMachine*>(this));
+  }
+
+  runtime::TVMArgsSetter setter(values, tcodes);
+  const DecodedRegArg* reg_args = decoded_->reg_args.data() + instr.reg_args_begin;
+  for (uint32_t i = 0; i < instr.num_reg_args; ++i) {
+    setter(reg_args[i].arg_index, curr_frame->register_file[reg_args[i].reg]);
+  }
+  if (capture_ != nullptr) {
+    RecordCall(curr_frame, instr, values, tcodes);
+  }
+  TVMRetValue ret;
+  if (sampling_.load(std::memory_order_relaxed) && --sample_countdown_ <= 0 &&
+      !instr.calls_vm_func) {
+    std::shared_ptr<VMSamplingProfiler> sampler = GetSampler();
+    sample_countdown_ = sampler->sample_period();
+    // Time the call exclusive of the VM functions it invokes, such as the closures of
+    // vm.builtin.invoke_closure, whose calls are sampled on their own.
+    struct SampleScope {
+      VirtualMachineImpl* vm;
+      uint64_t saved_nested_cycles;
+      explicit SampleScope(VirtualMachineImpl* vm)
+          : vm(vm), saved_nested_cycles(vm->nested_cycles_) {
+        vm->nested_cycles_ = 0;
+        ++vm->num_active_samples_;
+      }
+      ~SampleScope() {
+        vm->nested_cycles_ = saved_nested_cycles;
+        --vm->num_active_samples_;
+      }
+    } scope(this);
+    uint64_t start = ReadCycleCounter();
+    instr.callee->CallPacked(TVMArgs(values, tcodes, instr.num_args), &ret);
+    uint64_t cycles = ReadCycleCounter() - start;
+    RecordSample(sampler.get(), instr.func_idx, cycles - std::min(cycles, nested_cycles_));
+  } else {
+    instr.callee->CallPacked(TVMArgs(values, tcodes, instr.num_args), &ret);
+  }
+
+  // save the return value to the register
+  // saving to special register is a NOP
+  if (instr.reg < Instruction::kBeginSpecialReg) {
+    curr_frame->register_file[instr.reg] = std::move(ret);
+  }
+  pc_++;
+}
+
+void VirtualMachineImpl::RecordSample(VMSamplingProfiler* sampler, Index callee_idx,
+                                      uint64_t cycles) {
+  // keep the innermost functions of deep stacks.
+  Index stack[VMSamplingProfiler::kMaxStackDepth];
+  int depth = std::min<int>(frames_.size(), VMSamplingProfiler::kMaxStackDepth - 1);
+  for (int i = 0; i < depth; ++i) {
+    stack[i] = frames_[frames_.size() - depth + i]->func_idx;
+  }
+  stack[depth] = callee_idx;
+  sampler->Record(stack, depth + 1, cycles);
+}
+
+void VirtualMachineImpl::RecordCall(VMFrame* curr_frame, const DecodedInstr& instr,
+                                    const TVMValue* values, const int* tcodes) {
+  if (!capture_->replayable) return;
+  switch (instr.capture_kind) {
+    case DecodedInstr::CaptureKind::kKeep: {
+      return;
+    }
+    case DecodedInstr::CaptureKind::kUnsupported: {
+      DLOG(INFO) << "Cannot capture the call at pc = " << pc_;
+      capture_->replayable = false;
+      return;
+    }
+    case DecodedInstr::CaptureKind::kReplay: {
+      VMCapture::Call call{instr.callee, static_cast<uint32_t>(capture_->arg_values.size()),
+                           instr.num_args};
+      capture_->arg_values.insert(capture_->arg_values.end(), values, values + instr.num_args);
+      capture_->arg_tcodes.insert(capture_->arg_tcodes.end(), tcodes, tcodes + instr.num_args);
+      const DecodedRegArg* reg_args = decoded_->reg_args.data() + instr.reg_args_begin;
+      for (uint32_t i = 0; i < instr.num_reg_args; ++i) {
+        capture_->keep_alive.push_back(curr_frame->register_file[reg_args[i].reg]);
+      }
+      capture_->calls.push_back(call);
+      return;
+    }
+  }
+}
+
+RegType VirtualMachineImpl::InvokeCaptured(Index gf_idx, const std::vector<RegType>& args) {
+  const VMFuncInfo& gfunc = exec_->func_table[gf_idx];
+  CHECK(gfunc.kind == VMFuncInfo::FuncKind::kVMFunc)
+      << "ValueError: Only the bytecode functions of the VM can be captured, but " << gfunc.name
+      << " is not one";
+  // The signature covers everything the shape computations may depend on.
+  std::ostringstream os;
+  for (const RegType& arg : args) {
+    if (arg.type_code() == kTVMNDArrayHandle) {
+      NDArray arr = arg;
+      os << "T" << arr->device.device_type << ":" << arr->device.device_id << ":"
+         << DLDataType2String(arr->dtype) << "[";
+      for (int i = 0; i < arr->ndim; ++i) {
+        os << arr->shape[i] << ",";
+      }
+      os << "]";
+    } else if (arg.IsObjectRef<ShapeTuple>()) {
+      ShapeTuple shape = arg;
+      os << "S[";
+      for (int64_t dim : shape) {
+        os << dim << ",";
+      }
+      os << "]";
+    } else if (arg.type_code() == kDLInt) {
+      os << "I" << arg.operator int64_t();
+    } else {
+      // other inputs may be mutable or data dependent, so run without capture.
+      return InvokeBytecode(gf_idx, args);
+    }
+    os << ";";
+  }
+  std::string key = os.str();
+
+  auto it = captures_.find(gf_idx);
+  if (it != captures_.end() && it->second->key == key) {
+    VMCapture* capture = it->second.get();
+    if (!capture->replayable) {
+      return InvokeBytecode(gf_idx, args);
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+      if (args[i].type_code() == kTVMNDArrayHandle) {
+        capture->inputs[i].operator NDArray().CopyFrom(args[i].operator NDArray());
+      }
+    }
+    for (const VMCapture::Call& call : capture->calls) {
+      TVMRetValue rv;
+      call.callee->CallPacked(TVMArgs(capture->arg_values.data() + call.args_begin,
+                                      capture->arg_tcodes.data() + call.args_begin,
+                                      call.num_args),
+                              &rv);
+    }
+    return capture->result;
+  }
+
+  if (capture_ != nullptr || HasCallHook() || !use_decoded_dispatch_) {
+    return InvokeBytecode(gf_idx, args);
+  }
+  // Capture with inputs owned by the capture, which the replays copy into.
+  auto capture = std::make_unique<VMCapture>();
+  capture->key = key;
+  for (const RegType& arg : args) {
+    if (arg.type_code() == kTVMNDArrayHandle) {
+      NDArray arr = arg;
+      NDArray input = NDArray::Empty(arr.Shape(), arr->dtype, arr->device);
+      input.CopyFrom(arr);
+      RegType reg;
+      reg = input;
+      capture->inputs.push_back(reg);
+    } else {
+      capture->inputs.push_back(arg);
+    }
+  }
+  capture_ = capture.get();
+  try {
+    capture->result = InvokeBytecode(gf_idx, capture->inputs);
+  } catch (...) {
+    capture_ = nullptr;
+    throw;
+  }
+  capture_ = nullptr;
+  RegType result = capture->result;
+  captures_[gf_idx] = std::move(capture);
+  return result;
+}
+
+void VirtualMachineImpl::RunDecodedLoop() {
+  VMFrame* curr_frame = frames_.back().get();
+  const DecodedInstr* code = decoded_->instrs.data();
+  ICHECK_LT(static_cast<size_t>(pc_), decoded_->instrs.size()) << "run into invalid section";
+
+  // Use computed goto where the compiler supports it. Each opcode then ends
+  // with its own indirect branch, which predicts better than a shared switch.
+#if defined(__GNUC__) || defined(__clang__)
+  static void* const dispatch_table[] = {&&op_invalid, &&op_call, &&op_ret, &&op_goto, &&op_if};
+#define TVM_RELAX_VM_DISPATCH() goto* dispatch_table[static_cast<int>(code[pc_].op)]
+#define TVM_RELAX_VM_CASE(label, opcode) label:
+  TVM_RELAX_VM_DISPATCH();
+#else
+#define TVM_RELAX_VM_DISPATCH() continue
+#define TVM_RELAX_VM_CASE(label, opcode) case opcode:
+  while (true) {
+    switch (code[pc_].op) {
+#endif
+  TVM_RELAX_VM_CASE(op_call, Opcode::Call) {
+    this->RunDecodedCall(curr_frame, code[pc_]);
+    TVM_RELAX_VM_DISPATCH();
+  }
+  TVM_RELAX_VM_CASE(op_ret, Opcode::Ret) {
+    // If we have hit the point from which we started
+    // running, we should return to the caller breaking
+    // the dispatch loop.
+    // the frame is popped right after, so the result is moved out of its register.
+    if (code[pc_].reg < Instruction::kBeginSpecialReg) {
+      return_value_ = std::move(curr_frame->register_file[code[pc_].reg]);
+    } else {
+      return_value_ = ReadRegister(curr_frame, code[pc_].reg);
+    }
+    RegName caller_return_register = curr_frame->caller_return_register;
+    PopFrame();
+    if (frames_.size() != 0) {
+      // return from a local call.
+      // Update the current frame to be the parent frame.
+      curr_frame = frames_.back().get();
+      WriteRegister(curr_frame, caller_return_register, return_value_);
+    }
+    return;
+  }
+  TVM_RELAX_VM_CASE(op_goto, Opcode::Goto) {
+    pc_ += code[pc_].pc_offset;
+    TVM_RELAX_VM_DISPATCH();
+  }
+  TVM_RELAX_VM_CASE(op_if, Opcode::If) {
+    if (capture_ != nullptr) {
+      // the branch may depend on the data, which a replay cannot follow.
+      capture_->replayable = false;
+    }
+    int64_t cond_val = ReadRegister(curr_frame, code[pc_].reg);
+    pc_ += cond_val != 0 ? 1 : code[pc_].pc_offset;
+    TVM_RELAX_VM_DISPATCH();
+  }
+#if defined(__GNUC__) || defined(__clang__)
+op_invalid:
+#else
+      default:
+        break;
+    }
+    break;
+  }
+#endif
+  LOG(FATAL) << "should never hit this case: " << static_cast<int>(code[pc_].op);
+#undef TVM_RELAX_VM_DISPATCH
+#undef TVM_RELAX_VM_CASE
+}
+
 ObjectPtr<VirtualMachine> VirtualMachine::Create() { return make_object<VirtualMachineImpl>(); }
 
 //----------------------------------------------------------------
@@ -976,6 +1670,14 @@ class VirtualMachineProfiler : public VirtualMachineImpl {
   }
 
  protected:
+  ObjectPtr<VirtualMachineImpl> NewInstance() const override {
+    return make_object<VirtualMachineProfiler>();
+  }
+
+  bool HasCallHook() const override {
+    return (prof_ && prof_->IsRunning()) || VirtualMachineImpl::HasCallHook();
+  }
+
   void RunInstrCall(VMFrame* curr_frame, Instruction inst) override {
     bool profiling = false;
     if (prof_ && prof_->IsRunning()) {
@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*!
+ * \file src/support/mapped_file.h
+ * \brief Memory mapped files that CPU arrays can view into without copying.
+ */
+#ifndef TVM_SUPPORT_MAPPED_FILE_H_
+#define TVM_SUPPORT_MAPPED_FILE_H_
+
+#include <dlpack/dlpack.h>
+#include <tvm/runtime/logging.h>
+#include <tvm/runtime/ndarray.h>
+
+#include <memory>
+#include <string>
+
+#include "../runtime/file_utils.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tvm {
+namespace support {
+
+using runtime::DataType;
+using runtime::NDArray;
+using runtime::ShapeTuple;
+
+/*!
+ * \brief A memory mapped file, shared by all arrays viewing into it.
+ *
+ * The file is mapped privately, so that the pages are shared with the page
+ * cache (and thus with other processes mapping the same file) until they are
+ * written to. Platforms without mmap read the file into memory instead.
+ */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& file_name) {
+#if !defined(_WIN32)
+    int fd = open(file_name.c_str(), O_RDONLY);
+    CHECK_NE(fd, -1) << "Cannot open " << file_name;
+    struct stat file_stat;
+    CHECK_EQ(fstat(fd, &file_stat), 0) << "Cannot stat " << file_name;
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ != 0) {
+      void* data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      CHECK(data != MAP_FAILED) << "Cannot mmap " << file_name;
+      data_ = static_cast<char*>(data);
+    }
+    close(fd);
+#else
+    runtime::LoadBinaryFromFile(file_name, &buffer_);
+    data_ = buffer_.empty() ? nullptr : &buffer_[0];
+    size_ = buffer_.size();
+#endif
+  }
+
+  ~MappedFile() {
+#if !defined(_WIN32)
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  char* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  /*!
+   * \brief Create a CPU array viewing into the mapping.
+   * \param file The mapped file, kept alive as long as the view.
+   * \param byte_offset The offset of the array in the file.
+   * \param shape The shape of the array.
+   * \param dtype The dtype of the array.
+   */
+  static NDArray CreateView(std::shared_ptr<MappedFile> file, int64_t byte_offset,
+                            ShapeTuple shape, DataType dtype) {
+    struct ViewContext {
+      DLManagedTensor managed_tensor;
+      std::shared_ptr<MappedFile> file;
+    };
+    ViewContext* ctx = new ViewContext();
+    ctx->file = file;
+    DLTensor& tensor = ctx->managed_tensor.dl_tensor;
+    tensor.data = file->data() + byte_offset;
+    tensor.device = DLDevice{kDLCPU, 0};
+    tensor.ndim = static_cast<int32_t>(shape.size());
+    tensor.dtype = dtype;
+    // FromDLPack copies the shape before returning.
+    tensor.shape = const_cast<int64_t*>(shape.data());
+    tensor.strides = nullptr;
+    tensor.byte_offset = 0;
+    ctx->managed_tensor.manager_ctx = ctx;
+    ctx->managed_tensor.deleter = [](DLManagedTensor* self) {
+      delete static_cast<ViewContext*>(self->manager_ctx);
+    };
+    return NDArray::FromDLPack(&ctx->managed_tensor);
+  }
+
+ private:
+  char* data_{nullptr};
+  size_t size_{0};
+#if defined(_WIN32)
+  std::string buffer_;
+#endif
+};
+
+}  // namespace support
+}  // namespace tvm
+
+#endif  // TVM_SUPPORT_MAPPED_FILE_H_
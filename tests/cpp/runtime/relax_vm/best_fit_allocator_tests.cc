@@ -0,0 +1,129 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <tvm/runtime/data_type.h>
+
+#include "../../../../src/runtime/relax_vm/best_fit_allocator.h"
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+TEST(BestFitAllocator, ReuseFreedBlock) {
+  BestFitAllocator allocator({kDLCPU, 0});
+  auto buff = allocator.Alloc(1000, 64, DataType::Float(32));
+  EXPECT_EQ(buff.size, 1024);
+  allocator.Free(buff);
+  // a smaller request is served from the cached segment
+  auto buff2 = allocator.Alloc(700, 64, DataType::Float(32));
+  EXPECT_EQ(buff2.data, buff.data);
+  EXPECT_EQ(buff2.size, 1024);
+  auto stats = allocator.GetStats();
+  EXPECT_EQ(stats.num_allocs, 2);
+  EXPECT_EQ(stats.num_cache_hits, 1);
+  EXPECT_EQ(stats.num_device_allocs, 1);
+  EXPECT_EQ(stats.allocated_bytes, 1024);
+  EXPECT_EQ(stats.reserved_bytes, BestFitAllocator::kSmallSegmentSize);
+  allocator.Free(buff2);
+  EXPECT_EQ(allocator.GetStats().allocated_bytes, 0);
+}
+
+TEST(BestFitAllocator, SplitAndCoalesce) {
+  BestFitAllocator allocator({kDLCPU, 0});
+  auto a = allocator.Alloc(4096, 64, DataType::Float(32));
+  auto b = allocator.Alloc(4096, 64, DataType::Float(32));
+  auto c = allocator.Alloc(4096, 64, DataType::Float(32));
+  // the blocks are carved out of one segment
+  EXPECT_EQ(static_cast<char*>(b.data), static_cast<char*>(a.data) + 4096);
+  EXPECT_EQ(static_cast<char*>(c.data), static_cast<char*>(b.data) + 4096);
+  EXPECT_EQ(allocator.GetStats().num_segments, 1);
+  allocator.Free(a);
+  allocator.Free(b);
+  // the freed neighbours are merged into one block that fits a larger request
+  auto d = allocator.Alloc(8192, 64, DataType::Float(32));
+  EXPECT_EQ(d.data, a.data);
+  EXPECT_EQ(allocator.GetStats().num_segments, 1);
+  allocator.Free(c);
+  allocator.Free(d);
+  // everything coalesces back into the whole segment, which can be trimmed
+  allocator.Trim();
+  auto stats = allocator.GetStats();
+  EXPECT_EQ(stats.num_segments, 0);
+  EXPECT_EQ(stats.reserved_bytes, 0);
+  EXPECT_EQ(stats.num_device_frees, 1);
+}
+
+TEST(BestFitAllocator, AlignedReuse) {
+  BestFitAllocator allocator({kDLCPU, 0});
+  auto a = allocator.Alloc(100, 64, DataType::Float(32));
+  auto b = allocator.Alloc(100, 64, DataType::Float(32));
+  allocator.Free(a);
+  // a request with a larger alignment reuses blocks of the segment of smaller ones
+  auto c = allocator.Alloc(100, 256, DataType::Float(32));
+  auto d = allocator.Alloc(100, 256, DataType::Float(32));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(c.data) % 256, 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(d.data) % 256, 0);
+  auto stats = allocator.GetStats();
+  EXPECT_EQ(stats.num_cache_hits, 3);
+  EXPECT_EQ(stats.num_device_allocs, 1);
+  allocator.Free(b);
+  allocator.Free(c);
+  allocator.Free(d);
+}
+
+TEST(BestFitAllocator, LargeAllocation) {
+  BestFitAllocator allocator({kDLCPU, 0});
+  size_t nbytes = 3 * BestFitAllocator::kSmallSize;
+  auto buff = allocator.Alloc(nbytes, 64, DataType::Float(32));
+  EXPECT_EQ(buff.size, nbytes);
+  EXPECT_EQ(allocator.GetStats().reserved_bytes, 2 * BestFitAllocator::kLargeSegmentRoundSize);
+  allocator.Free(buff);
+  // a small request never takes a block from the large pool
+  auto small = allocator.Alloc(64, 64, DataType::Float(32));
+  EXPECT_EQ(allocator.GetStats().num_segments, 2);
+  allocator.Free(small);
+}
+
+TEST(BestFitAllocator, Budget) {
+  BestFitAllocator allocator({kDLCPU, 0});
+  size_t nbytes = BestFitAllocator::kLargeSegmentRoundSize * 2;
+  auto a = allocator.Alloc(nbytes, 64, DataType::Float(32));
+  auto b = allocator.Alloc(nbytes, 64, DataType::Float(32));
+  allocator.Free(a);
+  allocator.Free(b);
+  EXPECT_EQ(allocator.GetStats().reserved_bytes, 2 * nbytes);
+  // the least recently used segment goes back to the device first
+  allocator.SetBudget(nbytes);
+  auto stats = allocator.GetStats();
+  EXPECT_EQ(stats.reserved_bytes, nbytes);
+  EXPECT_EQ(stats.num_device_frees, 1);
+  auto c = allocator.Alloc(nbytes, 64, DataType::Float(32));
+  EXPECT_EQ(c.data, b.data);
+  // the budget is enforced before growing
+  auto d = allocator.Alloc(nbytes, 64, DataType::Float(32));
+  allocator.Free(c);
+  EXPECT_EQ(allocator.GetStats().reserved_bytes, nbytes);
+  EXPECT_EQ(allocator.GetStats().peak_reserved_bytes, 2 * nbytes);
+  allocator.Free(d);
+}
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
@@ -0,0 +1,182 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <tvm/runtime/data_type.h>
+#include <tvm/runtime/device_api.h>
+#include <tvm/runtime/registry.h>
+
+#include <cstdlib>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../../../src/runtime/relax_vm/pooled_allocator.h"
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+/*! \brief A device of ext_dev type, which runs out of memory past a few pages. */
+class LimitedDeviceAPI final : public DeviceAPI {
+ public:
+  static constexpr size_t kCapacity = 3 * PooledAllocator::kDefaultPageSize;
+
+  void SetDevice(Device dev) final {}
+  void GetAttr(Device dev, DeviceAttrKind kind, TVMRetValue* rv) final {}
+  void* AllocDataSpace(Device dev, size_t nbytes, size_t alignment, DLDataType type_hint) final {
+    std::lock_guard<std::mutex> lock(mu_);
+    CHECK_LE(used_ + nbytes, kCapacity) << "Out of memory";
+    void* ptr = std::malloc(nbytes);
+    sizes_[ptr] = nbytes;
+    used_ += nbytes;
+    return ptr;
+  }
+  void FreeDataSpace(Device dev, void* ptr) final {
+    std::lock_guard<std::mutex> lock(mu_);
+    used_ -= sizes_.at(ptr);
+    sizes_.erase(ptr);
+    std::free(ptr);
+  }
+  void StreamSync(Device dev, TVMStreamHandle stream) final {}
+
+ private:
+  std::mutex mu_;
+  std::unordered_map<void*, size_t> sizes_;
+  size_t used_{0};
+};
+
+TVM_REGISTER_GLOBAL("device_api.ext_dev").set_body([](TVMArgs args, TVMRetValue* rv) {
+  static LimitedDeviceAPI inst;
+  *rv = static_cast<void*>(&inst);
+});
+
+TEST(PooledAllocator, ThreadCacheReuse) {
+  PooledAllocator allocator({kDLCPU, 0});
+  auto buff = allocator.Alloc(64, 64, DataType::Float(32));
+  EXPECT_EQ(buff.size, PooledAllocator::kDefaultPageSize);
+  allocator.Free(buff);
+  // the freed buffer is served from the thread cache
+  auto buff2 = allocator.Alloc(100, 64, DataType::Float(32));
+  EXPECT_EQ(buff2.data, buff.data);
+  allocator.Free(buff2);
+}
+
+TEST(PooledAllocator, ThreadCacheFlush) {
+  PooledAllocator allocator({kDLCPU, 0});
+  size_t nbytes = PooledAllocator::kThreadCacheMaxBufferSize;
+  size_t num_buffers = PooledAllocator::kThreadCacheCapacity / nbytes + 1;
+  std::vector<Buffer> buffers;
+  for (size_t i = 0; i < num_buffers; ++i) {
+    buffers.push_back(allocator.Alloc(nbytes, 64, DataType::Float(32)));
+  }
+  for (const Buffer& buffer : buffers) {
+    allocator.Free(buffer);
+  }
+  // a cache over its capacity returns half of its bytes to the shared pool
+  EXPECT_NE(allocator.GetStatsJSON().find("\"num_thread_cache_flushes\": 1"), std::string::npos);
+
+  // another thread takes the returned buffers from the shared pool
+  std::vector<Buffer> other;
+  std::thread([&]() {
+    for (size_t i = 0; i < num_buffers; ++i) {
+      other.push_back(allocator.Alloc(nbytes, 64, DataType::Float(32)));
+    }
+    for (const Buffer& buffer : other) {
+      allocator.Free(buffer);
+    }
+  }).join();
+  size_t num_reused = 0;
+  for (const Buffer& buffer : other) {
+    for (const Buffer& prev : buffers) {
+      num_reused += buffer.data == prev.data;
+    }
+  }
+  EXPECT_EQ(num_reused, num_buffers - PooledAllocator::kThreadCacheCapacity / 2 / nbytes);
+}
+
+TEST(PooledAllocator, OrphanedThreadCache) {
+  PooledAllocator allocator({kDLCPU, 0});
+  Buffer buff;
+  std::thread([&]() {
+    buff = allocator.Alloc(64, 64, DataType::Float(32));
+    allocator.Free(buff);
+  }).join();
+  // the cache of the exited thread is taken over by the shared pool
+  auto buff2 = allocator.Alloc(64, 64, DataType::Float(32));
+  EXPECT_EQ(buff2.data, buff.data);
+  allocator.Free(buff2);
+}
+
+TEST(PooledAllocator, ConcurrentAllocFree) {
+  PooledAllocator allocator({kDLCPU, 0});
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 1000; ++i) {
+        std::vector<Buffer> buffers;
+        for (int j = 1; j <= 8; ++j) {
+          buffers.push_back(allocator.Alloc(j * 1000, 64, DataType::Float(32)));
+        }
+        for (const Buffer& buffer : buffers) {
+          allocator.Free(buffer);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // after warming up, every thread allocates from its own cache
+  std::string stats = allocator.GetStatsJSON();
+  EXPECT_EQ(stats.find("\"num_thread_cache_hits\": 0,"), std::string::npos);
+  EXPECT_NE(stats.find("\"num_thread_cache_flushes\": 0"), std::string::npos);
+}
+
+TEST(PooledAllocator, ReleaseThreadCachesOnOOM) {
+  PooledAllocator allocator({kDLExtDev, 0});
+  size_t page = PooledAllocator::kDefaultPageSize;
+  std::promise<void> cached, retried, caught_up, done;
+  std::thread worker([&]() {
+    Buffer cached_buff = allocator.Alloc(page, 64, DataType::Float(32));
+    Buffer held_buff = allocator.Alloc(page, 64, DataType::Float(32));
+    allocator.Free(cached_buff);
+    cached.set_value();
+    retried.get_future().wait();
+    // the next free of the worker releases its cache, which missed the retry
+    allocator.Free(held_buff);
+    caught_up.set_value();
+    done.get_future().wait();
+  });
+  cached.get_future().wait();
+  // the retry cannot take the buffer cached by the live worker
+  EXPECT_THROW(allocator.Alloc(2 * page, 64, DataType::Float(32)), InternalError);
+  retried.set_value();
+  caught_up.get_future().wait();
+  Buffer buff = allocator.Alloc(2 * page, 64, DataType::Float(32));
+  allocator.Free(buff);
+  done.set_value();
+  worker.join();
+}
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
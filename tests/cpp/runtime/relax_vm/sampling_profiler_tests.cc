@@ -0,0 +1,88 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "../../../../src/runtime/relax_vm/sampling_profiler.h"
+
+namespace tvm {
+namespace runtime {
+namespace relax_vm {
+
+TEST(VMSamplingProfiler, FoldedStacks) {
+  VMSamplingProfiler profiler(10);
+  std::vector<std::string> names = {"main", "inner", "add", "mul"};
+  Index add_stack[] = {0, 2};
+  Index mul_stack[] = {0, 1, 3};
+  profiler.Record(add_stack, 2, 100);
+  profiler.Record(add_stack, 2, 100);
+  profiler.Record(mul_stack, 3, 1000);
+  std::string folded = profiler.FoldedStacks(names);
+  // the stacks are sorted by time
+  EXPECT_EQ(folded.find("main;inner;mul "), 0);
+  EXPECT_NE(folded.find("\nmain;add "), std::string::npos);
+
+  profiling::Report report = profiler.Report(names);
+  ASSERT_EQ(report->calls.size(), 2);
+  EXPECT_EQ(report->calls[1]["Name"].as<StringObj>()->data, std::string("add"));
+  EXPECT_EQ(report->calls[1]["Samples"].as<profiling::CountNode>()->value, 2);
+  EXPECT_EQ(report->calls[1]["Count"].as<profiling::CountNode>()->value, 20);
+}
+
+TEST(VMSamplingProfiler, ConcurrentRecord) {
+  VMSamplingProfiler profiler(1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&profiler]() {
+      for (int i = 0; i < 10000; ++i) {
+        Index stack[] = {0, i % 64};
+        profiler.Record(stack, 2, 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::vector<std::string> names(64, "f");
+  profiling::Report report = profiler.Report(names);
+  ASSERT_EQ(report->calls.size(), 64);
+  int64_t num_samples = 0;
+  for (const auto& call : report->calls) {
+    num_samples += call["Samples"].as<profiling::CountNode>()->value;
+  }
+  EXPECT_EQ(num_samples, 8 * 10000);
+}
+
+TEST(VMSamplingProfiler, TableFull) {
+  VMSamplingProfiler profiler(1);
+  for (size_t i = 0; i <= VMSamplingProfiler::kNumBuckets; ++i) {
+    Index stack[] = {static_cast<Index>(i)};
+    profiler.Record(stack, 1, 1);
+  }
+  profiling::Report report = profiler.Report({});
+  EXPECT_EQ(report->calls.size(), VMSamplingProfiler::kNumBuckets);
+  EXPECT_EQ(report->configuration["Dropped Samples"].as<profiling::CountNode>()->value, 1);
+}
+
+}  // namespace relax_vm
+}  // namespace runtime
+}  // namespace tvm
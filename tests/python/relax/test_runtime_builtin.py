@@ -14,6 +14,8 @@
 # KIND, either express or implied.  See the License for the
 # specific language governing permissions and limitations
 # under the License.
+import json
+
 import tvm
 import tvm.testing
 from tvm.contrib import tvmjs, utils
@@ -192,6 +194,257 @@ def test_attention_kv_cache_create_multiple():
                 assert res[j][1] == j * cache_index
 
 
+def test_paged_kv_cache():
+    fcreate = tvm.get_global_func("vm.builtin.paged_kv_cache_create")
+    fadd_sequence = tvm.get_global_func("vm.builtin.paged_kv_cache_add_sequence")
+    fremove_sequence = tvm.get_global_func("vm.builtin.paged_kv_cache_remove_sequence")
+    fappend = tvm.get_global_func("vm.builtin.paged_kv_cache_append")
+    fpopn = tvm.get_global_func("vm.builtin.paged_kv_cache_popn")
+    fview = tvm.get_global_func("vm.builtin.paged_kv_cache_view")
+    fblock_table = tvm.get_global_func("vm.builtin.paged_kv_cache_block_table")
+    fnum_free_pages = tvm.get_global_func("vm.builtin.paged_kv_cache_get_num_free_pages")
+
+    page_size = 4
+    num_pages = 8
+    cache = fcreate(tvm.nd.empty((1, 2), dtype="int32"), page_size, num_pages)
+    fadd_sequence(cache, 0)
+    fadd_sequence(cache, 1)
+
+    # interleave the two sequences so that their pages are not contiguous
+    expected = {0: np.zeros((0, 2), dtype="int32"), 1: np.zeros((0, 2), dtype="int32")}
+    for step in range(3):
+        for seq_id, length in [(0, 3), (1, 5)]:
+            value = np.random.randint(0, 100, size=(length, 2)).astype("int32")
+            cache = fappend(cache, seq_id, tvm.nd.array(value))
+            expected[seq_id] = np.concatenate([expected[seq_id], value])
+
+    for seq_id in [0, 1]:
+        np.testing.assert_equal(fview(cache, seq_id).numpy(), expected[seq_id])
+    assert fblock_table(cache, 0).numpy().shape == (3,)
+    assert fblock_table(cache, 1).numpy().shape == (4,)
+    assert fnum_free_pages(cache) == num_pages - 7
+
+    # popping releases the trailing pages
+    fpopn(cache, 1, 6)
+    np.testing.assert_equal(fview(cache, 1).numpy(), expected[1][:9])
+    assert fblock_table(cache, 1).numpy().shape == (3,)
+    assert fnum_free_pages(cache) == num_pages - 6
+
+    # removing a sequence gives all its pages back
+    fremove_sequence(cache, 0)
+    assert fnum_free_pages(cache) == num_pages - 3
+    np.testing.assert_equal(fview(cache, 1).numpy(), expected[1][:9])
+
+    with pytest.raises(RuntimeError):
+        fview(cache, 0)
+    with pytest.raises(RuntimeError):
+        fappend(cache, 1, tvm.nd.array(np.zeros((page_size * num_pages, 2), dtype="int32")))
+
+
+def test_paged_kv_cache_batch():
+    fcreate = tvm.get_global_func("vm.builtin.paged_kv_cache_create")
+    fadd_sequence = tvm.get_global_func("vm.builtin.paged_kv_cache_add_sequence")
+    fbatch_append = tvm.get_global_func("vm.builtin.paged_kv_cache_batch_append")
+    fview = tvm.get_global_func("vm.builtin.paged_kv_cache_view")
+    fbatch_view = tvm.get_global_func("vm.builtin.paged_kv_cache_batch_view")
+    fbatch_block_table = tvm.get_global_func("vm.builtin.paged_kv_cache_batch_block_table")
+
+    page_size = 4
+    cache = fcreate(tvm.nd.empty((1, 3), dtype="float32"), page_size, 16)
+    seq_ids = [3, 1, 2]
+    for seq_id in seq_ids:
+        fadd_sequence(cache, seq_id)
+
+    expected = {seq_id: np.zeros((0, 3), dtype="float32") for seq_id in seq_ids}
+    for lengths in [[5, 1, 0], [1, 1, 1], [3, 7, 2]]:
+        indptr = np.cumsum([0] + lengths)
+        value = np.random.uniform(size=(indptr[-1], 3)).astype("float32")
+        cache = fbatch_append(
+            cache,
+            tvm.runtime.ShapeTuple(seq_ids),
+            tvm.nd.array(value),
+            tvm.runtime.ShapeTuple(indptr.tolist()),
+        )
+        for i, seq_id in enumerate(seq_ids):
+            expected[seq_id] = np.concatenate([expected[seq_id], value[indptr[i] : indptr[i + 1]]])
+
+    for seq_id in seq_ids:
+        np.testing.assert_equal(fview(cache, seq_id).numpy(), expected[seq_id])
+
+    data, seq_indptr = fbatch_view(cache, tvm.runtime.ShapeTuple([2, 3]))
+    np.testing.assert_equal(seq_indptr.numpy(), [0, 3, 12])
+    np.testing.assert_equal(data.numpy(), np.concatenate([expected[2], expected[3]]))
+
+    page_indptr, page_indices, last_page_len = fbatch_block_table(
+        cache, tvm.runtime.ShapeTuple(seq_ids)
+    )
+    np.testing.assert_equal(page_indptr.numpy(), [0, 3, 6, 7])
+    np.testing.assert_equal(last_page_len.numpy(), [1, 1, 3])
+    assert len(np.unique(page_indices.numpy())) == 7
+
+
+def test_paged_kv_cache_fork_and_prefix_cache():
+    fcreate = tvm.get_global_func("vm.builtin.paged_kv_cache_create")
+    fadd_sequence = tvm.get_global_func("vm.builtin.paged_kv_cache_add_sequence")
+    fremove_sequence = tvm.get_global_func("vm.builtin.paged_kv_cache_remove_sequence")
+    ffork_sequence = tvm.get_global_func("vm.builtin.paged_kv_cache_fork_sequence")
+    fcache_prefix = tvm.get_global_func("vm.builtin.paged_kv_cache_cache_prefix")
+    fmatch_prefix = tvm.get_global_func("vm.builtin.paged_kv_cache_match_prefix")
+    fappend = tvm.get_global_func("vm.builtin.paged_kv_cache_append")
+    fview = tvm.get_global_func("vm.builtin.paged_kv_cache_view")
+    fnum_free_pages = tvm.get_global_func("vm.builtin.paged_kv_cache_get_num_free_pages")
+
+    page_size = 4
+    num_pages = 8
+    cache = fcreate(tvm.nd.empty((1, 2), dtype="int32"), page_size, num_pages)
+    prefix = np.arange(20).reshape(10, 2).astype("int32")
+    fadd_sequence(cache, 0)
+    fappend(cache, 0, tvm.nd.array(prefix))
+    assert fnum_free_pages(cache) == 5
+
+    # forking shares all pages, the shared partial page is copied on write
+    ffork_sequence(cache, 0, 1, -1)
+    assert fnum_free_pages(cache) == 5
+    suffix = -np.ones((1, 2), dtype="int32")
+    fappend(cache, 1, tvm.nd.array(suffix))
+    assert fnum_free_pages(cache) == 4
+    np.testing.assert_equal(fview(cache, 0).numpy(), prefix)
+    np.testing.assert_equal(fview(cache, 1).numpy(), np.concatenate([prefix, suffix]))
+
+    # forking in the middle of a page
+    ffork_sequence(cache, 0, 2, 6)
+    fappend(cache, 2, tvm.nd.array(suffix))
+    np.testing.assert_equal(fview(cache, 2).numpy(), np.concatenate([prefix[:6], suffix]))
+    np.testing.assert_equal(fview(cache, 0).numpy(), prefix)
+
+    # the full pages stay in the prefix tree after the sequences are removed
+    tokens = tvm.runtime.ShapeTuple(list(range(100, 110)))
+    fcache_prefix(cache, 0, tokens)
+    for seq_id in [0, 1, 2]:
+        fremove_sequence(cache, seq_id)
+    assert fnum_free_pages(cache) == num_pages - 2
+
+    fadd_sequence(cache, 3)
+    assert fmatch_prefix(cache, 3, tokens) == 8
+    np.testing.assert_equal(fview(cache, 3).numpy(), prefix[:8])
+    fadd_sequence(cache, 4)
+    assert fmatch_prefix(cache, 4, tvm.runtime.ShapeTuple([100, 101, 102, 0, 1])) == 0
+    fremove_sequence(cache, 3)
+
+    # unreferenced prefix tree pages are evicted when the pool runs out
+    fappend(cache, 4, tvm.nd.array(np.zeros((page_size * num_pages, 2), dtype="int32")))
+    assert fnum_free_pages(cache) == 0
+
+
+def test_sample_top_k_top_p_from_logits():
+    fsample_top_p = tvm.get_global_func("vm.builtin.sample_top_p_from_logits")
+    fsample = tvm.get_global_func("vm.builtin.sample_top_k_top_p_from_logits")
+
+    logits_np = np.random.uniform(-5, 5, size=(1, 32000)).astype("float32")
+    logits = tvm.nd.array(logits_np)
+    order = np.argsort(-logits_np[0])
+
+    # argmax under zero temperature or top-k of 1
+    assert fsample(logits, 0.0, -1, 0.9, 0.5) == order[0]
+    assert fsample_top_p(logits, 0.0, 0.9, 0.5) == order[0]
+    for uniform_sample in [0.0, 0.5, 0.99]:
+        assert fsample(logits, 1.0, 1, 1.0, uniform_sample) == order[0]
+
+    # top-k only draws from the k most likely tokens
+    top_k = 5
+    for uniform_sample in np.linspace(0, 0.999, 20):
+        assert fsample(logits, 1.0, top_k, 1.0, uniform_sample) in order[:top_k]
+
+    # a small top-p with a peaked distribution only keeps the argmax
+    logits_np[0, order[0]] = 100.0
+    logits = tvm.nd.array(logits_np)
+    for uniform_sample in np.linspace(0, 0.999, 20):
+        assert fsample(logits, 1.0, -1, 0.5, uniform_sample) == order[0]
+        assert fsample_top_p(logits, 1.0, 0.5, uniform_sample) == order[0]
+
+
+def test_sample_top_p_from_prob():
+    fsample = tvm.get_global_func("vm.builtin.sample_top_p_from_prob")
+    prob = tvm.nd.array(np.array([[0.1, 0.2, 0.3, 0.4]], dtype="float32"))
+
+    # the argmax is returned when uniform_sample < p[argmax] / top_p
+    assert fsample(prob, 0.5, 0.7) == 3
+    assert fsample(prob, 0.5, 0.9) == 2
+    # with top_p = 1 the sample follows the cumulative probabilities in index order
+    assert fsample(prob, 1.0, 0.5) == 2
+    assert fsample(prob, 1.0, 0.95) == 3
+    assert fsample(prob, 1.0, 0.2) == 3
+
+
+def test_batch_sample_top_k_top_p_from_logits():
+    fsample = tvm.get_global_func("vm.builtin.sample_top_k_top_p_from_logits")
+    fbatch_sample = tvm.get_global_func("vm.builtin.batch_sample_top_k_top_p_from_logits")
+    fapply_repetition_penalty = tvm.get_global_func("vm.builtin.apply_repetition_penalty")
+
+    batch_size, vocab_size = 6, 1000
+    logits_np = np.random.uniform(-5, 5, size=(batch_size, vocab_size)).astype("float32")
+    temperatures = np.array([0.0, 0.7, 1.0, 1.0, 1.3, 1.0], dtype="float32")
+    top_ks = np.array([-1, 10, 1, -1, 50, 3], dtype="int32")
+    top_ps = np.array([0.9, 0.9, 1.0, 0.5, 0.95, 1.0], dtype="float32")
+    repetition_penalties = np.array([1.0, 1.1, 1.0, 2.0, 1.0, 1.5], dtype="float32")
+    history_indptr = np.array([0, 0, 3, 3, 5, 5, 8], dtype="int32")
+    history_token_ids = np.random.randint(0, vocab_size, size=(8,)).astype("int32")
+    uniform_samples = np.random.uniform(size=(batch_size,)).astype("float32")
+
+    res = fbatch_sample(
+        tvm.nd.array(logits_np),
+        tvm.nd.array(temperatures),
+        tvm.nd.array(top_ks),
+        tvm.nd.array(top_ps),
+        tvm.nd.array(repetition_penalties),
+        tvm.nd.array(history_token_ids),
+        tvm.nd.array(history_indptr),
+        tvm.nd.array(uniform_samples),
+    ).numpy()
+    assert res.shape == (batch_size,)
+
+    for i in range(batch_size):
+        row = tvm.nd.array(logits_np[i : i + 1])
+        history = history_token_ids[history_indptr[i] : history_indptr[i + 1]]
+        if len(history) > 0:
+            fapply_repetition_penalty(row, tvm.nd.array(history), float(repetition_penalties[i]))
+        expected = fsample(
+            row,
+            float(temperatures[i]),
+            int(top_ks[i]),
+            float(top_ps[i]),
+            float(uniform_samples[i]),
+        )
+        assert res[i] == expected
+
+    def batch_sample(history_token_ids, history_indptr):
+        return fbatch_sample(
+            tvm.nd.array(logits_np),
+            tvm.nd.array(temperatures),
+            tvm.nd.array(top_ks),
+            tvm.nd.array(top_ps),
+            tvm.nd.array(repetition_penalties),
+            tvm.nd.array(np.array(history_token_ids, dtype="int32")),
+            tvm.nd.array(np.array(history_indptr, dtype="int32")),
+            tvm.nd.array(uniform_samples),
+        )
+
+    invalid_histories = [
+        # indptr not starting at 0
+        (history_token_ids, [1, 1, 3, 3, 5, 5, 8]),
+        # indptr decreasing
+        (history_token_ids, [0, 3, 2, 3, 5, 5, 8]),
+        # indptr ending beyond the token ids
+        (history_token_ids, [0, 0, 3, 3, 5, 5, 9]),
+        # token ids out of the vocabulary
+        ([0, 1, 2, 3, vocab_size, 5, 6, 7], history_indptr),
+        ([0, 1, 2, 3, -1, 5, 6, 7], history_indptr),
+    ]
+    for token_ids, indptr in invalid_histories:
+        with pytest.raises(tvm.TVMError):
+            batch_sample(token_ids, indptr)
+
+
 def test_ndarray_cache():
     fload = tvm.get_global_func("vm.builtin.ndarray_cache.load")
     fget_params = tvm.get_global_func("vm.builtin.param_array_from_cache")
@@ -212,5 +465,115 @@ def test_ndarray_cache():
         np.testing.assert_allclose(v.numpy(), v_np, atol=1e-6, rtol=1e-6)
 
 
+def test_ndarray_cache_load_progress():
+    fload = tvm.get_global_func("vm.builtin.ndarray_cache.load")
+    fget_params = tvm.get_global_func("vm.builtin.param_array_from_cache")
+
+    param_dict = {f"y_{i}": np.random.uniform(size=[64, 128]).astype("float32") for i in range(8)}
+    temp = utils.tempdir()
+    # a small shard cap splits the parameters into multiple shards
+    tvmjs.dump_ndarray_cache(param_dict, temp.path, encode_format="raw", shard_cap_mb=0.1)
+
+    progress = []
+
+    def fprogress(loaded_nbytes, total_nbytes):
+        progress.append((loaded_nbytes, total_nbytes))
+
+    fload(str(temp.path), tvm.cpu().device_type, 0, fprogress)
+    assert len(progress) > 1
+    assert progress[-1][0] == progress[-1][1]
+    assert all(a[0] < b[0] for a, b in zip(progress, progress[1:]))
+
+    res = fget_params("y", -1)
+    assert len(res) == len(param_dict)
+    for i, v in enumerate(res):
+        np.testing.assert_equal(v.numpy(), param_dict[f"y_{i}"])
+
+
+def test_ndarray_cache_load_mmap():
+    fload = tvm.get_global_func("vm.builtin.ndarray_cache.load_mmap")
+    fget_params = tvm.get_global_func("vm.builtin.param_array_from_cache")
+
+    param_dict = {
+        "z_0": np.array([1, 2, 3], dtype="int32"),
+        "z_1": np.random.uniform(size=[10, 20]).astype("float32"),
+        "z_2": np.random.uniform(size=[7]).astype("float16"),
+    }
+    for encode_format in ["raw", "f32-to-bf16"]:
+        temp = utils.tempdir()
+        tvmjs.dump_ndarray_cache(param_dict, temp.path, encode_format=encode_format)
+        fload(str(temp.path))
+        res = fget_params("z", -1)
+        assert len(res) == len(param_dict)
+        for i, v in enumerate(res):
+            v_np = param_dict[f"z_{i}"]
+            if encode_format == "f32-to-bf16" and v_np.dtype == "float32":
+                v_np = tvmjs._convert_bf16_to_f32(tvmjs._convert_f32_to_bf16(v_np))
+            np.testing.assert_equal(v.numpy(), v_np)
+
+        # the parameters that need no decoding are views of one mapping of their
+        # shard, so their addresses are apart by exactly their offsets in the shard.
+        with open(temp.relpath("ndarray-cache.json"), "r") as f:
+            cache = json.load(f)
+        params = {f"z_{i}": v for i, v in enumerate(res)}
+        for shard in cache["records"]:
+            raw_records = [
+                rec
+                for rec in shard["records"]
+                if rec["format"] == "raw" or rec["dtype"] != "float32"
+            ]
+            assert len(raw_records) >= 2
+            bases = set()
+            for rec in raw_records:
+                view = np.from_dlpack(params[rec["name"]])
+                bases.add(view.__array_interface__["data"][0] - rec["byteOffset"])
+            assert len(bases) == 1
+
+
+@pytest.mark.parametrize("encode_format", ["f32-to-f16", "f32-to-int8-group", "f32-to-int4-group"])
+def test_ndarray_cache_decode(encode_format):
+    fload = tvm.get_global_func("vm.builtin.ndarray_cache.load")
+    fload_mmap = tvm.get_global_func("vm.builtin.ndarray_cache.load_mmap")
+    fget_params = tvm.get_global_func("vm.builtin.param_array_from_cache")
+
+    param_dict = {
+        "w_0": np.array([1, 2, 3], dtype="int32"),
+        "w_1": np.random.uniform(-1, 1, size=[10, 20]).astype("float32"),
+        "w_2": np.random.uniform(-1, 1, size=[33]).astype("float32"),
+    }
+    temp = utils.tempdir()
+    tvmjs.dump_ndarray_cache(param_dict, temp.path, encode_format=encode_format, group_size=16)
+    expected, _ = tvmjs.load_ndarray_cache(str(temp.path), tvm.cpu())
+
+    for f in [fload, fload_mmap]:
+        args = [tvm.cpu().device_type, 0] if f == fload else []
+        f(str(temp.path), *args)
+        res = fget_params("w", -1)
+        assert len(res) == len(param_dict)
+        for i, v in enumerate(res):
+            np.testing.assert_equal(v.numpy(), expected[f"w_{i}"].numpy())
+            np.testing.assert_allclose(v.numpy(), param_dict[f"w_{i}"], atol=0.1)
+
+
+def test_ndarray_cache_decode_error_single_thread(monkeypatch):
+    fload = tvm.get_global_func("vm.builtin.ndarray_cache.load")
+
+    param_dict = {f"v_{i}": np.random.uniform(size=[16]).astype("float32") for i in range(4)}
+    temp = utils.tempdir()
+    tvmjs.dump_ndarray_cache(param_dict, temp.path, encode_format="f32-to-bf16")
+    cache_json = temp.relpath("ndarray-cache.json")
+    with open(cache_json, "r") as f:
+        cache = json.load(f)
+    # the record size no longer matches the shape, which fails the decoder
+    cache["records"][0]["records"][1]["nbytes"] -= 2
+    with open(cache_json, "w") as f:
+        json.dump(cache, f)
+
+    # with a single worker the decoders run inline on the launching thread
+    monkeypatch.setenv("TVM_NUM_THREADS", "1")
+    with pytest.raises(tvm.TVMError, match="Record size mismatch"):
+        fload(str(temp.path), tvm.cpu().device_type, 0)
+
+
 if __name__ == "__main__":
     tvm.testing.main()
@@ -0,0 +1,191 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+import numpy as np
+import tvm
+from tvm import relax
+from tvm.script import tir as T, relax as R, ir as I
+import tvm.testing
+
+
+# fmt: off
+@I.ir_module
+class Before:
+    @T.prim_func
+    def exp(rxplaceholder: T.Buffer((T.int64(2), T.int64(4)), "float32"), compute: T.Buffer((T.int64(2), T.int64(4)), "float32")):
+        T.func_attr({"tir.noalias": True, "global_symbol": "exp"})
+        for i0, i1 in T.grid(T.int64(2), T.int64(4)):
+            with T.block("compute"):
+                v_i0, v_i1 = T.axis.remap("SS", [i0, i1])
+                compute[v_i0, v_i1] = T.exp(rxplaceholder[v_i0, v_i1])
+
+    @T.prim_func
+    def add(rxplaceholder: T.Buffer((T.int64(2), T.int64(4)), "float32"), rxplaceholder_1: T.Buffer((T.int64(2), T.int64(4)), "float32"), T_add: T.Buffer((T.int64(2), T.int64(4)), "float32")):
+        T.func_attr({"tir.noalias": True, "global_symbol": "add"})
+        for i0, i1 in T.grid(T.int64(2), T.int64(4)):
+            with T.block("T_add"):
+                v_i0, v_i1 = T.axis.remap("SS", [i0, i1])
+                T_add[v_i0, v_i1] = rxplaceholder[v_i0, v_i1] + rxplaceholder_1[v_i0, v_i1]
+
+    @R.function
+    def main(x: R.Tensor((2, 4), dtype="float32"), y: R.Tensor((2, 4), dtype="float32")) -> R.Tensor((2, 4), dtype="float32"):
+        R.func_attr({"relax.force_pure": True})
+        cls = Before
+        storage: R.Object = R.memory.alloc_storage(R.shape([32]), R.prim_value(0), R.str("global"), R.dtype("float32"))
+        alloc: R.Tensor((2, 4), dtype="float32") = R.memory.alloc_tensor(storage, R.prim_value(0), R.shape([2, 4]), R.dtype("float32"))
+        _1: R.Tuple = cls.exp(x, alloc)
+        storage1: R.Object = R.memory.alloc_storage(R.shape([32]), R.prim_value(0), R.str("global"), R.dtype("float32"))
+        alloc1: R.Tensor((2, 4), dtype="float32") = R.memory.alloc_tensor(storage1, R.prim_value(0), R.shape([2, 4]), R.dtype("float32"))
+        _2: R.Tuple = cls.exp(y, alloc1)
+        alloc2: R.Tensor((2, 4), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 4]), R.dtype("float32"), R.prim_value(0))
+        _3: R.Tuple = cls.add(alloc, alloc1, alloc2)
+        _4: R.Tuple = R.memory.kill_tensor(alloc)
+        _5: R.Tuple = R.memory.kill_tensor(alloc1)
+        _6: R.Tuple = R.memory.kill_storage(storage)
+        _7: R.Tuple = R.memory.kill_storage(storage1)
+        return alloc2
+# fmt: on
+
+
+def test_assign_async_streams():
+    # fmt: off
+    @I.ir_module
+    class Expected:
+        @T.prim_func
+        def exp(rxplaceholder: T.Buffer((T.int64(2), T.int64(4)), "float32"), compute: T.Buffer((T.int64(2), T.int64(4)), "float32")):
+            T.func_attr({"tir.noalias": True, "global_symbol": "exp"})
+            for i0, i1 in T.grid(T.int64(2), T.int64(4)):
+                with T.block("compute"):
+                    v_i0, v_i1 = T.axis.remap("SS", [i0, i1])
+                    compute[v_i0, v_i1] = T.exp(rxplaceholder[v_i0, v_i1])
+
+        @T.prim_func
+        def add(rxplaceholder: T.Buffer((T.int64(2), T.int64(4)), "float32"), rxplaceholder_1: T.Buffer((T.int64(2), T.int64(4)), "float32"), T_add: T.Buffer((T.int64(2), T.int64(4)), "float32")):
+            T.func_attr({"tir.noalias": True, "global_symbol": "add"})
+            for i0, i1 in T.grid(T.int64(2), T.int64(4)):
+                with T.block("T_add"):
+                    v_i0, v_i1 = T.axis.remap("SS", [i0, i1])
+                    T_add[v_i0, v_i1] = rxplaceholder[v_i0, v_i1] + rxplaceholder_1[v_i0, v_i1]
+
+        @R.function
+        def main(x: R.Tensor((2, 4), dtype="float32"), y: R.Tensor((2, 4), dtype="float32")) -> R.Tensor((2, 4), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Expected
+            storage: R.Object = R.memory.alloc_storage(R.shape([32]), R.prim_value(0), R.str("global"), R.dtype("float32"))
+            alloc: R.Tensor((2, 4), dtype="float32") = R.memory.alloc_tensor(storage, R.prim_value(0), R.shape([2, 4]), R.dtype("float32"))
+            _1: R.Tuple = R.call_builtin_with_ctx("vm.builtin.async_stream.launch", (R.prim_value(0), cls.exp, x, alloc), sinfo_args=(R.Tuple(),))
+            storage1: R.Object = R.memory.alloc_storage(R.shape([32]), R.prim_value(0), R.str("global"), R.dtype("float32"))
+            alloc1: R.Tensor((2, 4), dtype="float32") = R.memory.alloc_tensor(storage1, R.prim_value(0), R.shape([2, 4]), R.dtype("float32"))
+            _2: R.Tuple = R.call_builtin_with_ctx("vm.builtin.async_stream.launch", (R.prim_value(1), cls.exp, y, alloc1), sinfo_args=(R.Tuple(),))
+            alloc2: R.Tensor((2, 4), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 4]), R.dtype("float32"), R.prim_value(0))
+            _: R.Tuple = R.call_builtin_with_ctx("vm.builtin.async_stream.wait", (R.prim_value(1), R.prim_value(0)), sinfo_args=(R.Tuple(),))
+            _3: R.Tuple = R.call_builtin_with_ctx("vm.builtin.async_stream.launch", (R.prim_value(1), cls.add, alloc, alloc1, alloc2), sinfo_args=(R.Tuple(),))
+            _4: R.Tuple = R.memory.kill_tensor(alloc)
+            _5: R.Tuple = R.memory.kill_tensor(alloc1)
+            _6: R.Tuple = R.memory.kill_storage(storage)
+            _7: R.Tuple = R.memory.kill_storage(storage1)
+            _8: R.Tuple = R.call_builtin_with_ctx("vm.builtin.async_stream.sync", (), sinfo_args=(R.Tuple(),))
+            return alloc2
+    # fmt: on
+
+    after = relax.transform.AssignAsyncStreams(2)(Before)
+    tvm.ir.assert_structural_equal(after, Expected)
+
+
+def test_single_stream_unchanged():
+    after = relax.transform.AssignAsyncStreams(1)(Before)
+    tvm.ir.assert_structural_equal(after, Before)
+
+
+def test_shared_storage_serialized():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @T.prim_func
+        def exp(rxplaceholder: T.Buffer((T.int64(2), T.int64(4)), "float32"), compute: T.Buffer((T.int64(2), T.int64(4)), "float32")):
+            T.func_attr({"tir.noalias": True, "global_symbol": "exp"})
+            for i0, i1 in T.grid(T.int64(2), T.int64(4)):
+                with T.block("compute"):
+                    v_i0, v_i1 = T.axis.remap("SS", [i0, i1])
+                    compute[v_i0, v_i1] = T.exp(rxplaceholder[v_i0, v_i1])
+
+        @R.function
+        def main(x: R.Tensor((2, 4), dtype="float32")) -> R.Tensor((2, 4), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Module
+            storage: R.Object = R.memory.alloc_storage(R.shape([32]), R.prim_value(0), R.str("global"), R.dtype("float32"))
+            alloc: R.Tensor((2, 4), dtype="float32") = R.memory.alloc_tensor(storage, R.prim_value(0), R.shape([2, 4]), R.dtype("float32"))
+            _1: R.Tuple = cls.exp(x, alloc)
+            alloc1: R.Tensor((2, 4), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 4]), R.dtype("float32"), R.prim_value(0))
+            _2: R.Tuple = cls.exp(alloc, alloc1)
+            _3: R.Tuple = R.memory.kill_tensor(alloc)
+            # reuses the storage read by the previous kernel
+            alloc2: R.Tensor((2, 4), dtype="float32") = R.memory.alloc_tensor(storage, R.prim_value(0), R.shape([2, 4]), R.dtype("float32"))
+            _4: R.Tuple = cls.exp(x, alloc2)
+            _5: R.Tuple = R.memory.kill_storage(storage)
+            return alloc1
+    # fmt: on
+
+    # every kernel depends on the previous one, so they stay on a single stream
+    after = relax.transform.AssignAsyncStreams(2)(Module)
+    tvm.ir.assert_structural_equal(after, Module)
+
+
+def test_extern_func_in_place_serialized():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @T.prim_func
+        def exp(rxplaceholder: T.Buffer((T.int64(2), T.int64(4)), "float32"), compute: T.Buffer((T.int64(2), T.int64(4)), "float32")):
+            T.func_attr({"tir.noalias": True, "global_symbol": "exp"})
+            for i0, i1 in T.grid(T.int64(2), T.int64(4)):
+                with T.block("compute"):
+                    v_i0, v_i1 = T.axis.remap("SS", [i0, i1])
+                    compute[v_i0, v_i1] = T.exp(rxplaceholder[v_i0, v_i1])
+
+        @R.function
+        def main(x: R.Tensor((2, 4), dtype="float32")) -> R.Tensor((2, 4), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Module
+            alloc: R.Tensor((2, 4), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 4]), R.dtype("float32"), R.prim_value(0))
+            _1: R.Tuple = cls.exp(x, alloc)
+            # may update the input read by the previous kernel in place
+            _2: R.Tuple = R.call_packed("inplace_scale", x, sinfo_args=(R.Tuple(),))
+            alloc1: R.Tensor((2, 4), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 4]), R.dtype("float32"), R.prim_value(0))
+            _3: R.Tuple = cls.exp(x, alloc1)
+            return alloc1
+    # fmt: on
+
+    # every kernel depends on the previous one, so they stay on a single stream
+    after = relax.transform.AssignAsyncStreams(2)(Module)
+    tvm.ir.assert_structural_equal(after, Module)
+
+
+def test_run_async_streams():
+    x_np = np.random.rand(2, 4).astype("float32")
+    y_np = np.random.rand(2, 4).astype("float32")
+    with tvm.transform.PassContext(config={"relax.backend.num_async_streams": 2}):
+        ex = relax.build(Before, "llvm")
+    assert "vm.builtin.async_stream.launch" in ex.as_text()
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    for _ in range(3):
+        res = vm["main"](tvm.nd.array(x_np), tvm.nd.array(y_np))
+        tvm.testing.assert_allclose(res.numpy(), np.exp(x_np) + np.exp(y_np), rtol=1e-6, atol=1e-6)
+
+
+if __name__ == "__main__":
+    tvm.testing.main()
@@ -0,0 +1,143 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+import numpy as np
+import pytest
+import tvm
+from tvm import relax
+from tvm.script import tir as T, relax as R, ir as I
+import tvm.testing
+
+
+# fmt: off
+@I.ir_module
+class Before:
+    @R.function
+    def main(x: R.Tensor(("n", 4), dtype="float32"), y: R.Tensor((4,), dtype="float32")) -> R.Tensor(("n", 4), dtype="float32"):
+        n = T.int64()
+        R.func_attr({"tir_var_upper_bound": {"n": 64}})
+        with R.dataflow():
+            lv: R.Tensor((n, 4), dtype="float32") = R.multiply(x, y)
+            gv: R.Tensor((n, 4), dtype="float32") = R.add(lv, x)
+            R.output(gv)
+        return gv
+# fmt: on
+
+
+def test_specialize_shape_buckets():
+    mod = relax.transform.SpecializeShapeBuckets({"n": [4, 2]})(Before)
+    names = sorted(gv.name_hint for gv in mod.get_global_vars())
+    assert names == ["main", "main_dynamic", "main_n2", "main_n4"]
+
+    # the clones are private and static
+    clone = mod["main_n4"]
+    assert "global_symbol" not in clone.attrs
+    assert "n" not in clone.attrs["tir_var_upper_bound"]
+    static_sinfo = relax.TensorStructInfo([4, 4], "float32")
+    tvm.ir.assert_structural_equal(clone.params[0].struct_info, static_sinfo)
+    tvm.ir.assert_structural_equal(clone.ret_struct_info, static_sinfo)
+    assert int(clone.body.blocks[0].bindings[1].var.struct_info.shape.values[0]) == 4
+    assert "global_symbol" not in mod["main_dynamic"].attrs
+
+    # the function dispatches to the clones
+    dispatch = mod["main"].body.blocks[0].bindings[0].value
+    assert dispatch.op.name == "relax.call_builtin_with_ctx"
+    assert dispatch.args[0].global_symbol == "vm.builtin.shape_bucket.dispatch"
+    clones = [field.name_hint for field in dispatch.args[1].fields[3:]]
+    assert clones == ["main_dynamic", "main_n2", "main_n4"]
+    assert mod["main"].attrs["global_symbol"] == "main"
+    assert relax.analysis.well_formed(mod)
+
+
+def test_specialize_shape_buckets_run():
+    mod = relax.transform.SpecializeShapeBuckets({"n": [2, 4]}, pad_to_bucket=True)(Before)
+    assert relax.analysis.well_formed(mod)
+    mod = relax.transform.LegalizeOps()(mod)
+    ex = relax.build(mod, "llvm")
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    y = np.random.rand(4).astype("float32")
+    # exact bucket, padded to a bucket, and beyond the buckets
+    for n in [2, 3, 1, 4, 7]:
+        x = np.random.rand(n, 4).astype("float32")
+        res = vm["main"](tvm.nd.array(x), tvm.nd.array(y))
+        assert res.shape == (n, 4)
+        tvm.testing.assert_allclose(res.numpy(), x * y + x, rtol=1e-6, atol=1e-6)
+
+
+def test_specialize_shape_buckets_run_inner_axis():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @R.function
+        def main(x: R.Tensor((3, "n"), dtype="float32"), y: R.Tensor((3, 1), dtype="float32")) -> R.Tensor((3, "n"), dtype="float32"):
+            n = T.int64()
+            with R.dataflow():
+                lv: R.Tensor((3, n), dtype="float32") = R.multiply(x, y)
+                gv: R.Tensor((3, n), dtype="float32") = R.add(lv, x)
+                R.output(gv)
+            return gv
+    # fmt: on
+
+    # the padded axis is not the outermost one, so the result is sliced by a copy of each row
+    mod = relax.transform.SpecializeShapeBuckets({"n": [2, 4]}, pad_to_bucket=True)(Module)
+    assert relax.analysis.well_formed(mod)
+    mod = relax.transform.LegalizeOps()(mod)
+    ex = relax.build(mod, "llvm")
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    y = np.random.rand(3, 1).astype("float32")
+    for n in [1, 3, 4]:
+        x = np.random.rand(3, n).astype("float32")
+        res = vm["main"](tvm.nd.array(x), tvm.nd.array(y))
+        assert res.shape == (3, n)
+        tvm.testing.assert_allclose(res.numpy(), x * y + x, rtol=1e-6, atol=1e-6)
+
+
+def test_specialize_shape_buckets_exact():
+    # the arguments are not padded by default
+    mod = relax.transform.SpecializeShapeBuckets({"n": [2, 4]})(Before)
+    assert relax.analysis.well_formed(mod)
+    mod = relax.transform.LegalizeOps()(mod)
+    ex = relax.build(mod, "llvm")
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    y = np.random.rand(4).astype("float32")
+    for n in [2, 3]:
+        x = np.random.rand(n, 4).astype("float32")
+        res = vm["main"](tvm.nd.array(x), tvm.nd.array(y))
+        tvm.testing.assert_allclose(res.numpy(), x * y + x, rtol=1e-6, atol=1e-6)
+
+
+def test_specialize_shape_buckets_unsupported():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @R.function
+        def main(x: R.Tensor(("n", 4), dtype="float32")) -> R.Tensor(("n * 2", 4), dtype="float32"):
+            n = T.int64()
+            gv: R.Tensor((n * 2, 4), dtype="float32") = R.concat((x, x))
+            return gv
+    # fmt: on
+
+    with pytest.raises(tvm.TVMError):
+        relax.transform.SpecializeShapeBuckets({"n": [2, 4]}, pad_to_bucket=True)(Module)
+    # the exact buckets do not slice the result
+    mod = relax.transform.SpecializeShapeBuckets({"n": [2, 4]})(Module)
+    assert relax.analysis.well_formed(mod)
+    assert "main_n2" in [gv.name_hint for gv in mod.get_global_vars()]
+
+
+if __name__ == "__main__":
+    tvm.testing.main()
@@ -15,6 +15,7 @@
 # specific language governing permissions and limitations
 # under the License.
 
+import pytest
 import tvm
 import tvm.testing
 from tvm import relax
@@ -1158,5 +1159,188 @@ def test_call_tir_dyn():
     tvm.ir.assert_structural_equal(mod, Expected)
 
 
+def test_offset_planner():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @T.prim_func
+        def tir_exp(var_rxplaceholder: T.handle, var_compute: T.handle):
+            T.evaluate(0)
+
+        @T.prim_func
+        def tir_add(var_lhs: T.handle, var_rhs: T.handle, var_compute: T.handle):
+            T.evaluate(0)
+
+        @R.function
+        def main(x: R.Tensor((64,), dtype="float32")) -> R.Tensor((32,), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Module
+            alloc: R.Tensor((64,), dtype="float32") = R.builtin.alloc_tensor(R.shape([64]), R.dtype("float32"), R.prim_value(0))
+            _: R.Tuple = cls.tir_exp(x, alloc)
+            alloc1: R.Tensor((8,), dtype="float32") = R.builtin.alloc_tensor(R.shape([8]), R.dtype("float32"), R.prim_value(0))
+            _1: R.Tuple = cls.tir_exp(alloc, alloc1)
+            alloc2: R.Tensor((32,), dtype="float32") = R.builtin.alloc_tensor(R.shape([32]), R.dtype("float32"), R.prim_value(0))
+            _2: R.Tuple = cls.tir_exp(alloc1, alloc2)
+            alloc3: R.Tensor((32,), dtype="float32") = R.builtin.alloc_tensor(R.shape([32]), R.dtype("float32"), R.prim_value(0))
+            _3: R.Tuple = cls.tir_exp(alloc2, alloc3)
+            alloc4: R.Tensor((32,), dtype="float32") = R.builtin.alloc_tensor(R.shape([32]), R.dtype("float32"), R.prim_value(0))
+            _4: R.Tuple = cls.tir_add(alloc2, alloc3, alloc4)
+            return alloc4
+    # fmt: on
+
+    def get_allocs(mod):
+        storages, offsets = [], []
+        for binding in mod["main"].body.blocks[0].bindings:
+            if not isinstance(binding.value, relax.Call):
+                continue
+            if binding.value.op.name == "relax.memory.alloc_storage":
+                storages.append(int(binding.value.args[0].values[0]))
+            elif binding.value.op.name == "relax.memory.alloc_tensor":
+                offsets.append(int(binding.value.args[1].value))
+        return storages, offsets
+
+    # Without offsets, one 32-element tensor reuses the storage of the 64-element one, and
+    # the other enlarges the storage of the 8-element one.
+    storages, offsets = get_allocs(relax.transform.StaticPlanBlockMemory()(Module))
+    assert sorted(storages) == [128, 256]
+    assert offsets == [0, 0, 0, 0]
+
+    # With offsets, both fit in the space of the 64-element tensor, and the 8-element one
+    # is placed after it, with every tensor aligned to 64 bytes.
+    for planner in ["greedy_by_size", "best_fit", "auto"]:
+        with tvm.target.Target("llvm"):
+            with tvm.transform.PassContext(config={"relax.memory_plan.offset_planner": planner}):
+                storages, offsets = get_allocs(relax.transform.StaticPlanBlockMemory()(Module))
+        assert storages == [320]
+        assert offsets == [0, 256, 0, 128]
+
+    # The data of an OpenCL tensor is an opaque handle, which cannot be offset, and without
+    # a target the device is unknown, so the storages are reused whole instead.
+    with tvm.transform.PassContext(config={"relax.memory_plan.offset_planner": "auto"}):
+        with tvm.target.Target("opencl"):
+            storages, offsets = get_allocs(relax.transform.StaticPlanBlockMemory()(Module))
+        assert sorted(storages) == [128, 256]
+        assert offsets == [0, 0, 0, 0]
+        storages, offsets = get_allocs(relax.transform.StaticPlanBlockMemory()(Module))
+        assert sorted(storages) == [128, 256]
+        assert offsets == [0, 0, 0, 0]
+
+    with pytest.raises(tvm.TVMError):
+        with tvm.transform.PassContext(config={"relax.memory_plan.offset_planner": "ilp"}):
+            relax.transform.StaticPlanBlockMemory()(Module)
+
+
+def test_function_scope_if_reuse():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @T.prim_func
+        def exp(A: T.Buffer((2, 3), "float32"), B: T.Buffer((2, 3), "float32")):
+            T.evaluate(0)
+
+        @R.function
+        def main(cond: R.Tensor((), dtype="bool"), x: R.Tensor((2, 3), dtype="float32")) -> R.Tensor((2, 3), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Module
+            alloc: R.Tensor((2, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 3]), R.dtype("float32"), R.prim_value(0))
+            _: R.Tuple = cls.exp(x, alloc)
+            alloc1: R.Tensor((2, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 3]), R.dtype("float32"), R.prim_value(0))
+            _1: R.Tuple = cls.exp(alloc, alloc1)
+            if cond:
+                alloc2: R.Tensor((2, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 3]), R.dtype("float32"), R.prim_value(0))
+                _2: R.Tuple = cls.exp(x, alloc2)
+                alloc3: R.Tensor((2, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([2, 3]), R.dtype("float32"), R.prim_value(0))
+                _3: R.Tuple = cls.exp(alloc2, alloc3)
+                z: R.Tensor((2, 3), dtype="float32") = x
+            else:
+                z: R.Tensor((2, 3), dtype="float32") = x
+            return z
+    # fmt: on
+
+    def count_ops(expr):
+        counts = {}
+
+        def fvisit(e):
+            if isinstance(e, relax.Call) and isinstance(e.op, tvm.ir.Op):
+                counts[e.op.name] = counts.get(e.op.name, 0) + 1
+
+        relax.analysis.post_order_visit(expr, fvisit)
+        return counts
+
+    with tvm.transform.PassContext(config={"relax.memory_plan.scope": "function"}):
+        mod = relax.transform.StaticPlanBlockMemory()(Module)
+    func = mod["main"]
+    if_node = func.body.blocks[-1].bindings[-1].value
+    assert isinstance(if_node, relax.If)
+    # The then branch reuses the storages released before the If, which stay alive
+    # until the end of the function.
+    then_counts = count_ops(if_node.true_branch)
+    assert then_counts["relax.memory.alloc_tensor"] == 2
+    assert "relax.memory.alloc_storage" not in then_counts
+    assert "relax.memory.kill_storage" not in then_counts
+    counts = count_ops(func)
+    assert counts["relax.memory.alloc_storage"] == 2
+    assert counts["relax.memory.kill_storage"] == 2
+    assert relax.analysis.well_formed(mod)
+
+
+def test_module_scope():
+    # fmt: off
+    @I.ir_module
+    class Module:
+        @T.prim_func
+        def exp(var_A: T.handle, var_B: T.handle):
+            T.evaluate(0)
+
+        @R.function
+        def prefill(x: R.Tensor((4, 3), dtype="float32")) -> R.Tensor((4, 3), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Module
+            alloc: R.Tensor((4, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([4, 3]), R.dtype("float32"), R.prim_value(0))
+            _: R.Tuple = cls.exp(x, alloc)
+            alloc1: R.Tensor((4, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([4, 3]), R.dtype("float32"), R.prim_value(0))
+            _1: R.Tuple = cls.exp(alloc, alloc1)
+            return alloc1
+
+        @R.function
+        def decode(x: R.Tensor((1, 3), dtype="float32")) -> R.Tensor((1, 3), dtype="float32"):
+            R.func_attr({"relax.force_pure": True})
+            cls = Module
+            alloc: R.Tensor((1, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([1, 3]), R.dtype("float32"), R.prim_value(0))
+            _: R.Tuple = cls.exp(x, alloc)
+            alloc1: R.Tensor((1, 3), dtype="float32") = R.builtin.alloc_tensor(R.shape([1, 3]), R.dtype("float32"), R.prim_value(0))
+            _1: R.Tuple = cls.exp(alloc, alloc1)
+            return alloc1
+    # fmt: on
+
+    def storage_bytes(func):
+        sizes = []
+        for binding in func.body.blocks[0].bindings:
+            if isinstance(binding.value, relax.Call) and binding.value.op == tvm.ir.Op.get(
+                "relax.memory.alloc_storage"
+            ):
+                sizes.append(int(binding.value.args[0].values[0]))
+        return sizes
+
+    with tvm.transform.PassContext(config={"relax.memory_plan.scope": "function"}):
+        mod = relax.transform.StaticPlanBlockMemory()(Module)
+    assert storage_bytes(mod["prefill"]) == [48]
+    assert storage_bytes(mod["decode"]) == [12]
+
+    # The functions share a storage of the same size, served by the same pooled buffer.
+    for offset_planner in ["", "auto"]:
+        config = {"relax.memory_plan.scope": "module"}
+        if offset_planner:
+            config["relax.memory_plan.offset_planner"] = offset_planner
+        with tvm.target.Target("llvm"), tvm.transform.PassContext(config=config):
+            mod = relax.transform.StaticPlanBlockMemory()(Module)
+        assert storage_bytes(mod["prefill"]) == storage_bytes(mod["decode"])
+        assert storage_bytes(mod["prefill"])[0] >= 48
+
+    with pytest.raises(tvm.TVMError):
+        with tvm.transform.PassContext(config={"relax.memory_plan.scope": "program"}):
+            relax.transform.StaticPlanBlockMemory()(Module)
+
+
 if __name__ == "__main__":
     tvm.testing.main()
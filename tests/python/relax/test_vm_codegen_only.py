@@ -394,5 +394,50 @@ def test_vm_kill_object(exec_mode):
     tvm.testing.assert_allclose(res.numpy(), np.ones((4,), "float32"))
 
 
+def test_vm_invoke_captured_vm_tir_func():
+    @I.ir_module
+    class TestCapturedTIRFunc:
+        @T.prim_func
+        def add_one(A: T.Buffer((T.int64(4),), "float32"), B: T.Buffer((T.int64(4),), "float32")):
+            T.func_attr({"global_symbol": "add_one", "tir.noalias": T.bool(True)})
+            for ax0 in range(T.int64(4)):
+                with T.block("B"):
+                    v_ax0 = T.axis.spatial(T.int64(4), ax0)
+                    T.reads(A[v_ax0])
+                    T.writes(B[v_ax0])
+                    B[v_ax0] = A[v_ax0] + T.float32(1)
+
+        @R.function
+        def inner(x: R.Tensor((4,), dtype="float32")) -> R.Tensor((4,), dtype="float32"):
+            R.func_attr({"global_symbol": "inner"})
+            cls = TestCapturedTIRFunc
+            storage: R.Object = R.vm.alloc_storage(R.shape([16]), R.prim_value(0), R.dtype("uint8"))
+            y: R.Tensor((4,), dtype="float32") = R.vm.alloc_tensor(
+                storage, R.prim_value(0), R.shape([4]), R.dtype("float32")
+            )
+            _: R.Tuple = cls.add_one(x, y)
+            return y
+
+    target = tvm.target.Target("llvm", host="llvm")
+    builder = relax.ExecBuilder()
+    tir_mod = relax.vm_build._vmcodegen(builder, TestCapturedTIRFunc, exec_mode="compiled")
+    # a bytecode function calling the TIR function of the VM
+    with builder.function("main", num_inputs=1):
+        builder.emit_call("inner", args=[builder.r(0)], dst=builder.r(1))
+        builder.emit_ret(builder.r(1))
+    ex = relax.vm_build._vmlink(builder, target, tir_mod)
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+
+    a = np.random.rand(4).astype("float32")
+    b = np.random.rand(4).astype("float32")
+    res0 = vm.invoke_captured("main", tvm.nd.array(a))
+    tvm.testing.assert_allclose(res0.numpy(), a + 1, rtol=1e-7, atol=1e-7)
+    # the kernels of the TIR function are not recorded, so they run again
+    res1 = vm.invoke_captured("main", tvm.nd.array(b))
+    tvm.testing.assert_allclose(res1.numpy(), b + 1, rtol=1e-7, atol=1e-7)
+    with pytest.raises(tvm.TVMError):
+        vm.invoke_captured("inner", tvm.nd.array(a))
+
+
 if __name__ == "__main__":
     tvm.testing.main()
@@ -15,10 +15,14 @@
 # specific language governing permissions and limitations
 # under the License.
 """Lowest level testing VM. Test execbuilder and execution."""
+import struct
+import threading
+
 import tvm
 import pytest
 import numpy as np
 from tvm import relax, TVMError
+from tvm.contrib import utils
 from tvm.relax.testing.vm import check_saved_func
 
 
@@ -264,5 +268,216 @@ def test_vm_invoke_closure():
     )
 
 
+def test_vm_predecoded_dispatch():
+    ib = relax.ExecBuilder()
+    with ib.function("lifted_func", num_inputs=2):
+        ib.emit_call("test.vm.mul", args=[ib.r(0), ib.r(1)], dst=ib.r(2))
+        ib.emit_ret(ib.r(2))
+    with ib.function("main", num_inputs=3):
+        ib.emit_if(ib.r(0), 3)
+        ib.emit_call("test.vm.add", args=[ib.r(1), ib.r(2)], dst=ib.r(3))
+        ib.emit_goto(2)
+        ib.emit_call("lifted_func", args=[ib.r(1), ib.r(2)], dst=ib.r(3))
+        ib.emit_call("vm.builtin.shape_of", args=[ib.r(3)], dst=ib.r(4))
+        ib.emit_call("test.vm.add", args=[ib.r(3), ib.r(3)], dst=ib.r(5))
+        ib.emit_ret(ib.r(5))
+    ex = ib.get()
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    a = tvm.nd.array(np.random.rand(4))
+    b = tvm.nd.array(np.random.rand(4))
+    for predecoded in [True, False]:
+        vm.module["set_predecoded_dispatch"](predecoded)
+        res = vm["main"](0, a, b)
+        tvm.testing.assert_allclose(res.numpy(), 2 * a.numpy() * b.numpy(), rtol=1e-7, atol=1e-7)
+        res = vm["main"](1, a, b)
+        tvm.testing.assert_allclose(res.numpy(), 2 * (a.numpy() + b.numpy()), rtol=1e-7, atol=1e-7)
+
+
+def test_vm_invoke_captured():
+    dtype = tvm.DataType("float32")
+    ib = relax.ExecBuilder()
+    with ib.function("main", num_inputs=1):
+        ib.emit_call(
+            "vm.builtin.alloc_storage",
+            args=[
+                ib.vm_state(),
+                (12,),
+                ib.convert_constant(0),
+                dtype,
+                ib.convert_constant("global"),
+            ],
+            dst=ib.r(1),
+        )
+        ib.emit_call(
+            "vm.builtin.alloc_tensor", args=[ib.r(1), ib.imm(0), (2, 6), dtype], dst=ib.r(2)
+        )
+        ib.emit_call("test.vm.tile", args=[ib.r(0), ib.r(2)])
+        ib.emit_ret(ib.r(2))
+    ex = ib.get()
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    a = np.random.rand(2, 3).astype("float32")
+    b = np.random.rand(2, 3).astype("float32")
+    res0 = vm.invoke_captured("main", tvm.nd.array(a))
+    tvm.testing.assert_allclose(res0.numpy(), np.tile(a, (1, 2)), rtol=1e-7, atol=1e-7)
+    # the replay writes into the result of the capture
+    res1 = vm.invoke_captured("main", tvm.nd.array(b))
+    tvm.testing.assert_allclose(res1.numpy(), np.tile(b, (1, 2)), rtol=1e-7, atol=1e-7)
+    tvm.testing.assert_allclose(res0.numpy(), np.tile(b, (1, 2)), rtol=1e-7, atol=1e-7)
+    # after clearing, the function is captured again with new buffers
+    vm.module["clear_captures"]()
+    res2 = vm.invoke_captured("main", tvm.nd.array(a))
+    tvm.testing.assert_allclose(res2.numpy(), np.tile(a, (1, 2)), rtol=1e-7, atol=1e-7)
+    tvm.testing.assert_allclose(res1.numpy(), np.tile(b, (1, 2)), rtol=1e-7, atol=1e-7)
+
+
+def test_vm_create_session():
+    ib = relax.ExecBuilder()
+    with ib.function("lifted_func", num_inputs=2):
+        ib.emit_call("test.vm.mul", args=[ib.r(0), ib.r(1)], dst=ib.r(2))
+        ib.emit_ret(ib.r(2))
+    with ib.function("main", num_inputs=1):
+        # the weight is shared by the sessions
+        weight = ib.convert_constant(tvm.nd.array(np.full(4, 2.0)))
+        ib.emit_call("lifted_func", args=[ib.r(0), weight], dst=ib.r(1))
+        ib.emit_call("test.vm.add", args=[ib.r(1), ib.r(0)], dst=ib.r(2))
+        ib.emit_ret(ib.r(2))
+    ex = ib.get()
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    sessions = [vm.create_session() for _ in range(4)]
+    inputs = [np.random.rand(4) for _ in sessions]
+    results = [None] * len(sessions)
+
+    def run(i):
+        for _ in range(50):
+            results[i] = sessions[i]["main"](tvm.nd.array(inputs[i])).numpy()
+
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(len(sessions))]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    for inp, res in zip(inputs, results):
+        tvm.testing.assert_allclose(res, inp * 3, rtol=1e-7, atol=1e-7)
+    # the inputs and outputs of a session are its own
+    a = np.random.rand(4)
+    sessions[0].set_input("main", tvm.nd.array(a))
+    sessions[0].invoke_stateful("main")
+    with pytest.raises(TVMError):
+        sessions[1].invoke_stateful("main")
+    res = sessions[0].get_outputs("main")
+    tvm.testing.assert_allclose(res.numpy(), a * 3, rtol=1e-7, atol=1e-7)
+
+
+def test_vm_sampling_profiler():
+    ib = relax.ExecBuilder()
+    with ib.function("lifted_func", num_inputs=2):
+        ib.emit_call("test.vm.mul", args=[ib.r(0), ib.r(1)], dst=ib.r(2))
+        ib.emit_ret(ib.r(2))
+    with ib.function("main", num_inputs=2):
+        ib.emit_call("lifted_func", args=[ib.r(0), ib.r(1)], dst=ib.r(2))
+        ib.emit_call("test.vm.add", args=[ib.r(2), ib.r(1)], dst=ib.r(3))
+        ib.emit_ret(ib.r(3))
+    ex = ib.get()
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    a = tvm.nd.array(np.random.rand(4))
+    b = tvm.nd.array(np.random.rand(4))
+    vm.start_sampling(sample_period=1)
+    for _ in range(10):
+        vm["main"](a, b)
+    vm.stop_sampling()
+    vm["main"](a, b)
+
+    report = vm.sampling_report()
+    stacks = {call["Stack"]: call for call in report.calls}
+    assert set(stacks.keys()) == {"main;test.vm.add", "main;lifted_func;test.vm.mul"}
+    assert stacks["main;test.vm.add"]["Count"].value == 10
+    lines = vm.sampling_flamegraph().strip().split("\n")
+    assert sorted(line.rsplit(" ", 1)[0] for line in lines) == sorted(stacks.keys())
+    assert all(int(line.rsplit(" ", 1)[1]) > 0 for line in lines)
+
+
+def test_vm_sampling_profiler_exclusive_time():
+    ib = relax.ExecBuilder()
+    with ib.function("lifted_func", num_inputs=2):
+        ib.emit_call("test.vm.mul", args=[ib.r(0), ib.r(1)], dst=ib.r(2))
+        ib.emit_ret(ib.r(2))
+    with ib.function("main", num_inputs=2):
+        ib.emit_call("vm.builtin.make_closure", args=[ib.f("lifted_func"), ib.r(0)], dst=ib.r(2))
+        ib.emit_call(
+            "vm.builtin.invoke_closure", args=[ib.vm_state(), ib.r(2), ib.r(1)], dst=ib.r(3)
+        )
+        ib.emit_ret(ib.r(3))
+    ex = ib.get()
+    vm = relax.VirtualMachine(ex, tvm.cpu())
+    a = tvm.nd.array(np.random.rand(4))
+    b = tvm.nd.array(np.random.rand(4))
+    vm.start_sampling(sample_period=1)
+    for _ in range(10):
+        vm["main"](a, b)
+    vm.stop_sampling()
+
+    report = vm.sampling_report()
+    stacks = {call["Stack"]: call for call in report.calls}
+    assert "main;vm.builtin.invoke_closure" in stacks
+    assert "main;lifted_func;test.vm.mul" in stacks
+    # the builtin is not charged for the closure, so the percents add up to 100.
+    assert sum(call["Percent"].percent for call in report.calls) == pytest.approx(100)
+
+
+def test_vm_snapshot():
+    ib = relax.ExecBuilder()
+    x_np = np.random.rand(4, 3).astype("float32")
+    with ib.function("main", num_inputs=1, param_names=["y"]):
+        x = ib.convert_constant(tvm.nd.array(x_np))
+        ib.emit_call("test.vm.add", args=[x, ib.r(0)], dst=ib.r(1))
+        ib.emit_call("vm.builtin.shape_of", args=[ib.r(1)], dst=ib.r(2))
+        err_ctx = ib.convert_constant("shape of main")
+        ib.emit_call("vm.builtin.check_shape_info", args=[ib.r(2), ib.imm(2), err_ctx])
+        shape = ib.convert_constant(tvm.runtime.ShapeTuple([12]))
+        ib.emit_call("vm.builtin.reshape", args=[ib.r(1), shape], dst=ib.r(3))
+        ib.emit_ret(ib.r(3))
+    ex = ib.get()
+
+    temp = utils.tempdir()
+    path = temp.relpath("exec.snapshot")
+    ex.save_snapshot(path)
+    loaded = relax.Executable(tvm.runtime.load_module(path, "relax_snapshot"))
+    assert loaded.as_text() == ex.as_text()
+    assert loaded.stats() == ex.stats()
+
+    vm = relax.VirtualMachine(loaded, tvm.cpu())
+    y = tvm.nd.array(np.random.rand(4, 3).astype("float32"))
+    res = vm["main"](y)
+    assert vm.module["get_function_param_name"]("main", 0) == "y"
+    tvm.testing.assert_allclose(res.numpy(), (x_np + y.numpy()).reshape(12), rtol=1e-6)
+
+
+def test_vm_snapshot_size_mismatch():
+    ib = relax.ExecBuilder()
+    with ib.function("main", num_inputs=1):
+        x = ib.convert_constant(tvm.nd.array(np.random.rand(4, 3).astype("float32")))
+        ib.emit_call("test.vm.add", args=[x, ib.r(0)], dst=ib.r(1))
+        ib.emit_ret(ib.r(1))
+    ex = ib.get()
+
+    temp = utils.tempdir()
+    path = temp.relpath("exec.snapshot")
+    ex.save_snapshot(path)
+    with open(path, "rb") as f:
+        data = bytearray(f.read())
+    # the constant section follows the magic, versions, file size, vm version,
+    # function table and parameter names in the header.
+    (constants_offset,) = struct.unpack_from("<Q", data, 72)
+    # the nbytes of the NDArray constant is the last field of its record.
+    nbytes_offset = constants_offset + 40
+    (nbytes,) = struct.unpack_from("<Q", data, nbytes_offset)
+    assert nbytes == 4 * 3 * 4
+    struct.pack_into("<Q", data, nbytes_offset, nbytes - 4)
+    with open(path, "wb") as f:
+        f.write(data)
+    with pytest.raises(TVMError, match="constant"):
+        tvm.runtime.load_module(path, "relax_snapshot")
+
+
 if __name__ == "__main__":
     tvm.testing.main()
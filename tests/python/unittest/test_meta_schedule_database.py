@@ -16,7 +16,9 @@
 # under the License.
 # pylint: disable=missing-module-docstring,missing-function-docstring,missing-class-docstring
 """Test Meta Schedule Database"""
+import json
 import os.path as osp
+import struct
 import tempfile
 from typing import Callable, List, Optional
 
@@ -584,6 +586,192 @@ def test_json_database_get_top_k(k, expected):
     assert result == expected
 
 
+def _commit_records_of_two_workloads(database):
+    matmul = database.commit_workload(Matmul)
+    matmul_relu = database.commit_workload(MatmulRelu)
+    records = []
+    for i, run_secs in enumerate([[3.0], [1.0], [4.0], [2.0], [1.5]]):
+        mod, workload = (Matmul, matmul) if i % 2 == 0 else (MatmulRelu, matmul_relu)
+        sch = tir.Schedule(mod)
+        if i != 4:
+            # A trace without instructions makes the last record invalid.
+            sch.get_block("matmul")
+        record = ms.database.TuningRecord(
+            sch.trace,
+            workload,
+            run_secs,
+            tvm.target.Target("llvm"),
+            ms.arg_info.ArgInfo.from_prim_func(func=mod["main"]),
+        )
+        database.commit_tuning_record(record)
+        records.append(record)
+    return records
+
+
+def _check_top_k_of_two_workloads(database):
+    def get_top_k(mod, k):
+        workload = database.commit_workload(mod)
+        return [[v.value for v in r.run_secs] for r in database.get_top_k(workload, k)]
+
+    assert len(database) == 5
+    assert get_top_k(Matmul, 5) == [[3.0], [4.0]]
+    assert get_top_k(Matmul, 1) == [[3.0]]
+    assert get_top_k(MatmulRelu, 5) == [[1.0], [2.0]]
+
+
+def test_json_database_get_top_k_multiple_workloads():
+    with tempfile.TemporaryDirectory() as tmpdir:
+        database = _create_tmp_database(tmpdir)
+        _commit_records_of_two_workloads(database)
+        # The buffered records are written on a flush, without another commit.
+        tvm.get_global_func("meta_schedule.FileAppenderFlushAll")()
+        with open(database.path_tuning_record, "r", encoding="utf-8") as f:
+            assert len(f.readlines()) == 5
+        reloaded = ms.database.JSONDatabase(
+            path_workload=database.path_workload,
+            path_tuning_record=database.path_tuning_record,
+        )
+        for db in [database, reloaded]:
+            _check_top_k_of_two_workloads(db)
+
+
+def test_json_database_duplicated_workloads():
+    def get_top_k(database, workload):
+        return [[v.value for v in r.run_secs] for r in database.get_top_k(workload, 5)]
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        database = _create_tmp_database(tmpdir)
+        _commit_records_of_two_workloads(database)
+        # Loading the files again writes the buffered records.
+        _create_tmp_database(tmpdir)
+        with open(database.path_workload, "r", encoding="utf-8") as f:
+            workload_lines = f.readlines()
+        with open(database.path_tuning_record, "r", encoding="utf-8") as f:
+            index, record = json.loads(f.readline())
+        assert index == 0
+        # Matmul is written again, and a record refers to its second line.
+        with open(database.path_workload, "a", encoding="utf-8") as f:
+            f.write(workload_lines[0])
+        with open(database.path_tuning_record, "a", encoding="utf-8") as f:
+            f.write(json.dumps([len(workload_lines), record]) + "\n")
+
+        reloaded = _create_tmp_database(tmpdir)
+        assert len(reloaded) == 6
+        assert get_top_k(reloaded, reloaded.commit_workload(Matmul)) == [[3.0], [3.0], [4.0]]
+        # A new workload is indexed after the lines of the duplicated one.
+        mod = Matmul.with_attr("tag", "new")
+        sch = tir.Schedule(mod)
+        sch.get_block("matmul")
+        reloaded.commit_tuning_record(
+            ms.database.TuningRecord(
+                sch.trace,
+                reloaded.commit_workload(mod),
+                [0.5],
+                tvm.target.Target("llvm"),
+                ms.arg_info.ArgInfo.from_prim_func(func=mod["main"]),
+            )
+        )
+        reloaded = _create_tmp_database(tmpdir)
+        assert get_top_k(reloaded, reloaded.commit_workload(Matmul)) == [[3.0], [3.0], [4.0]]
+        assert get_top_k(reloaded, reloaded.commit_workload(mod)) == [[0.5]]
+
+
+def test_binary_database():
+    with tempfile.TemporaryDirectory() as tmpdir:
+        json_database = _create_tmp_database(tmpdir)
+        _commit_records_of_two_workloads(json_database)
+        path = osp.join(tmpdir, "database.bin")
+        database = ms.database.BinaryDatabase(path)
+        records = _commit_records_of_two_workloads(database)
+        # The buffered records are written before the file is read again.
+        reloaded = ms.database.BinaryDatabase(path, allow_missing=False)
+        converted = ms.database.BinaryDatabase.from_json(
+            osp.join(tmpdir, "database.converted.bin"),
+            json_database.path_workload,
+            json_database.path_tuning_record,
+        )
+        for db in [database, reloaded, converted]:
+            _check_top_k_of_two_workloads(db)
+        (best,) = reloaded.get_top_k(reloaded.commit_workload(MatmulRelu), 1)
+        _equal_record(best, records[1])
+        assert len(reloaded.get_all_tuning_records()) == 5
+        with pytest.raises(tvm.TVMError):
+            ms.database.BinaryDatabase(osp.join(tmpdir, "missing.bin"), allow_missing=False)
+        with pytest.raises(tvm.TVMError):
+            ms.database.BinaryDatabase(json_database.path_workload, allow_missing=False)
+
+
+def test_binary_database_corrupt():
+    def round_up_to_8(num_bytes):
+        return (num_bytes + 7) // 8 * 8
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = osp.join(tmpdir, "database.bin")
+        _commit_records_of_two_workloads(ms.database.BinaryDatabase(path))
+        # Loading the file again writes the buffered records.
+        ms.database.BinaryDatabase(path, allow_missing=False)
+        with open(path, "rb") as f:
+            data = f.read()
+        # Find the record chunk after the header and the two workload chunks.
+        pos = 16
+        while struct.unpack_from("<I", data, pos)[0] != 2:
+            pos += 16 + round_up_to_8(struct.unpack_from("<Q", data, pos + 8)[0])
+        num_entries = struct.unpack_from("<I", data, pos + 4)[0]
+        json_ends = pos + 16 + round_up_to_8(4 * num_entries) + 8 * num_entries
+        json_ends += round_up_to_8(num_entries)
+
+        def load_patched(patch_fn):
+            patched = bytearray(data)
+            patch_fn(patched)
+            corrupt_path = osp.join(tmpdir, "corrupt.bin")
+            with open(corrupt_path, "wb") as f:
+                f.write(patched)
+            return ms.database.BinaryDatabase(corrupt_path, allow_missing=False)
+
+        assert len(load_patched(lambda d: None)) == 5
+        corruptions = [
+            # truncated in the middle of the record chunk
+            lambda d: d.__delitem__(slice(len(d) - 24, None)),
+            # more entries than the columns of the payload hold
+            lambda d: struct.pack_into("<I", d, pos + 4, 1 << 20),
+            # the JSON of a record ends past the blob
+            lambda d: struct.pack_into("<Q", d, json_ends, 1 << 40),
+            # the JSON of a record ends before it begins
+            lambda d: struct.pack_into("<Q", d, json_ends + 8, 0),
+        ]
+        for corruption in corruptions:
+            with pytest.raises(tvm.TVMError):
+                load_patched(corruption)
+
+
+def test_binary_database_duplicated_workloads():
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = osp.join(tmpdir, "database.bin")
+        _commit_records_of_two_workloads(ms.database.BinaryDatabase(path))
+        # Loading the file again writes the buffered records.
+        ms.database.BinaryDatabase(path, allow_missing=False)
+        with open(path, "rb") as f:
+            data = f.read()
+        chunks = []
+        pos = 16
+        while pos < len(data):
+            chunk_bytes = 16 + (struct.unpack_from("<Q", data, pos + 8)[0] + 7) // 8 * 8
+            chunks.append(bytearray(data[pos : pos + chunk_bytes]))
+            pos += chunk_bytes
+        matmul_chunk, _, record_chunk = chunks
+        # Matmul is written again, and the records of Matmul are copied to refer to it.
+        for i in range(struct.unpack_from("<I", record_chunk, 4)[0]):
+            if struct.unpack_from("<i", record_chunk, 16 + 4 * i)[0] == 0:
+                struct.pack_into("<i", record_chunk, 16 + 4 * i, 2)
+        with open(path, "ab") as f:
+            f.write(matmul_chunk + record_chunk)
+
+        reloaded = ms.database.BinaryDatabase(path, allow_missing=False)
+        assert len(reloaded) == 10
+        top_k = reloaded.get_top_k(reloaded.commit_workload(Matmul), 5)
+        assert [[v.value for v in r.run_secs] for r in top_k] == [[3.0], [3.0], [4.0], [4.0]]
+
+
 def MatmulFunc() -> IRModule:
     a = relay.var("a", relay.TensorType((1024, 1024), "float32"))
     b = relay.var("b", relay.TensorType((1024, 1024), "float32"))
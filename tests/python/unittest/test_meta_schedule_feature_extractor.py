@@ -19,6 +19,7 @@ import re
 from typing import List
 
 import numpy as np
+from tvm import te, tir
 from tvm.meta_schedule import TuneContext
 from tvm.meta_schedule.feature_extractor import PyFeatureExtractor
 from tvm.meta_schedule.search_strategy import MeasureCandidate
@@ -42,6 +43,28 @@ def test_meta_schedule_feature_extractor():
     assert features[0].shape == (4, 5)
 
 
+def test_meta_schedule_feature_extractor_batch():
+    features = [np.random.rand(4, 5), np.random.rand(0, 5), np.random.rand(2, 5)]
+
+    @derived_object
+    class FancyFeatureExtractor(PyFeatureExtractor):
+        def extract_from(
+            self,
+            context: TuneContext,  # pylint: disable = unused-argument
+            candidates: List[MeasureCandidate],  # pylint: disable = unused-argument
+        ) -> List[np.ndarray]:
+            return [array(x) for x in features]
+
+    a = te.placeholder((4,), name="A")
+    b = te.compute((4,), lambda i: a[i] + 1.0, name="B")
+    sch = tir.Schedule(te.create_prim_func([a, b]))
+    candidates = [MeasureCandidate(sch, args_info=[]) for _ in features]
+    batch, offsets = FancyFeatureExtractor().extract_batch_from(TuneContext(), candidates)
+    assert batch.dtype == "float32"
+    assert offsets.tolist() == [0, 4, 4, 6]
+    np.testing.assert_allclose(batch, np.concatenate(features).astype("float32"))
+
+
 def test_meta_schedule_feature_extractor_as_string():
     @derived_object
     class NotSoFancyFeatureExtractor(PyFeatureExtractor):
@@ -59,4 +82,5 @@ def test_meta_schedule_feature_extractor_as_string():
 
 if __name__ == "__main__":
     test_meta_schedule_feature_extractor()
+    test_meta_schedule_feature_extractor_batch()
     test_meta_schedule_feature_extractor_as_string()
@@ -18,6 +18,7 @@
 import sys
 from typing import Callable, List
 
+import numpy as np
 import pytest
 import tvm
 import tvm.testing
@@ -1632,5 +1633,51 @@ def test_negative_extent():
     assert named_features["B0.unique_bytes"] == 0
 
 
+def test_cached_features():
+    def _create_schedule(factor):
+        sch = tir.Schedule(matmul, debug_mask="all")
+        i, _, _ = sch.get_loops(sch.get_block("C"))
+        sch.split(i, factors=[None, factor])
+        return sch
+
+    extractor = ms.feature_extractor.PerStoreFeature()
+    context = _make_context(tvm.target.Target("llvm"))
+    candidates = [
+        _make_candidate(lambda factor=factor: _create_schedule(factor)) for factor in [16, 8]
+    ]
+    script = candidates[0].sch.mod.script()
+    first, other = extractor.extract_from(context, candidates=candidates)
+    assert extractor.cache_stats() == (0, 2)
+    # the module of the schedule is not mutated by the extraction
+    assert candidates[0].sch.mod.script() == script
+    # a structurally equal module from a later iteration hits the cache
+    (second,) = extractor.extract_from(
+        context, candidates=[_make_candidate(lambda: _create_schedule(16))]
+    )
+    assert extractor.cache_stats() == (1, 2)
+    assert_allclose(first.numpy(), second.numpy())
+    assert not (first.numpy() == other.numpy()).all()
+
+
+@pytest.mark.parametrize("extract_workload", [False, True])
+def test_extract_batch(extract_workload):
+    def _create_schedule(factor):
+        sch = tir.Schedule(matmul, debug_mask="all")
+        i, _, _ = sch.get_loops(sch.get_block("C"))
+        sch.split(i, factors=[None, factor])
+        return sch
+
+    extractor = ms.feature_extractor.PerStoreFeature(extract_workload=extract_workload)
+    context = ms.TuneContext(mod=matmul, target=tvm.target.Target("llvm"), num_threads=1)
+    candidates = [
+        _make_candidate(lambda factor=factor: _create_schedule(factor)) for factor in [16, 8, 4]
+    ]
+    features = extractor.extract_from(context, candidates)
+    batch, offsets = extractor.extract_batch_from(context, candidates)
+    assert batch.dtype == "float32"
+    assert offsets.tolist() == [0, 1, 2, 3]
+    assert_allclose(batch, np.concatenate([x.numpy() for x in features]), rtol=1e-6)
+
+
 if __name__ == "__main__":
     tvm.testing.main()
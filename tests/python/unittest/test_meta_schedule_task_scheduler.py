@@ -353,6 +353,55 @@ def test_meta_schedule_task_scheduler_multiple_gradient_based():
         )
 
 
+@pytest.mark.parametrize(
+    "task_scheduler",
+    [
+        lambda: ms.task_scheduler.RoundRobin(num_batches_in_flight=3),
+        lambda: ms.task_scheduler.GradientBased(num_batches_in_flight=2),
+    ],
+)
+def test_meta_schedule_task_scheduler_pipelined(task_scheduler):
+    max_trials_per_task = 101
+    tasks = [
+        ms.TuneContext(
+            MatmulModule,
+            target=tvm.target.Target("llvm"),
+            space_generator=_schedule_matmul,
+            search_strategy=ms.search_strategy.ReplayTrace(),
+            task_name="Matmul",
+            rand_state=42,
+        ),
+        ms.TuneContext(
+            BatchMatmulModule,
+            target=tvm.target.Target("llvm"),
+            space_generator=_schedule_batch_matmul,
+            search_strategy=ms.search_strategy.ReplayTrace(),
+            task_name="BatchMatmul",
+            rand_state=0x114514,
+        ),
+    ]
+    database = ms.database.MemoryDatabase()
+    task_scheduler().tune(
+        tasks,
+        task_weights=[1.0, 1.0],
+        builder=DummyBuilder(),
+        runner=DummyRunner(),
+        database=database,
+        measure_callbacks=[ms.measure_callback.AddToDatabase()],
+        max_trials_global=max_trials_per_task * len(tasks),
+        max_trials_per_task=max_trials_per_task,
+        num_trials_per_iter=6,
+        cost_model=None,
+    )
+    # the batches in flight do not exceed the trials of each task
+    assert len(database) == max_trials_per_task * len(tasks)
+    for task in tasks:
+        assert (
+            len(database.get_top_k(database.commit_workload(task.mod), 10000))
+            == max_trials_per_task
+        )
+
+
 def test_meta_schedule_task_scheduler_gradient_based_with_null_search_strategy():
     """
     When search strategy of one task returns empty list of candidates or None,
@@ -443,4 +492,7 @@ if __name__ == "__main__":
     test_meta_schedule_task_scheduler_avoid_cyclic()
     test_meta_schedule_task_scheduler_override_next_task_id_only()
     test_meta_schedule_task_scheduler_multiple_gradient_based()
+    test_meta_schedule_task_scheduler_pipelined(
+        lambda: ms.task_scheduler.RoundRobin(num_batches_in_flight=3)
+    )
     test_meta_schedule_task_scheduler_gradient_based_with_null_search_strategy()